@@ -0,0 +1,73 @@
+/* A minimal application to run inside lia-apphost. Build it as a shared
+   module and host it, e.g:
+
+     gcc -shared -fPIC -o libhello-app.so hello-app.c \
+         $(pkg-config --cflags --libs lia-0.1)
+
+     lia-apphost --app org.example.Hello1=./libhello-app.so \
+                 --app org.example.Hello2=./libhello-app.so
+
+   Each instance answers on its own object path, under its service name. */
+
+#include <gmodule.h>
+#include <lia.h>
+
+static const gchar iface_xml[] =
+  "<interface name='org.example.Hello'>"
+  "  <method name='Greet'>"
+  "    <arg type='s' name='who' direction='in'/>"
+  "    <arg type='s' name='greeting' direction='out'/>"
+  "  </method>"
+  "</interface>";
+
+static void
+on_method_call (LiaHostedApp          *app,
+                LiaBusType             bus_type,
+                const gchar           *caller_id,
+                const gchar           *object_path,
+                const gchar           *interface_name,
+                const gchar           *method_name,
+                GVariant              *arguments,
+                GDBusMethodInvocation *invocation,
+                gpointer               user_data)
+{
+  const gchar *who;
+  gchar *greeting;
+
+  g_variant_get (arguments, "(&s)", &who);
+  greeting = g_strdup_printf ("Hello %s, from %s",
+                              who,
+                              lia_hosted_app_get_service_name (app));
+
+  g_dbus_method_invocation_return_value (invocation,
+                                         g_variant_new ("(s)", greeting));
+  g_free (greeting);
+}
+
+G_MODULE_EXPORT gboolean
+lia_hosted_app_init (LiaHostedApp *app, GError **error)
+{
+  return TRUE;
+}
+
+G_MODULE_EXPORT void
+lia_hosted_app_register_objects (LiaHostedApp *app, LiaBusType bus_type)
+{
+  GError *error = NULL;
+
+  if (bus_type != LIA_BUS_PROTECTED)
+    return;
+
+  if (lia_hosted_app_register_object (app,
+                                      bus_type,
+                                      lia_hosted_app_get_object_path (app),
+                                      iface_xml,
+                                      on_method_call,
+                                      NULL,
+                                      NULL,
+                                      &error) == 0)
+    {
+      g_print ("Error registering object: %s\n", error->message);
+      g_error_free (error);
+    }
+}
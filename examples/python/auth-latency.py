@@ -0,0 +1,51 @@
+from gi.repository import Gio, GLib
+import os
+import sys
+import time
+
+# Measures Authenticate latency on core's AuthService, both through the
+# private bus and through the direct peer-to-peer link. Run it with the
+# environment of a running lia-core, e.g:
+#
+#   env $(python lia-env.py) python auth-latency.py [iterations]
+
+AUTH_SERVICE_OBJ_PATH = "/org/eventdance/lia/Core/AuthService"
+AUTH_SERVICE_IFACE_NAME = "org.eventdance.lia.Core.AuthService"
+
+iterations = int(sys.argv[1]) if len(sys.argv) > 1 else 10000
+
+def measure(conn, bus_name):
+    args = GLib.Variant("(sss)", ("user", "passw", "localhost:8080"))
+    samples = []
+
+    for i in range(iterations):
+        start = time.time()
+        conn.call_sync(bus_name,
+                       AUTH_SERVICE_OBJ_PATH,
+                       AUTH_SERVICE_IFACE_NAME,
+                       "Authenticate",
+                       args,
+                       None,
+                       Gio.DBusCallFlags.NONE,
+                       -1,
+                       None)
+        samples.append((time.time() - start) * 1000000)
+
+    samples.sort()
+    return (samples[len(samples) // 2], samples[len(samples) * 99 // 100])
+
+def report(label, result):
+    print("%-12s p50: %8.1f us   p99: %8.1f us" % (label, result[0], result[1]))
+
+bus = Gio.DBusConnection.new_for_address_sync(
+    os.environ["LIA_PRIVATE_BUS_ADDRESS"],
+    Gio.DBusConnectionFlags.AUTHENTICATION_CLIENT |
+    Gio.DBusConnectionFlags.MESSAGE_BUS_CONNECTION,
+    None, None)
+report("bus", measure(bus, os.environ["LIA_CORE_SERVICE_NAME"]))
+
+peer = Gio.DBusConnection.new_for_address_sync(
+    os.environ["LIA_CORE_PEER_ADDRESS"],
+    Gio.DBusConnectionFlags.AUTHENTICATION_CLIENT,
+    None, None)
+report("direct link", measure(peer, None))
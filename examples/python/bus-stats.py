@@ -0,0 +1,79 @@
+from gi.repository import Gio, GLib
+import os
+import sys
+import time
+
+# Prints the load of each Lia bus as last sampled by core, and the
+# message rate history of the given bus if any. Run it with the
+# environment of a running lia-core, e.g:
+#
+#   env $(python lia-env.py) python bus-stats.py [public]
+
+SUPERVISOR_OBJ_PATH = "/org/eventdance/lia/Core/Supervisor"
+SUPERVISOR_IFACE_NAME = "org.eventdance.lia.Core.Supervisor"
+
+BUS_TYPES = {"private": 0, "protected": 1, "public": 2}
+
+bus = Gio.DBusConnection.new_for_address_sync(
+    os.environ["LIA_PRIVATE_BUS_ADDRESS"],
+    Gio.DBusConnectionFlags.AUTHENTICATION_CLIENT |
+    Gio.DBusConnectionFlags.MESSAGE_BUS_CONNECTION,
+    None, None)
+
+def call(method, args=None):
+    return bus.call_sync(os.environ["LIA_CORE_SERVICE_NAME"],
+                         SUPERVISOR_OBJ_PATH,
+                         SUPERVISOR_IFACE_NAME,
+                         method,
+                         args, None,
+                         Gio.DBusCallFlags.NONE, -1, None).unpack()[0]
+
+buses = call("GetBusStats")
+
+for name in ("private", "protected", "public"):
+    info = buses[name]
+    print("%s bus (%s):" % (name, info["source"]))
+
+    if not info["available"]:
+        print("  statistics not available")
+        continue
+
+    sample = info.get("last-sample")
+    if sample is None:
+        print("  not sampled yet")
+        continue
+
+    limits = info["limits"]
+
+    def limit(key):
+        return " (limit %d)" % limits[key] if key in limits else ""
+
+    print("  connections: %d%s" % (sample["connections"],
+                                   limit("max_completed_connections")))
+    print("  bus names: %d, at most %d per connection%s" %
+          (sample["bus-names"], sample["max-bus-names-per-connection"],
+           limit("max_names_per_connection")))
+    print("  match rules: %d, at most %d per connection%s" %
+          (sample["match-rules"], sample["max-match-rules-per-connection"],
+           limit("max_match_rules_per_connection")))
+    print("  queued: %d messages, %d bytes (in %d sampled connections)" %
+          (sample["queued-messages"], sample["queued-bytes"],
+           sample["sampled-connections"]))
+    if "message-rate" in sample:
+        print("  message rate: %.1f msg/s" % sample["message-rate"])
+    for warning in sample["warnings"]:
+        print("  WARNING: approaching %s" % warning)
+
+if len(sys.argv) > 1:
+    samples = call("GetBusStatsHistory",
+                   GLib.Variant("(n)", (BUS_TYPES[sys.argv[1]],)))
+
+    print("\n%s bus history:" % sys.argv[1])
+    for sample in samples:
+        print("  %s  %5d connections  %6d queued  %s" %
+              (time.strftime("%H:%M:%S",
+                             time.localtime(sample["time"] / 1000000)),
+               sample["connections"],
+               sample["queued-messages"],
+               "%.1f msg/s" % sample["message-rate"]
+               if "message-rate" in sample else ""))
@@ -0,0 +1,91 @@
+from gi.repository import Gio, GLib
+import os
+import sys
+import time
+
+# Measures message throughput on one of Lia's buses, between two
+# connections of this process: method calls (org.freedesktop.DBus.Peer.Ping,
+# answered by GDBus itself) with a window of calls in flight, and
+# broadcast signals. Run it against a lia-core started with and without
+# --embedded-broker to compare the in-process broker with dbus-daemon, e.g:
+#
+#   env $(python lia-env.py) python bus-throughput.py [protected|public] [messages]
+
+bus_name = sys.argv[1] if len(sys.argv) > 1 else "protected"
+messages = int(sys.argv[2]) if len(sys.argv) > 2 else 100000
+window = 64
+
+address = os.environ["LIA_%s_BUS_ADDRESS" % bus_name.upper()]
+
+def connect():
+    return Gio.DBusConnection.new_for_address_sync(
+        address,
+        Gio.DBusConnectionFlags.AUTHENTICATION_CLIENT |
+        Gio.DBusConnectionFlags.MESSAGE_BUS_CONNECTION,
+        None, None)
+
+sender = connect()
+receiver = connect()
+loop = GLib.MainLoop()
+
+def measure_calls():
+    state = {"sent": 0, "done": 0}
+
+    def on_reply(conn, res, data):
+        conn.call_finish(res)
+        state["done"] += 1
+        if state["done"] == messages:
+            loop.quit()
+        elif state["sent"] < messages:
+            send()
+
+    def send():
+        state["sent"] += 1
+        sender.call(receiver.get_unique_name(),
+                    "/",
+                    "org.freedesktop.DBus.Peer",
+                    "Ping",
+                    None, None,
+                    Gio.DBusCallFlags.NONE, -1, None,
+                    on_reply, None)
+
+    start = time.time()
+    for i in range(min(window, messages)):
+        send()
+    loop.run()
+    return messages / (time.time() - start)
+
+def measure_signals():
+    state = {"received": 0}
+
+    def on_signal(conn, sender_name, path, iface, signal, params, data):
+        state["received"] += 1
+        if state["received"] == messages:
+            loop.quit()
+
+    receiver.signal_subscribe(sender.get_unique_name(),
+                              "org.eventdance.lia.Benchmark",
+                              "Tick",
+                              "/org/eventdance/lia/Benchmark",
+                              None,
+                              Gio.DBusSignalFlags.NONE,
+                              on_signal, None)
+
+    # make sure the match rule is in place before emitting
+    receiver.call_sync("org.freedesktop.DBus", "/org/freedesktop/DBus",
+                       "org.freedesktop.DBus", "GetId", None, None,
+                       Gio.DBusCallFlags.NONE, -1, None)
+
+    start = time.time()
+    for i in range(messages):
+        sender.emit_signal(None,
+                           "/org/eventdance/lia/Benchmark",
+                           "org.eventdance.lia.Benchmark",
+                           "Tick",
+                           GLib.Variant("(u)", (i,)))
+    loop.run()
+    return messages / (time.time() - start)
+
+print("%s bus: %s" % (bus_name, address))
+print("method calls: %10.0f msg/s" % measure_calls())
+print("signals:      %10.0f msg/s" % measure_signals())
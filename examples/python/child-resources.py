@@ -0,0 +1,48 @@
+from gi.repository import Gio, GLib
+import os
+
+# Prints the resource usage and pressure of every application launched by
+# core, as accounted by their cgroups. Run it with the environment of a
+# running lia-core, e.g:
+#
+#   env $(python lia-env.py) python child-resources.py
+
+SUPERVISOR_OBJ_PATH = "/org/eventdance/lia/Core/Supervisor"
+SUPERVISOR_IFACE_NAME = "org.eventdance.lia.Core.Supervisor"
+
+bus = Gio.DBusConnection.new_for_address_sync(
+    os.environ["LIA_PRIVATE_BUS_ADDRESS"],
+    Gio.DBusConnectionFlags.AUTHENTICATION_CLIENT |
+    Gio.DBusConnectionFlags.MESSAGE_BUS_CONNECTION,
+    None, None)
+
+children = bus.call_sync(os.environ["LIA_CORE_SERVICE_NAME"],
+                         SUPERVISOR_OBJ_PATH,
+                         SUPERVISOR_IFACE_NAME,
+                         "GetChildren",
+                         None, None,
+                         Gio.DBusCallFlags.NONE, -1, None).unpack()[0]
+
+def limit(value):
+    return "max" if value == 0 else "%d MiB" % (value // (1024 * 1024))
+
+for (child_id, info) in sorted(children):
+    print("%u: %s (%s)" % (child_id, info["command-line"], info["state"]))
+
+    if "cgroup" not in info:
+        print("    no cgroup of its own")
+        continue
+
+    print("    cpu weight: %u   cpu time: %.1f s" %
+          (info["cpu-weight"], info["cgroup-cpu-usage-us"] / 1000000.0))
+    print("    memory: %d MiB   high: %s   max: %s" %
+          (info["cgroup-memory-bytes"] // (1024 * 1024),
+           limit(info["memory-high-bytes"]),
+           limit(info["memory-max-bytes"])))
+
+    for resource in ("cpu", "memory", "io"):
+        if resource + "-pressure-some" in info:
+            print("    %-6s pressure  some: %5.2f%%  full: %5.2f%%" %
+                  (resource,
+                   info[resource + "-pressure-some"],
+                   info[resource + "-pressure-full"]))
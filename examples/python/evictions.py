@@ -0,0 +1,36 @@
+from gi.repository import Gio, GLib
+import os
+
+# Prints how many idle applications core stopped under memory pressure,
+# and how much memory that reclaimed. Run it with the environment of a
+# running lia-core, e.g:
+#
+#   env $(python lia-env.py) python evictions.py
+
+SUPERVISOR_OBJ_PATH = "/org/eventdance/lia/Core/Supervisor"
+SUPERVISOR_IFACE_NAME = "org.eventdance.lia.Core.Supervisor"
+
+bus = Gio.DBusConnection.new_for_address_sync(
+    os.environ["LIA_PRIVATE_BUS_ADDRESS"],
+    Gio.DBusConnectionFlags.AUTHENTICATION_CLIENT |
+    Gio.DBusConnectionFlags.MESSAGE_BUS_CONNECTION,
+    None, None)
+
+info = bus.call_sync(os.environ["LIA_CORE_SERVICE_NAME"],
+                     SUPERVISOR_OBJ_PATH,
+                     SUPERVISOR_IFACE_NAME,
+                     "GetEvictions",
+                     None, None,
+                     Gio.DBusCallFlags.NONE, -1, None).unpack()[0]
+
+if info["memory-pressure-threshold"] == 0:
+    print("eviction disabled")
+else:
+    print("evicting applications idle for %u s when memory pressure is above %.2f%%" %
+          (info["idle-time-s"], info["memory-pressure-threshold"]))
+
+if "memory-pressure" in info:
+    print("memory pressure: %.2f%%" % info["memory-pressure"])
+
+print("applications evicted: %u" % info["evictions"])
+print("memory reclaimed: %d MiB" % (info["memory-reclaimed-bytes"] // (1024 * 1024)))
@@ -0,0 +1,35 @@
+from gi.repository import Gio
+import sys
+
+# Prints the configuration of a running lia-core as environment variables,
+# for the other example scripts, e.g:
+#
+#   env $(python lia-env.py net.free-social.Lia) python method-stats.py
+#
+# The configuration is obtained from core's discovery endpoint, with a
+# single call.
+
+DISCOVERY_ADDRESS_FORMAT = "unix:abstract=lia-discovery-%s"
+DISCOVERY_OBJ_PATH = "/org/eventdance/lia/Core/Discovery"
+DISCOVERY_IFACE_NAME = "org.eventdance.lia.Core.Discovery"
+
+base_service_name = sys.argv[1] if len(sys.argv) > 1 else "net.free-social.Lia"
+address = DISCOVERY_ADDRESS_FORMAT % base_service_name
+
+peer = Gio.DBusConnection.new_for_address_sync(
+    address,
+    Gio.DBusConnectionFlags.AUTHENTICATION_CLIENT,
+    None, None)
+
+(version, config) = peer.call_sync(None,
+                                   DISCOVERY_OBJ_PATH,
+                                   DISCOVERY_IFACE_NAME,
+                                   "GetConfig",
+                                   None, None,
+                                   Gio.DBusCallFlags.NONE, -1, None).unpack()
+
+# e.g 'private-bus-address' becomes LIA_PRIVATE_BUS_ADDRESS
+for key in sorted(config):
+    print("LIA_%s=%s" % (key.upper().replace("-", "_"), config[key]))
+
+print("LIA_CORE_PEER_ADDRESS=%s" % address)
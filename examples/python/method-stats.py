@@ -0,0 +1,62 @@
+from gi.repository import Gio, GLib
+import os
+
+# Collects the method call stats exported by every Lia application on the
+# private bus and prints them aggregated per method. Run it with the
+# environment of a running lia-core, e.g:
+#
+#   env $(python lia-env.py) python method-stats.py
+
+STATS_OBJ_PATH = "/org/eventdance/lia/Stats"
+STATS_IFACE_NAME = "org.eventdance.lia.Stats"
+
+bus = Gio.DBusConnection.new_for_address_sync(
+    os.environ["LIA_PRIVATE_BUS_ADDRESS"],
+    Gio.DBusConnectionFlags.AUTHENTICATION_CLIENT |
+    Gio.DBusConnectionFlags.MESSAGE_BUS_CONNECTION,
+    None, None)
+
+names = bus.call_sync("org.freedesktop.DBus",
+                      "/org/freedesktop/DBus",
+                      "org.freedesktop.DBus",
+                      "ListNames",
+                      None, None,
+                      Gio.DBusCallFlags.NONE, -1, None).unpack()[0]
+
+methods = {}
+
+for name in names:
+    if not name.startswith(":"):
+        continue
+
+    try:
+        stats = bus.call_sync(name,
+                              STATS_OBJ_PATH,
+                              STATS_IFACE_NAME,
+                              "GetMethodStats",
+                              None, None,
+                              Gio.DBusCallFlags.NONE, 1000, None).unpack()[0]
+    except GLib.Error:
+        continue
+
+    for (iface, method, calls, errors, buckets) in stats:
+        entry = methods.setdefault("%s.%s" % (iface, method), [0, 0, {}])
+        entry[0] += calls
+        entry[1] += errors
+        for (value, count) in buckets:
+            entry[2][value] = entry[2].get(value, 0) + count
+
+def percentile(buckets, p):
+    total = sum(buckets.values())
+    seen = 0
+    for value in sorted(buckets):
+        seen += buckets[value]
+        if seen * 100 >= total * p:
+            return value
+    return 0
+
+for name in sorted(methods):
+    calls, errors, buckets = methods[name]
+    print("%-60s calls: %8d  errors: %6d  p50: %8d us  p99: %8d us" %
+          (name, calls, errors,
+           percentile(buckets, 50), percentile(buckets, 99)))
@@ -0,0 +1,120 @@
+from gi.repository import Gio, GLib
+import os
+import resource
+import sys
+import time
+
+# Measures the CPU time the Webview spends per broadcast signal relayed
+# through its bus mux, with one subscribed peer and with many. The peers
+# are connections of this process to the mux of the public bus (lia-core
+# started with --webview-bus-mux=N), whose address is asked to the
+# Webview, and the signals are emitted on the public bus, e.g:
+#
+#   env $(python lia-env.py) python signal-broadcast.py WEBVIEW_PID [peers] [signals]
+#
+# With --embedded-webview, WEBVIEW_PID is lia-core's.
+
+WEBVIEW_OBJ_PATH = "/org/eventdance/lia/Webview"
+WEBVIEW_IFACE_NAME = "org.eventdance.lia.Webview"
+
+webview_pid = int(sys.argv[1])
+num_peers = int(sys.argv[2]) if len(sys.argv) > 2 else 10000
+num_signals = int(sys.argv[3]) if len(sys.argv) > 3 else 200
+
+# every peer is a socket
+(soft, hard) = resource.getrlimit(resource.RLIMIT_NOFILE)
+resource.setrlimit(resource.RLIMIT_NOFILE, (hard, hard))
+
+def connect(address):
+    return Gio.DBusConnection.new_for_address_sync(
+        address,
+        Gio.DBusConnectionFlags.AUTHENTICATION_CLIENT |
+        Gio.DBusConnectionFlags.MESSAGE_BUS_CONNECTION,
+        None, None)
+
+def cpu_time(pid):
+    with open("/proc/%d/stat" % pid) as f:
+        fields = f.read().rsplit(")", 1)[1].split()
+    # utime and stime, in clock ticks
+    return (int(fields[11]) + int(fields[12])) / float(os.sysconf("SC_CLK_TCK"))
+
+emitter = connect(os.environ["LIA_PUBLIC_BUS_ADDRESS"])
+
+private_bus = connect(os.environ["LIA_PRIVATE_BUS_ADDRESS"])
+mux_address = private_bus.call_sync(os.environ["LIA_WEBVIEW_SERVICE_NAME"],
+                                    WEBVIEW_OBJ_PATH,
+                                    WEBVIEW_IFACE_NAME,
+                                    "GetBusMuxAddress",
+                                    GLib.Variant("(s)", (os.environ["LIA_PUBLIC_BUS_ADDRESS"],)),
+                                    None,
+                                    Gio.DBusCallFlags.NONE, -1, None).unpack()[0]
+if mux_address == "":
+    print("The Webview has no bus mux, start lia-core with --webview-bus-mux=N")
+    sys.exit(1)
+loop = GLib.MainLoop()
+state = {"received": 0, "expected": 0}
+
+def on_signal(conn, sender_name, path, iface, signal, params, data):
+    state["received"] += 1
+    if state["received"] == state["expected"]:
+        loop.quit()
+
+def on_timeout():
+    loop.quit()
+    return False
+
+peers = []
+
+def measure(count):
+    while len(peers) < count:
+        peer = connect(mux_address)
+        peer.signal_subscribe(emitter.get_unique_name(),
+                              "org.eventdance.lia.Benchmark",
+                              "Tick",
+                              "/org/eventdance/lia/Benchmark",
+                              None,
+                              Gio.DBusSignalFlags.NONE,
+                              on_signal, None)
+        peers.append(peer)
+
+    # make sure the match rules are in place upstream before emitting
+    for peer in peers:
+        peer.call_sync("org.freedesktop.DBus", "/org/freedesktop/DBus",
+                       "org.freedesktop.DBus", "GetId", None, None,
+                       Gio.DBusCallFlags.NONE, -1, None)
+
+    state["received"] = 0
+    state["expected"] = count * num_signals
+
+    start_cpu = cpu_time(webview_pid)
+    start = time.time()
+    for i in range(num_signals):
+        emitter.emit_signal(None,
+                            "/org/eventdance/lia/Benchmark",
+                            "org.eventdance.lia.Benchmark",
+                            "Tick",
+                            GLib.Variant("(us)", (i, "x" * 1024)))
+
+    timeout_id = GLib.timeout_add_seconds(120, on_timeout)
+    loop.run()
+    GLib.source_remove(timeout_id)
+
+    elapsed = time.time() - start
+    cpu = cpu_time(webview_pid) - start_cpu
+
+    if state["received"] < state["expected"]:
+        print("  only %d of %d deliveries arrived" %
+              (state["received"], state["expected"]))
+
+    return (cpu / num_signals, elapsed)
+
+print("%d signals of 1 KiB through %s" % (num_signals, mux_address))
+
+(single, elapsed) = measure(1)
+print("1 peer:      %8.1f us CPU/signal  (%.2f s)" % (single * 1e6, elapsed))
+
+(many, elapsed) = measure(num_peers)
+print("%d peers: %8.1f us CPU/signal  (%.2f s)" % (num_peers, many * 1e6, elapsed))
+
+if single > 0:
+    print("ratio:       %8.1fx" % (many / single))
@@ -0,0 +1,37 @@
+from gi.repository import Gio, GLib
+import os
+
+# Prints core's time-to-ready and the spans recorded during its startup,
+# as a timeline. Spans that overlap ran concurrently. Run it with the
+# environment of a running lia-core, e.g:
+#
+#   env $(python lia-env.py) python startup-trace.py
+
+SUPERVISOR_OBJ_PATH = "/org/eventdance/lia/Core/Supervisor"
+SUPERVISOR_IFACE_NAME = "org.eventdance.lia.Core.Supervisor"
+
+bus = Gio.DBusConnection.new_for_address_sync(
+    os.environ["LIA_PRIVATE_BUS_ADDRESS"],
+    Gio.DBusConnectionFlags.AUTHENTICATION_CLIENT |
+    Gio.DBusConnectionFlags.MESSAGE_BUS_CONNECTION,
+    None, None)
+
+(time_to_ready, trace) = bus.call_sync(os.environ["LIA_CORE_SERVICE_NAME"],
+                                       SUPERVISOR_OBJ_PATH,
+                                       SUPERVISOR_IFACE_NAME,
+                                       "GetStartup",
+                                       None, None,
+                                       Gio.DBusCallFlags.NONE,
+                                       -1, None).unpack()
+
+if time_to_ready < 0:
+    print("System is not ready yet")
+else:
+    print("Time to ready: %.1f ms" % (time_to_ready / 1000.0))
+
+for (phase, start, duration) in sorted(trace, key=lambda span: span[1]):
+    if duration < 0:
+        print("%-40s %8.1f ms  (unfinished)" % (phase, start / 1000.0))
+    else:
+        print("%-40s %8.1f ms  +%.1f ms" % (phase, start / 1000.0,
+                                           duration / 1000.0))
@@ -0,0 +1,106 @@
+#include <string.h>
+#include <evd.h>
+#include <lia.h>
+
+#define DEFAULT_SERVICE_NAME_SUFFIX "AppHost"
+
+static LiaAppHost *host;
+
+static gchar *name_suffix = NULL;
+static gchar **apps = NULL;
+
+static GOptionEntry entries[] =
+{
+  { "name", 0, 0, G_OPTION_ARG_STRING, &name_suffix, "Service name of the host, relative to the base service name (default: " DEFAULT_SERVICE_NAME_SUFFIX ")", "NAME" },
+  { "app", 'a', 0, G_OPTION_ARG_STRING_ARRAY, &apps, "Host the application built as MODULE, owning SERVICE_NAME. Can be given several times", "SERVICE_NAME=MODULE[:HTML_ROOT]" },
+  { NULL }
+};
+
+static void
+load_app (const gchar *spec)
+{
+  gchar **parts;
+  gchar *module_path;
+  gchar *html_root;
+  GError *error = NULL;
+
+  parts = g_strsplit (spec, "=", 2);
+  if (parts[0] == NULL || parts[1] == NULL)
+    {
+      g_print ("Invalid application '%s', expected SERVICE_NAME=MODULE[:HTML_ROOT]\n",
+               spec);
+      g_strfreev (parts);
+      return;
+    }
+
+  module_path = parts[1];
+  html_root = strchr (module_path, ':');
+  if (html_root != NULL)
+    {
+      *html_root = '\0';
+      html_root++;
+    }
+
+  if (lia_app_host_load_module (host,
+                                module_path,
+                                parts[0],
+                                html_root,
+                                &error) == NULL)
+    {
+      g_print ("Failed to host '%s': %s\n", parts[0], error->message);
+      g_error_free (error);
+    }
+
+  g_strfreev (parts);
+}
+
+gint
+main (gint argc, gchar *argv[])
+{
+  gint exit_code = 0;
+  GError *error = NULL;
+  GOptionContext *context;
+  const gchar *base_service_name;
+  gchar *service_name;
+  gint i;
+
+  context = g_option_context_new ("- Lia host of lightweight applications");
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (! g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_print ("option parsing failed: %s\n", error->message);
+      return -1;
+    }
+  g_option_context_free (context);
+
+  g_type_init ();
+
+  base_service_name = g_getenv (LIA_ENV_KEY_BASE_SERVICE_NAME);
+  service_name = g_strdup_printf ("%s.%s",
+                                  base_service_name,
+                                  name_suffix != NULL ?
+                                  name_suffix : DEFAULT_SERVICE_NAME_SUFFIX);
+
+  host = g_object_new (LIA_TYPE_APP_HOST,
+                       "service-name", service_name,
+                       NULL);
+
+  g_free (service_name);
+
+  /* applications get their objects registered and their service names
+     owned as soon as the host connects to each bus */
+  for (i=0; apps != NULL && apps[i] != NULL; i++)
+    load_app (apps[i]);
+
+  /* start the show */
+  exit_code = lia_application_run (LIA_APPLICATION (host));
+
+  /* free stuff */
+  g_object_unref (host);
+  g_strfreev (apps);
+  g_free (name_suffix);
+
+  g_print ("\rlia-apphost terminated\n");
+
+  return exit_code;
+}
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <signal.h>
 #include <evd.h>
 
 #include <lia.h>
@@ -7,15 +8,67 @@
 
 static LiaCore *core = NULL;
 
+static gboolean embedded_broker = FALSE;
+static gboolean embedded_webview = FALSE;
+static gint child_cpu_weight = 0;
+static gint64 child_memory_high = 0;
+static gint64 child_memory_max = 0;
+static gdouble eviction_pressure = 20.0;
+static gint eviction_idle_time = 600;
+static gint public_bus_shards = 1;
+static gint webview_bus_mux = 0;
+
+static GOptionEntry entries[] =
+{
+  { "embedded-broker", 0, 0, G_OPTION_ARG_NONE, &embedded_broker, "Route the protected and public buses in-process instead of spawning dbus-daemon", NULL },
+  { "embedded-webview", 0, 0, G_OPTION_ARG_NONE, &embedded_webview, "Run the Webview in this same process instead of launching lia-webview", NULL },
+  { "child-cpu-weight", 0, 0, G_OPTION_ARG_INT, &child_cpu_weight, "CPU weight (1-10000) of each launched application's cgroup", "WEIGHT" },
+  { "child-memory-high", 0, 0, G_OPTION_ARG_INT64, &child_memory_high, "Memory in bytes above which a launched application is throttled", "BYTES" },
+  { "child-memory-max", 0, 0, G_OPTION_ARG_INT64, &child_memory_max, "Memory in bytes a launched application can't exceed", "BYTES" },
+  { "eviction-pressure", 0, 0, G_OPTION_ARG_DOUBLE, &eviction_pressure, "Memory pressure (0-100) above which idle installed applications are stopped, 0 to disable", "PERCENT" },
+  { "public-bus-shards", 0, 0, G_OPTION_ARG_INT, &public_bus_shards, "Number of bus daemons (1-64) the public bus is split into, among which web peers are spread", "N" },
+  { "webview-bus-mux", 0, 0, G_OPTION_ARG_INT, &webview_bus_mux, "Carry the web peers' bus traffic over N shared connections per bus (1-64) instead of one connection per peer, unless an installed application declares PeerIdentity", "N" },
+  { "eviction-idle-time", 0, 0, G_OPTION_ARG_INT, &eviction_idle_time, "Seconds an installed application must be idle to be stopped under memory pressure", "SECONDS" },
+  { NULL }
+};
+
 gint
 main (gint argc, gchar *argv[])
 {
   gint exit_status = 0;
+  GError *error = NULL;
+  GOptionContext *context;
+
+  context = g_option_context_new ("- Lia core daemon");
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (! g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_print ("option parsing failed: %s\n", error->message);
+      return -1;
+    }
+  g_option_context_free (context);
 
   g_type_init ();
 
+  if (embedded_webview)
+    {
+      evd_tls_init (NULL);
+
+      /* uploads are streamed into pipes that applications may close early */
+      signal (SIGPIPE, SIG_IGN);
+    }
+
   core = g_object_new (LIA_TYPE_CORE,
                        "service-name", SERVICE_NAME,
+                       "embedded-broker", embedded_broker,
+                       "embedded-webview", embedded_webview,
+                       "child-cpu-weight", (guint) CLAMP (child_cpu_weight, 0, 10000),
+                       "child-memory-high", (guint64) MAX (child_memory_high, 0),
+                       "child-memory-max", (guint64) MAX (child_memory_max, 0),
+                       "eviction-memory-pressure", CLAMP (eviction_pressure, 0.0, 100.0),
+                       "eviction-idle-time", (guint) MAX (eviction_idle_time, 0),
+                       "public-bus-shards", (guint) CLAMP (public_bus_shards, 1, 64),
+                       "webview-bus-mux", (guint) CLAMP (webview_bus_mux, 0, 64),
                        NULL);
 
   /* start the show */
@@ -26,5 +79,8 @@ main (gint argc, gchar *argv[])
 
   g_print ("\rlia-core terminated\n");
 
+  if (embedded_webview)
+    evd_tls_deinit ();
+
   return exit_status;
 }
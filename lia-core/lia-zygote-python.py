@@ -0,0 +1,125 @@
+# Lia zygote for Python applications.
+#
+# Started by lia-core, it imports the modules every Lia application needs
+# and then waits for launch requests on the socket given in the
+# LIA_ZYGOTE_ADDRESS environment variable. Each request forks a child that
+# runs the application script, so the interpreter start-up and the module
+# imports are paid only once and the resulting pages are shared among all
+# children.
+#
+# The protocol is one JSON object per line. Requests from lia-core:
+#
+#   {"id": 1, "argv": ["python3", "app.py"], "env": ["KEY=value", ...]}
+#
+# Replies from the zygote:
+#
+#   {"id": 1, "pid": 1234}
+#   {"exited": 1234, "status": 0}
+#
+# Nothing here may start threads or connect to a bus before forking.
+
+import json
+import os
+import runpy
+import select
+import signal
+import socket
+import sys
+
+from gi.repository import GLib, GObject, Gio
+
+try:
+    from gi.repository import Evd, Lia
+except ImportError:
+    pass
+
+def run_child(sock, wakeup_r, wakeup_w, request):
+    signal.set_wakeup_fd(-1)
+    signal.signal(signal.SIGCHLD, signal.SIG_DFL)
+
+    sock.close()
+    os.close(wakeup_r)
+    os.close(wakeup_w)
+
+    os.setsid()
+
+    os.environ.clear()
+    for entry in request["env"]:
+        key, sep, value = entry.partition("=")
+        if sep:
+            os.environ[key] = value
+
+    sys.argv = request["argv"][1:]
+    status = 0
+    try:
+        runpy.run_path(sys.argv[0], run_name="__main__")
+    except SystemExit as e:
+        if isinstance(e.code, int):
+            status = e.code
+        elif e.code is not None:
+            sys.stderr.write("%s\n" % e.code)
+            status = 1
+    except BaseException:
+        import traceback
+        traceback.print_exc()
+        status = 1
+
+    sys.stdout.flush()
+    sys.stderr.flush()
+    os._exit(status)
+
+def send(sock, msg):
+    sock.sendall((json.dumps(msg) + "\n").encode("utf-8"))
+
+def reap_children(sock):
+    while True:
+        try:
+            pid, status = os.waitpid(-1, os.WNOHANG)
+        except ChildProcessError:
+            return
+        if pid == 0:
+            return
+        send(sock, {"exited": pid, "status": status})
+
+def main():
+    sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    sock.connect("\0" + os.environ["LIA_ZYGOTE_ADDRESS"])
+    sock.set_inheritable(False)
+
+    # a self-pipe wakes the loop up when a child exits
+    wakeup_r, wakeup_w = os.pipe()
+    os.set_blocking(wakeup_w, False)
+    signal.set_wakeup_fd(wakeup_w)
+    signal.signal(signal.SIGCHLD, lambda signum, frame: None)
+
+    buf = b""
+    while True:
+        try:
+            readable, _, _ = select.select([sock, wakeup_r], [], [])
+        except InterruptedError:
+            continue
+
+        if wakeup_r in readable:
+            os.read(wakeup_r, 512)
+            reap_children(sock)
+
+        if sock not in readable:
+            continue
+
+        data = sock.recv(65536)
+        if not data:
+            # lia-core is gone, the children are adopted by init
+            return
+
+        buf += data
+        while b"\n" in buf:
+            line, buf = buf.split(b"\n", 1)
+            request = json.loads(line.decode("utf-8"))
+
+            pid = os.fork()
+            if pid == 0:
+                run_child(sock, wakeup_r, wakeup_w, request)
+
+            send(sock, {"id": request["id"], "pid": pid})
+
+main()
@@ -40,6 +40,9 @@ main (gint argc, gchar *argv[])
   g_type_init ();
   evd_tls_init (NULL);
 
+  /* uploads are streamed into pipes that applications may close early */
+  signal (SIGPIPE, SIG_IGN);
+
   base_service_name = g_getenv (LIA_ENV_KEY_BASE_SERVICE_NAME);
   service_name = g_strdup_printf ("%s.%s",
                                   base_service_name,
@@ -0,0 +1,789 @@
+/*
+ * lia-app-host.c
+ *
+ * This file is part of Lia <http://free-social.net/lia/>
+ *
+ * Copyright (C) 2012 Igalia S.L.
+ *
+ * Authors:
+ *   Eduardo Lima Mitev <elima@igalia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License at http://www.gnu.org/licenses/gpl-3.0.txt
+ * for more details.
+ */
+
+/* A LiaApplication that runs many lightweight applications, built as
+   loadable modules, in a single process. Hosted applications share the
+   host's bus connections, daemon and main loop, so each one costs little
+   more than its own code and data. Still, every hosted application owns
+   its own service name, and its objects live under an object path
+   namespace derived from it, e.g 'org.example.Notes' gets
+   '/org/example/Notes'. Calls are only dispatched to an object when
+   addressed to the service name of the application that registered it. */
+
+#include <string.h>
+#include <gmodule.h>
+
+#include "lia-app-host.h"
+#include "lia-application-private.h"
+
+G_DEFINE_TYPE (LiaAppHost, lia_app_host, LIA_TYPE_APPLICATION);
+
+#define LIA_APP_HOST_GET_PRIVATE(obj) (G_TYPE_INSTANCE_GET_PRIVATE ((obj), \
+                                       LIA_TYPE_APP_HOST, \
+                                       LiaAppHostPrivate))
+
+/* private data */
+struct _LiaAppHostPrivate
+{
+  GList *apps;
+
+  guint webview_watcher_id;
+  gchar *webview_name;
+};
+
+/* HostedModule, referenced by the application and each of its objects,
+   since GDBus frees unregistered objects later from an idle, and calls
+   in flight keep them alive. The module is closed once none of its code
+   can run anymore */
+typedef struct
+{
+  GModule *module;
+  gint ref_count;
+} HostedModule;
+
+struct _LiaHostedApp
+{
+  LiaAppHost *host;
+  gchar *service_name;
+  gchar *object_path;
+  gchar *html_root;
+
+  HostedModule *module;
+  LiaHostedAppRegisterObjectsFunc register_objects;
+  LiaHostedAppShutdownFunc shutdown;
+
+  guint name_owner_id[3];
+  GList *objects;
+
+  gpointer user_data;
+  GDestroyNotify user_data_free_func;
+};
+
+/* HostedObject */
+typedef struct
+{
+  LiaHostedApp *app;
+  HostedModule *module;
+  LiaBusType bus_type;
+  guint reg_id;
+  LiaHostedAppMethodCallFunc method_call_func;
+  gpointer user_data;
+  GDestroyNotify user_data_free_func;
+} HostedObject;
+
+static void     lia_app_host_class_init        (LiaAppHostClass *class);
+static void     lia_app_host_init              (LiaAppHost *self);
+
+static void     finalize                       (GObject *obj);
+static void     dispose                        (GObject *obj);
+
+static void     register_objects               (LiaApplication *app,
+                                                LiaBusType      bus_type);
+
+static void     free_hosted_app                (LiaHostedApp *app);
+
+static void
+lia_app_host_class_init (LiaAppHostClass *class)
+{
+  GObjectClass *obj_class;
+  LiaApplicationClass *lia_app_class;
+
+  obj_class = G_OBJECT_CLASS (class);
+  obj_class->dispose = dispose;
+  obj_class->finalize = finalize;
+
+  lia_app_class = LIA_APPLICATION_CLASS (class);
+  lia_app_class->register_objects = register_objects;
+
+  g_type_class_add_private (obj_class, sizeof (LiaAppHostPrivate));
+}
+
+static void
+lia_app_host_init (LiaAppHost *self)
+{
+  LiaAppHostPrivate *priv;
+
+  priv = LIA_APP_HOST_GET_PRIVATE (self);
+  self->priv = priv;
+
+  priv->apps = NULL;
+
+  priv->webview_watcher_id = 0;
+  priv->webview_name = NULL;
+}
+
+static void
+dispose (GObject *obj)
+{
+  LiaAppHost *self = LIA_APP_HOST (obj);
+
+  while (self->priv->apps != NULL)
+    {
+      LiaHostedApp *app = self->priv->apps->data;
+
+      self->priv->apps = g_list_delete_link (self->priv->apps,
+                                             self->priv->apps);
+      free_hosted_app (app);
+    }
+
+  if (self->priv->webview_watcher_id > 0)
+    {
+      g_bus_unwatch_name (self->priv->webview_watcher_id);
+      self->priv->webview_watcher_id = 0;
+    }
+
+  G_OBJECT_CLASS (lia_app_host_parent_class)->dispose (obj);
+}
+
+static void
+finalize (GObject *obj)
+{
+  LiaAppHost *self = LIA_APP_HOST (obj);
+
+  g_free (self->priv->webview_name);
+
+  G_OBJECT_CLASS (lia_app_host_parent_class)->finalize (obj);
+}
+
+static HostedModule *
+hosted_module_ref (HostedModule *module)
+{
+  module->ref_count++;
+
+  return module;
+}
+
+static void
+hosted_module_unref (HostedModule *module)
+{
+  module->ref_count--;
+  if (module->ref_count > 0)
+    return;
+
+  g_module_close (module->module);
+
+  g_slice_free (HostedModule, module);
+}
+
+static void
+free_hosted_object (gpointer _data)
+{
+  HostedObject *obj = _data;
+
+  if (obj->app != NULL)
+    obj->app->objects = g_list_remove (obj->app->objects, obj);
+
+  if (obj->user_data != NULL && obj->user_data_free_func != NULL)
+    obj->user_data_free_func (obj->user_data);
+
+  hosted_module_unref (obj->module);
+
+  g_slice_free (HostedObject, obj);
+}
+
+/* forgets the objects registered on a bus, which are gone with the
+   connection or about to be unregistered */
+static void
+drop_hosted_objects (LiaHostedApp *app, gint bus_type, gboolean unregister)
+{
+  GList *node;
+
+  node = app->objects;
+  while (node != NULL)
+    {
+      HostedObject *obj = node->data;
+      GList *next = node->next;
+
+      if (bus_type < 0 || obj->bus_type == bus_type)
+        {
+          app->objects = g_list_delete_link (app->objects, node);
+          obj->app = NULL;
+
+          if (unregister)
+            lia_application_unregister_object (LIA_APPLICATION (app->host),
+                                               obj->bus_type,
+                                               obj->reg_id);
+        }
+
+      node = next;
+    }
+}
+
+static void
+free_hosted_app (LiaHostedApp *app)
+{
+  gint i;
+
+  if (app->shutdown != NULL)
+    app->shutdown (app);
+
+  drop_hosted_objects (app, -1, TRUE);
+
+  for (i=0; i<3; i++)
+    if (app->name_owner_id[i] > 0)
+      g_bus_unown_name (app->name_owner_id[i]);
+
+  if (app->user_data != NULL && app->user_data_free_func != NULL)
+    app->user_data_free_func (app->user_data);
+
+  hosted_module_unref (app->module);
+
+  g_free (app->service_name);
+  g_free (app->object_path);
+  g_free (app->html_root);
+
+  g_slice_free (LiaHostedApp, app);
+}
+
+static void
+on_hosted_app_name_lost (GDBusConnection *connection,
+                         const gchar     *name,
+                         gpointer         user_data)
+{
+  /* @TODO: log properly */
+  g_print ("Hosted application lost its service name '%s'\n", name);
+}
+
+static void
+hosted_app_bus_ready (LiaHostedApp *app, LiaBusType bus_type)
+{
+  GDBusConnection *conn;
+
+  conn = lia_application_get_bus (LIA_APPLICATION (app->host), bus_type);
+  if (conn == NULL)
+    return;
+
+  /* a bus that moved comes back without any of the previous objects */
+  drop_hosted_objects (app, bus_type, FALSE);
+  if (app->name_owner_id[bus_type] > 0)
+    g_bus_unown_name (app->name_owner_id[bus_type]);
+
+  app->name_owner_id[bus_type] =
+    g_bus_own_name_on_connection (conn,
+                                  app->service_name,
+                                  G_BUS_NAME_OWNER_FLAGS_NONE,
+                                  NULL,
+                                  on_hosted_app_name_lost,
+                                  app,
+                                  NULL);
+
+  if (app->register_objects != NULL)
+    app->register_objects (app, bus_type);
+}
+
+static void
+on_web_dir_registered (GObject      *obj,
+                       GAsyncResult *res,
+                       gpointer      user_data)
+{
+  gchar *service_name = user_data;
+  GVariant *ret;
+  GError *error = NULL;
+
+  ret = g_dbus_connection_call_finish (G_DBUS_CONNECTION (obj), res, &error);
+  if (ret == NULL)
+    {
+      g_print ("Error registering HTML root of '%s': %s\n",
+               service_name,
+               error->message);
+      g_error_free (error);
+    }
+  else
+    {
+      g_variant_unref (ret);
+    }
+
+  g_free (service_name);
+}
+
+static void
+register_hosted_app_web_dir (LiaHostedApp *app)
+{
+  LiaAppHost *self = app->host;
+
+  if (app->html_root == NULL || self->priv->webview_name == NULL)
+    return;
+
+  g_dbus_connection_call (lia_application_get_bus (LIA_APPLICATION (self),
+                                                   LIA_BUS_PRIVATE),
+                          self->priv->webview_name,
+                          LIA_WEBVIEW_OBJ_PATH,
+                          LIA_WEBVIEW_IFACE_NAME,
+                          "RegisterWebDir",
+                          g_variant_new ("(ss)",
+                                         app->service_name,
+                                         app->html_root),
+                          NULL,
+                          G_DBUS_CALL_FLAGS_NONE,
+                          -1,
+                          NULL,
+                          on_web_dir_registered,
+                          g_strdup (app->service_name));
+}
+
+static void
+webview_name_appeared (GDBusConnection *connection,
+                       const gchar     *name,
+                       const gchar     *name_owner,
+                       gpointer         user_data)
+{
+  LiaAppHost *self = LIA_APP_HOST (user_data);
+  GList *node;
+
+  g_free (self->priv->webview_name);
+  self->priv->webview_name = g_strdup (name);
+
+  for (node = self->priv->apps; node != NULL; node = node->next)
+    register_hosted_app_web_dir (node->data);
+}
+
+static void
+webview_name_vanished (GDBusConnection *connection,
+                       const gchar     *name,
+                       gpointer         user_data)
+{
+  LiaAppHost *self = LIA_APP_HOST (user_data);
+
+  g_free (self->priv->webview_name);
+  self->priv->webview_name = NULL;
+}
+
+static void
+watch_webview_name (LiaAppHost *self)
+{
+  const gchar *webview_name;
+
+  if (self->priv->webview_watcher_id > 0)
+    {
+      g_bus_unwatch_name (self->priv->webview_watcher_id);
+      self->priv->webview_watcher_id = 0;
+    }
+
+  webview_name =
+    lia_application_get_config_string (LIA_APPLICATION (self),
+                                       LIA_CONFIG_KEY_WEBVIEW_SERVICE_NAME);
+  if (webview_name == NULL)
+    return;
+
+  self->priv->webview_watcher_id =
+    g_bus_watch_name_on_connection (lia_application_get_bus (LIA_APPLICATION (self),
+                                                             LIA_BUS_PRIVATE),
+                                    webview_name,
+                                    G_BUS_NAME_WATCHER_FLAGS_NONE,
+                                    webview_name_appeared,
+                                    webview_name_vanished,
+                                    self,
+                                    NULL);
+}
+
+static void
+register_objects (LiaApplication *app, LiaBusType bus_type)
+{
+  LiaAppHost *self = LIA_APP_HOST (app);
+  GList *node;
+
+  /* the host's own objects, if any */
+  LIA_APPLICATION_CLASS (lia_app_host_parent_class)->register_objects (app,
+                                                                      bus_type);
+
+  for (node = self->priv->apps; node != NULL; node = node->next)
+    hosted_app_bus_ready (node->data, bus_type);
+
+  if (bus_type == LIA_BUS_PRIVATE)
+    watch_webview_name (self);
+}
+
+static void
+on_hosted_object_method_call (LiaApplication        *host,
+                              LiaBusType             bus_type,
+                              const gchar           *caller_id,
+                              const gchar           *object_path,
+                              const gchar           *interface_name,
+                              const gchar           *method_name,
+                              GVariant              *arguments,
+                              GDBusMethodInvocation *invocation,
+                              gpointer               user_data)
+{
+  HostedObject *obj = user_data;
+  const gchar *destination;
+
+  /* all hosted applications share the host's connections, so a call
+     reaches every object with a matching path no matter which service
+     name it was sent to */
+  destination =
+    g_dbus_message_get_destination (g_dbus_method_invocation_get_message (invocation));
+
+  if (obj->app == NULL ||
+      (destination != NULL &&
+       ! g_dbus_is_unique_name (destination) &&
+       g_strcmp0 (destination, obj->app->service_name) != 0))
+    {
+      g_dbus_method_invocation_return_error (invocation,
+                                             G_DBUS_ERROR,
+                                             G_DBUS_ERROR_UNKNOWN_OBJECT,
+                                             "No such object path '%s'",
+                                             object_path);
+      return;
+    }
+
+  obj->method_call_func (obj->app,
+                         bus_type,
+                         caller_id,
+                         object_path,
+                         interface_name,
+                         method_name,
+                         arguments,
+                         invocation,
+                         obj->user_data);
+}
+
+/* 'org.example.Notes' -> '/org/example/Notes' */
+static gchar *
+object_path_from_service_name (const gchar *service_name)
+{
+  gchar *path;
+  gint i;
+
+  path = g_strdup_printf ("/%s", service_name);
+  for (i=1; path[i] != '\0'; i++)
+    {
+      if (path[i] == '.')
+        path[i] = '/';
+      else if (path[i] == '-')
+        path[i] = '_';
+    }
+
+  return path;
+}
+
+static LiaHostedApp *
+lookup_hosted_app (LiaAppHost *self, const gchar *service_name)
+{
+  GList *node;
+
+  for (node = self->priv->apps; node != NULL; node = node->next)
+    {
+      LiaHostedApp *app = node->data;
+
+      if (g_strcmp0 (app->service_name, service_name) == 0)
+        return app;
+    }
+
+  return NULL;
+}
+
+/* public methods */
+
+/**
+ * lia_app_host_load_module:
+ * @module_path: Path of the application's loadable module
+ * @service_name: The service name the application will own on the buses
+ * @html_root: (allow-none): The application's HTML root, registered with
+ * the Webview
+ * @error: (allow-none):
+ *
+ * Loads an application module and runs its init function. The module
+ * must export a #LiaHostedAppInitFunc named 'lia_hosted_app_init', and
+ * can also export 'lia_hosted_app_register_objects' and
+ * 'lia_hosted_app_shutdown'. Modules built for one host can be loaded
+ * more than once, under different service names.
+ *
+ * Returns: (transfer none): The hosted application, or %NULL on error.
+ **/
+LiaHostedApp *
+lia_app_host_load_module (LiaAppHost   *self,
+                          const gchar  *module_path,
+                          const gchar  *service_name,
+                          const gchar  *html_root,
+                          GError      **error)
+{
+  LiaHostedApp *app;
+  GModule *module;
+  LiaHostedAppInitFunc init_func;
+  gint i;
+
+  g_return_val_if_fail (LIA_IS_APP_HOST (self), NULL);
+  g_return_val_if_fail (module_path != NULL, NULL);
+  g_return_val_if_fail (service_name != NULL, NULL);
+
+  if (! g_dbus_is_name (service_name) || g_dbus_is_unique_name (service_name))
+    {
+      g_set_error (error,
+                   G_IO_ERROR,
+                   G_IO_ERROR_INVALID_ARGUMENT,
+                   "Invalid service name '%s'",
+                   service_name);
+      return NULL;
+    }
+
+  if (lookup_hosted_app (self, service_name) != NULL)
+    {
+      g_set_error (error,
+                   G_IO_ERROR,
+                   G_IO_ERROR_EXISTS,
+                   "An application with service name '%s' is already hosted",
+                   service_name);
+      return NULL;
+    }
+
+  /* symbols are kept local, every module exports the same entry points */
+  module = g_module_open (module_path,
+                          G_MODULE_BIND_LAZY | G_MODULE_BIND_LOCAL);
+  if (module == NULL)
+    {
+      g_set_error (error,
+                   G_IO_ERROR,
+                   G_IO_ERROR_FAILED,
+                   "Failed to load module '%s': %s",
+                   module_path,
+                   g_module_error ());
+      return NULL;
+    }
+
+  if (! g_module_symbol (module,
+                         LIA_HOSTED_APP_INIT_SYMBOL,
+                         (gpointer *) &init_func))
+    {
+      g_set_error (error,
+                   G_IO_ERROR,
+                   G_IO_ERROR_NOT_SUPPORTED,
+                   "Module '%s' is not a Lia application, '%s' not found",
+                   module_path,
+                   LIA_HOSTED_APP_INIT_SYMBOL);
+      g_module_close (module);
+      return NULL;
+    }
+
+  app = g_slice_new0 (LiaHostedApp);
+  app->host = self;
+  app->service_name = g_strdup (service_name);
+  app->object_path = object_path_from_service_name (service_name);
+  app->html_root = g_strdup (html_root);
+  app->module = g_slice_new (HostedModule);
+  app->module->module = module;
+  app->module->ref_count = 1;
+
+  g_module_symbol (module,
+                   LIA_HOSTED_APP_REGISTER_OBJECTS_SYMBOL,
+                   (gpointer *) &app->register_objects);
+  g_module_symbol (module,
+                   LIA_HOSTED_APP_SHUTDOWN_SYMBOL,
+                   (gpointer *) &app->shutdown);
+
+  if (! init_func (app, error))
+    {
+      /* never started, so not shut down either */
+      app->shutdown = NULL;
+      free_hosted_app (app);
+      return NULL;
+    }
+
+  self->priv->apps = g_list_append (self->priv->apps, app);
+
+  /* buses connected already */
+  for (i=0; i<3; i++)
+    hosted_app_bus_ready (app, i);
+
+  register_hosted_app_web_dir (app);
+
+  g_print ("Hosting '%s' from %s\n", service_name, module_path);
+
+  return app;
+}
+
+/**
+ * lia_app_host_unload_app:
+ * @service_name: The service name of a hosted application
+ *
+ * Shuts a hosted application down, drops its objects and service name,
+ * and unloads its module once GDBus has released all of its objects.
+ *
+ * Returns: %FALSE if no application is hosted with @service_name.
+ **/
+gboolean
+lia_app_host_unload_app (LiaAppHost *self, const gchar *service_name)
+{
+  LiaHostedApp *app;
+
+  g_return_val_if_fail (LIA_IS_APP_HOST (self), FALSE);
+  g_return_val_if_fail (service_name != NULL, FALSE);
+
+  app = lookup_hosted_app (self, service_name);
+  if (app == NULL)
+    return FALSE;
+
+  self->priv->apps = g_list_remove (self->priv->apps, app);
+  free_hosted_app (app);
+
+  g_print ("Unloaded '%s'\n", service_name);
+
+  return TRUE;
+}
+
+LiaAppHost *
+lia_hosted_app_get_host (LiaHostedApp *app)
+{
+  g_return_val_if_fail (app != NULL, NULL);
+
+  return app->host;
+}
+
+const gchar *
+lia_hosted_app_get_service_name (LiaHostedApp *app)
+{
+  g_return_val_if_fail (app != NULL, NULL);
+
+  return app->service_name;
+}
+
+/**
+ * lia_hosted_app_get_object_path:
+ *
+ * Returns: The root of the object path namespace of the application,
+ * derived from its service name.
+ **/
+const gchar *
+lia_hosted_app_get_object_path (LiaHostedApp *app)
+{
+  g_return_val_if_fail (app != NULL, NULL);
+
+  return app->object_path;
+}
+
+void
+lia_hosted_app_set_user_data (LiaHostedApp   *app,
+                              gpointer        user_data,
+                              GDestroyNotify  user_data_free_func)
+{
+  g_return_if_fail (app != NULL);
+
+  if (app->user_data != NULL && app->user_data_free_func != NULL)
+    app->user_data_free_func (app->user_data);
+
+  app->user_data = user_data;
+  app->user_data_free_func = user_data_free_func;
+}
+
+gpointer
+lia_hosted_app_get_user_data (LiaHostedApp *app)
+{
+  g_return_val_if_fail (app != NULL, NULL);
+
+  return app->user_data;
+}
+
+/**
+ * lia_hosted_app_register_object:
+ *
+ * Like lia_application_register_object(), but the object belongs to the
+ * hosted application: @object_path must be within the application's
+ * namespace (see lia_hosted_app_get_object_path()), calls are only
+ * dispatched when addressed to the application's service name, and the
+ * object is unregistered when the application is unloaded.
+ **/
+guint
+lia_hosted_app_register_object (LiaHostedApp                *app,
+                                LiaBusType                   bus_type,
+                                const gchar                 *object_path,
+                                const gchar                 *interface_xml,
+                                LiaHostedAppMethodCallFunc   method_call_func,
+                                gpointer                     user_data,
+                                GDestroyNotify               user_data_free_func,
+                                GError                     **error)
+{
+  HostedObject *obj;
+  gsize len;
+
+  g_return_val_if_fail (app != NULL, 0);
+  g_return_val_if_fail (object_path != NULL, 0);
+  g_return_val_if_fail (method_call_func != NULL, 0);
+
+  len = strlen (app->object_path);
+  if (strncmp (object_path, app->object_path, len) != 0 ||
+      (object_path[len] != '\0' && object_path[len] != '/'))
+    {
+      g_set_error (error,
+                   G_IO_ERROR,
+                   G_IO_ERROR_PERMISSION_DENIED,
+                   "Object path '%s' is outside of '%s'",
+                   object_path,
+                   app->object_path);
+      return 0;
+    }
+
+  obj = g_slice_new0 (HostedObject);
+  obj->app = app;
+  obj->module = hosted_module_ref (app->module);
+  obj->bus_type = bus_type;
+  obj->method_call_func = method_call_func;
+  obj->user_data = user_data;
+  obj->user_data_free_func = user_data_free_func;
+
+  obj->reg_id = lia_application_register_object (LIA_APPLICATION (app->host),
+                                                 bus_type,
+                                                 object_path,
+                                                 interface_xml,
+                                                 on_hosted_object_method_call,
+                                                 obj,
+                                                 free_hosted_object,
+                                                 error);
+  if (obj->reg_id == 0)
+    {
+      /* the user data stays with the caller */
+      hosted_module_unref (obj->module);
+      g_slice_free (HostedObject, obj);
+      return 0;
+    }
+
+  app->objects = g_list_prepend (app->objects, obj);
+
+  return obj->reg_id;
+}
+
+gboolean
+lia_hosted_app_unregister_object (LiaHostedApp *app,
+                                  LiaBusType    bus_type,
+                                  guint         registration_id)
+{
+  GList *node;
+
+  g_return_val_if_fail (app != NULL, FALSE);
+  g_return_val_if_fail (registration_id > 0, FALSE);
+
+  /* applications can only unregister their own objects */
+  for (node = app->objects; node != NULL; node = node->next)
+    {
+      HostedObject *obj = node->data;
+
+      if (obj->bus_type == bus_type && obj->reg_id == registration_id)
+        {
+          app->objects = g_list_delete_link (app->objects, node);
+          obj->app = NULL;
+
+          return lia_application_unregister_object (LIA_APPLICATION (app->host),
+                                                    bus_type,
+                                                    registration_id);
+        }
+    }
+
+  return FALSE;
+}
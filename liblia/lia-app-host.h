@@ -0,0 +1,116 @@
+/*
+ * lia-app-host.h
+ *
+ * This file is part of Lia <http://free-social.net/lia/>
+ *
+ * Copyright (C) 2012 Igalia S.L.
+ *
+ * Authors:
+ *   Eduardo Lima Mitev <elima@igalia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License at http://www.gnu.org/licenses/gpl-3.0.txt
+ * for more details.
+ */
+
+#ifndef __LIA_APP_HOST_H__
+#define __LIA_APP_HOST_H__
+
+#include <glib-object.h>
+#include <gio/gio.h>
+
+#include <lia-defines.h>
+#include <lia-application.h>
+
+G_BEGIN_DECLS
+
+typedef struct _LiaAppHost LiaAppHost;
+typedef struct _LiaAppHostClass LiaAppHostClass;
+typedef struct _LiaAppHostPrivate LiaAppHostPrivate;
+
+typedef struct _LiaHostedApp LiaHostedApp;
+
+/* Entry points of a hosted application module. Only the init function is
+   mandatory. Register-objects is called every time one of the buses is
+   connected, like the LiaApplication's signal of the same name */
+#define LIA_HOSTED_APP_INIT_SYMBOL             "lia_hosted_app_init"
+#define LIA_HOSTED_APP_REGISTER_OBJECTS_SYMBOL "lia_hosted_app_register_objects"
+#define LIA_HOSTED_APP_SHUTDOWN_SYMBOL         "lia_hosted_app_shutdown"
+
+typedef gboolean (* LiaHostedAppInitFunc)            (LiaHostedApp  *app,
+                                                      GError       **error);
+typedef void     (* LiaHostedAppRegisterObjectsFunc) (LiaHostedApp  *app,
+                                                      LiaBusType     bus_type);
+typedef void     (* LiaHostedAppShutdownFunc)        (LiaHostedApp  *app);
+
+typedef void (* LiaHostedAppMethodCallFunc) (LiaHostedApp          *app,
+                                             LiaBusType             bus_type,
+                                             const gchar           *caller_id,
+                                             const gchar           *object_path,
+                                             const gchar           *interface_name,
+                                             const gchar           *method_name,
+                                             GVariant              *arguments,
+                                             GDBusMethodInvocation *invocation,
+                                             gpointer               user_data);
+
+struct _LiaAppHost
+{
+  LiaApplication parent;
+
+  LiaAppHostPrivate *priv;
+};
+
+struct _LiaAppHostClass
+{
+  LiaApplicationClass parent_class;
+};
+
+#define LIA_TYPE_APP_HOST           (lia_app_host_get_type ())
+#define LIA_APP_HOST(obj)           (G_TYPE_CHECK_INSTANCE_CAST ((obj), LIA_TYPE_APP_HOST, LiaAppHost))
+#define LIA_APP_HOST_CLASS(obj)     (G_TYPE_CHECK_CLASS_CAST ((obj), LIA_TYPE_APP_HOST, LiaAppHostClass))
+#define LIA_IS_APP_HOST(obj)        (G_TYPE_CHECK_INSTANCE_TYPE ((obj), LIA_TYPE_APP_HOST))
+#define LIA_IS_APP_HOST_CLASS(obj)  (G_TYPE_CHECK_CLASS_TYPE ((obj), LIA_TYPE_APP_HOST))
+#define LIA_APP_HOST_GET_CLASS(obj) (G_TYPE_INSTANCE_GET_CLASS ((obj), LIA_TYPE_APP_HOST, LiaAppHostClass))
+
+
+GType             lia_app_host_get_type               (void) G_GNUC_CONST;
+
+LiaHostedApp *    lia_app_host_load_module            (LiaAppHost   *self,
+                                                       const gchar  *module_path,
+                                                       const gchar  *service_name,
+                                                       const gchar  *html_root,
+                                                       GError      **error);
+gboolean          lia_app_host_unload_app             (LiaAppHost  *self,
+                                                       const gchar *service_name);
+
+LiaAppHost *      lia_hosted_app_get_host             (LiaHostedApp *app);
+const gchar *     lia_hosted_app_get_service_name     (LiaHostedApp *app);
+const gchar *     lia_hosted_app_get_object_path      (LiaHostedApp *app);
+
+void              lia_hosted_app_set_user_data        (LiaHostedApp   *app,
+                                                       gpointer        user_data,
+                                                       GDestroyNotify  user_data_free_func);
+gpointer          lia_hosted_app_get_user_data        (LiaHostedApp *app);
+
+guint             lia_hosted_app_register_object      (LiaHostedApp                *app,
+                                                       LiaBusType                   bus_type,
+                                                       const gchar                 *object_path,
+                                                       const gchar                 *interface_xml,
+                                                       LiaHostedAppMethodCallFunc   method_call_func,
+                                                       gpointer                     user_data,
+                                                       GDestroyNotify               user_data_free_func,
+                                                       GError                     **error);
+gboolean          lia_hosted_app_unregister_object    (LiaHostedApp *app,
+                                                       LiaBusType    bus_type,
+                                                       guint         registration_id);
+
+G_END_DECLS
+
+#endif /* __LIA_APP_HOST_H__ */
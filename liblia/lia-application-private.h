@@ -0,0 +1,52 @@
+/*
+ * lia-application-private.h
+ *
+ * This file is part of Lia <http://free-social.net/lia/>
+ *
+ * Copyright (C) 2012 Igalia S.L.
+ *
+ * Authors:
+ *   Eduardo Lima Mitev <elima@igalia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License at http://www.gnu.org/licenses/gpl-3.0.txt
+ * for more details.
+ */
+
+#ifndef __LIA_APPLICATION_PRIVATE_H__
+#define __LIA_APPLICATION_PRIVATE_H__
+
+#include <lia-application.h>
+
+G_BEGIN_DECLS
+
+/* Methods meant to be used only by LiaApplication subclasses in liblia */
+
+void              lia_application_set_bus_address                (LiaApplication *self,
+                                                                  LiaBusType      bus_type,
+                                                                  const gchar    *address);
+
+void              lia_application_set_config                     (LiaApplication *self,
+                                                                  guint           version,
+                                                                  GVariant       *config);
+GVariant *        lia_application_get_config                     (LiaApplication *self);
+const gchar *     lia_application_get_config_string              (LiaApplication *self,
+                                                                  const gchar    *key);
+
+GDBusConnection * lia_application_get_discovery_connection       (LiaApplication *self);
+
+guint             lia_application_trace_begin                    (LiaApplication *self,
+                                                                  const gchar    *phase);
+void              lia_application_trace_end                      (LiaApplication *self,
+                                                                  guint           span_id);
+
+G_END_DECLS
+
+#endif /* __LIA_APPLICATION_PRIVATE_H__ */
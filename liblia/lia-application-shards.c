@@ -0,0 +1,392 @@
+/* Public bus shards. Core may run the public bus as several bus daemons
+   (shards), among which the Webview spreads web peers. The first shard
+   is the regular public bus connection. Applications connect to the
+   others transparently: objects registered on the public bus and the
+   service name are mirrored on every shard, each shard has its own
+   caller cache since unique names are only unique within a bus, and
+   broadcast signals emitted with lia_application_emit_signal_coalesced()
+   go out on all of them. */
+
+typedef struct
+{
+  LiaApplication *self;
+  guint index;
+  gchar *address;
+  GDBusConnection *conn;
+  GCancellable *cancellable;
+
+  guint name_owner_id;
+  GHashTable *caller_cache;
+  guint name_owner_sub_id;
+
+  /* registration id on shard 0 -> registration id on this shard */
+  GHashTable *registrations;
+} BusShard;
+
+typedef struct
+{
+  gchar *object_path;
+  GDBusInterfaceInfo *iface_info;
+  RegObjData *reg_data;
+} PublicObject;
+
+static void
+free_public_object (gpointer _data)
+{
+  PublicObject *obj = _data;
+
+  g_free (obj->object_path);
+  g_dbus_interface_info_unref (obj->iface_info);
+  reg_obj_data_unref (obj->reg_data);
+
+  g_slice_free (PublicObject, obj);
+}
+
+static void
+free_bus_shard (gpointer _data)
+{
+  BusShard *shard = _data;
+
+  g_cancellable_cancel (shard->cancellable);
+  g_object_unref (shard->cancellable);
+
+  if (shard->conn != NULL)
+    {
+      GHashTableIter iter;
+      gpointer shard_reg_id;
+
+      if (shard->name_owner_id > 0)
+        g_bus_unown_name (shard->name_owner_id);
+
+      g_hash_table_iter_init (&iter, shard->registrations);
+      while (g_hash_table_iter_next (&iter, NULL, &shard_reg_id))
+        g_dbus_connection_unregister_object (shard->conn,
+                                             GPOINTER_TO_UINT (shard_reg_id));
+
+      g_dbus_connection_signal_unsubscribe (shard->conn,
+                                            shard->name_owner_sub_id);
+
+      g_dbus_connection_close (shard->conn, NULL, NULL, NULL);
+      g_object_unref (shard->conn);
+    }
+
+  if (shard->caller_cache != NULL)
+    g_hash_table_unref (shard->caller_cache);
+
+  g_hash_table_unref (shard->registrations);
+  g_free (shard->address);
+
+  g_slice_free (BusShard, shard);
+}
+
+static BusShard *
+lookup_shard_by_connection (LiaApplication *self, GDBusConnection *conn)
+{
+  guint i;
+
+  for (i=0; i<self->priv->public_shards->len; i++)
+    {
+      BusShard *shard = g_ptr_array_index (self->priv->public_shards, i);
+
+      if (shard->conn == conn)
+        return shard;
+    }
+
+  return NULL;
+}
+
+/* returns the caller cache for calls arriving on @conn */
+static GHashTable *
+lookup_caller_cache (LiaApplication *self, GDBusConnection *conn)
+{
+  BusShard *shard;
+  gint bus_type;
+
+  bus_type = get_bus_type_from_connection (self, conn);
+  if (bus_type >= 0)
+    return self->priv->caller_cache[bus_type];
+
+  shard = lookup_shard_by_connection (self, conn);
+  if (shard != NULL)
+    return shard->caller_cache;
+
+  return NULL;
+}
+
+static void
+shard_register_object (BusShard *shard, guint reg_id, PublicObject *obj)
+{
+  guint shard_reg_id;
+  GError *error = NULL;
+
+  shard_reg_id =
+    g_dbus_connection_register_object (shard->conn,
+                                       obj->object_path,
+                                       obj->iface_info,
+                                       &shard->self->priv->reg_obj_vtable,
+                                       reg_obj_data_ref (obj->reg_data),
+                                       reg_obj_data_unref,
+                                       &error);
+  if (shard_reg_id == 0)
+    {
+      g_print ("Error registering object %s on public bus shard %u: %s\n",
+               obj->object_path,
+               shard->index,
+               error->message);
+      g_error_free (error);
+      return;
+    }
+
+  g_hash_table_insert (shard->registrations,
+                       GUINT_TO_POINTER (reg_id),
+                       GUINT_TO_POINTER (shard_reg_id));
+}
+
+static void
+on_shard_name_lost (GDBusConnection *connection,
+                    const gchar     *name,
+                    gpointer         user_data)
+{
+  LiaApplication *self = LIA_APPLICATION (user_data);
+
+  /* @TODO: log properly */
+  g_critical ("Application's service name '%s' lost on a public bus shard",
+              self->priv->service_name);
+  evd_daemon_quit (self->priv->daemon, -1);
+}
+
+static void
+shard_acquire_service_name (LiaApplication *self, BusShard *shard)
+{
+  if (self->priv->service_name == NULL ||
+      shard->conn == NULL ||
+      shard->name_owner_id > 0)
+    {
+      return;
+    }
+
+  shard->name_owner_id =
+    g_bus_own_name_on_connection (shard->conn,
+                                  self->priv->service_name,
+                                  G_BUS_NAME_OWNER_FLAGS_NONE,
+                                  NULL,
+                                  on_shard_name_lost,
+                                  self,
+                                  NULL);
+}
+
+/* called once the service name is known */
+static void
+acquire_shard_service_names (LiaApplication *self)
+{
+  guint i;
+
+  for (i=0; i<self->priv->public_shards->len; i++)
+    shard_acquire_service_name (self,
+                                g_ptr_array_index (self->priv->public_shards, i));
+}
+
+static void
+on_shard_connection (GObject      *obj,
+                     GAsyncResult *res,
+                     gpointer      user_data)
+{
+  BusShard *shard = user_data;
+  LiaApplication *self;
+  GDBusConnection *conn;
+  GHashTableIter iter;
+  gpointer reg_id;
+  gpointer public_obj;
+  GError *error = NULL;
+
+  conn = g_dbus_connection_new_for_address_finish (res, &error);
+  if (conn == NULL)
+    {
+      /* the shard was dropped meanwhile */
+      if (! g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        g_print ("Error connecting to public bus shard %u: %s\n",
+                 shard->index,
+                 error->message);
+      g_error_free (error);
+      return;
+    }
+
+  self = shard->self;
+  shard->conn = conn;
+
+  shard->caller_cache = g_hash_table_new_full (g_str_hash,
+                                               g_str_equal,
+                                               NULL,
+                                               caller_cache_entry_unref);
+  shard->name_owner_sub_id =
+    g_dbus_connection_signal_subscribe (conn,
+                                        "org.freedesktop.DBus",
+                                        "org.freedesktop.DBus",
+                                        "NameOwnerChanged",
+                                        "/org/freedesktop/DBus",
+                                        NULL,
+                                        G_DBUS_SIGNAL_FLAGS_NONE,
+                                        on_name_owner_changed,
+                                        self,
+                                        NULL);
+
+  /* objects registered on the public bus so far */
+  g_hash_table_iter_init (&iter, self->priv->public_objects);
+  while (g_hash_table_iter_next (&iter, &reg_id, &public_obj))
+    shard_register_object (shard, GPOINTER_TO_UINT (reg_id), public_obj);
+
+  if (self->priv->env_loaded)
+    shard_acquire_service_name (self, shard);
+}
+
+static BusShard *
+bus_shard_new (LiaApplication *self, guint index, const gchar *address)
+{
+  BusShard *shard;
+
+  shard = g_slice_new0 (BusShard);
+  shard->self = self;
+  shard->index = index;
+  shard->address = g_strdup (address);
+  shard->cancellable = g_cancellable_new ();
+  shard->registrations = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+  /* the shard is owned by the application and the connection attempt
+     is cancelled when it is dropped, so no reference is taken */
+  g_dbus_connection_new_for_address (address,
+                                     G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+                                     G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+                                     NULL,
+                                     shard->cancellable,
+                                     on_shard_connection,
+                                     shard);
+
+  return shard;
+}
+
+/* Connects to the public bus shards in @addresses, the first of which
+   is the public bus itself. Shards whose address didn't change are
+   kept */
+static void
+set_public_bus_shards (LiaApplication *self, const gchar **addresses)
+{
+  GPtrArray *shards = self->priv->public_shards;
+  guint len;
+  guint i;
+
+  len = addresses != NULL ? g_strv_length ((gchar **) addresses) : 0;
+  len = len > 0 ? len - 1 : 0;
+
+  if (shards->len > len)
+    g_ptr_array_set_size (shards, len);
+
+  for (i=0; i<len; i++)
+    {
+      const gchar *address = addresses[i + 1];
+
+      if (i < shards->len)
+        {
+          BusShard *shard = g_ptr_array_index (shards, i);
+
+          if (g_strcmp0 (shard->address, address) == 0)
+            continue;
+
+          g_print ("Public bus shard %u moved to %s\n", i + 1, address);
+
+          free_bus_shard (shard);
+          g_ptr_array_index (shards, i) = bus_shard_new (self, i + 1, address);
+        }
+      else
+        {
+          g_ptr_array_add (shards, bus_shard_new (self, i + 1, address));
+        }
+    }
+}
+
+/* mirrors an object just registered on the public bus on every shard */
+static void
+mirror_public_object (LiaApplication     *self,
+                      guint               reg_id,
+                      const gchar        *object_path,
+                      GDBusInterfaceInfo *iface_info,
+                      RegObjData         *reg_data)
+{
+  PublicObject *obj;
+  guint i;
+
+  obj = g_slice_new (PublicObject);
+  obj->object_path = g_strdup (object_path);
+  obj->iface_info = g_dbus_interface_info_ref (iface_info);
+  obj->reg_data = reg_obj_data_ref (reg_data);
+
+  g_hash_table_insert (self->priv->public_objects,
+                       GUINT_TO_POINTER (reg_id),
+                       obj);
+
+  for (i=0; i<self->priv->public_shards->len; i++)
+    {
+      BusShard *shard = g_ptr_array_index (self->priv->public_shards, i);
+
+      if (shard->conn != NULL)
+        shard_register_object (shard, reg_id, obj);
+    }
+}
+
+static void
+unmirror_public_object (LiaApplication *self, guint reg_id)
+{
+  guint i;
+
+  for (i=0; i<self->priv->public_shards->len; i++)
+    {
+      BusShard *shard = g_ptr_array_index (self->priv->public_shards, i);
+      guint shard_reg_id;
+
+      shard_reg_id =
+        GPOINTER_TO_UINT (g_hash_table_lookup (shard->registrations,
+                                               GUINT_TO_POINTER (reg_id)));
+      if (shard_reg_id == 0)
+        continue;
+
+      g_dbus_connection_unregister_object (shard->conn, shard_reg_id);
+      g_hash_table_remove (shard->registrations, GUINT_TO_POINTER (reg_id));
+    }
+
+  g_hash_table_remove (self->priv->public_objects, GUINT_TO_POINTER (reg_id));
+}
+
+/* emits a signal on every shard but the first, broadcast or to a
+   well-known name */
+static void
+emit_signal_on_shards (LiaApplication *self,
+                       const gchar    *destination_bus_name,
+                       const gchar    *object_path,
+                       const gchar    *interface_name,
+                       const gchar    *signal_name,
+                       GVariant       *parameters)
+{
+  guint i;
+
+  for (i=0; i<self->priv->public_shards->len; i++)
+    {
+      BusShard *shard = g_ptr_array_index (self->priv->public_shards, i);
+      GError *error = NULL;
+
+      if (shard->conn == NULL)
+        continue;
+
+      if (! g_dbus_connection_emit_signal (shard->conn,
+                                           destination_bus_name,
+                                           object_path,
+                                           interface_name,
+                                           signal_name,
+                                           parameters,
+                                           &error))
+        {
+          g_debug ("Error emitting signal on public bus shard %u: %s",
+                   shard->index,
+                   error->message);
+          g_error_free (error);
+        }
+    }
+}
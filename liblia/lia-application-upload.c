@@ -0,0 +1,87 @@
+/* Upload streams. The content of an upload is piped from the Webview,
+   which tells the application whether all of it arrived (EndUpload)
+   before closing the pipe. Reading a stream whose upload was cut short
+   fails with G_IO_ERROR_PARTIAL_INPUT where it would otherwise reach
+   EOF, so a truncated upload can't be taken for a complete one. */
+
+typedef struct
+{
+  GFilterInputStream parent;
+
+  volatile gint complete;
+} LiaUploadStream;
+
+typedef struct
+{
+  GFilterInputStreamClass parent_class;
+} LiaUploadStreamClass;
+
+#define LIA_TYPE_UPLOAD_STREAM (lia_upload_stream_get_type ())
+
+GType lia_upload_stream_get_type (void) G_GNUC_CONST;
+
+G_DEFINE_TYPE (LiaUploadStream, lia_upload_stream, G_TYPE_FILTER_INPUT_STREAM);
+
+static gssize
+lia_upload_stream_read (GInputStream  *stream,
+                        void          *buffer,
+                        gsize          count,
+                        GCancellable  *cancellable,
+                        GError       **error)
+{
+  LiaUploadStream *self = (LiaUploadStream *) stream;
+  GInputStream *base_stream;
+  gssize size;
+
+  base_stream = g_filter_input_stream_get_base_stream (G_FILTER_INPUT_STREAM (stream));
+
+  size = g_input_stream_read (base_stream, buffer, count, cancellable, error);
+
+  /* read from a worker thread for asynchronous reads, but the pipe is
+     only closed after EndUpload was handled */
+  if (size == 0 && count > 0 && ! g_atomic_int_get (&self->complete))
+    {
+      g_set_error_literal (error,
+                           G_IO_ERROR,
+                           G_IO_ERROR_PARTIAL_INPUT,
+                           "Upload content was cut short");
+      return -1;
+    }
+
+  return size;
+}
+
+static void
+lia_upload_stream_class_init (LiaUploadStreamClass *class)
+{
+  GInputStreamClass *input_stream_class = G_INPUT_STREAM_CLASS (class);
+
+  input_stream_class->read_fn = lia_upload_stream_read;
+}
+
+static void
+lia_upload_stream_init (LiaUploadStream *self)
+{
+  self->complete = FALSE;
+}
+
+static GInputStream *
+lia_upload_stream_new (gint fd)
+{
+  GInputStream *base_stream;
+  GInputStream *stream;
+
+  base_stream = g_unix_input_stream_new (fd, TRUE);
+  stream = g_object_new (LIA_TYPE_UPLOAD_STREAM,
+                         "base-stream", base_stream,
+                         NULL);
+  g_object_unref (base_stream);
+
+  return stream;
+}
+
+static void
+lia_upload_stream_end (LiaUploadStream *self, gboolean complete)
+{
+  g_atomic_int_set (&self->complete, complete);
+}
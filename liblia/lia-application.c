@@ -20,21 +20,41 @@
  * for more details.
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <evd.h>
+#include <gio/gunixfdlist.h>
+#include <gio/gunixinputstream.h>
 
 #include "lia-application.h"
+#include "lia-application-private.h"
 #include "lia-marshal.h"
+#include "lia-method-stats.h"
 
 #define LIA_APPLICATION_GET_PRIVATE(obj) (G_TYPE_INSTANCE_GET_PRIVATE ((obj), \
                                           LIA_TYPE_APPLICATION, \
                                           LiaApplicationPrivate))
 
+/* calls on a low priority bus waiting for their turn, beyond which new
+   calls on that bus are rejected */
+#define MAX_DEFERRED_CALLS 4096
+
 /* private data */
 struct _LiaApplicationPrivate
 {
   GSimpleAsyncResult *async_result;
   gboolean initialized;
+  GCancellable *init_cancellable;
+  GError *init_error;
+  guint init_ops;
+  gboolean env_loaded;
+  gint io_priority;
 
   GDBusInterfaceVTable reg_obj_vtable;
 
@@ -43,25 +63,97 @@ struct _LiaApplicationPrivate
   gchar *base_service_name;
   gchar *service_name;
 
-  guint8 create_bus_conn_ops;
-  guint8 acquire_bus_name_ops;
+  GDBusConnection *discovery_conn;
+  guint discovery_sub_id;
+  GVariant *config;
+  guint config_version;
+  GSimpleAsyncResult *load_env_result;
 
   gchar *bus_addr[3];
   GDBusConnection *bus_conn[3];
+  GPtrArray *public_shards;
+  GHashTable *public_objects;
   guint service_name_owner_id[3];
+  gboolean acquiring_name[3];
+  guint acquire_name_span[3];
 
   gchar *webview_html_root;
+  guint webview_html_root_span;
+
+  GHashTable *caller_cache[3];
+
+  gint bus_priority[3];
+  guint call_deadline[3];
+  GQueue *deferred_calls[3];
+  guint deferred_calls_src_id[3];
+
+  guint max_calls_per_caller;
+  guint max_calls_per_object;
+  gint max_queued_per_caller;
+  GHashTable *object_calls;
+  GQueue *ready_callers;
+  guint serve_calls_src_id;
+  guint calls_in_flight;
+  gint64 last_call_time;
+  guint calls_queued;
+  guint64 calls_queued_total;
+  guint64 calls_rejected_total;
+
+  GHashTable *coalesced_signals;
+  guint name_owner_sub_id[3];
+
+  /* upload id -> LiaUploadStream of accepted uploads, until EndUpload */
+  GHashTable *uploads;
+
+  guint app_obj_reg_id;
+  guint stats_obj_reg_id;
+
+  guint supervisor_watch_id;
+
+  LiaMethodStats *method_stats;
+  guint method_stats_watch_id[3];
+
+  gint64 startup_time;
+  GArray *startup_trace;
+  guint startup_span;
+  guint load_env_span;
 };
 
 typedef struct
 {
-  GSimpleAsyncResult *result;
+  LiaApplication *self;
   LiaBusType bus_type;
-  GCancellable *cancellable;
+  gchar *address;
+  gboolean init_op;
+  guint span_id;
 } BusConnData;
 
 typedef struct
 {
+  LiaApplication *self;
+  gchar *key;
+  LiaBusType bus_type;
+  gchar *destination;
+  gchar *object_path;
+  gchar *interface_name;
+  gchar *signal_name;
+  LiaCoalesceMode mode;
+  guint window_ms;
+  guint src_id;
+  GVariant *last_value;
+  GPtrArray *values;
+} CoalescedSignal;
+
+typedef struct
+{
+  gchar *phase;
+  gint64 start;
+  gint64 end;
+} TraceSpan;
+
+typedef struct
+{
+  gint ref_count;
   LiaApplication *self;
   gpointer user_data;
   GDestroyNotify user_data_free_func;
@@ -69,16 +161,91 @@ typedef struct
   LiaBusType bus_type;
 } RegObjData;
 
+typedef struct
+{
+  gint ref_count;
+  LiaCallerIdentity *identity;
+  GDBusConnection *conn;
+  gboolean resolved;
+  gboolean resolving;
+  GQueue *identity_waiters;
+
+  guint in_flight;
+  GQueue *queued_calls;
+  gboolean scheduled;
+  GList *in_flight_calls;
+} CallerCacheEntry;
+
+typedef struct
+{
+  RegObjData *reg_data;
+  GDBusMethodInvocation *invocation;
+} PendingCall;
+
+typedef struct
+{
+  LiaApplication *self;
+  CallerCacheEntry *entry;
+} ResolveCallerData;
+
+typedef struct
+{
+  LiaApplication *self;
+  CallerCacheEntry *entry;
+  gchar *object_key;
+  GCancellable *cancellable;
+  guint deadline_src_id;
+} InFlightCall;
+
+typedef struct
+{
+  LiaApplication *self;
+  LiaBusType bus_type;
+} DeferredCallsData;
+
 /* signals */
 enum
 {
   SIGNAL_READY,
   SIGNAL_EXPORT_OBJECTS,
+  SIGNAL_UPLOAD,
+  SIGNAL_DRAIN,
   SIGNAL_LAST
 };
 
 static guint lia_application_signals [SIGNAL_LAST] = { 0 };
 
+static GQuark in_flight_call_quark = 0;
+
+/* object exported by every application on the private bus */
+static const gchar app_introspection_xml[] =
+  "<node>"
+  "  <interface name='" LIA_APPLICATION_IFACE_NAME "'>"
+  "    <method name='HandleUpload'>"
+  "      <arg type='h' name='fd' direction='in'/>"
+  "      <arg type='s' name='path' direction='in'/>"
+  "      <arg type='s' name='content_type' direction='in'/>"
+  "      <arg type='x' name='content_length' direction='in'/>"
+  "      <arg type='n' name='bus_type' direction='in'/>"
+  "      <arg type='u' name='upload_id' direction='in'/>"
+  "      <arg type='b' name='accepted' direction='out'/>"
+  "    </method>"
+  "    <method name='EndUpload'>"
+  "      <arg type='u' name='upload_id' direction='in'/>"
+  "      <arg type='b' name='complete' direction='in'/>"
+  "    </method>"
+  "    <method name='Drain'/>"
+  "  </interface>"
+  "  <interface name='" LIA_STATS_IFACE_NAME "'>"
+  "    <method name='GetMethodStats'>"
+  "      <arg type='a(ssuua(tu))' name='stats' direction='out'/>"
+  "    </method>"
+  "    <method name='GetCallStats'>"
+  "      <arg type='a{sv}' name='stats' direction='out'/>"
+  "    </method>"
+  "  </interface>"
+  "</node>";
+
 /* properties */
 enum
 {
@@ -114,13 +281,37 @@ static gboolean init_finish                               (GAsyncInitable      *
                                                            GAsyncResult        *res,
                                                            GError             **error);
 
-static gboolean load_env                                  (LiaApplication  *self,
+static void     load_env_async                            (LiaApplication      *self,
+                                                           gint                 io_priority,
+                                                           GCancellable        *cancellable,
+                                                           GAsyncReadyCallback  callback,
+                                                           gpointer             user_data);
+static gboolean load_env_finish                           (LiaApplication  *self,
+                                                           GAsyncResult    *result,
                                                            gchar          **service_name,
                                                            GError         **error);
 
 static void     register_objects                          (LiaApplication  *self,
                                                            LiaBusType       bus_type);
 
+static void     disconnect_bus                            (LiaApplication *self,
+                                                           LiaBusType      bus_type);
+
+static void     free_coalesced_signal                     (gpointer _data);
+
+static void     setup_caller_cache                        (LiaApplication  *self,
+                                                           LiaBusType       bus_type);
+
+static void     free_pending_call                         (PendingCall *call);
+static RegObjData *
+                reg_obj_data_ref                          (RegObjData *data);
+static void     reg_obj_data_unref                        (gpointer _data);
+static void     caller_cache_entry_unref                  (gpointer _entry);
+static void     run_method_call                           (LiaApplication        *self,
+                                                           CallerCacheEntry      *entry,
+                                                           RegObjData            *reg_data,
+                                                           GDBusMethodInvocation *invocation);
+
 static void     on_bus_method_call                        (GDBusConnection       *connection,
                                                            const gchar           *sender,
                                                            const gchar           *object_path,
@@ -130,6 +321,36 @@ static void     on_bus_method_call                        (GDBusConnection
                                                            GDBusMethodInvocation *invocation,
                                                            gpointer               user_data);
 
+static void     on_name_owner_changed                     (GDBusConnection *connection,
+                                                           const gchar     *sender_name,
+                                                           const gchar     *object_path,
+                                                           const gchar     *interface_name,
+                                                           const gchar     *signal_name,
+                                                           GVariant        *parameters,
+                                                           gpointer         user_data);
+
+static void     free_bus_shard                            (gpointer _data);
+static void     free_public_object                        (gpointer _data);
+static GHashTable *
+                lookup_caller_cache                       (LiaApplication  *self,
+                                                           GDBusConnection *conn);
+static void     acquire_shard_service_names               (LiaApplication *self);
+static void     set_public_bus_shards                     (LiaApplication  *self,
+                                                           const gchar    **addresses);
+static void     mirror_public_object                      (LiaApplication     *self,
+                                                           guint               reg_id,
+                                                           const gchar        *object_path,
+                                                           GDBusInterfaceInfo *iface_info,
+                                                           RegObjData         *reg_data);
+static void     unmirror_public_object                    (LiaApplication *self,
+                                                           guint           reg_id);
+static void     emit_signal_on_shards                     (LiaApplication *self,
+                                                           const gchar    *destination_bus_name,
+                                                           const gchar    *object_path,
+                                                           const gchar    *interface_name,
+                                                           const gchar    *signal_name,
+                                                           GVariant       *parameters);
+
 G_DEFINE_TYPE_WITH_CODE (LiaApplication, lia_application, G_TYPE_OBJECT,
                          G_IMPLEMENT_INTERFACE (G_TYPE_ASYNC_INITABLE,
                                                 async_initable_iface_init));
@@ -154,7 +375,8 @@ lia_application_class_init (LiaApplicationClass *class)
   obj_class->set_property = set_property;
 
   class->register_objects = register_objects;
-  class->load_env = load_env;
+  class->load_env_async = load_env_async;
+  class->load_env_finish = load_env_finish;
 
   /* signals */
    lia_application_signals[SIGNAL_READY] =
@@ -163,9 +385,23 @@ lia_application_class_init (LiaApplicationClass *class)
                    G_SIGNAL_RUN_LAST | G_SIGNAL_ACTION,
                    G_STRUCT_OFFSET (LiaApplicationClass, signal_ready),
                    NULL, NULL,
-                   g_cclosure_marshal_VOID__BOXED,
+                   g_cclosure_marshal_VOID__VOID,
                    G_TYPE_NONE, 0);
 
+   lia_application_signals[SIGNAL_UPLOAD] =
+     g_signal_new ("upload",
+                   G_TYPE_FROM_CLASS (obj_class),
+                   G_SIGNAL_RUN_LAST,
+                   G_STRUCT_OFFSET (LiaApplicationClass, signal_upload),
+                   g_signal_accumulator_true_handled, NULL,
+                   lia_marshal_BOOLEAN__OBJECT_STRING_STRING_INT64_UINT,
+                   G_TYPE_BOOLEAN, 5,
+                   G_TYPE_INPUT_STREAM,
+                   G_TYPE_STRING,
+                   G_TYPE_STRING,
+                   G_TYPE_INT64,
+                   G_TYPE_UINT);
+
    lia_application_signals[SIGNAL_EXPORT_OBJECTS] =
      g_signal_new ("register-objects",
                    G_TYPE_FROM_CLASS (obj_class),
@@ -176,6 +412,15 @@ lia_application_class_init (LiaApplicationClass *class)
                    G_TYPE_NONE, 1,
                    G_TYPE_UINT);
 
+   lia_application_signals[SIGNAL_DRAIN] =
+     g_signal_new ("drain",
+                   G_TYPE_FROM_CLASS (obj_class),
+                   G_SIGNAL_RUN_LAST,
+                   G_STRUCT_OFFSET (LiaApplicationClass, signal_drain),
+                   NULL, NULL,
+                   g_cclosure_marshal_VOID__VOID,
+                   G_TYPE_NONE, 0);
+
   /* properties */
   g_object_class_install_property (obj_class,
                                    PROP_BASE_SERVICE_NAME,
@@ -205,12 +450,15 @@ lia_application_class_init (LiaApplicationClass *class)
                                                         G_PARAM_STATIC_STRINGS));
 
   g_type_class_add_private (obj_class, sizeof (LiaApplicationPrivate));
+
+  in_flight_call_quark = g_quark_from_static_string ("lia-in-flight-call");
 }
 
 static void
 lia_application_init (LiaApplication *self)
 {
   LiaApplicationPrivate *priv;
+  gint i;
 
   priv = LIA_APPLICATION_GET_PRIVATE (self);
   self->priv = priv;
@@ -219,15 +467,83 @@ lia_application_init (LiaApplication *self)
 
   priv->async_result = NULL;
   priv->initialized = FALSE;
+  priv->init_cancellable = NULL;
+  priv->init_error = NULL;
+  priv->init_ops = 0;
+  priv->env_loaded = FALSE;
+  priv->io_priority = G_PRIORITY_DEFAULT;
 
   priv->reg_obj_vtable.method_call = on_bus_method_call;
 
   priv->daemon = evd_daemon_get_default (NULL, NULL);
 
+  priv->discovery_conn = NULL;
+  priv->discovery_sub_id = 0;
+  priv->config = NULL;
+  priv->config_version = 0;
+  priv->load_env_result = NULL;
+
   memset (priv->bus_addr, 0, 3);
   memset (priv->bus_conn, 0, 3);
 
+  priv->public_shards = g_ptr_array_new_with_free_func (free_bus_shard);
+  priv->public_objects = g_hash_table_new_full (g_direct_hash,
+                                                g_direct_equal,
+                                                NULL,
+                                                free_public_object);
+
   priv->webview_html_root = NULL;
+  priv->webview_html_root_span = 0;
+
+  for (i=0; i<3; i++)
+    priv->caller_cache[i] = NULL;
+
+  /* calls are handled as they arrive unless the application lowers the
+     priority of a bus, see lia_application_set_bus_priority() */
+  for (i=0; i<3; i++)
+    {
+      priv->bus_priority[i] = G_PRIORITY_DEFAULT;
+      priv->call_deadline[i] = 0;
+      priv->deferred_calls[i] = g_queue_new ();
+      priv->deferred_calls_src_id[i] = 0;
+    }
+
+  priv->max_calls_per_caller = 0;
+  priv->max_calls_per_object = 0;
+  priv->max_queued_per_caller = -1;
+  priv->object_calls = g_hash_table_new_full (g_str_hash,
+                                              g_str_equal,
+                                              g_free,
+                                              NULL);
+  priv->ready_callers = g_queue_new ();
+  priv->serve_calls_src_id = 0;
+  priv->calls_in_flight = 0;
+  priv->last_call_time = 0;
+  priv->calls_queued = 0;
+  priv->calls_queued_total = 0;
+  priv->calls_rejected_total = 0;
+
+  priv->coalesced_signals = g_hash_table_new_full (g_str_hash,
+                                                   g_str_equal,
+                                                   NULL,
+                                                   free_coalesced_signal);
+
+  priv->uploads = g_hash_table_new_full (g_direct_hash,
+                                         g_direct_equal,
+                                         NULL,
+                                         g_object_unref);
+
+  priv->app_obj_reg_id = 0;
+  priv->stats_obj_reg_id = 0;
+
+  priv->supervisor_watch_id = 0;
+
+  priv->method_stats = lia_method_stats_new ();
+  for (i=0; i<3; i++)
+    priv->method_stats_watch_id[i] = 0;
+
+  priv->startup_time = 0;
+  priv->startup_trace = g_array_new (FALSE, TRUE, sizeof (TraceSpan));
 }
 
 static void
@@ -236,12 +552,59 @@ dispose (GObject *obj)
   LiaApplication *self = LIA_APPLICATION (obj);
   gint i;
 
+  if (self->priv->supervisor_watch_id > 0)
+    {
+      g_bus_unwatch_name (self->priv->supervisor_watch_id);
+      self->priv->supervisor_watch_id = 0;
+    }
+
+  for (i=0; i<3; i++)
+    {
+      if (self->priv->deferred_calls_src_id[i] > 0)
+        {
+          g_source_remove (self->priv->deferred_calls_src_id[i]);
+          self->priv->deferred_calls_src_id[i] = 0;
+        }
+
+      g_queue_foreach (self->priv->deferred_calls[i],
+                       (GFunc) free_pending_call,
+                       NULL);
+      g_queue_clear (self->priv->deferred_calls[i]);
+    }
+
+  if (self->priv->serve_calls_src_id > 0)
+    {
+      g_source_remove (self->priv->serve_calls_src_id);
+      self->priv->serve_calls_src_id = 0;
+    }
+
+  /* calls waiting for their turn are dropped */
+  while (! g_queue_is_empty (self->priv->ready_callers))
+    {
+      CallerCacheEntry *entry;
+
+      entry = g_queue_pop_head (self->priv->ready_callers);
+      entry->scheduled = FALSE;
+      caller_cache_entry_unref (entry);
+    }
+
+  /* pending coalesced signals are dropped */
+  g_hash_table_remove_all (self->priv->coalesced_signals);
+  g_hash_table_remove_all (self->priv->uploads);
+
   for (i=0; i<3; i++)
-    if (self->priv->bus_conn[i] != NULL)
-      {
-        g_object_unref (self->priv->bus_conn[i]);
-        self->priv->bus_conn[i] = NULL;
-      }
+    disconnect_bus (self, i);
+
+  g_ptr_array_set_size (self->priv->public_shards, 0);
+  g_hash_table_remove_all (self->priv->public_objects);
+
+  if (self->priv->discovery_conn != NULL)
+    {
+      g_dbus_connection_signal_unsubscribe (self->priv->discovery_conn,
+                                            self->priv->discovery_sub_id);
+      g_object_unref (self->priv->discovery_conn);
+      self->priv->discovery_conn = NULL;
+    }
 
   G_OBJECT_CLASS (lia_application_parent_class)->dispose (obj);
 }
@@ -258,10 +621,31 @@ finalize (GObject *obj)
     if (self->priv->bus_addr[i] != NULL)
       g_free (self->priv->bus_addr[i]);
 
+  if (self->priv->config != NULL)
+    g_variant_unref (self->priv->config);
+
   g_free (self->priv->base_service_name);
   g_free (self->priv->service_name);
   g_free (self->priv->webview_html_root);
 
+  g_hash_table_unref (self->priv->coalesced_signals);
+  g_hash_table_unref (self->priv->uploads);
+
+  g_hash_table_unref (self->priv->object_calls);
+
+  g_ptr_array_unref (self->priv->public_shards);
+  g_hash_table_unref (self->priv->public_objects);
+
+  for (i=0; i<3; i++)
+    g_queue_free (self->priv->deferred_calls[i]);
+  g_queue_free (self->priv->ready_callers);
+
+  lia_method_stats_unref (self->priv->method_stats);
+
+  for (i=0; i<self->priv->startup_trace->len; i++)
+    g_free (g_array_index (self->priv->startup_trace, TraceSpan, i).phase);
+  g_array_free (self->priv->startup_trace, TRUE);
+
   G_OBJECT_CLASS (lia_application_parent_class)->finalize (obj);
 
   g_print ("%s finalized\n", G_OBJECT_CLASS_NAME (LIA_APPLICATION_GET_CLASS (self)));
@@ -327,6 +711,27 @@ get_property (GObject    *obj,
     }
 }
 
+static const gchar *
+get_bus_type_name (LiaBusType bus_type)
+{
+  static const gchar *BUS_TYPE_NAMES[3] = {"private", "protected", "public"};
+
+  return BUS_TYPE_NAMES[bus_type];
+}
+
+static gint
+get_bus_type_from_connection (LiaApplication  *self,
+                              GDBusConnection *connection)
+{
+  gint i;
+
+  for (i=0; i<3; i++)
+    if (self->priv->bus_conn[i] == connection)
+      return i;
+
+  return -1;
+}
+
 static void
 abort_init_async (LiaApplication     *self,
                   GSimpleAsyncResult *res,
@@ -351,8 +756,8 @@ finish_init_async (LiaApplication     *self,
     {
       class->init_async_finished (self,
                                   G_ASYNC_RESULT (res),
-                                  G_PRIORITY_DEFAULT,
-                                  NULL);
+                                  self->priv->io_priority,
+                                  self->priv->init_cancellable);
     }
   else
     {
@@ -383,12 +788,17 @@ on_webview_html_root_registered (GObject      *obj,
       g_variant_unref (ret);
     }
 
+  lia_application_trace_end (self, self->priv->webview_html_root_span);
+
   g_object_unref (self);
 }
 
 static void
 register_webview_html_root (LiaApplication *self, const gchar *bus_name)
 {
+  self->priv->webview_html_root_span =
+    lia_application_trace_begin (self, "register-webview-html-root");
+
   g_object_ref (self);
   g_dbus_connection_call (self->priv->bus_conn[LIA_BUS_PRIVATE],
                           bus_name,
@@ -428,44 +838,94 @@ webview_bus_name_vanished (GDBusConnection *connection,
   g_warning ("Webview service '%s' vanished!", name);
 }
 
+static void
+watch_webview_bus_name (LiaApplication *self)
+{
+  gchar *bus_name;
+
+  bus_name = g_strdup_printf ("%s." LIA_WEBVIEW_SERVICE_NAME_SUFFIX,
+                              self->priv->base_service_name);
+
+  g_bus_watch_name_on_connection (self->priv->bus_conn[LIA_BUS_PRIVATE],
+                                  bus_name,
+                                  G_BUS_NAME_WATCHER_FLAGS_AUTO_START,
+                                  webview_bus_name_appeared,
+                                  webview_bus_name_vanished,
+                                  self,
+                                  NULL);
+  g_free (bus_name);
+}
+
+static void
+take_init_error (LiaApplication *self, GError *error)
+{
+  /* only the first error is reported, the rest are just logged */
+  if (self->priv->init_error == NULL)
+    {
+      self->priv->init_error = error;
+    }
+  else
+    {
+      g_debug ("Startup error ignored: %s", error->message);
+      g_error_free (error);
+    }
+}
+
+static void
+init_op_done (LiaApplication *self)
+{
+  GSimpleAsyncResult *res;
+
+  self->priv->init_ops--;
+  if (self->priv->init_ops > 0)
+    return;
+
+  res = self->priv->async_result;
+  self->priv->async_result = NULL;
+
+  if (self->priv->init_cancellable != NULL)
+    {
+      g_object_unref (self->priv->init_cancellable);
+      self->priv->init_cancellable = NULL;
+    }
+
+  if (self->priv->init_error != NULL)
+    {
+      g_simple_async_result_take_error (res, self->priv->init_error);
+      self->priv->init_error = NULL;
+
+      g_simple_async_result_complete (res);
+      g_object_unref (res);
+    }
+  else
+    {
+      /* watch Webview bus name to register app's HTML root */
+      if (self->priv->webview_html_root != NULL &&
+          self->priv->bus_conn[LIA_BUS_PRIVATE] != NULL)
+        {
+          watch_webview_bus_name (self);
+        }
+
+      finish_init_async (self, res);
+    }
+}
+
 static void
 on_service_name_acquired (GDBusConnection *connection,
                           const gchar     *name,
                           gpointer         user_data)
 {
   LiaApplication *self = LIA_APPLICATION (user_data);
+  gint bus_type;
 
-  if (self->priv->async_result != NULL)
-    {
-      self->priv->acquire_bus_name_ops--;
+  bus_type = get_bus_type_from_connection (self, connection);
+  if (bus_type < 0 || ! self->priv->acquiring_name[bus_type])
+    return;
 
-      if (self->priv->acquire_bus_name_ops == 0 &&
-          self->priv->create_bus_conn_ops == 0)
-        {
-          /* watch Webview bus name to register app's HTML root */
-          if (self->priv->webview_html_root != NULL &&
-              self->priv->bus_conn[LIA_BUS_PRIVATE] != NULL)
-            {
-              gchar *bus_name;
-
-              bus_name =
-                g_strdup_printf ("%s." LIA_WEBVIEW_SERVICE_NAME_SUFFIX,
-                                 self->priv->base_service_name);
-
-              g_bus_watch_name_on_connection (self->priv->bus_conn[LIA_BUS_PRIVATE],
-                                              bus_name,
-                                              G_BUS_NAME_WATCHER_FLAGS_AUTO_START,
-                                              webview_bus_name_appeared,
-                                              webview_bus_name_vanished,
-                                              self,
-                                              NULL);
-              g_free (bus_name);
-            }
+  self->priv->acquiring_name[bus_type] = FALSE;
+  lia_application_trace_end (self, self->priv->acquire_name_span[bus_type]);
 
-          finish_init_async (self, self->priv->async_result);
-          self->priv->async_result = NULL;
-        }
-    }
+  init_op_done (self);
 }
 
 static void
@@ -474,20 +934,21 @@ on_service_name_lost (GDBusConnection *connection,
                       gpointer         user_data)
 {
   LiaApplication *self = LIA_APPLICATION (user_data);
+  gint bus_type;
 
-  if (self->priv->async_result != NULL)
+  bus_type = get_bus_type_from_connection (self, connection);
+  if (bus_type >= 0 && self->priv->acquiring_name[bus_type])
     {
-      self->priv->acquire_bus_name_ops--;
+      self->priv->acquiring_name[bus_type] = FALSE;
+      lia_application_trace_end (self, self->priv->acquire_name_span[bus_type]);
 
-      g_simple_async_result_set_error (self->priv->async_result,
-                                       G_IO_ERROR,
-                                       G_IO_ERROR_DBUS_ERROR,
-                                       "Failed to own service name");
-
-      g_simple_async_result_complete (self->priv->async_result);
+      take_init_error (self,
+                       g_error_new (G_IO_ERROR,
+                                    G_IO_ERROR_DBUS_ERROR,
+                                    "Failed to own service name on %s bus",
+                                    get_bus_type_name (bus_type)));
 
-      g_object_unref (self->priv->async_result);
-      self->priv->async_result = NULL;
+      init_op_done (self);
     }
   else
     {
@@ -498,6 +959,37 @@ on_service_name_lost (GDBusConnection *connection,
     }
 }
 
+static void
+acquire_service_name (LiaApplication *self, LiaBusType bus_type)
+{
+  gchar *phase;
+
+  if (self->priv->service_name == NULL)
+    return;
+
+  /* names owned again after a bus moved don't count for initialization,
+     and losing them is fatal right away */
+  if (self->priv->async_result != NULL)
+    {
+      phase = g_strdup_printf ("acquire-name:%s", get_bus_type_name (bus_type));
+      self->priv->acquire_name_span[bus_type] =
+        lia_application_trace_begin (self, phase);
+      g_free (phase);
+
+      self->priv->acquiring_name[bus_type] = TRUE;
+      self->priv->init_ops++;
+    }
+
+  self->priv->service_name_owner_id[bus_type] =
+    g_bus_own_name_on_connection (self->priv->bus_conn[bus_type],
+                                  self->priv->service_name,
+                                  G_BUS_NAME_OWNER_FLAGS_NONE,
+                                  on_service_name_acquired,
+                                  on_service_name_lost,
+                                  self,
+                                  NULL);
+}
+
 static void
 register_objects (LiaApplication  *self, LiaBusType bus_type)
 {
@@ -519,203 +1011,723 @@ dbus_connection_closed (GDBusConnection *conn,
   if (remote_peer_vanished)
     g_print ("Connection closed: %s!\n", error->message);
 
+  /* while core can still be reached, the bus might just be moving and
+     its new address will come through discovery */
+  if (self->priv->discovery_conn != NULL &&
+      ! g_dbus_connection_is_closed (self->priv->discovery_conn))
+    {
+      return;
+    }
+
   /* @TODO: try to recover from a closed D-Bus connection! */
 
   /* by now just terminated the application */
   evd_daemon_quit (self->priv->daemon, -1);
 }
 
+#include "lia-application-upload.c"
+
 static void
-on_dbus_connection (GObject      *obj,
-                    GAsyncResult *res,
-                    gpointer      user_data)
+handle_upload_call (LiaApplication        *self,
+                    GVariant              *parameters,
+                    GDBusMethodInvocation *invocation)
 {
-  BusConnData *data = user_data;
-  GSimpleAsyncResult *result;
-  LiaApplication *self;
+  GDBusMessage *msg;
+  GUnixFDList *fd_list;
+  gint32 fd_index;
+  const gchar *path;
+  const gchar *content_type;
+  gint64 content_length;
+  gint16 bus_type;
+  guint32 upload_id;
+  gint fd;
+  GInputStream *stream;
+  gboolean accepted = FALSE;
   GError *error = NULL;
 
-  result = data->result;
-  self = LIA_APPLICATION (g_async_result_get_source_object (G_ASYNC_RESULT (result)));
-
-  self->priv->create_bus_conn_ops--;
-
-  self->priv->bus_conn[data->bus_type] =
-    g_dbus_connection_new_for_address_finish (res, &error);
-  if (self->priv->bus_conn[data->bus_type] == NULL)
+  g_variant_get (parameters,
+                 "(h&s&sxnu)",
+                 &fd_index,
+                 &path,
+                 &content_type,
+                 &content_length,
+                 &bus_type,
+                 &upload_id);
+
+  msg = g_dbus_method_invocation_get_message (invocation);
+  fd_list = g_dbus_message_get_unix_fd_list (msg);
+  if (fd_list == NULL)
     {
-      g_print ("Error: %s\n", error->message);
-      g_cancellable_cancel (data->cancellable);
-
-      if (self->priv->create_bus_conn_ops == 0)
-        {
-          abort_init_async (self, result, error);
-        }
-      else
-        {
-          g_simple_async_result_set_from_error (result, error);
-          g_error_free (error);
-        }
+      g_dbus_method_invocation_return_error (invocation,
+                                             G_IO_ERROR,
+                                             G_IO_ERROR_INVALID_ARGUMENT,
+                                             "No file descriptor was passed");
+      return;
     }
-  else
+
+  fd = g_unix_fd_list_get (fd_list, fd_index, &error);
+  if (fd < 0)
     {
-      LiaApplicationClass *class;
+      g_dbus_method_invocation_take_error (invocation, error);
+      return;
+    }
 
-      g_signal_connect (self->priv->bus_conn[data->bus_type],
-                        "closed",
-                        G_CALLBACK (dbus_connection_closed),
-                        self);
+  /* the upload content is streamed through this fd as it arrives from the
+     web client. Handlers accepting the upload keep a reference to the
+     stream and read it to EOF; closing it early aborts the upload. If
+     the content is cut short, reading fails instead of reaching EOF */
+  stream = lia_upload_stream_new (fd);
 
-      /* register objects over this bus */
-      class = LIA_APPLICATION_GET_CLASS (self);
-      if (class->register_objects != NULL)
-        class->register_objects (self, data->bus_type);
+  g_signal_emit (self,
+                 lia_application_signals[SIGNAL_UPLOAD],
+                 0,
+                 stream,
+                 path,
+                 content_type,
+                 content_length,
+                 (guint) bus_type,
+                 &accepted);
+
+  if (accepted)
+    g_hash_table_insert (self->priv->uploads,
+                         GUINT_TO_POINTER (upload_id),
+                         stream);
+  else
+    g_object_unref (stream);
 
-      if (self->priv->service_name != NULL)
-        {
-          self->priv->async_result = result;
-
-          self->priv->service_name_owner_id[data->bus_type] =
-            g_bus_own_name_on_connection (self->priv->bus_conn[data->bus_type],
-                                          self->priv->service_name,
-                                          G_BUS_NAME_OWNER_FLAGS_NONE,
-                                          on_service_name_acquired,
-                                          on_service_name_lost,
-                                          self,
-                                          g_object_unref);
-
-          self->priv->acquire_bus_name_ops++;
-        }
+  g_dbus_method_invocation_return_value (invocation,
+                                         g_variant_new ("(b)", accepted));
+}
 
-      if (self->priv->create_bus_conn_ops == 0 &&
-          self->priv->acquire_bus_name_ops == 0)
-        {
-          /* or finish initialization */
-          finish_init_async (self, result);
-        }
-    }
+/* time (microseconds) since the last method call was dispatched, or
+   since startup if there was none. Calls coming from web peers through
+   the Webview's D-Bus bridge count too */
+static gint64
+get_idle_time (LiaApplication *self)
+{
+  gint64 last;
 
-  g_slice_free (BusConnData, data);
+  last = MAX (self->priv->last_call_time, self->priv->startup_time);
 
-  g_object_unref (result);
-  g_object_unref (self);
+  return g_get_monotonic_time () - last;
 }
 
-static gboolean
-resolve_base_service_name (LiaApplication *self, GError **error)
+static void
+on_app_method_call (GDBusConnection       *connection,
+                    const gchar           *sender,
+                    const gchar           *object_path,
+                    const gchar           *interface_name,
+                    const gchar           *method_name,
+                    GVariant              *parameters,
+                    GDBusMethodInvocation *invocation,
+                    gpointer               user_data)
 {
-  if (self->priv->base_service_name == NULL)
+  LiaApplication *self = LIA_APPLICATION (user_data);
+
+  /* HandleUpload */
+  if (g_strcmp0 (method_name, "HandleUpload") == 0)
     {
-      const gchar *base_service_name;
+      handle_upload_call (self, parameters, invocation);
+    }
+  /* EndUpload */
+  else if (g_strcmp0 (method_name, "EndUpload") == 0)
+    {
+      guint32 upload_id;
+      gboolean complete;
+      LiaUploadStream *stream;
 
-      base_service_name = g_getenv (LIA_ENV_KEY_BASE_SERVICE_NAME);
+      g_variant_get (parameters, "(ub)", &upload_id, &complete);
 
-      if (base_service_name == NULL)
-        {
-          g_set_error (error,
-                       G_IO_ERROR,
-                       G_IO_ERROR_INVALID_ARGUMENT,
-                       "Failed to resolve base service name");
-          return FALSE;
-        }
-      else
+      stream = g_hash_table_lookup (self->priv->uploads,
+                                    GUINT_TO_POINTER (upload_id));
+      if (stream != NULL)
         {
-          self->priv->base_service_name = g_strdup (base_service_name);
+          lia_upload_stream_end (stream, complete);
+          g_hash_table_remove (self->priv->uploads,
+                               GUINT_TO_POINTER (upload_id));
         }
+
+      g_dbus_method_invocation_return_value (invocation, NULL);
     }
+  /* Drain */
+  else if (g_strcmp0 (method_name, "Drain") == 0)
+    {
+      /* core is about to stop us to reclaim memory, and will launch us
+         again on demand. Handlers save whatever state they need to */
+      g_debug ("Draining before being stopped");
+      g_signal_emit (self, lia_application_signals[SIGNAL_DRAIN], 0);
 
-  return TRUE;
+      g_dbus_method_invocation_return_value (invocation, NULL);
+    }
+  /* GetMethodStats */
+  else if (g_strcmp0 (method_name, "GetMethodStats") == 0)
+    {
+      GVariant *stats;
+
+      stats = lia_method_stats_get_snapshot (self->priv->method_stats);
+      g_dbus_method_invocation_return_value (invocation,
+                                             g_variant_new_tuple (&stats, 1));
+    }
+  /* GetCallStats */
+  else if (g_strcmp0 (method_name, "GetCallStats") == 0)
+    {
+      GVariantBuilder builder;
+
+      g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+      g_variant_builder_add (&builder, "{sv}", "in-flight",
+                             g_variant_new_uint32 (self->priv->calls_in_flight));
+      g_variant_builder_add (&builder, "{sv}", "queued",
+                             g_variant_new_uint32 (self->priv->calls_queued));
+      g_variant_builder_add (&builder, "{sv}", "queued-total",
+                             g_variant_new_uint64 (self->priv->calls_queued_total));
+      g_variant_builder_add (&builder, "{sv}", "rejected-total",
+                             g_variant_new_uint64 (self->priv->calls_rejected_total));
+      g_variant_builder_add (&builder, "{sv}", "idle-time-ms",
+                             g_variant_new_uint64 (get_idle_time (self) / 1000));
+      g_variant_builder_add (&builder, "{sv}", "max-calls-per-caller",
+                             g_variant_new_uint32 (self->priv->max_calls_per_caller));
+      g_variant_builder_add (&builder, "{sv}", "max-calls-per-object",
+                             g_variant_new_uint32 (self->priv->max_calls_per_object));
+      g_variant_builder_add (&builder, "{sv}", "max-queued-per-caller",
+                             g_variant_new_int32 (self->priv->max_queued_per_caller));
+
+      g_dbus_method_invocation_return_value (invocation,
+                                             g_variant_new ("(a{sv})", &builder));
+    }
+}
+
+static void
+register_app_object (LiaApplication *self, GDBusConnection *conn)
+{
+  static GDBusNodeInfo *introspection_data = NULL;
+  static const GDBusInterfaceVTable vtable = { on_app_method_call, NULL, NULL };
+  GError *error = NULL;
+
+  if (introspection_data == NULL)
+    introspection_data = g_dbus_node_info_new_for_xml (app_introspection_xml,
+                                                       NULL);
+
+  self->priv->app_obj_reg_id =
+    g_dbus_connection_register_object (conn,
+                                       LIA_APPLICATION_OBJ_PATH,
+                                       introspection_data->interfaces[0],
+                                       &vtable,
+                                       self,
+                                       NULL,
+                                       &error);
+  if (self->priv->app_obj_reg_id == 0)
+    {
+      g_print ("Error registering application object: %s\n", error->message);
+      g_clear_error (&error);
+    }
+
+  self->priv->stats_obj_reg_id =
+    g_dbus_connection_register_object (conn,
+                                       LIA_STATS_OBJ_PATH,
+                                       introspection_data->interfaces[1],
+                                       &vtable,
+                                       self,
+                                       NULL,
+                                       &error);
+  if (self->priv->stats_obj_reg_id == 0)
+    {
+      g_print ("Error registering stats object: %s\n", error->message);
+      g_error_free (error);
+    }
+}
+
+static void
+on_dbus_connection (GObject      *obj,
+                    GAsyncResult *res,
+                    gpointer      user_data)
+{
+  BusConnData *data = user_data;
+  LiaApplication *self;
+  GDBusConnection *conn;
+  GError *error = NULL;
+
+  self = data->self;
+
+  lia_application_trace_end (self, data->span_id);
+
+  conn = g_dbus_connection_new_for_address_finish (res, &error);
+  if (conn == NULL)
+    {
+      g_print ("Error: %s\n", error->message);
+      if (data->init_op)
+        take_init_error (self, error);
+      else
+        g_error_free (error);
+    }
+  else if (g_strcmp0 (data->address, self->priv->bus_addr[data->bus_type]) != 0)
+    {
+      /* the bus moved while connecting, a connection to the new address
+         is on its way */
+      g_dbus_connection_close (conn, NULL, NULL, NULL);
+      g_object_unref (conn);
+    }
+  else
+    {
+      LiaApplicationClass *class;
+      gchar *phase;
+      guint span_id;
+
+      self->priv->bus_conn[data->bus_type] = conn;
+
+      g_signal_connect (conn,
+                        "closed",
+                        G_CALLBACK (dbus_connection_closed),
+                        self);
+
+      setup_caller_cache (self, data->bus_type);
+
+      self->priv->method_stats_watch_id[data->bus_type] =
+        lia_method_stats_watch_connection (self->priv->method_stats, conn);
+
+      if (data->bus_type == LIA_BUS_PRIVATE)
+        register_app_object (self, conn);
+
+      /* register objects over this bus */
+      phase = g_strdup_printf ("register-objects:%s",
+                               get_bus_type_name (data->bus_type));
+      span_id = lia_application_trace_begin (self, phase);
+      g_free (phase);
+
+      class = LIA_APPLICATION_GET_CLASS (self);
+      if (class->register_objects != NULL)
+        class->register_objects (self, data->bus_type);
+
+      lia_application_trace_end (self, span_id);
+
+      /* if the environment is not loaded yet, the service name might still
+         change, so name acquisition is deferred until then */
+      if (self->priv->env_loaded)
+        acquire_service_name (self, data->bus_type);
+    }
+
+  if (data->init_op)
+    init_op_done (self);
+
+  g_free (data->address);
+  g_slice_free (BusConnData, data);
+
+  g_object_unref (self);
+}
+
+/* drops the connection to a bus, and everything set up on it */
+static void
+disconnect_bus (LiaApplication *self, LiaBusType bus_type)
+{
+  GDBusConnection *conn = self->priv->bus_conn[bus_type];
+
+  if (conn == NULL)
+    return;
+
+  if (self->priv->service_name_owner_id[bus_type] > 0)
+    {
+      g_bus_unown_name (self->priv->service_name_owner_id[bus_type]);
+      self->priv->service_name_owner_id[bus_type] = 0;
+    }
+
+  if (bus_type == LIA_BUS_PRIVATE)
+    {
+      if (self->priv->app_obj_reg_id > 0)
+        {
+          g_dbus_connection_unregister_object (conn,
+                                               self->priv->app_obj_reg_id);
+          self->priv->app_obj_reg_id = 0;
+        }
+
+      if (self->priv->stats_obj_reg_id > 0)
+        {
+          g_dbus_connection_unregister_object (conn,
+                                               self->priv->stats_obj_reg_id);
+          self->priv->stats_obj_reg_id = 0;
+        }
+    }
+
+  if (self->priv->method_stats_watch_id[bus_type] > 0)
+    {
+      lia_method_stats_unwatch_connection (self->priv->method_stats,
+                                           conn,
+                                           self->priv->method_stats_watch_id[bus_type]);
+      self->priv->method_stats_watch_id[bus_type] = 0;
+    }
+
+  if (self->priv->caller_cache[bus_type] != NULL)
+    {
+      g_dbus_connection_signal_unsubscribe (conn,
+                                            self->priv->name_owner_sub_id[bus_type]);
+      g_hash_table_unref (self->priv->caller_cache[bus_type]);
+      self->priv->caller_cache[bus_type] = NULL;
+    }
+
+  g_signal_handlers_disconnect_by_func (conn, dbus_connection_closed, self);
+  g_dbus_connection_close (conn, NULL, NULL, NULL);
+
+  g_object_unref (conn);
+  self->priv->bus_conn[bus_type] = NULL;
+}
+
+static void
+connect_bus (LiaApplication *self, LiaBusType bus_type)
+{
+  BusConnData *data;
+  gchar *phase;
+
+  data = g_slice_new (BusConnData);
+  data->self = self;
+  g_object_ref (self);
+  data->bus_type = bus_type;
+  data->address = g_strdup (self->priv->bus_addr[bus_type]);
+  data->span_id = 0;
+
+  /* connections made after initialization (e.g when a bus moved) don't
+     hold it */
+  data->init_op = self->priv->async_result != NULL;
+  if (data->init_op)
+    {
+      phase = g_strdup_printf ("connect:%s", get_bus_type_name (bus_type));
+      data->span_id = lia_application_trace_begin (self, phase);
+      g_free (phase);
+
+      self->priv->init_ops++;
+    }
+
+  g_dbus_connection_new_for_address (data->address,
+                                     G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+                                     G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+                                     NULL,
+                                     self->priv->init_cancellable,
+                                     on_dbus_connection,
+                                     data);
 }
 
 static gboolean
-setup_env_from_file (LiaApplication *self, GError **error)
+resolve_base_service_name (LiaApplication *self, GError **error)
 {
-  gchar *contents;
-  gchar *filename;
-  gboolean result = TRUE;
-  gchar **entries = NULL;
-  gint i;
-  gchar **pair = NULL;
+  if (self->priv->base_service_name == NULL)
+    {
+      const gchar *base_service_name;
+
+      base_service_name = g_getenv (LIA_ENV_KEY_BASE_SERVICE_NAME);
+
+      if (base_service_name == NULL)
+        {
+          g_set_error (error,
+                       G_IO_ERROR,
+                       G_IO_ERROR_INVALID_ARGUMENT,
+                       "Failed to resolve base service name");
+          return FALSE;
+        }
+      else
+        {
+          self->priv->base_service_name = g_strdup (base_service_name);
+        }
+    }
+
+  return TRUE;
+}
+
+static gboolean
+config_is_complete (LiaApplication *self)
+{
+  return
+    lia_application_get_config_string (self, LIA_CONFIG_KEY_CORE_SERVICE_NAME) != NULL &&
+    lia_application_get_config_string (self, LIA_CONFIG_KEY_PRIVATE_BUS_ADDR) != NULL &&
+    lia_application_get_config_string (self, LIA_CONFIG_KEY_PROTECTED_BUS_ADDR) != NULL &&
+    lia_application_get_config_string (self, LIA_CONFIG_KEY_PUBLIC_BUS_ADDR) != NULL;
+}
+
+static void
+on_discovery_config_changed (GDBusConnection *connection,
+                             const gchar     *sender_name,
+                             const gchar     *object_path,
+                             const gchar     *interface_name,
+                             const gchar     *signal_name,
+                             GVariant        *parameters,
+                             gpointer         user_data)
+{
+  LiaApplication *self = LIA_APPLICATION (user_data);
+  guint32 version;
+  GVariant *config;
+
+  if (! g_variant_is_of_type (parameters, G_VARIANT_TYPE ("(ua{sv})")))
+    return;
+
+  g_variant_get (parameters, "(u@a{sv})", &version, &config);
+  lia_application_set_config (self, version, config);
+  g_variant_unref (config);
+}
+
+static void
+on_discovery_config (GObject      *obj,
+                     GAsyncResult *res,
+                     gpointer      user_data)
+{
+  LiaApplication *self = LIA_APPLICATION (user_data);
+  GVariant *ret;
+  GError *error = NULL;
 
-  filename = g_strdup_printf ("/tmp/%s.env", self->priv->base_service_name);
+  ret = g_dbus_connection_call_finish (G_DBUS_CONNECTION (obj), res, &error);
+  if (ret == NULL)
+    {
+      if (self->priv->load_env_result != NULL)
+        {
+          GSimpleAsyncResult *result = self->priv->load_env_result;
 
-  if (! g_file_get_contents (filename,
-                             &contents,
-                             NULL,
-                             error))
+          self->priv->load_env_result = NULL;
+          g_simple_async_result_take_error (result, error);
+          g_simple_async_result_complete (result);
+          g_object_unref (result);
+        }
+      else
+        {
+          g_error_free (error);
+        }
+    }
+  else
     {
-      result = FALSE;
-      goto out;
+      guint32 version;
+      GVariant *config;
+
+      g_variant_get (ret, "(u@a{sv})", &version, &config);
+      lia_application_set_config (self, version, config);
+      g_variant_unref (config);
+
+      g_variant_unref (ret);
     }
 
-  entries = g_strsplit (contents, "\n", 16);
-  if (entries == NULL)
-    goto out;
+  g_object_unref (self);
+}
+
+/* Builds a configuration from the environment variables applications
+   got before core had a discovery endpoint, so those started outside
+   core keep working. Returns NULL if a bus address is missing */
+static GVariant *
+get_config_from_env (LiaApplication *self)
+{
+  static const gchar *BUS_ADDR_KEYS[3][2] = {
+    { LIA_CONFIG_KEY_PRIVATE_BUS_ADDR, LIA_ENV_KEY_PRIVATE_BUS_ADDR },
+    { LIA_CONFIG_KEY_PROTECTED_BUS_ADDR, LIA_ENV_KEY_PROTECTED_BUS_ADDR },
+    { LIA_CONFIG_KEY_PUBLIC_BUS_ADDR, LIA_ENV_KEY_PUBLIC_BUS_ADDR }
+  };
+
+  GVariantBuilder builder;
+  const gchar *value;
+  gchar *service_name;
+  gint i;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
 
-  i = 0;
-  while (entries[i] != NULL)
+  for (i=0; i<3; i++)
     {
-      if (entries[i][0] != '\0')
+      value = g_getenv (BUS_ADDR_KEYS[i][1]);
+      if (value == NULL)
         {
-          pair = g_strsplit (entries[i], "=", 2);
+          g_variant_builder_clear (&builder);
+          return NULL;
+        }
 
-          if (pair == NULL || g_strv_length (pair) != 2)
-            {
-              g_set_error (error,
-                           G_IO_ERROR,
-                           G_IO_ERROR_INVALID_ARGUMENT,
-                           "Error in service environment file '%s', line %d",
-                           filename, i + 1);
-              result = FALSE;
-              g_strfreev (pair);
-              goto out;
-            }
-          else
-            {
-              g_setenv (pair[0], pair[1], TRUE);
-            }
+      g_variant_builder_add (&builder,
+                             "{sv}",
+                             BUS_ADDR_KEYS[i][0],
+                             g_variant_new_string (value));
+    }
+
+  g_variant_builder_add (&builder,
+                         "{sv}",
+                         LIA_CONFIG_KEY_BASE_SERVICE_NAME,
+                         g_variant_new_string (self->priv->base_service_name));
+
+  /* service names default to those core would give */
+  value = g_getenv (LIA_ENV_KEY_CORE_SERVICE_NAME);
+  if (value != NULL)
+    service_name = g_strdup (value);
+  else
+    service_name = g_strdup_printf ("%s." LIA_CORE_SERVICE_NAME_SUFFIX,
+                                    self->priv->base_service_name);
+  g_variant_builder_add (&builder,
+                         "{sv}",
+                         LIA_CONFIG_KEY_CORE_SERVICE_NAME,
+                         g_variant_new_string (service_name));
+  g_free (service_name);
+
+  value = g_getenv (LIA_ENV_KEY_WEBVIEW_SERVICE_NAME);
+  if (value != NULL)
+    service_name = g_strdup (value);
+  else
+    service_name = g_strdup_printf ("%s." LIA_WEBVIEW_SERVICE_NAME_SUFFIX,
+                                    self->priv->base_service_name);
+  g_variant_builder_add (&builder,
+                         "{sv}",
+                         LIA_CONFIG_KEY_WEBVIEW_SERVICE_NAME,
+                         g_variant_new_string (service_name));
+  g_free (service_name);
+
+  return g_variant_builder_end (&builder);
+}
+
+static void
+on_discovery_connection (GObject      *obj,
+                         GAsyncResult *res,
+                         gpointer      user_data)
+{
+  GSimpleAsyncResult *result = G_SIMPLE_ASYNC_RESULT (user_data);
+  LiaApplication *self;
+  GDBusConnection *conn;
+  GError *error = NULL;
+
+  self = LIA_APPLICATION (g_async_result_get_source_object (G_ASYNC_RESULT (result)));
+
+  conn = g_dbus_connection_new_for_address_finish (res, &error);
+  if (conn == NULL)
+    {
+      GVariant *config;
+
+      /* fall back to the environment, without updates from core */
+      config = get_config_from_env (self);
+      if (config != NULL)
+        {
+          g_debug ("Discovery endpoint not reachable (%s), using the "
+                   "bus addresses from the environment",
+                   error->message);
+          g_error_free (error);
 
-          g_strfreev (pair);
+          lia_application_set_config (self, 1, config);
+        }
+      else
+        {
+          g_simple_async_result_take_error (result, error);
         }
 
-      i++;
+      g_simple_async_result_complete (result);
+      g_object_unref (result);
+    }
+  else
+    {
+      self->priv->discovery_conn = conn;
+
+      /* subscribe before asking for the snapshot so no change is missed.
+         Snapshots older than the one we have are ignored */
+      self->priv->discovery_sub_id =
+        g_dbus_connection_signal_subscribe (conn,
+                                            NULL,
+                                            LIA_DISCOVERY_IFACE_NAME,
+                                            "Changed",
+                                            LIA_DISCOVERY_OBJ_PATH,
+                                            NULL,
+                                            G_DBUS_SIGNAL_FLAGS_NONE,
+                                            on_discovery_config_changed,
+                                            self,
+                                            NULL);
+
+      /* completed once the configuration has all we need, see
+         lia_application_set_config() */
+      self->priv->load_env_result = result;
+
+      g_object_ref (self);
+      g_dbus_connection_call (conn,
+                              NULL,
+                              LIA_DISCOVERY_OBJ_PATH,
+                              LIA_DISCOVERY_IFACE_NAME,
+                              "GetConfig",
+                              NULL,
+                              G_VARIANT_TYPE ("(ua{sv})"),
+                              G_DBUS_CALL_FLAGS_NONE,
+                              -1,
+                              self->priv->init_cancellable,
+                              on_discovery_config,
+                              self);
     }
 
- out:
-  g_free (filename);
-  g_strfreev (entries);
-  g_free (contents);
+  g_object_unref (self);
+}
+
+static void
+load_env_async (LiaApplication      *self,
+                gint                 io_priority,
+                GCancellable        *cancellable,
+                GAsyncReadyCallback  callback,
+                gpointer             user_data)
+{
+  GSimpleAsyncResult *res;
+  gchar *address;
 
-  return result;
+  res = g_simple_async_result_new (G_OBJECT (self),
+                                   callback,
+                                   user_data,
+                                   load_env_async);
+
+  /* the configuration may have been handed in directly already, as core
+     does with a Webview that runs in its own process */
+  if (config_is_complete (self))
+    {
+      g_simple_async_result_complete_in_idle (res);
+      g_object_unref (res);
+      return;
+    }
+
+  /* By default, an application gets its configuration from core's
+     discovery endpoint, whose address only depends on the base service
+     name, or else from the LIA_*_BUS_ADDRESS environment variables */
+  address = g_strdup_printf (LIA_DISCOVERY_ADDRESS_FORMAT,
+                             self->priv->base_service_name);
+
+  g_dbus_connection_new_for_address (address,
+                                     G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT,
+                                     NULL,
+                                     cancellable,
+                                     on_discovery_connection,
+                                     res);
+
+  g_free (address);
 }
 
 static gboolean
-load_env (LiaApplication *self, gchar **service_name, GError **error)
+load_env_finish (LiaApplication  *self,
+                 GAsyncResult    *result,
+                 gchar          **service_name,
+                 GError         **error)
 {
-  gboolean result = TRUE;
-  const gchar *core_service_name;
+  /* bus addresses are set as the configuration arrives, so there is
+     nothing else to do here */
+  return ! g_simple_async_result_propagate_error (G_SIMPLE_ASYNC_RESULT (result),
+                                                  error);
+}
+
+static void
+on_env_loaded (GObject      *obj,
+               GAsyncResult *res,
+               gpointer      user_data)
+{
+  LiaApplication *self = LIA_APPLICATION (obj);
+  GError *error = NULL;
+  gint i;
 
-  /* resolve core service name */
-  core_service_name = g_getenv (LIA_ENV_KEY_CORE_SERVICE_NAME);
-  if (core_service_name == NULL)
+  lia_application_trace_end (self, self->priv->load_env_span);
+
+  if (! LIA_APPLICATION_GET_CLASS (self)->load_env_finish (self,
+                                                           res,
+                                                           &self->priv->service_name,
+                                                           &error))
     {
-      /* try loading env from file */
-      if (! setup_env_from_file (self, error))
-        return FALSE;
+      take_init_error (self, error);
     }
+  else
+    {
+      self->priv->env_loaded = TRUE;
 
-  /* By default, an application read the bus addresses from
-     environment variables */
-  self->priv->bus_addr[LIA_BUS_PRIVATE] =
-    g_strdup (g_getenv (LIA_ENV_KEY_PRIVATE_BUS_ADDR));
-
-  self->priv->bus_addr[LIA_BUS_PROTECTED] =
-    g_strdup (g_getenv (LIA_ENV_KEY_PROTECTED_BUS_ADDR));
+      /* acquire service name on buses that connected before the
+         environment was fully loaded */
+      for (i=0; i<3; i++)
+        if (self->priv->bus_conn[i] != NULL)
+          acquire_service_name (self, i);
 
-  self->priv->bus_addr[LIA_BUS_PUBLIC] =
-    g_strdup (g_getenv (LIA_ENV_KEY_PUBLIC_BUS_ADDR));
+      acquire_shard_service_names (self);
+    }
 
-  return result;
+  init_op_done (self);
 }
 
 static void
@@ -728,13 +1740,15 @@ init_async (GAsyncInitable      *initable,
   LiaApplication *self = LIA_APPLICATION (initable);
   GError *error = NULL;
   GSimpleAsyncResult *res;
-  gint i;
 
   res = g_simple_async_result_new (G_OBJECT (self),
                                    callback,
                                    user_data,
                                    init_async);
 
+  self->priv->startup_time = g_get_monotonic_time ();
+  self->priv->startup_span = lia_application_trace_begin (self, "startup");
+
   /* resolve base service name */
   if (! resolve_base_service_name (self, &error))
     {
@@ -742,37 +1756,27 @@ init_async (GAsyncInitable      *initable,
       return;
     }
 
-  /* load service environment */
-  if (! LIA_APPLICATION_GET_CLASS (self)->load_env (self,
-                                                    &self->priv->service_name,
-                                                    &error))
-    {
-      abort_init_async (self, res, error);
-      return;
-    }
-
-  self->priv->create_bus_conn_ops = 0;
-  self->priv->acquire_bus_name_ops = 0;
-
-  for (i=0; i<3; i++)
-    if (self->priv->bus_addr[i] != NULL)
-      {
-        BusConnData *data;
-
-        data = g_slice_new (BusConnData);
-        data->result = res;
-        g_object_ref (res);
-        data->cancellable = cancellable;
-        data->bus_type = i;
-        g_dbus_connection_new_for_address (self->priv->bus_addr[i],
-                                           G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
-                                           G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
-                                           NULL,
-                                           cancellable,
-                                           on_dbus_connection,
-                                           data);
-        self->priv->create_bus_conn_ops++;
-      }
+  /* applications activated on demand get their HTML root from core */
+  if (self->priv->webview_html_root == NULL)
+    self->priv->webview_html_root =
+      g_strdup (g_getenv (LIA_ENV_KEY_WEBVIEW_HTML_ROOT));
+
+  self->priv->async_result = res;
+  self->priv->io_priority = io_priority;
+  if (cancellable != NULL)
+    self->priv->init_cancellable = g_object_ref (cancellable);
+
+  /* load service environment. Bus connections are started as soon as
+     their addresses are known, which might happen before the whole
+     environment is loaded (see lia_application_set_bus_address()) */
+  self->priv->init_ops = 1;
+  self->priv->load_env_span = lia_application_trace_begin (self, "load-env");
+
+  LIA_APPLICATION_GET_CLASS (self)->load_env_async (self,
+                                                    io_priority,
+                                                    cancellable,
+                                                    on_env_loaded,
+                                                    NULL);
 }
 
 static gboolean
@@ -790,19 +1794,82 @@ init_finish (GAsyncInitable  *initable,
 }
 
 static void
-on_initialized (GObject      *obj,
-                GAsyncResult *res,
-                gpointer      user_data)
+supervisor_bus_name_appeared (GDBusConnection *connection,
+                              const gchar     *name,
+                              const gchar     *name_owner,
+                              gpointer         user_data)
 {
   LiaApplication *self = LIA_APPLICATION (user_data);
-  GError *error = NULL;
+  const gchar *child_id;
+
+  g_bus_unwatch_name (self->priv->supervisor_watch_id);
+  self->priv->supervisor_watch_id = 0;
+
+  child_id = g_getenv (LIA_ENV_KEY_CHILD_ID);
+
+  g_dbus_connection_call (connection,
+                          name_owner,
+                          LIA_SUPERVISOR_OBJ_PATH,
+                          LIA_SUPERVISOR_IFACE_NAME,
+                          "NotifyReady",
+                          g_variant_new ("(u)",
+                                         (guint32) g_ascii_strtoull (child_id,
+                                                                     NULL,
+                                                                     10)),
+                          NULL,
+                          G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                          -1,
+                          NULL,
+                          NULL,
+                          NULL);
+}
 
-  if (! g_async_initable_init_finish (G_ASYNC_INITABLE (obj),
-                                      res,
-                                      &error))
-    {
-      /* @TODO: log error */
-      g_warning ("ERROR: failed to initalize application: %s", error->message);
+/* tells core's supervisor that this application, launched by it, is ready
+   to do its job. Core starts its children concurrently with its own
+   initialization, so the application might get ready before core owns
+   its name on the private bus. In that case, readiness is reported as
+   soon as core shows up */
+static void
+notify_supervisor_ready (LiaApplication *self)
+{
+  const gchar *core_service_name;
+  GDBusConnection *conn;
+
+  core_service_name = lia_application_get_core_service_name (self);
+  conn = self->priv->bus_conn[LIA_BUS_PRIVATE];
+
+  if (g_getenv (LIA_ENV_KEY_CHILD_ID) == NULL ||
+      core_service_name == NULL ||
+      conn == NULL ||
+      self->priv->supervisor_watch_id > 0)
+    {
+      return;
+    }
+
+  self->priv->supervisor_watch_id =
+    g_bus_watch_name_on_connection (conn,
+                                    core_service_name,
+                                    G_BUS_NAME_WATCHER_FLAGS_NONE,
+                                    supervisor_bus_name_appeared,
+                                    NULL,
+                                    self,
+                                    NULL);
+}
+
+static void
+on_initialized (GObject      *obj,
+                GAsyncResult *res,
+                gpointer      user_data)
+{
+  LiaApplication *self = LIA_APPLICATION (user_data);
+  GError *error = NULL;
+
+  if (! g_async_initable_init_finish (G_ASYNC_INITABLE (obj),
+                                      res,
+                                      &error))
+    {
+      /* @TODO: log error */
+      g_warning ("ERROR: failed to initalize application: %s", error->message);
       g_error_free (error);
 
       //      evd_daemon_quit (self->priv->daemon, -1);
@@ -810,236 +1877,1810 @@ on_initialized (GObject      *obj,
   else
     {
       /* app initialized successfully */
+      lia_application_trace_end (self, self->priv->startup_span);
+
+      g_print ("'%s' application initialized successfully in %" G_GINT64_FORMAT " ms\n",
+               self->priv->service_name,
+               (g_get_monotonic_time () - self->priv->startup_time) / 1000);
+
+      /* fire "ready" signal. Handlers get the startup breakdown from
+         lia_application_get_startup_trace() */
+      g_signal_emit (self, lia_application_signals[SIGNAL_READY], 0, NULL);
+
+      notify_supervisor_ready (self);
+    }
+}
+
+static RegObjData *
+reg_obj_data_ref (RegObjData *data)
+{
+  data->ref_count++;
+
+  return data;
+}
+
+static void
+reg_obj_data_unref (gpointer _data)
+{
+  RegObjData *data = _data;
+
+  data->ref_count--;
+  if (data->ref_count > 0)
+    return;
+
+  g_object_unref (data->self);
+
+  if (data->user_data != NULL && data->user_data_free_func != NULL)
+    data->user_data_free_func (data->user_data);
+
+  g_slice_free (RegObjData, data);
+}
+
+static void
+dispatch_method_call (RegObjData            *data,
+                      GDBusMethodInvocation *invocation)
+{
+  g_debug ("method called %p", data->method_call_func);
+
+  data->method_call_func (data->self,
+                          data->bus_type,
+                          g_dbus_method_invocation_get_sender (invocation),
+                          g_dbus_method_invocation_get_object_path (invocation),
+                          g_dbus_method_invocation_get_interface_name (invocation),
+                          g_dbus_method_invocation_get_method_name (invocation),
+                          g_dbus_method_invocation_get_parameters (invocation),
+                          invocation,
+                          data->user_data);
+}
+
+static void
+free_pending_call (PendingCall *call)
+{
+  reg_obj_data_unref (call->reg_data);
+  g_object_unref (call->invocation);
+
+  g_slice_free (PendingCall, call);
+}
+
+static CallerCacheEntry *
+caller_cache_entry_ref (CallerCacheEntry *entry)
+{
+  entry->ref_count++;
+
+  return entry;
+}
+
+static void
+caller_cache_entry_unref (gpointer _entry)
+{
+  CallerCacheEntry *entry = _entry;
+
+  entry->ref_count--;
+  if (entry->ref_count > 0)
+    return;
+
+  lia_caller_identity_unref (entry->identity);
+  g_object_unref (entry->conn);
+  g_queue_free (entry->identity_waiters);
+  g_queue_free_full (entry->queued_calls, (GDestroyNotify) free_pending_call);
+
+  g_slice_free (CallerCacheEntry, entry);
+}
+
+static gchar *
+get_object_key (LiaBusType bus_type, GDBusMethodInvocation *invocation)
+{
+  return g_strdup_printf ("%d|%s",
+                          bus_type,
+                          g_dbus_method_invocation_get_object_path (invocation));
+}
+
+static gboolean
+can_run_method_call (LiaApplication        *self,
+                     CallerCacheEntry      *entry,
+                     LiaBusType             bus_type,
+                     GDBusMethodInvocation *invocation)
+{
+  if (self->priv->max_calls_per_caller > 0 &&
+      entry->in_flight >= self->priv->max_calls_per_caller)
+    {
+      return FALSE;
+    }
+
+  if (self->priv->max_calls_per_object > 0)
+    {
+      gchar *key;
+      guint count;
+
+      key = get_object_key (bus_type, invocation);
+      count = GPOINTER_TO_UINT (g_hash_table_lookup (self->priv->object_calls,
+                                                     key));
+      g_free (key);
+
+      if (count >= self->priv->max_calls_per_object)
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+static gboolean
+serve_queued_calls (gpointer user_data)
+{
+  LiaApplication *self = LIA_APPLICATION (user_data);
+  gboolean progress = TRUE;
+
+  self->priv->serve_calls_src_id = 0;
+
+  /* callers with queued calls are served round-robin, one call each per
+     round, until no more calls fit within the limits */
+  while (progress && ! g_queue_is_empty (self->priv->ready_callers))
+    {
+      guint i;
+      guint len;
+
+      progress = FALSE;
+
+      len = g_queue_get_length (self->priv->ready_callers);
+      for (i=0; i<len; i++)
+        {
+          CallerCacheEntry *entry;
+          PendingCall *call;
+
+          entry = g_queue_pop_head (self->priv->ready_callers);
+
+          call = g_queue_peek_head (entry->queued_calls);
+          if (call != NULL &&
+              can_run_method_call (self,
+                                   entry,
+                                   call->reg_data->bus_type,
+                                   call->invocation))
+            {
+              g_queue_pop_head (entry->queued_calls);
+              self->priv->calls_queued--;
+
+              run_method_call (self, entry, call->reg_data, call->invocation);
+              free_pending_call (call);
+
+              progress = TRUE;
+            }
+
+          if (! g_queue_is_empty (entry->queued_calls))
+            {
+              g_queue_push_tail (self->priv->ready_callers, entry);
+            }
+          else
+            {
+              entry->scheduled = FALSE;
+              caller_cache_entry_unref (entry);
+            }
+        }
+    }
+
+  return FALSE;
+}
+
+static void
+on_method_call_finished (gpointer  user_data,
+                         GObject  *where_the_object_was)
+{
+  InFlightCall *data = user_data;
+  LiaApplication *self = data->self;
+  guint count;
+
+  count = GPOINTER_TO_UINT (g_hash_table_lookup (self->priv->object_calls,
+                                                 data->object_key));
+  if (count <= 1)
+    g_hash_table_remove (self->priv->object_calls, data->object_key);
+  else
+    g_hash_table_insert (self->priv->object_calls,
+                         g_strdup (data->object_key),
+                         GUINT_TO_POINTER (count - 1));
+
+  data->entry->in_flight--;
+  data->entry->in_flight_calls = g_list_remove (data->entry->in_flight_calls,
+                                                data);
+  caller_cache_entry_unref (data->entry);
+
+  if (data->deadline_src_id > 0)
+    g_source_remove (data->deadline_src_id);
+  g_object_unref (data->cancellable);
+
+  self->priv->calls_in_flight--;
+
+  /* a slot was released, give queued calls a chance. This is deferred
+     since invocations are usually finalized from within a handler */
+  if (! g_queue_is_empty (self->priv->ready_callers) &&
+      self->priv->serve_calls_src_id == 0)
+    {
+      self->priv->serve_calls_src_id = g_idle_add (serve_queued_calls, self);
+    }
+
+  g_free (data->object_key);
+  g_slice_free (InFlightCall, data);
+
+  g_object_unref (self);
+}
+
+static gboolean
+on_call_deadline (gpointer user_data)
+{
+  InFlightCall *data = user_data;
+
+  data->deadline_src_id = 0;
+  g_cancellable_cancel (data->cancellable);
+
+  return FALSE;
+}
+
+static void
+run_method_call (LiaApplication        *self,
+                 CallerCacheEntry      *entry,
+                 RegObjData            *reg_data,
+                 GDBusMethodInvocation *invocation)
+{
+  InFlightCall *data;
+  guint count;
+
+  data = g_slice_new (InFlightCall);
+  data->self = self;
+  g_object_ref (self);
+  data->entry = caller_cache_entry_ref (entry);
+  data->object_key = get_object_key (reg_data->bus_type, invocation);
+
+  count = GPOINTER_TO_UINT (g_hash_table_lookup (self->priv->object_calls,
+                                                 data->object_key));
+  g_hash_table_insert (self->priv->object_calls,
+                       g_strdup (data->object_key),
+                       GUINT_TO_POINTER (count + 1));
+
+  entry->in_flight++;
+  entry->in_flight_calls = g_list_prepend (entry->in_flight_calls, data);
+  self->priv->calls_in_flight++;
+  self->priv->last_call_time = g_get_monotonic_time ();
+
+  /* cancelled if the caller goes away or the deadline expires, see
+     lia_application_get_call_cancellable() */
+  data->cancellable = g_cancellable_new ();
+  data->deadline_src_id = 0;
+  if (self->priv->call_deadline[reg_data->bus_type] > 0)
+    data->deadline_src_id =
+      g_timeout_add (self->priv->call_deadline[reg_data->bus_type],
+                     on_call_deadline,
+                     data);
+
+  g_object_set_qdata (G_OBJECT (invocation), in_flight_call_quark, data);
+
+  /* the call is in flight until its invocation is returned and freed */
+  g_object_weak_ref (G_OBJECT (invocation), on_method_call_finished, data);
+
+  dispatch_method_call (reg_data, invocation);
+}
+
+static void
+submit_method_call (LiaApplication        *self,
+                    CallerCacheEntry      *entry,
+                    RegObjData            *reg_data,
+                    GDBusMethodInvocation *invocation)
+{
+  PendingCall *call;
+
+  if (g_queue_is_empty (entry->queued_calls) &&
+      can_run_method_call (self, entry, reg_data->bus_type, invocation))
+    {
+      run_method_call (self, entry, reg_data, invocation);
+      return;
+    }
+
+  if (self->priv->max_queued_per_caller >= 0 &&
+      g_queue_get_length (entry->queued_calls) >=
+      (guint) self->priv->max_queued_per_caller)
+    {
+      self->priv->calls_rejected_total++;
+
+      g_dbus_method_invocation_return_dbus_error (invocation,
+                                                  LIA_DBUS_ERROR_LIMITS_EXCEEDED,
+                                                  "Too many calls in flight");
+      return;
+    }
+
+  call = g_slice_new (PendingCall);
+  call->reg_data = reg_obj_data_ref (reg_data);
+  call->invocation = g_object_ref (invocation);
+
+  g_queue_push_tail (entry->queued_calls, call);
+  self->priv->calls_queued++;
+  self->priv->calls_queued_total++;
+
+  if (! entry->scheduled)
+    {
+      entry->scheduled = TRUE;
+      g_queue_push_tail (self->priv->ready_callers,
+                         caller_cache_entry_ref (entry));
+    }
+}
+
+static void
+caller_resolved (ResolveCallerData *data)
+{
+  CallerCacheEntry *entry = data->entry;
+  GSimpleAsyncResult *res;
+
+  entry->resolved = TRUE;
+  entry->resolving = FALSE;
+
+  while ((res = g_queue_pop_head (entry->identity_waiters)) != NULL)
+    {
+      g_simple_async_result_set_op_res_gpointer (res,
+                                                 lia_caller_identity_ref (entry->identity),
+                                                 (GDestroyNotify) lia_caller_identity_unref);
+      g_simple_async_result_complete (res);
+      g_object_unref (res);
+    }
+
+  caller_cache_entry_unref (entry);
+  g_object_unref (data->self);
+
+  g_slice_free (ResolveCallerData, data);
+}
+
+static void
+on_caller_unix_user (GObject      *obj,
+                     GAsyncResult *res,
+                     gpointer      user_data)
+{
+  ResolveCallerData *data = user_data;
+  GVariant *ret;
+  GError *error = NULL;
+
+  ret = g_dbus_connection_call_finish (G_DBUS_CONNECTION (obj), res, &error);
+  if (ret == NULL)
+    {
+      g_debug ("Failed to resolve caller '%s': %s",
+               data->entry->identity->unique_name,
+               error->message);
+      g_error_free (error);
+    }
+  else
+    {
+      g_variant_get (ret, "(u)", &data->entry->identity->uid);
+      g_variant_unref (ret);
+    }
+
+  caller_resolved (data);
+}
+
+static void
+on_caller_credentials (GObject      *obj,
+                       GAsyncResult *res,
+                       gpointer      user_data)
+{
+  ResolveCallerData *data = user_data;
+  LiaCallerIdentity *identity = data->entry->identity;
+  GVariant *ret;
+  GVariant *creds;
+  GError *error = NULL;
+
+  ret = g_dbus_connection_call_finish (G_DBUS_CONNECTION (obj), res, &error);
+  if (ret == NULL)
+    {
+      /* older bus daemons don't implement GetConnectionCredentials */
+      g_error_free (error);
+
+      g_dbus_connection_call (G_DBUS_CONNECTION (obj),
+                              "org.freedesktop.DBus",
+                              "/org/freedesktop/DBus",
+                              "org.freedesktop.DBus",
+                              "GetConnectionUnixUser",
+                              g_variant_new ("(s)", identity->unique_name),
+                              G_VARIANT_TYPE ("(u)"),
+                              G_DBUS_CALL_FLAGS_NONE,
+                              -1,
+                              NULL,
+                              on_caller_unix_user,
+                              data);
+      return;
+    }
+
+  creds = g_variant_get_child_value (ret, 0);
+  g_variant_lookup (creds, "UnixUserID", "u", &identity->uid);
+  g_variant_lookup (creds, "ProcessID", "u", &identity->pid);
+  g_variant_unref (creds);
+  g_variant_unref (ret);
+
+  caller_resolved (data);
+}
+
+static void
+resolve_caller (LiaApplication *self, CallerCacheEntry *entry)
+{
+  ResolveCallerData *data;
+
+  data = g_slice_new (ResolveCallerData);
+  data->self = self;
+  g_object_ref (self);
+  data->entry = caller_cache_entry_ref (entry);
+
+  /* the caller's bus, which may be one of the public bus shards */
+  g_dbus_connection_call (entry->conn,
+                          "org.freedesktop.DBus",
+                          "/org/freedesktop/DBus",
+                          "org.freedesktop.DBus",
+                          "GetConnectionCredentials",
+                          g_variant_new ("(s)", entry->identity->unique_name),
+                          G_VARIANT_TYPE ("(a{sv})"),
+                          G_DBUS_CALL_FLAGS_NONE,
+                          -1,
+                          NULL,
+                          on_caller_credentials,
+                          data);
+}
+
+static void
+on_name_owner_changed (GDBusConnection *connection,
+                       const gchar     *sender_name,
+                       const gchar     *object_path,
+                       const gchar     *interface_name,
+                       const gchar     *signal_name,
+                       GVariant        *parameters,
+                       gpointer         user_data)
+{
+  LiaApplication *self = LIA_APPLICATION (user_data);
+  const gchar *name;
+  const gchar *new_owner;
+  GHashTable *cache;
+
+  g_variant_get (parameters, "(&s&s&s)", &name, NULL, &new_owner);
+
+  /* only unique names going away are interesting */
+  if (name[0] != ':' || new_owner[0] != '\0')
+    return;
+
+  cache = lookup_caller_cache (self, connection);
+  if (cache != NULL)
+    {
+      CallerCacheEntry *entry;
+
+      /* nobody is left to reply to calls still waiting for their turn */
+      entry = g_hash_table_lookup (cache, name);
+      if (entry != NULL)
+        {
+          GList *node;
+
+          /* calls already being handled are abandoned */
+          for (node = entry->in_flight_calls; node != NULL; node = node->next)
+            {
+              InFlightCall *call = node->data;
+
+              g_cancellable_cancel (call->cancellable);
+            }
+
+          self->priv->calls_queued -= g_queue_get_length (entry->queued_calls);
+          g_queue_foreach (entry->queued_calls, (GFunc) free_pending_call, NULL);
+          g_queue_clear (entry->queued_calls);
+        }
+
+      g_hash_table_remove (cache, name);
+    }
+}
+
+static void
+setup_caller_cache (LiaApplication *self, LiaBusType bus_type)
+{
+  self->priv->caller_cache[bus_type] =
+    g_hash_table_new_full (g_str_hash,
+                           g_str_equal,
+                           NULL,
+                           caller_cache_entry_unref);
+
+  self->priv->name_owner_sub_id[bus_type] =
+    g_dbus_connection_signal_subscribe (self->priv->bus_conn[bus_type],
+                                        "org.freedesktop.DBus",
+                                        "org.freedesktop.DBus",
+                                        "NameOwnerChanged",
+                                        "/org/freedesktop/DBus",
+                                        NULL,
+                                        G_DBUS_SIGNAL_FLAGS_NONE,
+                                        on_name_owner_changed,
+                                        self,
+                                        NULL);
+}
+
+#include "lia-application-shards.c"
+
+static void
+handle_method_call (RegObjData            *data,
+                    GDBusMethodInvocation *invocation)
+{
+  LiaApplication *self = data->self;
+  const gchar *sender;
+  GHashTable *cache;
+  CallerCacheEntry *entry;
+
+  sender = g_dbus_method_invocation_get_sender (invocation);
+  cache = lookup_caller_cache (self,
+                               g_dbus_method_invocation_get_connection (invocation));
+  if (sender == NULL || cache == NULL)
+    {
+      dispatch_method_call (data, invocation);
+      return;
+    }
+
+  entry = g_hash_table_lookup (cache, sender);
+  if (entry == NULL)
+    {
+      entry = g_slice_new0 (CallerCacheEntry);
+      entry->ref_count = 1;
+      entry->identity = lia_caller_identity_new (sender, data->bus_type);
+      entry->conn =
+        g_object_ref (g_dbus_method_invocation_get_connection (invocation));
+      entry->resolved = FALSE;
+      entry->resolving = FALSE;
+      entry->identity_waiters = g_queue_new ();
+      entry->in_flight = 0;
+      entry->queued_calls = g_queue_new ();
+      entry->scheduled = FALSE;
+      entry->in_flight_calls = NULL;
+
+      /* the identity is only resolved if asked for, see
+         lia_application_resolve_caller_identity() */
+      g_hash_table_insert (cache, entry->identity->unique_name, entry);
+    }
+
+  submit_method_call (self, entry, data, invocation);
+}
+
+static gboolean
+dispatch_deferred_call (gpointer user_data)
+{
+  DeferredCallsData *data = user_data;
+  LiaApplication *self = data->self;
+  PendingCall *call;
+
+  /* one call per main loop iteration, so that sources of higher
+     priority get a chance to run in between */
+  call = g_queue_pop_head (self->priv->deferred_calls[data->bus_type]);
+  if (call != NULL)
+    {
+      handle_method_call (call->reg_data, call->invocation);
+      free_pending_call (call);
+    }
+
+  if (g_queue_is_empty (self->priv->deferred_calls[data->bus_type]))
+    {
+      self->priv->deferred_calls_src_id[data->bus_type] = 0;
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+static void
+free_deferred_calls_data (gpointer _data)
+{
+  g_slice_free (DeferredCallsData, _data);
+}
+
+static void
+on_bus_method_call (GDBusConnection       *connection,
+                    const gchar           *sender,
+                    const gchar           *object_path,
+                    const gchar           *interface_name,
+                    const gchar           *method_name,
+                    GVariant              *parameters,
+                    GDBusMethodInvocation *invocation,
+                    gpointer               user_data)
+{
+  RegObjData *data = user_data;
+  LiaApplication *self = data->self;
+  LiaBusType bus_type = data->bus_type;
+  PendingCall *call;
+
+  /* GDBus dispatches incoming calls of all connections at default
+     priority. Calls on buses configured below that are re-queued and
+     handled from a source running at the bus' priority */
+  if (self->priv->bus_priority[bus_type] <= G_PRIORITY_DEFAULT &&
+      g_queue_is_empty (self->priv->deferred_calls[bus_type]))
+    {
+      handle_method_call (data, invocation);
+      return;
+    }
+
+  /* per-caller limits only apply once the call is handled, so a flood on
+     a low priority bus would otherwise pile up here */
+  if (g_queue_get_length (self->priv->deferred_calls[bus_type]) >=
+      MAX_DEFERRED_CALLS)
+    {
+      self->priv->calls_rejected_total++;
+
+      g_dbus_method_invocation_return_dbus_error (invocation,
+                                                  LIA_DBUS_ERROR_LIMITS_EXCEEDED,
+                                                  "Too many calls waiting");
+      return;
+    }
+
+  call = g_slice_new (PendingCall);
+  call->reg_data = reg_obj_data_ref (data);
+  call->invocation = g_object_ref (invocation);
+  g_queue_push_tail (self->priv->deferred_calls[bus_type], call);
+
+  if (self->priv->deferred_calls_src_id[bus_type] == 0)
+    {
+      DeferredCallsData *src_data;
+
+      src_data = g_slice_new (DeferredCallsData);
+      src_data->self = self;
+      src_data->bus_type = bus_type;
+
+      self->priv->deferred_calls_src_id[bus_type] =
+        g_idle_add_full (self->priv->bus_priority[bus_type],
+                         dispatch_deferred_call,
+                         src_data,
+                         free_deferred_calls_data);
+    }
+}
+
+static void
+free_coalesced_signal (gpointer _data)
+{
+  CoalescedSignal *data = _data;
+
+  if (data->src_id > 0)
+    g_source_remove (data->src_id);
+
+  if (data->last_value != NULL)
+    g_variant_unref (data->last_value);
+
+  if (data->values != NULL)
+    g_ptr_array_unref (data->values);
+
+  g_free (data->key);
+  g_free (data->destination);
+  g_free (data->object_path);
+  g_free (data->interface_name);
+  g_free (data->signal_name);
+
+  g_slice_free (CoalescedSignal, data);
+}
+
+/* Emits whatever has been coalesced so far. Returns FALSE if there was
+   nothing to emit. */
+static gboolean
+flush_coalesced_signal (CoalescedSignal *data, GError **error)
+{
+  GVariant *params;
+
+  if (data->mode == LIA_COALESCE_ACCUMULATE)
+    {
+      GVariant *array;
+
+      if (data->values->len == 0)
+        return FALSE;
+
+      array = g_variant_new_array (NULL,
+                                   (GVariant **) data->values->pdata,
+                                   data->values->len);
+      params = g_variant_ref_sink (g_variant_new_tuple (&array, 1));
+
+      g_ptr_array_set_size (data->values, 0);
+    }
+  else
+    {
+      if (data->last_value == NULL)
+        return FALSE;
+
+      params = data->last_value;
+      data->last_value = NULL;
+    }
+
+  lia_application_emit_signal (data->self,
+                               data->bus_type,
+                               data->destination,
+                               data->object_path,
+                               data->interface_name,
+                               data->signal_name,
+                               params,
+                               error);
+  g_variant_unref (params);
+
+  return TRUE;
+}
+
+static gboolean
+on_coalescing_window_elapsed (gpointer user_data)
+{
+  CoalescedSignal *data = user_data;
+  GError *error = NULL;
+
+  if (flush_coalesced_signal (data, &error))
+    {
+      if (error != NULL)
+        {
+          g_print ("Error emitting coalesced signal '%s': %s\n",
+                   data->signal_name,
+                   error->message);
+          g_error_free (error);
+        }
+
+      /* something was emitted, keep the window open */
+      return TRUE;
+    }
+
+  /* window elapsed with nothing to emit, next emission will go out
+     immediately */
+  data->src_id = 0;
+  g_hash_table_remove (data->self->priv->coalesced_signals, data->key);
+
+  return FALSE;
+}
+
+/* public methods */
+
+gint
+lia_application_run (LiaApplication *self)
+{
+  g_return_val_if_fail (LIA_IS_APPLICATION (self), -1);
+
+  if (! self->priv->initialized)
+    {
+      self->priv->initialized = TRUE;
+
+      g_async_initable_init_async (G_ASYNC_INITABLE (self),
+                                   G_PRIORITY_DEFAULT,
+                                   NULL,
+                                   on_initialized,
+                                   self);
+    }
+
+  return evd_daemon_run (self->priv->daemon, NULL);
+}
+
+void
+lia_application_quit (LiaApplication *self, gint exit_code)
+{
+  g_return_if_fail (LIA_IS_APPLICATION (self));
+
+  evd_daemon_quit (self->priv->daemon, exit_code);
+}
+
+/**
+ * lia_application_get_service_name:
+ *
+ * Returns: (transfer none):
+ **/
+const gchar *
+lia_application_get_service_name (LiaApplication *self)
+{
+  g_return_val_if_fail (LIA_IS_APPLICATION (self), NULL);
+
+  return self->priv->service_name;
+}
+
+/**
+ * lia_application_get_core_service_name:
+ *
+ * Returns: (transfer none):
+ **/
+const gchar *
+lia_application_get_core_service_name (LiaApplication *self)
+{
+  g_return_val_if_fail (LIA_IS_APPLICATION (self), NULL);
+
+  return lia_application_get_config_string (self,
+                                            LIA_CONFIG_KEY_CORE_SERVICE_NAME);
+}
+
+/**
+ * lia_application_get_base_service_name:
+ *
+ * Returns: (transfer none):
+ **/
+const gchar *
+lia_application_get_base_service_name (LiaApplication *self)
+{
+  g_return_val_if_fail (LIA_IS_APPLICATION (self), NULL);
+
+  return self->priv->base_service_name;
+}
+
+/**
+ * lia_application_get_bus_address:
+ *
+ * Returns: (transfer none):
+ **/
+const gchar *
+lia_application_get_bus_address (LiaApplication *self, LiaBusType bus_type)
+{
+  g_return_val_if_fail (LIA_IS_APPLICATION (self), NULL);
+  g_return_val_if_fail (bus_type >= LIA_BUS_PRIVATE &&
+                        bus_type <= LIA_BUS_PUBLIC, NULL);
+
+  return self->priv->bus_addr[bus_type];
+}
+
+/**
+ * lia_application_get_bus:
+ *
+ * For the public bus, this is the connection to its first shard only.
+ * Emit signals with lia_application_emit_signal() so they reach all of
+ * them.
+ *
+ * Returns: (transfer none):
+ **/
+GDBusConnection *
+lia_application_get_bus (LiaApplication *self, LiaBusType bus_type)
+{
+  g_return_val_if_fail (LIA_IS_APPLICATION (self), NULL);
+  g_return_val_if_fail (bus_type >= LIA_BUS_PRIVATE &&
+                        bus_type <= LIA_BUS_PUBLIC, NULL);
+
+  return self->priv->bus_conn[bus_type];
+}
+
+/**
+ * lia_application_register_object:
+ * @method_call_func: (scope async) (closure user_data):
+ * @user_data: (allow-none) (closure):
+ * @user_data_free_func: (allow-none) (type any):
+ *
+ * Returns:
+ **/
+guint
+lia_application_register_object (LiaApplication        *self,
+                                 guint                  bus_type,
+                                 const gchar           *object_path,
+                                 const gchar           *interface_xml,
+                                 LiaBusMethodCallFunc   method_call_func,
+                                 gpointer               user_data,
+                                 GDestroyNotify         user_data_free_func,
+                                 GError               **error)
+{
+  static GDBusNodeInfo *introspection_data = NULL;
+  gchar *introspection_xml;
+  guint reg_id = 0;
+  RegObjData *data = NULL;
+  GDBusConnection *conn = NULL;
+
+  g_return_val_if_fail (LIA_IS_APPLICATION (self), 0);
+  g_return_val_if_fail (bus_type >= LIA_BUS_PRIVATE &&
+                        bus_type <= LIA_BUS_PUBLIC, 0);
+  g_return_val_if_fail (object_path != NULL, 0);
+  g_return_val_if_fail (interface_xml != NULL, 0);
+  g_return_val_if_fail (method_call_func != NULL, 0);
+
+  introspection_xml = g_strdup_printf ("<node>%s</node>", interface_xml);
+  introspection_data = g_dbus_node_info_new_for_xml (introspection_xml, error);
+  g_free (introspection_xml);
+
+  if (introspection_data == NULL)
+    return 0;
+
+  conn = self->priv->bus_conn[bus_type];
+  if (conn == NULL)
+    {
+      g_set_error (error,
+                   G_IO_ERROR,
+                   G_IO_ERROR_INVALID_ARGUMENT,
+                   "Bus type %d is not available for application",
+                   bus_type);
+      return 0;
+    }
+
+  data = g_slice_new0 (RegObjData);
+  data->ref_count = 1;
+  data->self = self;
+  g_object_ref (self);
+  data->user_data = user_data;
+  data->user_data_free_func = user_data_free_func;
+  data->method_call_func = method_call_func;
+  data->bus_type = bus_type;
+
+  reg_id = g_dbus_connection_register_object (conn,
+                                              object_path,
+                                              introspection_data->interfaces[0],
+                                              &self->priv->reg_obj_vtable,
+                                              data,
+                                              reg_obj_data_unref,
+                                              error);
+
+  if (reg_id > 0 && bus_type == LIA_BUS_PUBLIC)
+    mirror_public_object (self,
+                          reg_id,
+                          object_path,
+                          introspection_data->interfaces[0],
+                          data);
+
+  return reg_id;
+}
+
+gboolean
+lia_application_unregister_object (LiaApplication *self,
+                                   guint           bus_type,
+                                   guint           registration_id)
+{
+  g_return_val_if_fail (LIA_IS_APPLICATION (self), FALSE);
+  g_return_val_if_fail (registration_id > 0, FALSE);
+
+  if (bus_type == LIA_BUS_PUBLIC)
+    unmirror_public_object (self, registration_id);
+
+  if (self->priv->bus_conn[bus_type] != NULL)
+    {
+      return g_dbus_connection_unregister_object (self->priv->bus_conn[bus_type],
+                                                  registration_id);
+    }
+  else
+    {
+      return FALSE;
+    }
+}
+
+/**
+ * lia_application_emit_signal:
+ * @destination_bus_name: (allow-none):
+ * @parameters: (allow-none): A tuple #GVariant with the signal's parameters
+ *
+ * Emits a D-Bus signal on one of the application's buses. Use it instead
+ * of g_dbus_connection_emit_signal() on the connection returned by
+ * lia_application_get_bus(), which on a sharded public bus only reaches
+ * the peers of the first shard.
+ *
+ * On the public bus, broadcasts and signals to a well-known name are
+ * emitted on every shard. Signals to a unique name go to the shard the
+ * name last called the application from, or to the first shard if it
+ * never did, since unique names are only meaningful within one shard.
+ *
+ * Returns: %TRUE on success, %FALSE on error.
+ **/
+gboolean
+lia_application_emit_signal (LiaApplication  *self,
+                             LiaBusType       bus_type,
+                             const gchar     *destination_bus_name,
+                             const gchar     *object_path,
+                             const gchar     *interface_name,
+                             const gchar     *signal_name,
+                             GVariant        *parameters,
+                             GError         **error)
+{
+  GDBusConnection *conn;
+  gboolean result;
+
+  g_return_val_if_fail (LIA_IS_APPLICATION (self), FALSE);
+  g_return_val_if_fail (bus_type >= LIA_BUS_PRIVATE &&
+                        bus_type <= LIA_BUS_PUBLIC, FALSE);
+  g_return_val_if_fail (object_path != NULL, FALSE);
+  g_return_val_if_fail (interface_name != NULL, FALSE);
+  g_return_val_if_fail (signal_name != NULL, FALSE);
+
+  conn = self->priv->bus_conn[bus_type];
+  if (conn == NULL)
+    {
+      g_set_error (error,
+                   G_IO_ERROR,
+                   G_IO_ERROR_INVALID_ARGUMENT,
+                   "Bus type %d is not available for application",
+                   bus_type);
+      return FALSE;
+    }
+
+  if (parameters != NULL)
+    g_variant_ref_sink (parameters);
+
+  /* a unique name that called us is known to be on the shard it called
+     from */
+  if (destination_bus_name != NULL &&
+      destination_bus_name[0] == ':' &&
+      self->priv->caller_cache[bus_type] != NULL)
+    {
+      CallerCacheEntry *entry;
+
+      entry = g_hash_table_lookup (self->priv->caller_cache[bus_type],
+                                   destination_bus_name);
+      if (entry != NULL)
+        conn = entry->conn;
+    }
+
+  result = g_dbus_connection_emit_signal (conn,
+                                          destination_bus_name,
+                                          object_path,
+                                          interface_name,
+                                          signal_name,
+                                          parameters,
+                                          error);
+
+  if (bus_type == LIA_BUS_PUBLIC &&
+      (destination_bus_name == NULL || destination_bus_name[0] != ':'))
+    {
+      emit_signal_on_shards (self,
+                             destination_bus_name,
+                             object_path,
+                             interface_name,
+                             signal_name,
+                             parameters);
+    }
+
+  if (parameters != NULL)
+    g_variant_unref (parameters);
+
+  return result;
+}
+
+/**
+ * lia_application_emit_signal_coalesced:
+ * @destination_bus_name: (allow-none):
+ * @parameters: (allow-none): A tuple #GVariant with the signal's parameters
+ * @window_ms: Length of the coalescing window in milliseconds
+ * @mode: A #LiaCoalesceMode
+ *
+ * Emits a D-Bus signal, coalescing it with other emissions of the same
+ * signal on the same object. The first emission goes out immediately
+ * and opens a window of @window_ms milliseconds. Emissions within the
+ * window are merged according to @mode and sent together when the
+ * window elapses. The output rate of each signal is thus bounded to one
+ * per window, regardless of how often it is emitted. Signals are sent
+ * as with lia_application_emit_signal().
+ *
+ * Signals sent to a web peer's unique name only reach it if the peer
+ * has a bus connection of its own, see lia_application_set_call_limits().
+ *
+ * Returns: %TRUE on success, %FALSE on error.
+ **/
+gboolean
+lia_application_emit_signal_coalesced (LiaApplication   *self,
+                                       LiaBusType        bus_type,
+                                       const gchar      *destination_bus_name,
+                                       const gchar      *object_path,
+                                       const gchar      *interface_name,
+                                       const gchar      *signal_name,
+                                       GVariant         *parameters,
+                                       guint             window_ms,
+                                       LiaCoalesceMode   mode,
+                                       GError          **error)
+{
+  CoalescedSignal *data;
+  gchar *key;
+  GError *_error = NULL;
+
+  g_return_val_if_fail (LIA_IS_APPLICATION (self), FALSE);
+  g_return_val_if_fail (bus_type >= LIA_BUS_PRIVATE &&
+                        bus_type <= LIA_BUS_PUBLIC, FALSE);
+  g_return_val_if_fail (object_path != NULL, FALSE);
+  g_return_val_if_fail (interface_name != NULL, FALSE);
+  g_return_val_if_fail (signal_name != NULL, FALSE);
+  g_return_val_if_fail (window_ms > 0, FALSE);
+
+  if (parameters == NULL)
+    parameters = g_variant_new ("()");
+  g_variant_ref_sink (parameters);
+
+  key = g_strdup_printf ("%d|%s|%s|%s|%s",
+                         bus_type,
+                         destination_bus_name != NULL ? destination_bus_name : "",
+                         object_path,
+                         interface_name,
+                         signal_name);
+
+  data = g_hash_table_lookup (self->priv->coalesced_signals, key);
+  if (data == NULL)
+    {
+      data = g_slice_new0 (CoalescedSignal);
+      data->self = self;
+      data->key = key;
+      data->bus_type = bus_type;
+      data->destination = g_strdup (destination_bus_name);
+      data->object_path = g_strdup (object_path);
+      data->interface_name = g_strdup (interface_name);
+      data->signal_name = g_strdup (signal_name);
+      data->mode = mode;
+      data->window_ms = window_ms;
+
+      if (mode == LIA_COALESCE_ACCUMULATE)
+        data->values =
+          g_ptr_array_new_with_free_func ((GDestroyNotify) g_variant_unref);
+
+      g_hash_table_insert (self->priv->coalesced_signals, data->key, data);
+      key = NULL;
+    }
+
+  g_free (key);
+
+  if (data->mode == LIA_COALESCE_ACCUMULATE)
+    {
+      if (data->values->len > 0 &&
+          ! g_variant_is_of_type (parameters,
+                                  g_variant_get_type (data->values->pdata[0])))
+        {
+          g_set_error (error,
+                       G_IO_ERROR,
+                       G_IO_ERROR_INVALID_ARGUMENT,
+                       "Accumulated values of signal '%s' must all have the same type",
+                       signal_name);
+          g_variant_unref (parameters);
+          return FALSE;
+        }
+
+      g_ptr_array_add (data->values, parameters);
+    }
+  else
+    {
+      if (data->last_value != NULL)
+        g_variant_unref (data->last_value);
+      data->last_value = parameters;
+    }
+
+  /* no window open, emit right away and open one */
+  if (data->src_id == 0)
+    {
+      flush_coalesced_signal (data, &_error);
+
+      data->src_id = g_timeout_add (data->window_ms,
+                                    on_coalescing_window_elapsed,
+                                    data);
+
+      if (_error != NULL)
+        {
+          g_propagate_error (error, _error);
+          return FALSE;
+        }
+    }
+
+  return TRUE;
+}
+
+/**
+ * lia_application_new_download_fd:
+ * @name: A name for the file, used only for debugging purposes
+ *
+ * Creates an anonymous in-memory file where an application can write
+ * a large payload (an export, an image, etc), to later hand it to the
+ * Webview with lia_application_offer_download(). Falls back to an
+ * unlinked temporary file where memfd is not available.
+ *
+ * Returns: A file descriptor owned by the caller, or -1 on error.
+ **/
+gint
+lia_application_new_download_fd (LiaApplication  *self,
+                                 const gchar     *name,
+                                 GError         **error)
+{
+  gint fd = -1;
+  gchar *path;
+
+  g_return_val_if_fail (LIA_IS_APPLICATION (self), -1);
+
+#ifdef MFD_ALLOW_SEALING
+  fd = memfd_create (name != NULL ? name : "lia-download",
+                     MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (fd >= 0)
+    return fd;
+#endif
+
+  fd = g_file_open_tmp ("lia-download-XXXXXX", &path, error);
+  if (fd >= 0)
+    {
+      unlink (path);
+      g_free (path);
+    }
+
+  return fd;
+}
+
+static void
+on_download_offered (GObject      *obj,
+                     GAsyncResult *res,
+                     gpointer      user_data)
+{
+  GSimpleAsyncResult *result = G_SIMPLE_ASYNC_RESULT (user_data);
+  GVariant *ret;
+  GError *error = NULL;
+
+  ret = g_dbus_connection_call_with_unix_fd_list_finish (G_DBUS_CONNECTION (obj),
+                                                         NULL,
+                                                         res,
+                                                         &error);
+  if (ret == NULL)
+    {
+      g_simple_async_result_take_error (result, error);
+    }
+  else
+    {
+      gchar *url_path;
+
+      g_variant_get (ret, "(s)", &url_path);
+      g_simple_async_result_set_op_res_gpointer (result, url_path, g_free);
+      g_variant_unref (ret);
+    }
+
+  g_simple_async_result_complete (result);
+  g_object_unref (result);
+}
+
+/**
+ * lia_application_offer_download:
+ * @fd: A file descriptor with the payload, as returned by
+ *   lia_application_new_download_fd()
+ * @content_type: (allow-none): MIME type of the payload
+ * @file_name: (allow-none): File name suggested to the web client
+ * @bus_type: The least privileged bus whose web peers can download it
+ * @cancellable: (allow-none):
+ * @callback: (scope async):
+ * @user_data: (closure):
+ *
+ * Hands @fd to the Webview over the private bus, so that web clients can
+ * download its contents through HTTP. The payload is streamed from the
+ * file descriptor directly, without being marshalled through D-Bus or
+ * the bridge. If @fd is a memfd it is sealed against further
+ * modification first. The caller keeps ownership of @fd.
+ *
+ * The URL path to download the payload is obtained with
+ * lia_application_offer_download_finish(). Downloads are one-shot and
+ * expire if not requested within a few minutes.
+ **/
+void
+lia_application_offer_download (LiaApplication      *self,
+                                gint                 fd,
+                                const gchar         *content_type,
+                                const gchar         *file_name,
+                                LiaBusType           bus_type,
+                                GCancellable        *cancellable,
+                                GAsyncReadyCallback  callback,
+                                gpointer             user_data)
+{
+  GSimpleAsyncResult *res;
+  GUnixFDList *fd_list;
+  gint fd_index;
+  gchar *webview_service_name;
+  GError *error = NULL;
+
+  g_return_if_fail (LIA_IS_APPLICATION (self));
+  g_return_if_fail (fd >= 0);
+
+  res = g_simple_async_result_new (G_OBJECT (self),
+                                   callback,
+                                   user_data,
+                                   lia_application_offer_download);
+
+  if (self->priv->bus_conn[LIA_BUS_PRIVATE] == NULL)
+    {
+      g_simple_async_result_set_error (res,
+                                       G_IO_ERROR,
+                                       G_IO_ERROR_NOT_CONNECTED,
+                                       "Private bus is not available for application");
+      g_simple_async_result_complete_in_idle (res);
+      g_object_unref (res);
+      return;
+    }
 
-      g_print ("'%s' application initialized successfully\n",
-               self->priv->service_name);
+#ifdef F_ADD_SEALS
+  /* best effort, fails for anything but a memfd */
+  fcntl (fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+#endif
 
-      /* fire "ready" signal */
-      g_signal_emit (self, lia_application_signals[SIGNAL_READY], 0, NULL);
+  fd_list = g_unix_fd_list_new ();
+  fd_index = g_unix_fd_list_append (fd_list, fd, &error);
+  if (fd_index < 0)
+    {
+      g_simple_async_result_take_error (res, error);
+      g_simple_async_result_complete_in_idle (res);
+      g_object_unref (res);
+      g_object_unref (fd_list);
+      return;
     }
+
+  webview_service_name =
+    g_strdup_printf ("%s." LIA_WEBVIEW_SERVICE_NAME_SUFFIX,
+                     self->priv->base_service_name);
+
+  g_dbus_connection_call_with_unix_fd_list (self->priv->bus_conn[LIA_BUS_PRIVATE],
+                                            webview_service_name,
+                                            LIA_WEBVIEW_OBJ_PATH,
+                                            LIA_WEBVIEW_IFACE_NAME,
+                                            "OfferDownload",
+                                            g_variant_new ("(hssn)",
+                                                           fd_index,
+                                                           content_type != NULL ? content_type : "",
+                                                           file_name != NULL ? file_name : "",
+                                                           bus_type),
+                                            G_VARIANT_TYPE ("(s)"),
+                                            G_DBUS_CALL_FLAGS_NONE,
+                                            -1,
+                                            fd_list,
+                                            cancellable,
+                                            on_download_offered,
+                                            res);
+
+  g_free (webview_service_name);
+  g_object_unref (fd_list);
 }
 
-static void
-free_registered_object_data (gpointer _data)
+/**
+ * lia_application_offer_download_finish:
+ *
+ * Returns: (transfer full): The URL path of the download, or %NULL on error.
+ **/
+gchar *
+lia_application_offer_download_finish (LiaApplication  *self,
+                                       GAsyncResult    *result,
+                                       GError         **error)
 {
-  RegObjData *data = _data;
+  GSimpleAsyncResult *res;
 
-  g_object_unref (data->self);
+  g_return_val_if_fail (LIA_IS_APPLICATION (self), NULL);
+  g_return_val_if_fail (g_simple_async_result_is_valid (result,
+                                                        G_OBJECT (self),
+                                                        lia_application_offer_download),
+                        NULL);
 
-  if (data->user_data != NULL && data->user_data_free_func != NULL)
-    data->user_data_free_func (data->user_data);
+  res = G_SIMPLE_ASYNC_RESULT (result);
 
-  g_slice_free (RegObjData, data);
+  if (g_simple_async_result_propagate_error (res, error))
+    return NULL;
+
+  return g_strdup (g_simple_async_result_get_op_res_gpointer (res));
 }
 
-static void
-on_bus_method_call (GDBusConnection       *connection,
-                    const gchar           *sender,
-                    const gchar           *object_path,
-                    const gchar           *interface_name,
-                    const gchar           *method_name,
-                    GVariant              *parameters,
-                    GDBusMethodInvocation *invocation,
-                    gpointer               user_data)
+/**
+ * lia_application_set_bus_priority:
+ * @bus_type: A #LiaBusType
+ * @priority: The main loop priority to handle calls from @bus_type at
+ *
+ * Sets the priority at which method calls on objects registered on
+ * @bus_type are handled. Calls on buses with a priority lower than
+ * %G_PRIORITY_DEFAULT are queued as they arrive and handled one per main
+ * loop iteration, only when no source of higher priority is ready. Calls
+ * arriving while too many are queued on their bus are rejected with a
+ * %LIA_DBUS_ERROR_LIMITS_EXCEEDED error. All buses run at
+ * %G_PRIORITY_DEFAULT by default. Lowering the priority of the protected
+ * and public buses keeps a flood of calls on them from delaying private
+ * bus traffic.
+ **/
+void
+lia_application_set_bus_priority (LiaApplication *self,
+                                  LiaBusType      bus_type,
+                                  gint            priority)
 {
-  RegObjData *data = user_data;
+  g_return_if_fail (LIA_IS_APPLICATION (self));
+  g_return_if_fail (bus_type >= LIA_BUS_PRIVATE &&
+                    bus_type <= LIA_BUS_PUBLIC);
 
-  /* @TODO: resolve caller_id from 'sender'. By now use 'sender' itself */
+  self->priv->bus_priority[bus_type] = priority;
 
-  g_debug ("method called %p", data->method_call_func);
+  if (self->priv->deferred_calls_src_id[bus_type] > 0)
+    {
+      GSource *src;
 
-  data->method_call_func (data->self,
-                          data->bus_type,
-                          sender,
-                          object_path,
-                          interface_name,
-                          method_name,
-                          parameters,
-                          invocation,
-                          data->user_data);
+      src = g_main_context_find_source_by_id (NULL,
+                                  self->priv->deferred_calls_src_id[bus_type]);
+      if (src != NULL)
+        g_source_set_priority (src, priority);
+    }
 }
 
-/* public methods */
-
 gint
-lia_application_run (LiaApplication *self)
+lia_application_get_bus_priority (LiaApplication *self,
+                                  LiaBusType      bus_type)
 {
-  g_return_val_if_fail (LIA_IS_APPLICATION (self), -1);
-
-  if (! self->priv->initialized)
-    {
-      self->priv->initialized = TRUE;
-
-      g_async_initable_init_async (G_ASYNC_INITABLE (self),
-                                   G_PRIORITY_DEFAULT,
-                                   NULL,
-                                   on_initialized,
-                                   self);
-    }
+  g_return_val_if_fail (LIA_IS_APPLICATION (self), G_PRIORITY_DEFAULT);
+  g_return_val_if_fail (bus_type >= LIA_BUS_PRIVATE &&
+                        bus_type <= LIA_BUS_PUBLIC, G_PRIORITY_DEFAULT);
 
-  return evd_daemon_run (self->priv->daemon, NULL);
+  return self->priv->bus_priority[bus_type];
 }
 
+/**
+ * lia_application_set_call_deadline:
+ * @bus_type: A #LiaBusType
+ * @timeout_ms: Maximum time in milliseconds a call from @bus_type may take,
+ *   or 0 for no deadline
+ *
+ * Sets the deadline of method calls on objects registered on @bus_type,
+ * counted from the moment a call is dispatched to its
+ * #LiaBusMethodCallFunc. When it expires, the cancellable returned by
+ * lia_application_get_call_cancellable() is cancelled.
+ **/
 void
-lia_application_quit (LiaApplication *self, gint exit_code)
+lia_application_set_call_deadline (LiaApplication *self,
+                                   LiaBusType      bus_type,
+                                   guint           timeout_ms)
 {
   g_return_if_fail (LIA_IS_APPLICATION (self));
+  g_return_if_fail (bus_type >= LIA_BUS_PRIVATE &&
+                    bus_type <= LIA_BUS_PUBLIC);
 
-  evd_daemon_quit (self->priv->daemon, exit_code);
+  self->priv->call_deadline[bus_type] = timeout_ms;
 }
 
 /**
- * lia_application_get_service_name:
+ * lia_application_get_call_cancellable:
+ * @invocation: The #GDBusMethodInvocation passed to a #LiaBusMethodCallFunc
  *
- * Returns: (transfer none):
+ * Returns a #GCancellable that is cancelled when the call represented by
+ * @invocation is abandoned: either because the caller left the bus, as
+ * happens when a web peer disconnects and its bridged connection is
+ * closed, or because the call's deadline expired (see
+ * lia_application_set_call_deadline()). Handlers doing long or
+ * asynchronous work should pass it along and stop as soon as it is
+ * cancelled. The invocation must still be returned.
+ *
+ * Returns: (transfer none) (allow-none): A #GCancellable valid until
+ *   @invocation is returned, or %NULL if the call is not tracked, as
+ *   happens with calls received on peer-to-peer connections.
  **/
-const gchar *
-lia_application_get_service_name (LiaApplication *self)
+GCancellable *
+lia_application_get_call_cancellable (LiaApplication        *self,
+                                      GDBusMethodInvocation *invocation)
 {
+  InFlightCall *data;
+
   g_return_val_if_fail (LIA_IS_APPLICATION (self), NULL);
+  g_return_val_if_fail (G_IS_DBUS_METHOD_INVOCATION (invocation), NULL);
 
-  return self->priv->service_name;
+  data = g_object_get_qdata (G_OBJECT (invocation), in_flight_call_quark);
+  if (data == NULL)
+    return NULL;
+
+  return data->cancellable;
 }
 
 /**
- * lia_application_get_core_service_name:
+ * lia_application_set_call_limits:
+ * @max_calls_per_caller: Maximum number of calls from a single caller being
+ *   handled at the same time, or 0 for no limit
+ * @max_calls_per_object: Maximum number of calls on a single registered
+ *   object being handled at the same time, or 0 for no limit
+ * @max_queued_per_caller: Maximum number of calls from a single caller
+ *   waiting for their turn, or -1 for no limit
  *
- * Returns: (transfer none):
+ * Limits the method calls on registered objects that are handled
+ * concurrently. Calls over the limits wait in a queue per caller, and
+ * queues are served round-robin as in-flight calls return, so a single
+ * caller flooding the application cannot starve the others. Calls not
+ * fitting in their caller's queue are rejected with a
+ * %LIA_DBUS_ERROR_LIMITS_EXCEEDED error.
+ *
+ * A call is in flight from the moment it is dispatched to its
+ * #LiaBusMethodCallFunc until its #GDBusMethodInvocation is returned.
+ * Current counters are exported through the GetCallStats method of the
+ * application's stats object.
+ *
+ * Web peers multiplexed by the Webview onto a shared bus connection
+ * look like a single caller. Installed applications relying on telling
+ * web peers apart declare PeerIdentity in their application file, which
+ * keeps core from configuring the multiplexer.
  **/
-const gchar *
-lia_application_get_core_service_name (LiaApplication *self)
+void
+lia_application_set_call_limits (LiaApplication *self,
+                                 guint           max_calls_per_caller,
+                                 guint           max_calls_per_object,
+                                 gint            max_queued_per_caller)
 {
-  g_return_val_if_fail (LIA_IS_APPLICATION (self), NULL);
+  g_return_if_fail (LIA_IS_APPLICATION (self));
+
+  self->priv->max_calls_per_caller = max_calls_per_caller;
+  self->priv->max_calls_per_object = max_calls_per_object;
+  self->priv->max_queued_per_caller = max_queued_per_caller;
 
-  return g_getenv (LIA_ENV_KEY_CORE_SERVICE_NAME);
+  /* raised limits might let queued calls through */
+  if (! g_queue_is_empty (self->priv->ready_callers) &&
+      self->priv->serve_calls_src_id == 0)
+    {
+      self->priv->serve_calls_src_id = g_idle_add (serve_queued_calls, self);
+    }
 }
 
 /**
- * lia_application_get_base_service_name:
+ * lia_application_resolve_caller_identity:
+ * @bus_type: The bus the call was received on
+ * @caller_id: The caller id passed to the #LiaBusMethodCallFunc
+ * @cancellable: (allow-none):
+ * @callback: (allow-none):
+ * @user_data: (allow-none):
  *
- * Returns: (transfer none):
+ * Resolves the identity of a caller of a registered object, asking the
+ * bus for its credentials the first time it is requested. Identities are
+ * cached until the caller leaves the bus, so later requests complete
+ * without a D-Bus round trip.
  **/
-const gchar *
-lia_application_get_base_service_name (LiaApplication *self)
+void
+lia_application_resolve_caller_identity (LiaApplication      *self,
+                                         LiaBusType           bus_type,
+                                         const gchar         *caller_id,
+                                         GCancellable        *cancellable,
+                                         GAsyncReadyCallback  callback,
+                                         gpointer             user_data)
 {
-  g_return_val_if_fail (LIA_IS_APPLICATION (self), NULL);
+  GSimpleAsyncResult *res;
+  CallerCacheEntry *entry = NULL;
 
-  return self->priv->base_service_name;
+  g_return_if_fail (LIA_IS_APPLICATION (self));
+  g_return_if_fail (bus_type >= LIA_BUS_PRIVATE && bus_type <= LIA_BUS_PUBLIC);
+  g_return_if_fail (caller_id != NULL);
+
+  res = g_simple_async_result_new (G_OBJECT (self),
+                                   callback,
+                                   user_data,
+                                   lia_application_resolve_caller_identity);
+  g_simple_async_result_set_check_cancellable (res, cancellable);
+
+  if (self->priv->caller_cache[bus_type] != NULL)
+    entry = g_hash_table_lookup (self->priv->caller_cache[bus_type], caller_id);
+
+  if (entry == NULL)
+    {
+      g_simple_async_result_set_error (res,
+                                       G_IO_ERROR,
+                                       G_IO_ERROR_NOT_FOUND,
+                                       "Unknown caller '%s'",
+                                       caller_id);
+      g_simple_async_result_complete_in_idle (res);
+      g_object_unref (res);
+      return;
+    }
+
+  if (entry->resolved)
+    {
+      g_simple_async_result_set_op_res_gpointer (res,
+                                                 lia_caller_identity_ref (entry->identity),
+                                                 (GDestroyNotify) lia_caller_identity_unref);
+      g_simple_async_result_complete_in_idle (res);
+      g_object_unref (res);
+      return;
+    }
+
+  g_queue_push_tail (entry->identity_waiters, res);
+
+  if (! entry->resolving)
+    {
+      entry->resolving = TRUE;
+      resolve_caller (self, entry);
+    }
 }
 
 /**
- * lia_application_get_bus_address:
+ * lia_application_resolve_caller_identity_finish:
  *
- * Returns: (transfer none):
+ * Returns: (transfer full): The #LiaCallerIdentity of the caller, or
+ *   %NULL on error.
  **/
-const gchar *
-lia_application_get_bus_address (LiaApplication *self, LiaBusType bus_type)
+LiaCallerIdentity *
+lia_application_resolve_caller_identity_finish (LiaApplication  *self,
+                                                GAsyncResult    *result,
+                                                GError         **error)
 {
+  GSimpleAsyncResult *res;
+
   g_return_val_if_fail (LIA_IS_APPLICATION (self), NULL);
-  g_return_val_if_fail (bus_type >= LIA_BUS_PRIVATE &&
-                        bus_type <= LIA_BUS_PUBLIC, NULL);
+  g_return_val_if_fail (g_simple_async_result_is_valid (result,
+                                                        G_OBJECT (self),
+                                                        lia_application_resolve_caller_identity),
+                        NULL);
 
-  return self->priv->bus_addr[bus_type];
+  res = G_SIMPLE_ASYNC_RESULT (result);
+
+  if (g_simple_async_result_propagate_error (res, error))
+    return NULL;
+
+  return lia_caller_identity_ref (g_simple_async_result_get_op_res_gpointer (res));
 }
 
 /**
- * lia_application_get_bus:
+ * lia_application_get_caller_identity:
+ * @bus_type: The bus the call was received on
+ * @caller_id: The caller id passed to the #LiaBusMethodCallFunc
  *
- * Returns: (transfer none):
+ * Returns the cached identity of a caller, if it was resolved already
+ * (see lia_application_resolve_caller_identity()). Never involves a
+ * D-Bus round trip.
+ *
+ * Returns: (transfer none) (allow-none): A #LiaCallerIdentity, or %NULL
+ * if @caller_id is not known or its identity was not resolved yet.
  **/
-GDBusConnection *
-lia_application_get_bus (LiaApplication *self, LiaBusType bus_type)
+LiaCallerIdentity *
+lia_application_get_caller_identity (LiaApplication *self,
+                                     LiaBusType      bus_type,
+                                     const gchar    *caller_id)
 {
+  CallerCacheEntry *entry;
+
   g_return_val_if_fail (LIA_IS_APPLICATION (self), NULL);
   g_return_val_if_fail (bus_type >= LIA_BUS_PRIVATE &&
                         bus_type <= LIA_BUS_PUBLIC, NULL);
+  g_return_val_if_fail (caller_id != NULL, NULL);
 
-  return self->priv->bus_conn[bus_type];
+  if (self->priv->caller_cache[bus_type] == NULL)
+    return NULL;
+
+  entry = g_hash_table_lookup (self->priv->caller_cache[bus_type], caller_id);
+  if (entry == NULL || ! entry->resolved)
+    return NULL;
+
+  return entry->identity;
 }
 
 /**
- * lia_application_register_object:
- * @method_call_func: (scope async) (closure user_data):
- * @user_data: (allow-none) (closure):
- * @user_data_free_func: (allow-none) (type any):
+ * lia_application_get_startup_trace:
  *
- * Returns:
+ * Returns the timestamped spans recorded during application startup, as
+ * an array of (phase, start offset, duration) tuples with times in
+ * microseconds relative to the start of initialization. Spans that have
+ * not finished yet report a duration of -1.
+ *
+ * Returns: (transfer full): A #GVariant of type 'a(sxx)'.
  **/
-guint
-lia_application_register_object (LiaApplication        *self,
-                                 guint                  bus_type,
-                                 const gchar           *object_path,
-                                 const gchar           *interface_xml,
-                                 LiaBusMethodCallFunc   method_call_func,
-                                 gpointer               user_data,
-                                 GDestroyNotify         user_data_free_func,
-                                 GError               **error)
+GVariant *
+lia_application_get_startup_trace (LiaApplication *self)
 {
-  static GDBusNodeInfo *introspection_data = NULL;
-  gchar *introspection_xml;
-  guint reg_id = 0;
-  RegObjData *data = NULL;
-  GDBusConnection *conn = NULL;
+  GVariantBuilder builder;
+  guint i;
 
-  g_return_val_if_fail (LIA_IS_APPLICATION (self), 0);
-  g_return_val_if_fail (bus_type >= LIA_BUS_PRIVATE &&
-                        bus_type <= LIA_BUS_PUBLIC, 0);
-  g_return_val_if_fail (object_path != NULL, 0);
-  g_return_val_if_fail (interface_xml != NULL, 0);
-  g_return_val_if_fail (method_call_func != NULL, 0);
+  g_return_val_if_fail (LIA_IS_APPLICATION (self), NULL);
 
-  introspection_xml = g_strdup_printf ("<node>%s</node>", interface_xml);
-  introspection_data = g_dbus_node_info_new_for_xml (introspection_xml, error);
-  g_free (introspection_xml);
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(sxx)"));
 
-  if (introspection_data == NULL)
-    return 0;
+  for (i=0; i<self->priv->startup_trace->len; i++)
+    {
+      TraceSpan *span;
+
+      span = &g_array_index (self->priv->startup_trace, TraceSpan, i);
+      g_variant_builder_add (&builder,
+                             "(sxx)",
+                             span->phase,
+                             span->start - self->priv->startup_time,
+                             span->end > 0 ? span->end - span->start : -1);
+    }
 
-  conn = self->priv->bus_conn[bus_type];
-  if (conn == NULL)
+  return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
+
+/* private methods */
+
+void
+lia_application_set_bus_address (LiaApplication *self,
+                                 LiaBusType      bus_type,
+                                 const gchar    *address)
+{
+  g_return_if_fail (LIA_IS_APPLICATION (self));
+  g_return_if_fail (bus_type >= LIA_BUS_PRIVATE &&
+                    bus_type <= LIA_BUS_PUBLIC);
+
+  if (address == NULL ||
+      g_strcmp0 (address, self->priv->bus_addr[bus_type]) == 0)
     {
-      g_set_error (error,
-                   G_IO_ERROR,
-                   G_IO_ERROR_INVALID_ARGUMENT,
-                   "Bus type %d is not available for application",
-                   bus_type);
-      return 0;
+      return;
     }
 
-  data = g_slice_new0 (RegObjData);
-  data->self = self;
-  g_object_ref (self);
-  data->user_data = user_data;
-  data->user_data_free_func = user_data_free_func;
-  data->method_call_func = method_call_func;
-  data->bus_type = bus_type;
+  if (self->priv->bus_addr[bus_type] != NULL)
+    {
+      g_print ("%s bus moved to %s\n", get_bus_type_name (bus_type), address);
 
-  reg_id = g_dbus_connection_register_object (conn,
-                                              object_path,
-                                              introspection_data->interfaces[0],
-                                              &self->priv->reg_obj_vtable,
-                                              data,
-                                              free_registered_object_data,
-                                              error);
+      /* objects are exported again on the new connection through the
+         'export-objects' signal */
+      disconnect_bus (self, bus_type);
+      g_free (self->priv->bus_addr[bus_type]);
+    }
 
-  return reg_id;
+  self->priv->bus_addr[bus_type] = g_strdup (address);
+
+  /* start connecting right away if we are initializing, or reconnect if
+     we were already connected */
+  if (self->priv->async_result != NULL || self->priv->env_loaded)
+    connect_bus (self, bus_type);
 }
 
-gboolean
-lia_application_unregister_object (LiaApplication *self,
-                                   guint           bus_type,
-                                   guint           registration_id)
+/* Applies a configuration snapshot obtained from core's discovery
+   endpoint. Older snapshots than the current one are ignored. Buses are
+   connected as soon as their address is known, and reconnected if it
+   changes later on */
+void
+lia_application_set_config (LiaApplication *self,
+                            guint           version,
+                            GVariant       *config)
 {
-  g_return_val_if_fail (LIA_IS_APPLICATION (self), FALSE);
-  g_return_val_if_fail (registration_id > 0, FALSE);
+  static const gchar *BUS_ADDR_KEYS[3] = {
+    LIA_CONFIG_KEY_PRIVATE_BUS_ADDR,
+    LIA_CONFIG_KEY_PROTECTED_BUS_ADDR,
+    LIA_CONFIG_KEY_PUBLIC_BUS_ADDR
+  };
+
+  GVariant *old_config;
+  const gchar **shards = NULL;
+  gint i;
 
-  if (self->priv->bus_conn[bus_type] != NULL)
+  g_return_if_fail (LIA_IS_APPLICATION (self));
+  g_return_if_fail (g_variant_is_of_type (config, G_VARIANT_TYPE ("a{sv}")));
+
+  if (self->priv->config != NULL && version <= self->priv->config_version)
+    return;
+
+  old_config = self->priv->config;
+  self->priv->config = g_variant_ref_sink (config);
+  self->priv->config_version = version;
+
+  for (i=0; i<3; i++)
+    lia_application_set_bus_address (self,
+                                      i,
+                                      lia_application_get_config_string (self,
+                                                                         BUS_ADDR_KEYS[i]));
+
+  g_variant_lookup (self->priv->config,
+                    LIA_CONFIG_KEY_PUBLIC_BUS_SHARDS,
+                    "^a&s",
+                    &shards);
+  set_public_bus_shards (self, shards);
+  g_free (shards);
+
+  if (old_config != NULL)
+    g_variant_unref (old_config);
+
+  if (self->priv->load_env_result != NULL && config_is_complete (self))
     {
-      return g_dbus_connection_unregister_object (self->priv->bus_conn[bus_type],
-                                                  registration_id);
+      GSimpleAsyncResult *res = self->priv->load_env_result;
+
+      self->priv->load_env_result = NULL;
+      g_simple_async_result_complete (res);
+      g_object_unref (res);
     }
-  else
+}
+
+/* returns the current configuration snapshot, or NULL if none was
+   obtained yet (transfer none) */
+GVariant *
+lia_application_get_config (LiaApplication *self)
+{
+  g_return_val_if_fail (LIA_IS_APPLICATION (self), NULL);
+
+  return self->priv->config;
+}
+
+const gchar *
+lia_application_get_config_string (LiaApplication *self, const gchar *key)
+{
+  const gchar *value;
+
+  g_return_val_if_fail (LIA_IS_APPLICATION (self), NULL);
+
+  if (self->priv->config == NULL ||
+      ! g_variant_lookup (self->priv->config, key, "&s", &value))
     {
-      return FALSE;
+      return NULL;
     }
+
+  return value;
+}
+
+GDBusConnection *
+lia_application_get_discovery_connection (LiaApplication *self)
+{
+  g_return_val_if_fail (LIA_IS_APPLICATION (self), NULL);
+
+  return self->priv->discovery_conn;
+}
+
+guint
+lia_application_trace_begin (LiaApplication *self, const gchar *phase)
+{
+  TraceSpan span;
+
+  g_return_val_if_fail (LIA_IS_APPLICATION (self), 0);
+
+  span.phase = g_strdup (phase);
+  span.start = g_get_monotonic_time ();
+  span.end = 0;
+
+  g_array_append_val (self->priv->startup_trace, span);
+
+  /* span ids are 1-based so that 0 means no span */
+  return self->priv->startup_trace->len;
+}
+
+void
+lia_application_trace_end (LiaApplication *self, guint span_id)
+{
+  g_return_if_fail (LIA_IS_APPLICATION (self));
+
+  if (span_id == 0 || span_id > self->priv->startup_trace->len)
+    return;
+
+  g_array_index (self->priv->startup_trace, TraceSpan, span_id - 1).end =
+    g_get_monotonic_time ();
 }
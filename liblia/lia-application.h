@@ -27,6 +27,7 @@
 #include <gio/gio.h>
 
 #include <lia-defines.h>
+#include <lia-caller-identity.h>
 
 G_BEGIN_DECLS
 
@@ -34,11 +35,29 @@ typedef struct _LiaApplication LiaApplication;
 typedef struct _LiaApplicationClass LiaApplicationClass;
 typedef struct _LiaApplicationPrivate LiaApplicationPrivate;
 
+/**
+ * LiaCoalesceMode:
+ * @LIA_COALESCE_LAST_VALUE: Only the last value emitted within a window is
+ *   sent, with the signal's own parameters
+ * @LIA_COALESCE_ACCUMULATE: All values emitted within a window are sent
+ *   together as a single argument, an array of the signal's parameter
+ *   tuples. The signal must be declared accordingly.
+ *
+ * How signals emitted with lia_application_emit_signal_coalesced() are
+ * merged within a coalescing window.
+ **/
+typedef enum
+{
+  LIA_COALESCE_LAST_VALUE = 0,
+  LIA_COALESCE_ACCUMULATE = 1
+} LiaCoalesceMode;
+
 /**
  * LiaBusMethodCallFunc:
  * @app: The #LiaApplication
  * @bus_type:
- * @caller_id:
+ * @caller_id: The unique bus name of the caller. Its identity can be
+ *   resolved with lia_application_resolve_caller_identity()
  * @object_path:
  * @interface_name:
  * @method_name:
@@ -82,7 +101,13 @@ struct _LiaApplicationClass
                                     gchar          **pub_bus_addr,
                                     GError         **error);
 
-  gboolean (* load_env)            (LiaApplication  *self,
+  void     (* load_env_async)      (LiaApplication      *self,
+                                    gint                 io_priority,
+                                    GCancellable        *cancellable,
+                                    GAsyncReadyCallback  callback,
+                                    gpointer             user_data);
+  gboolean (* load_env_finish)     (LiaApplication  *self,
+                                    GAsyncResult    *result,
                                     gchar          **service_name,
                                     GError         **error);
 
@@ -93,6 +118,17 @@ struct _LiaApplicationClass
 
   void (* signal_ready)            (LiaApplication *self,
                                     gpointer        user_data);
+
+  gboolean (* signal_upload)       (LiaApplication *self,
+                                    GInputStream   *stream,
+                                    const gchar    *path,
+                                    const gchar    *content_type,
+                                    gint64          content_length,
+                                    LiaBusType      bus_type,
+                                    gpointer        user_data);
+
+  void (* signal_drain)            (LiaApplication *self,
+                                    gpointer        user_data);
 };
 
 #define LIA_TYPE_APPLICATION           (lia_application_get_type ())
@@ -131,6 +167,72 @@ gboolean          lia_application_unregister_object              (LiaApplication
                                                                   guint           bus_type,
                                                                   guint           registration_id);
 
+void              lia_application_set_bus_priority               (LiaApplication *self,
+                                                                  LiaBusType      bus_type,
+                                                                  gint            priority);
+gint              lia_application_get_bus_priority               (LiaApplication *self,
+                                                                  LiaBusType      bus_type);
+
+void              lia_application_set_call_deadline              (LiaApplication *self,
+                                                                  LiaBusType      bus_type,
+                                                                  guint           timeout_ms);
+GCancellable *    lia_application_get_call_cancellable           (LiaApplication        *self,
+                                                                  GDBusMethodInvocation *invocation);
+
+void              lia_application_set_call_limits                (LiaApplication *self,
+                                                                  guint           max_calls_per_caller,
+                                                                  guint           max_calls_per_object,
+                                                                  gint            max_queued_per_caller);
+
+void              lia_application_resolve_caller_identity        (LiaApplication      *self,
+                                                                  LiaBusType           bus_type,
+                                                                  const gchar         *caller_id,
+                                                                  GCancellable        *cancellable,
+                                                                  GAsyncReadyCallback  callback,
+                                                                  gpointer             user_data);
+LiaCallerIdentity * lia_application_resolve_caller_identity_finish (LiaApplication  *self,
+                                                                  GAsyncResult    *result,
+                                                                  GError         **error);
+LiaCallerIdentity * lia_application_get_caller_identity          (LiaApplication *self,
+                                                                  LiaBusType      bus_type,
+                                                                  const gchar    *caller_id);
+
+gboolean          lia_application_emit_signal                    (LiaApplication  *self,
+                                                                  LiaBusType       bus_type,
+                                                                  const gchar     *destination_bus_name,
+                                                                  const gchar     *object_path,
+                                                                  const gchar     *interface_name,
+                                                                  const gchar     *signal_name,
+                                                                  GVariant        *parameters,
+                                                                  GError         **error);
+gboolean          lia_application_emit_signal_coalesced          (LiaApplication   *self,
+                                                                  LiaBusType        bus_type,
+                                                                  const gchar      *destination_bus_name,
+                                                                  const gchar      *object_path,
+                                                                  const gchar      *interface_name,
+                                                                  const gchar      *signal_name,
+                                                                  GVariant         *parameters,
+                                                                  guint             window_ms,
+                                                                  LiaCoalesceMode   mode,
+                                                                  GError          **error);
+
+gint              lia_application_new_download_fd                (LiaApplication  *self,
+                                                                  const gchar     *name,
+                                                                  GError         **error);
+void              lia_application_offer_download                 (LiaApplication      *self,
+                                                                  gint                 fd,
+                                                                  const gchar         *content_type,
+                                                                  const gchar         *file_name,
+                                                                  LiaBusType           bus_type,
+                                                                  GCancellable        *cancellable,
+                                                                  GAsyncReadyCallback  callback,
+                                                                  gpointer             user_data);
+gchar *           lia_application_offer_download_finish          (LiaApplication  *self,
+                                                                  GAsyncResult    *result,
+                                                                  GError         **error);
+
+GVariant *        lia_application_get_startup_trace              (LiaApplication *self);
+
 G_END_DECLS
 
 #endif /* __LIA_APPLICATION_H__ */
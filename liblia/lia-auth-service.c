@@ -54,6 +54,9 @@ struct _LiaAuthServicePrivate
   guint bus_registration_id;
 
   GDBusInterfaceVTable bus_iface_vtable;
+  GDBusNodeInfo *introspection_data;
+
+  GHashTable *peer_registrations;
 };
 
 /* properties */
@@ -146,12 +149,36 @@ lia_auth_service_init (LiaAuthService *self)
   priv->bus_registration_id = 0;
 
   priv->bus_iface_vtable.method_call = on_bus_method_call;
+  priv->introspection_data = NULL;
+
+  priv->peer_registrations = g_hash_table_new_full (g_direct_hash,
+                                                    g_direct_equal,
+                                                    g_object_unref,
+                                                    NULL);
 }
 
+static void     on_peer_connection_closed          (GDBusConnection *connection,
+                                                    gboolean         remote_peer_vanished,
+                                                    GError          *error,
+                                                    gpointer         user_data);
+
 static void
 dispose (GObject *obj)
 {
   LiaAuthService *self = LIA_AUTH_SERVICE (obj);
+  GHashTableIter iter;
+  gpointer conn, reg_id;
+
+  g_hash_table_iter_init (&iter, self->priv->peer_registrations);
+  while (g_hash_table_iter_next (&iter, &conn, &reg_id))
+    {
+      g_signal_handlers_disconnect_by_func (conn,
+                                            on_peer_connection_closed,
+                                            self);
+      g_dbus_connection_unregister_object (G_DBUS_CONNECTION (conn),
+                                           GPOINTER_TO_UINT (reg_id));
+    }
+  g_hash_table_remove_all (self->priv->peer_registrations);
 
   if (self->priv->dbus_conn != NULL)
     {
@@ -169,7 +196,12 @@ dispose (GObject *obj)
 static void
 finalize (GObject *obj)
 {
-  //  LiaAuthService *self = LIA_AUTH_SERVICE (obj);
+  LiaAuthService *self = LIA_AUTH_SERVICE (obj);
+
+  if (self->priv->introspection_data != NULL)
+    g_dbus_node_info_unref (self->priv->introspection_data);
+
+  g_hash_table_unref (self->priv->peer_registrations);
 
   G_OBJECT_CLASS (lia_auth_service_parent_class)->finalize (obj);
 }
@@ -220,6 +252,26 @@ get_property (GObject    *obj,
     }
 }
 
+/* Shared by the bus method and the in-process API, so both paths
+   always authenticate the same way */
+static gboolean
+authenticate (LiaAuthService  *self,
+              const gchar     *user_name,
+              const gchar     *password,
+              const gchar     *domain,
+              gchar          **user_id,
+              gchar          **auth_token,
+              LiaBusType      *bus_type,
+              GError         **error)
+{
+  /* @TODO: actually authenticate the user */
+  *user_id = g_strdup ("elima@free-social.net");
+  *auth_token = g_strdup ("14r34625234f4323423432sdff4f32");
+  *bus_type = LIA_BUS_PRIVATE;
+
+  return TRUE;
+}
+
 static void
 on_bus_method_call (GDBusConnection       *connection,
                     const gchar           *sender,
@@ -230,16 +282,41 @@ on_bus_method_call (GDBusConnection       *connection,
                     GDBusMethodInvocation *invocation,
                     gpointer               user_data)
 {
-  GVariant *result;
-  //  LiaAuthService *self = LIA_AUTH_SERVICE (user_data);
+  LiaAuthService *self = LIA_AUTH_SERVICE (user_data);
+  const gchar *user_name;
+  const gchar *password;
+  const gchar *domain;
+  gchar *user_id;
+  gchar *auth_token;
+  LiaBusType bus_type;
+  GError *error = NULL;
 
   g_print ("method %s called\n", method_name);
-  result = g_variant_new ("(ssn)",
-                          "elima@free-social.net",
-                          "14r34625234f4323423432sdff4f32",
-                          LIA_BUS_PRIVATE);
 
-  g_dbus_method_invocation_return_value (invocation, result);
+  g_variant_get (parameters, "(&s&s&s)", &user_name, &password, &domain);
+
+  if (authenticate (self,
+                    user_name,
+                    password,
+                    domain,
+                    &user_id,
+                    &auth_token,
+                    &bus_type,
+                    &error))
+    {
+      g_dbus_method_invocation_return_value (invocation,
+                                             g_variant_new ("(ssn)",
+                                                            user_id,
+                                                            auth_token,
+                                                            bus_type));
+      g_free (user_id);
+      g_free (auth_token);
+    }
+  else
+    {
+      g_dbus_method_invocation_return_gerror (invocation, error);
+      g_error_free (error);
+    }
 }
 
 /*
@@ -267,7 +344,6 @@ init_async (GAsyncInitable      *initable,
 {
   LiaAuthService *self = LIA_AUTH_SERVICE (initable);
   GSimpleAsyncResult *res;
-  GDBusNodeInfo *introspection_data = NULL;
   GError *error = NULL;
 
   res = g_simple_async_result_new (G_OBJECT (self),
@@ -276,18 +352,18 @@ init_async (GAsyncInitable      *initable,
                                    init_async);
 
   /* register bus object */
-  introspection_data = g_dbus_node_info_new_for_xml (introspection_xml, &error);
-  if (introspection_data != NULL)
+  self->priv->introspection_data =
+    g_dbus_node_info_new_for_xml (introspection_xml, &error);
+  if (self->priv->introspection_data != NULL)
     {
       self->priv->bus_registration_id =
         g_dbus_connection_register_object (self->priv->dbus_conn,
                                            LIA_AUTH_SERVICE_OBJ_PATH,
-                                           introspection_data->interfaces[0],
+                                           self->priv->introspection_data->interfaces[0],
                                            &self->priv->bus_iface_vtable,
                                            self,
                                            NULL,
                                            &error);
-      g_dbus_node_info_unref (introspection_data);
     }
 
   if (error != NULL)
@@ -317,3 +393,167 @@ init_finish (GAsyncInitable  *initable,
   return (! g_simple_async_result_propagate_error (G_SIMPLE_ASYNC_RESULT (res),
                                                    error));
 }
+
+static void
+on_peer_connection_closed (GDBusConnection *connection,
+                           gboolean         remote_peer_vanished,
+                           GError          *error,
+                           gpointer         user_data)
+{
+  LiaAuthService *self = LIA_AUTH_SERVICE (user_data);
+  guint reg_id;
+
+  reg_id = GPOINTER_TO_UINT (g_hash_table_lookup (self->priv->peer_registrations,
+                                                  connection));
+  if (reg_id > 0)
+    g_dbus_connection_unregister_object (connection, reg_id);
+
+  g_signal_handlers_disconnect_by_func (connection,
+                                        on_peer_connection_closed,
+                                        self);
+  g_hash_table_remove (self->priv->peer_registrations, connection);
+}
+
+/* public methods */
+
+/**
+ * lia_auth_service_export_on_connection:
+ *
+ * Exports the auth service object on @connection, in addition to the
+ * bus connection it was created for. This is used to serve the service
+ * over direct peer-to-peer connections, where no bus daemon is involved.
+ * The object is unexported automatically when @connection is closed.
+ *
+ * Returns: %TRUE on success, %FALSE on error.
+ **/
+gboolean
+lia_auth_service_export_on_connection (LiaAuthService   *self,
+                                       GDBusConnection  *connection,
+                                       GError          **error)
+{
+  guint reg_id;
+
+  g_return_val_if_fail (LIA_IS_AUTH_SERVICE (self), FALSE);
+  g_return_val_if_fail (G_IS_DBUS_CONNECTION (connection), FALSE);
+  g_return_val_if_fail (self->priv->introspection_data != NULL, FALSE);
+
+  if (g_hash_table_lookup (self->priv->peer_registrations, connection) != NULL)
+    return TRUE;
+
+  reg_id =
+    g_dbus_connection_register_object (connection,
+                                       LIA_AUTH_SERVICE_OBJ_PATH,
+                                       self->priv->introspection_data->interfaces[0],
+                                       &self->priv->bus_iface_vtable,
+                                       self,
+                                       NULL,
+                                       error);
+  if (reg_id == 0)
+    return FALSE;
+
+  g_hash_table_insert (self->priv->peer_registrations,
+                       g_object_ref (connection),
+                       GUINT_TO_POINTER (reg_id));
+
+  g_signal_connect (connection,
+                    "closed",
+                    G_CALLBACK (on_peer_connection_closed),
+                    self);
+
+  return TRUE;
+}
+
+/**
+ * lia_auth_service_authenticate:
+ *
+ * Authenticates a user directly, without going through the bus. This is
+ * what a Webview running in the same process as core uses instead of
+ * calling the Authenticate method.
+ **/
+void
+lia_auth_service_authenticate (LiaAuthService      *self,
+                               const gchar         *user_name,
+                               const gchar         *password,
+                               const gchar         *domain,
+                               GCancellable        *cancellable,
+                               GAsyncReadyCallback  callback,
+                               gpointer             user_data)
+{
+  GSimpleAsyncResult *res;
+  gchar *user_id;
+  gchar *auth_token;
+  LiaBusType bus_type;
+  GError *error = NULL;
+
+  g_return_if_fail (LIA_IS_AUTH_SERVICE (self));
+  g_return_if_fail (user_name != NULL);
+
+  res = g_simple_async_result_new (G_OBJECT (self),
+                                   callback,
+                                   user_data,
+                                   lia_auth_service_authenticate);
+
+  if (authenticate (self,
+                    user_name,
+                    password != NULL ? password : "",
+                    domain != NULL ? domain : "",
+                    &user_id,
+                    &auth_token,
+                    &bus_type,
+                    &error))
+    {
+      GVariant *result;
+
+      result = g_variant_new ("(ssn)", user_id, auth_token, bus_type);
+      g_simple_async_result_set_op_res_gpointer (res,
+                                                 g_variant_ref_sink (result),
+                                                 (GDestroyNotify) g_variant_unref);
+
+      g_free (user_id);
+      g_free (auth_token);
+    }
+  else
+    {
+      g_simple_async_result_set_from_error (res, error);
+      g_error_free (error);
+    }
+
+  g_simple_async_result_complete_in_idle (res);
+  g_object_unref (res);
+}
+
+/**
+ * lia_auth_service_authenticate_finish:
+ *
+ * Returns: %TRUE on success, in which case @user_id and @auth_token are
+ * filled with newly allocated strings. %FALSE on error.
+ **/
+gboolean
+lia_auth_service_authenticate_finish (LiaAuthService  *self,
+                                      GAsyncResult    *res,
+                                      gchar          **user_id,
+                                      gchar          **auth_token,
+                                      LiaBusType      *bus_type,
+                                      GError         **error)
+{
+  GVariant *result;
+  gint16 _bus_type;
+
+  g_return_val_if_fail (LIA_IS_AUTH_SERVICE (self), FALSE);
+  g_return_val_if_fail (g_simple_async_result_is_valid (res,
+                                           G_OBJECT (self),
+                                           lia_auth_service_authenticate),
+                        FALSE);
+
+  if (g_simple_async_result_propagate_error (G_SIMPLE_ASYNC_RESULT (res),
+                                             error))
+    return FALSE;
+
+  result = g_simple_async_result_get_op_res_gpointer (G_SIMPLE_ASYNC_RESULT (res));
+  g_variant_get (result, "(ssn)", user_id, auth_token, &_bus_type);
+
+  if (bus_type != NULL)
+    *bus_type = (LiaBusType) _bus_type;
+
+  return TRUE;
+}
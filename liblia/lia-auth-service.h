@@ -26,6 +26,8 @@
 #include <glib-object.h>
 #include <gio/gio.h>
 
+#include <lia-defines.h>
+
 G_BEGIN_DECLS
 
 typedef struct _LiaAuthService LiaAuthService;
@@ -55,6 +57,24 @@ struct _LiaAuthServiceClass
 
 GType             lia_auth_service_get_type            (void) G_GNUC_CONST;
 
+gboolean          lia_auth_service_export_on_connection (LiaAuthService   *self,
+                                                         GDBusConnection  *connection,
+                                                         GError          **error);
+
+void              lia_auth_service_authenticate        (LiaAuthService      *self,
+                                                        const gchar         *user_name,
+                                                        const gchar         *password,
+                                                        const gchar         *domain,
+                                                        GCancellable        *cancellable,
+                                                        GAsyncReadyCallback  callback,
+                                                        gpointer             user_data);
+gboolean          lia_auth_service_authenticate_finish (LiaAuthService  *self,
+                                                        GAsyncResult    *res,
+                                                        gchar          **user_id,
+                                                        gchar          **auth_token,
+                                                        LiaBusType      *bus_type,
+                                                        GError         **error);
+
 G_END_DECLS
 
 #endif /* __LIA_AUTH_SERVICE_H__ */
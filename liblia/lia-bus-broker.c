@@ -0,0 +1,1771 @@
+/*
+ * lia-bus-broker.c
+ *
+ * This file is part of Lia <http://free-social.net/lia/>
+ *
+ * Copyright (C) 2012 Igalia S.L.
+ *
+ * Authors:
+ *   Eduardo Lima Mitev <elima@igalia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License at http://www.gnu.org/licenses/gpl-3.0.txt
+ * for more details.
+ */
+
+
+#include <string.h>
+#include <unistd.h>
+
+#include "lia-bus-broker.h"
+
+#define DBUS_SERVICE_NAME "org.freedesktop.DBus"
+#define DBUS_OBJ_PATH     "/org/freedesktop/DBus"
+#define DBUS_IFACE_NAME   "org.freedesktop.DBus"
+
+#define DBUS_ERROR_ACCESS_DENIED    DBUS_IFACE_NAME ".Error.AccessDenied"
+#define DBUS_ERROR_INVALID_ARGS     DBUS_IFACE_NAME ".Error.InvalidArgs"
+#define DBUS_ERROR_LIMITS_EXCEEDED  DBUS_IFACE_NAME ".Error.LimitsExceeded"
+#define DBUS_ERROR_MATCH_INVALID    DBUS_IFACE_NAME ".Error.MatchRuleInvalid"
+#define DBUS_ERROR_MATCH_NOT_FOUND  DBUS_IFACE_NAME ".Error.MatchRuleNotFound"
+#define DBUS_ERROR_NAME_HAS_NO_OWNER DBUS_IFACE_NAME ".Error.NameHasNoOwner"
+#define DBUS_ERROR_SERVICE_UNKNOWN  DBUS_IFACE_NAME ".Error.ServiceUnknown"
+#define DBUS_ERROR_UNKNOWN_METHOD   DBUS_IFACE_NAME ".Error.UnknownMethod"
+
+/* RequestName flags and replies */
+#define NAME_FLAG_ALLOW_REPLACEMENT 0x1
+#define NAME_FLAG_REPLACE_EXISTING  0x2
+#define NAME_FLAG_DO_NOT_QUEUE      0x4
+
+#define REQUEST_NAME_PRIMARY_OWNER  1
+#define REQUEST_NAME_IN_QUEUE       2
+#define REQUEST_NAME_EXISTS         3
+#define REQUEST_NAME_ALREADY_OWNER  4
+
+#define RELEASE_NAME_RELEASED       1
+#define RELEASE_NAME_NON_EXISTENT   2
+#define RELEASE_NAME_NOT_OWNER      3
+
+#include "lia-bus-match-rule.c"
+
+typedef struct
+{
+  LiaBusBroker *broker;
+  GDBusConnection *conn;
+  gchar *unique_name;
+  guint filter_id;
+
+  guint uid;
+  gint64 pid;
+
+  GList *names;
+  GList *match_rules;
+  gboolean closed;
+
+  /* replies this peer owes, as "caller|serial" -> caller */
+  GHashTable *expected_replies;
+  /* calls of this peer waiting for a reply */
+  guint pending_calls;
+  /* match rules with eavesdrop='true' */
+  guint eavesdrop_rules;
+
+  volatile gint ref_count;
+} Peer;
+
+typedef struct
+{
+  Peer *peer;
+  guint flags;
+} NameOwner;
+
+typedef struct
+{
+  gchar *name;
+
+  /* primary owner first, then the queue */
+  GList *owners;
+} NameEntry;
+
+/* The broker's state is only touched with 'lock' held. Messages are
+   routed from the connection filters, which run in GDBus' worker thread,
+   while connections are accepted and dropped in the thread that created
+   the broker. Messages are sent with g_dbus_connection_send_message(),
+   which only queues them, so holding the lock there is cheap. */
+struct _LiaBusBroker
+{
+  GDBusServer *server;
+  gchar *guid;
+  LiaBusBrokerPolicy policy;
+
+  GMutex lock;
+
+  GList *peer_list;
+  GHashTable *peers;
+  GHashTable *names;
+  guint next_peer_id;
+
+  /* connections, in total and per unix user */
+  guint num_peers;
+  GHashTable *peers_per_uid;
+  guint eavesdrop_rules;
+
+  guint64 routed_messages;
+};
+
+static void     remove_peer                  (LiaBusBroker *self,
+                                              Peer         *peer);
+
+static Peer *
+peer_ref (Peer *peer)
+{
+  g_atomic_int_inc (&peer->ref_count);
+
+  return peer;
+}
+
+static void
+peer_unref (gpointer _data)
+{
+  Peer *peer = _data;
+
+  if (! g_atomic_int_dec_and_test (&peer->ref_count))
+    return;
+
+  g_object_unref (peer->conn);
+  g_free (peer->unique_name);
+
+  g_list_free_full (peer->match_rules, free_match_rule);
+  g_list_free (peer->names);
+
+  g_hash_table_unref (peer->expected_replies);
+
+  g_slice_free (Peer, peer);
+}
+
+static void
+forget_expected_reply (gpointer _data)
+{
+  Peer *caller = _data;
+
+  caller->pending_calls--;
+  peer_unref (caller);
+}
+
+static void
+free_name_entry (gpointer _data)
+{
+  NameEntry *entry = _data;
+
+  g_free (entry->name);
+
+  g_slice_free (NameEntry, entry);
+}
+
+/* policy */
+
+static gboolean
+name_in_list (const gchar * const *list, const gchar *name)
+{
+  gint i;
+
+  if (list == NULL || name == NULL)
+    return FALSE;
+
+  for (i=0; list[i] != NULL; i++)
+    {
+      gsize len = strlen (list[i]);
+
+      if (len > 0 && list[i][len - 1] == '*')
+        {
+          if (strncmp (list[i], name, len - 1) == 0)
+            return TRUE;
+        }
+      else if (strcmp (list[i], name) == 0)
+        {
+          return TRUE;
+        }
+    }
+
+  return FALSE;
+}
+
+static gboolean
+policy_allows_send (LiaBusBroker *self,
+                    const gchar  *destination,
+                    Peer         *target)
+{
+  GList *node;
+
+  if (name_in_list (self->policy.allow_send_destination, destination))
+    return TRUE;
+
+  /* a message addressed to a unique name is also allowed if the receiver
+     owns any name we are allowed to send to, as dbus-daemon does */
+  for (node = target->names; node != NULL; node = node->next)
+    {
+      NameEntry *entry = node->data;
+
+      if (((NameOwner *) entry->owners->data)->peer == target &&
+          name_in_list (self->policy.allow_send_destination, entry->name))
+        {
+          return TRUE;
+        }
+    }
+
+  return FALSE;
+}
+
+/* sending */
+
+static void
+send_to_peer (Peer *peer, GDBusMessage *msg, gboolean preserve_serial)
+{
+  GError *error = NULL;
+
+  if (peer->closed)
+    return;
+
+  if (! g_dbus_connection_send_message (peer->conn,
+                                        msg,
+                                        preserve_serial ?
+                                        G_DBUS_SEND_MESSAGE_FLAGS_PRESERVE_SERIAL :
+                                        G_DBUS_SEND_MESSAGE_FLAGS_NONE,
+                                        NULL,
+                                        &error))
+    {
+      g_debug ("Error sending message to '%s': %s",
+               peer->unique_name,
+               error->message);
+      g_error_free (error);
+    }
+}
+
+static void
+forward_message (LiaBusBroker *self,
+                 Peer         *target,
+                 GDBusMessage *msg,
+                 const gchar  *sender,
+                 gboolean      preserve_serial)
+{
+  GDBusMessage *copy;
+  GError *error = NULL;
+
+  /* messages get locked when sent, so each receiver needs its own */
+  copy = g_dbus_message_copy (msg, &error);
+  if (copy == NULL)
+    {
+      g_debug ("Error copying message: %s", error->message);
+      g_error_free (error);
+      return;
+    }
+
+  g_dbus_message_set_sender (copy, sender);
+  send_to_peer (target, copy, preserve_serial);
+  g_object_unref (copy);
+}
+
+static void
+reply_driver_call (Peer *peer, GDBusMessage *call, GVariant *body)
+{
+  GDBusMessage *reply;
+
+  if (g_dbus_message_get_flags (call) & G_DBUS_MESSAGE_FLAGS_NO_REPLY_EXPECTED)
+    {
+      if (body != NULL)
+        g_variant_unref (g_variant_ref_sink (body));
+      return;
+    }
+
+  reply = g_dbus_message_new_method_reply (call);
+  g_dbus_message_set_sender (reply, DBUS_SERVICE_NAME);
+  g_dbus_message_set_destination (reply, peer->unique_name);
+  if (body != NULL)
+    g_dbus_message_set_body (reply, body);
+
+  send_to_peer (peer, reply, FALSE);
+  g_object_unref (reply);
+}
+
+static void
+reply_driver_error (Peer         *peer,
+                    GDBusMessage *call,
+                    const gchar  *error_name,
+                    const gchar  *format,
+                    ...)
+{
+  GDBusMessage *reply;
+  va_list args;
+
+  if (g_dbus_message_get_message_type (call) != G_DBUS_MESSAGE_TYPE_METHOD_CALL ||
+      (g_dbus_message_get_flags (call) & G_DBUS_MESSAGE_FLAGS_NO_REPLY_EXPECTED))
+    {
+      return;
+    }
+
+  va_start (args, format);
+  reply = g_dbus_message_new_method_error_valist (call, error_name, format, args);
+  va_end (args);
+
+  g_dbus_message_set_sender (reply, DBUS_SERVICE_NAME);
+  g_dbus_message_set_destination (reply, peer->unique_name);
+
+  send_to_peer (peer, reply, FALSE);
+  g_object_unref (reply);
+}
+
+static Peer *
+lookup_name_owner (LiaBusBroker *self, const gchar *name)
+{
+  NameEntry *entry;
+
+  if (name[0] == ':')
+    return g_hash_table_lookup (self->peers, name);
+
+  entry = g_hash_table_lookup (self->names, name);
+  if (entry == NULL)
+    return NULL;
+
+  return ((NameOwner *) entry->owners->data)->peer;
+}
+
+static const gchar *
+get_name_owner (const gchar *name, gpointer user_data)
+{
+  Peer *owner;
+
+  owner = lookup_name_owner (user_data, name);
+
+  return owner != NULL ? owner->unique_name : NULL;
+}
+
+/* Delivers a message addressed to @target to the peers eavesdropping on
+   it, if the policy allows eavesdropping */
+static void
+eavesdrop_message (LiaBusBroker *self,
+                   GDBusMessage *msg,
+                   const gchar  *sender,
+                   Peer         *target)
+{
+  GList *node;
+
+  if (! self->policy.allow_eavesdrop || self->eavesdrop_rules == 0)
+    return;
+
+  for (node = self->peer_list; node != NULL; node = node->next)
+    {
+      Peer *peer = node->data;
+      GList *rule_node;
+
+      if (peer == target ||
+          peer->eavesdrop_rules == 0 ||
+          peer->unique_name == NULL ||
+          peer->closed)
+        {
+          continue;
+        }
+
+      for (rule_node = peer->match_rules;
+           rule_node != NULL;
+           rule_node = rule_node->next)
+        {
+          MatchRule *rule = rule_node->data;
+
+          if (rule->eavesdrop &&
+              match_rule_matches (rule, msg, sender, get_name_owner, self))
+            {
+              forward_message (self, peer, msg, sender, TRUE);
+              break;
+            }
+        }
+    }
+}
+
+static void
+broadcast_signal (LiaBusBroker *self,
+                  GDBusMessage *msg,
+                  const gchar  *sender,
+                  gboolean      preserve_serial)
+{
+  GList *node;
+
+  for (node = self->peer_list; node != NULL; node = node->next)
+    {
+      Peer *peer = node->data;
+      GList *rule_node;
+
+      if (peer->unique_name == NULL || peer->closed)
+        continue;
+
+      for (rule_node = peer->match_rules;
+           rule_node != NULL;
+           rule_node = rule_node->next)
+        {
+          if (match_rule_matches (rule_node->data,
+                                  msg,
+                                  sender,
+                                  get_name_owner,
+                                  self))
+            {
+              forward_message (self, peer, msg, sender, preserve_serial);
+              break;
+            }
+        }
+    }
+}
+
+/* names */
+
+static void
+emit_driver_signal (LiaBusBroker *self,
+                    Peer         *destination,
+                    const gchar  *signal_name,
+                    GVariant     *args)
+{
+  GDBusMessage *msg;
+
+  msg = g_dbus_message_new_signal (DBUS_OBJ_PATH, DBUS_IFACE_NAME, signal_name);
+  g_dbus_message_set_sender (msg, DBUS_SERVICE_NAME);
+  g_dbus_message_set_body (msg, args);
+
+  if (destination != NULL)
+    {
+      /* unicast signals are delivered regardless of match rules */
+      g_dbus_message_set_destination (msg, destination->unique_name);
+      send_to_peer (destination, msg, FALSE);
+    }
+  else
+    {
+      broadcast_signal (self, msg, DBUS_SERVICE_NAME, FALSE);
+    }
+
+  g_object_unref (msg);
+}
+
+static void
+name_owner_changed (LiaBusBroker *self,
+                    const gchar  *name,
+                    Peer         *old_owner,
+                    Peer         *new_owner)
+{
+  emit_driver_signal (self,
+                      NULL,
+                      "NameOwnerChanged",
+                      g_variant_new ("(sss)",
+                                     name,
+                                     old_owner != NULL ? old_owner->unique_name : "",
+                                     new_owner != NULL ? new_owner->unique_name : ""));
+}
+
+static GList *
+find_name_owner (NameEntry *entry, Peer *peer)
+{
+  GList *node;
+
+  for (node = entry->owners; node != NULL; node = node->next)
+    if (((NameOwner *) node->data)->peer == peer)
+      return node;
+
+  return NULL;
+}
+
+static gboolean
+release_name (LiaBusBroker *self, NameEntry *entry, Peer *peer)
+{
+  GList *node;
+  gboolean was_primary;
+
+  node = find_name_owner (entry, peer);
+  if (node == NULL)
+    return FALSE;
+
+  was_primary = node == entry->owners;
+
+  g_slice_free (NameOwner, node->data);
+  entry->owners = g_list_delete_link (entry->owners, node);
+  peer->names = g_list_remove (peer->names, entry);
+
+  if (was_primary)
+    {
+      Peer *new_owner = NULL;
+
+      if (entry->owners != NULL)
+        new_owner = ((NameOwner *) entry->owners->data)->peer;
+
+      emit_driver_signal (self,
+                          peer,
+                          "NameLost",
+                          g_variant_new ("(s)", entry->name));
+      name_owner_changed (self, entry->name, peer, new_owner);
+      if (new_owner != NULL)
+        emit_driver_signal (self,
+                            new_owner,
+                            "NameAcquired",
+                            g_variant_new ("(s)", entry->name));
+    }
+
+  if (entry->owners == NULL)
+    g_hash_table_remove (self->names, entry->name);
+
+  return TRUE;
+}
+
+static guint
+request_name (LiaBusBroker *self,
+              Peer         *peer,
+              const gchar  *name,
+              guint         flags)
+{
+  NameEntry *entry;
+  NameOwner *primary;
+  NameOwner *owner;
+  GList *queued;
+
+  entry = g_hash_table_lookup (self->names, name);
+  if (entry == NULL)
+    {
+      entry = g_slice_new0 (NameEntry);
+      entry->name = g_strdup (name);
+      g_hash_table_insert (self->names, entry->name, entry);
+    }
+
+  if (entry->owners == NULL)
+    {
+      owner = g_slice_new (NameOwner);
+      owner->peer = peer;
+      owner->flags = flags;
+      entry->owners = g_list_append (entry->owners, owner);
+      peer->names = g_list_prepend (peer->names, entry);
+
+      name_owner_changed (self, name, NULL, peer);
+      emit_driver_signal (self,
+                          peer,
+                          "NameAcquired",
+                          g_variant_new ("(s)", name));
+
+      return REQUEST_NAME_PRIMARY_OWNER;
+    }
+
+  primary = entry->owners->data;
+  if (primary->peer == peer)
+    {
+      primary->flags = flags;
+      return REQUEST_NAME_ALREADY_OWNER;
+    }
+
+  queued = find_name_owner (entry, peer);
+
+  if ((flags & NAME_FLAG_REPLACE_EXISTING) &&
+      (primary->flags & NAME_FLAG_ALLOW_REPLACEMENT))
+    {
+      Peer *old_owner = primary->peer;
+
+      if (queued != NULL)
+        {
+          g_slice_free (NameOwner, queued->data);
+          entry->owners = g_list_delete_link (entry->owners, queued);
+        }
+      else
+        {
+          peer->names = g_list_prepend (peer->names, entry);
+        }
+
+      /* the previous owner goes first in the queue, unless it asked not
+         to be queued */
+      entry->owners = g_list_remove (entry->owners, primary);
+      if (primary->flags & NAME_FLAG_DO_NOT_QUEUE)
+        {
+          old_owner->names = g_list_remove (old_owner->names, entry);
+          g_slice_free (NameOwner, primary);
+        }
+      else
+        {
+          entry->owners = g_list_prepend (entry->owners, primary);
+        }
+
+      owner = g_slice_new (NameOwner);
+      owner->peer = peer;
+      owner->flags = flags;
+      entry->owners = g_list_prepend (entry->owners, owner);
+
+      emit_driver_signal (self,
+                          old_owner,
+                          "NameLost",
+                          g_variant_new ("(s)", name));
+      name_owner_changed (self, name, old_owner, peer);
+      emit_driver_signal (self,
+                          peer,
+                          "NameAcquired",
+                          g_variant_new ("(s)", name));
+
+      return REQUEST_NAME_PRIMARY_OWNER;
+    }
+
+  if (flags & NAME_FLAG_DO_NOT_QUEUE)
+    {
+      if (queued != NULL)
+        release_name (self, entry, peer);
+
+      return REQUEST_NAME_EXISTS;
+    }
+
+  if (queued != NULL)
+    {
+      ((NameOwner *) queued->data)->flags = flags;
+    }
+  else
+    {
+      owner = g_slice_new (NameOwner);
+      owner->peer = peer;
+      owner->flags = flags;
+      entry->owners = g_list_append (entry->owners, owner);
+      peer->names = g_list_prepend (peer->names, entry);
+    }
+
+  return REQUEST_NAME_IN_QUEUE;
+}
+
+/* org.freedesktop.DBus */
+
+static GVariant *
+get_driver_call_args (Peer         *peer,
+                      GDBusMessage *msg,
+                      const gchar  *type)
+{
+  GVariant *body;
+
+  body = g_dbus_message_get_body (msg);
+  if (body == NULL || ! g_variant_is_of_type (body, G_VARIANT_TYPE (type)))
+    {
+      reply_driver_error (peer,
+                          msg,
+                          DBUS_ERROR_INVALID_ARGS,
+                          "Expected arguments of type '%s'",
+                          type);
+      return NULL;
+    }
+
+  return body;
+}
+
+static Peer *
+get_connection_arg (LiaBusBroker *self, Peer *peer, GDBusMessage *msg)
+{
+  GVariant *args;
+  const gchar *name;
+  Peer *target;
+
+  args = get_driver_call_args (peer, msg, "(s)");
+  if (args == NULL)
+    return NULL;
+
+  g_variant_get (args, "(&s)", &name);
+
+  target = lookup_name_owner (self, name);
+  if (target == NULL)
+    reply_driver_error (peer,
+                        msg,
+                        DBUS_ERROR_NAME_HAS_NO_OWNER,
+                        "Could not get owner of name '%s': no such name",
+                        name);
+
+  return target;
+}
+
+static void
+handle_driver_call (LiaBusBroker *self, Peer *peer, GDBusMessage *msg)
+{
+  const gchar *member;
+  GVariant *args;
+  const gchar *name;
+  Peer *target;
+
+  member = g_dbus_message_get_member (msg);
+
+  if (g_strcmp0 (member, "Hello") == 0)
+    {
+      if (peer->unique_name != NULL)
+        {
+          reply_driver_error (peer,
+                              msg,
+                              DBUS_IFACE_NAME ".Error.Failed",
+                              "Already handled an Hello message");
+          return;
+        }
+
+      peer->unique_name = g_strdup_printf (":1.%u", self->next_peer_id++);
+      g_hash_table_insert (self->peers, peer->unique_name, peer_ref (peer));
+
+      reply_driver_call (peer, msg, g_variant_new ("(s)", peer->unique_name));
+
+      emit_driver_signal (self,
+                          peer,
+                          "NameAcquired",
+                          g_variant_new ("(s)", peer->unique_name));
+      name_owner_changed (self, peer->unique_name, NULL, peer);
+    }
+  else if (g_strcmp0 (member, "RequestName") == 0)
+    {
+      guint32 flags;
+
+      if ((args = get_driver_call_args (peer, msg, "(su)")) == NULL)
+        return;
+      g_variant_get (args, "(&su)", &name, &flags);
+
+      if (! g_dbus_is_name (name) ||
+          g_dbus_is_unique_name (name) ||
+          strcmp (name, DBUS_SERVICE_NAME) == 0)
+        {
+          reply_driver_error (peer,
+                              msg,
+                              DBUS_ERROR_INVALID_ARGS,
+                              "Cannot acquire a service named '%s'",
+                              name);
+        }
+      else if (! name_in_list (self->policy.allow_own, name))
+        {
+          reply_driver_error (peer,
+                              msg,
+                              DBUS_ERROR_ACCESS_DENIED,
+                              "Connection '%s' is not allowed to own the "
+                              "service '%s'",
+                              peer->unique_name,
+                              name);
+        }
+      else if (self->policy.max_names_per_connection > 0 &&
+               g_list_length (peer->names) >= self->policy.max_names_per_connection)
+        {
+          reply_driver_error (peer,
+                              msg,
+                              DBUS_ERROR_LIMITS_EXCEEDED,
+                              "Connection '%s' owns too many names",
+                              peer->unique_name);
+        }
+      else
+        {
+          guint result;
+
+          result = request_name (self, peer, name, flags);
+          reply_driver_call (peer, msg, g_variant_new ("(u)", result));
+        }
+    }
+  else if (g_strcmp0 (member, "ReleaseName") == 0)
+    {
+      NameEntry *entry;
+      guint result;
+
+      if ((args = get_driver_call_args (peer, msg, "(s)")) == NULL)
+        return;
+      g_variant_get (args, "(&s)", &name);
+
+      entry = g_hash_table_lookup (self->names, name);
+      if (entry == NULL)
+        result = RELEASE_NAME_NON_EXISTENT;
+      else if (release_name (self, entry, peer))
+        result = RELEASE_NAME_RELEASED;
+      else
+        result = RELEASE_NAME_NOT_OWNER;
+
+      reply_driver_call (peer, msg, g_variant_new ("(u)", result));
+    }
+  else if (g_strcmp0 (member, "GetNameOwner") == 0)
+    {
+      if ((args = get_driver_call_args (peer, msg, "(s)")) == NULL)
+        return;
+      g_variant_get (args, "(&s)", &name);
+
+      if (strcmp (name, DBUS_SERVICE_NAME) == 0)
+        {
+          reply_driver_call (peer, msg, g_variant_new ("(s)", DBUS_SERVICE_NAME));
+        }
+      else if ((target = get_connection_arg (self, peer, msg)) != NULL)
+        {
+          reply_driver_call (peer,
+                             msg,
+                             g_variant_new ("(s)", target->unique_name));
+        }
+    }
+  else if (g_strcmp0 (member, "NameHasOwner") == 0)
+    {
+      if ((args = get_driver_call_args (peer, msg, "(s)")) == NULL)
+        return;
+      g_variant_get (args, "(&s)", &name);
+
+      reply_driver_call (peer,
+                         msg,
+                         g_variant_new ("(b)",
+                                        strcmp (name, DBUS_SERVICE_NAME) == 0 ||
+                                        lookup_name_owner (self, name) != NULL));
+    }
+  else if (g_strcmp0 (member, "ListNames") == 0)
+    {
+      GVariantBuilder builder;
+      GHashTableIter iter;
+      gpointer key;
+
+      g_variant_builder_init (&builder, G_VARIANT_TYPE ("as"));
+      g_variant_builder_add (&builder, "s", DBUS_SERVICE_NAME);
+
+      g_hash_table_iter_init (&iter, self->peers);
+      while (g_hash_table_iter_next (&iter, &key, NULL))
+        g_variant_builder_add (&builder, "s", key);
+
+      g_hash_table_iter_init (&iter, self->names);
+      while (g_hash_table_iter_next (&iter, &key, NULL))
+        g_variant_builder_add (&builder, "s", key);
+
+      reply_driver_call (peer, msg, g_variant_new ("(as)", &builder));
+    }
+  else if (g_strcmp0 (member, "ListActivatableNames") == 0)
+    {
+      const gchar *names[] = { DBUS_SERVICE_NAME };
+
+      reply_driver_call (peer,
+                         msg,
+                         g_variant_new ("(@as)",
+                                        g_variant_new_strv (names, 1)));
+    }
+  else if (g_strcmp0 (member, "ListQueuedOwners") == 0)
+    {
+      NameEntry *entry;
+      GVariantBuilder builder;
+      GList *node;
+
+      if ((args = get_driver_call_args (peer, msg, "(s)")) == NULL)
+        return;
+      g_variant_get (args, "(&s)", &name);
+
+      entry = g_hash_table_lookup (self->names, name);
+      if (entry == NULL)
+        {
+          target = get_connection_arg (self, peer, msg);
+          if (target != NULL)
+            reply_driver_call (peer,
+                               msg,
+                               g_variant_new ("(@as)",
+                                              g_variant_new_strv ((const gchar **) &target->unique_name,
+                                                                  1)));
+          return;
+        }
+
+      g_variant_builder_init (&builder, G_VARIANT_TYPE ("as"));
+      for (node = entry->owners; node != NULL; node = node->next)
+        g_variant_builder_add (&builder,
+                               "s",
+                               ((NameOwner *) node->data)->peer->unique_name);
+
+      reply_driver_call (peer, msg, g_variant_new ("(as)", &builder));
+    }
+  else if (g_strcmp0 (member, "AddMatch") == 0)
+    {
+      MatchRule *rule;
+
+      if ((args = get_driver_call_args (peer, msg, "(s)")) == NULL)
+        return;
+      g_variant_get (args, "(&s)", &name);
+
+      if (self->policy.max_match_rules_per_connection > 0 &&
+          g_list_length (peer->match_rules) >= self->policy.max_match_rules_per_connection)
+        {
+          reply_driver_error (peer,
+                              msg,
+                              DBUS_ERROR_LIMITS_EXCEEDED,
+                              "Connection '%s' has too many match rules",
+                              peer->unique_name);
+          return;
+        }
+
+      rule = parse_match_rule (name);
+      if (rule == NULL)
+        {
+          reply_driver_error (peer,
+                              msg,
+                              DBUS_ERROR_MATCH_INVALID,
+                              "Invalid match rule '%s'",
+                              name);
+          return;
+        }
+
+      peer->match_rules = g_list_prepend (peer->match_rules, rule);
+      if (rule->eavesdrop)
+        {
+          peer->eavesdrop_rules++;
+          self->eavesdrop_rules++;
+        }
+
+      reply_driver_call (peer, msg, NULL);
+    }
+  else if (g_strcmp0 (member, "RemoveMatch") == 0)
+    {
+      GList *node;
+
+      if ((args = get_driver_call_args (peer, msg, "(s)")) == NULL)
+        return;
+      g_variant_get (args, "(&s)", &name);
+
+      for (node = peer->match_rules; node != NULL; node = node->next)
+        if (strcmp (((MatchRule *) node->data)->rule, name) == 0)
+          break;
+
+      if (node == NULL)
+        {
+          reply_driver_error (peer,
+                              msg,
+                              DBUS_ERROR_MATCH_NOT_FOUND,
+                              "The given match rule wasn't found");
+          return;
+        }
+
+      if (((MatchRule *) node->data)->eavesdrop)
+        {
+          peer->eavesdrop_rules--;
+          self->eavesdrop_rules--;
+        }
+
+      free_match_rule (node->data);
+      peer->match_rules = g_list_delete_link (peer->match_rules, node);
+      reply_driver_call (peer, msg, NULL);
+    }
+  else if (g_strcmp0 (member, "GetConnectionUnixUser") == 0)
+    {
+      if ((target = get_connection_arg (self, peer, msg)) != NULL)
+        reply_driver_call (peer, msg, g_variant_new ("(u)", target->uid));
+    }
+  else if (g_strcmp0 (member, "GetConnectionUnixProcessID") == 0)
+    {
+      if ((target = get_connection_arg (self, peer, msg)) == NULL)
+        return;
+
+      if (target->pid < 0)
+        reply_driver_error (peer,
+                            msg,
+                            DBUS_IFACE_NAME ".Error.UnixProcessIdUnknown",
+                            "Could not determine PID for '%s'",
+                            target->unique_name);
+      else
+        reply_driver_call (peer,
+                           msg,
+                           g_variant_new ("(u)", (guint32) target->pid));
+    }
+  else if (g_strcmp0 (member, "GetConnectionCredentials") == 0)
+    {
+      GVariantBuilder builder;
+
+      if ((target = get_connection_arg (self, peer, msg)) == NULL)
+        return;
+
+      g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+      g_variant_builder_add (&builder,
+                             "{sv}",
+                             "UnixUserID",
+                             g_variant_new_uint32 (target->uid));
+      if (target->pid >= 0)
+        g_variant_builder_add (&builder,
+                               "{sv}",
+                               "ProcessID",
+                               g_variant_new_uint32 (target->pid));
+
+      reply_driver_call (peer, msg, g_variant_new ("(a{sv})", &builder));
+    }
+  else if (g_strcmp0 (member, "GetId") == 0)
+    {
+      reply_driver_call (peer, msg, g_variant_new ("(s)", self->guid));
+    }
+  else if (g_strcmp0 (member, "StartServiceByName") == 0)
+    {
+      guint32 flags;
+
+      if ((args = get_driver_call_args (peer, msg, "(su)")) == NULL)
+        return;
+      g_variant_get (args, "(&su)", &name, &flags);
+
+      /* there is no service activation, names are only ever running */
+      if (lookup_name_owner (self, name) != NULL)
+        reply_driver_call (peer, msg, g_variant_new ("(u)", 2));
+      else
+        reply_driver_error (peer,
+                            msg,
+                            DBUS_ERROR_SERVICE_UNKNOWN,
+                            "The name %s was not provided by any .service files",
+                            name);
+    }
+  else if (g_strcmp0 (member, "UpdateActivationEnvironment") == 0 ||
+           g_strcmp0 (member, "Ping") == 0)
+    {
+      reply_driver_call (peer, msg, NULL);
+    }
+  else
+    {
+      reply_driver_error (peer,
+                          msg,
+                          DBUS_ERROR_UNKNOWN_METHOD,
+                          "Method '%s' is not implemented by the broker",
+                          member);
+    }
+}
+
+/* routing */
+
+/* Calls are forwarded with the caller's serial, so a reply is identified
+   by its destination and reply serial. Only replies to calls actually
+   forwarded to the replying peer get through, as dbus-daemon does */
+static gboolean
+expect_reply (LiaBusBroker *self,
+              Peer         *caller,
+              Peer         *target,
+              GDBusMessage *msg)
+{
+  if (self->policy.max_replies_per_connection > 0 &&
+      caller->pending_calls >= self->policy.max_replies_per_connection)
+    {
+      reply_driver_error (caller,
+                          msg,
+                          DBUS_ERROR_LIMITS_EXCEEDED,
+                          "Connection '%s' has too many calls waiting "
+                          "for a reply",
+                          caller->unique_name);
+      return FALSE;
+    }
+
+  caller->pending_calls++;
+  g_hash_table_replace (target->expected_replies,
+                        g_strdup_printf ("%s|%u",
+                                         caller->unique_name,
+                                         g_dbus_message_get_serial (msg)),
+                        peer_ref (caller));
+
+  return TRUE;
+}
+
+static gboolean
+is_reply_to (gpointer key, gpointer value, gpointer user_data)
+{
+  return value == user_data;
+}
+
+static void
+route_reply (LiaBusBroker *self, Peer *peer, GDBusMessage *msg)
+{
+  const gchar *destination;
+  gchar *key;
+  Peer *caller;
+
+  destination = g_dbus_message_get_destination (msg);
+  if (destination == NULL)
+    return;
+
+  key = g_strdup_printf ("%s|%u",
+                         destination,
+                         g_dbus_message_get_reply_serial (msg));
+
+  caller = g_hash_table_lookup (peer->expected_replies, key);
+  if (caller == NULL)
+    {
+      g_debug ("Dropped unrequested reply from '%s' to '%s'",
+               peer->unique_name,
+               destination);
+    }
+  else
+    {
+      /* replies are not subject to the send policy */
+      forward_message (self, caller, msg, peer->unique_name, TRUE);
+      eavesdrop_message (self, msg, peer->unique_name, caller);
+      g_hash_table_remove (peer->expected_replies, key);
+    }
+
+  g_free (key);
+}
+
+static void
+route_message (LiaBusBroker *self, Peer *peer, GDBusMessage *msg)
+{
+  GDBusMessageType type;
+  const gchar *destination;
+  Peer *target;
+
+  type = g_dbus_message_get_message_type (msg);
+  destination = g_dbus_message_get_destination (msg);
+
+  if (g_strcmp0 (destination, DBUS_SERVICE_NAME) == 0)
+    {
+      if (type != G_DBUS_MESSAGE_TYPE_METHOD_CALL)
+        return;
+
+      if (peer->unique_name == NULL &&
+          g_strcmp0 (g_dbus_message_get_member (msg), "Hello") != 0)
+        {
+          goto not_registered;
+        }
+
+      handle_driver_call (self, peer, msg);
+      return;
+    }
+
+  if (peer->unique_name == NULL)
+    goto not_registered;
+
+  if (type == G_DBUS_MESSAGE_TYPE_METHOD_RETURN ||
+      type == G_DBUS_MESSAGE_TYPE_ERROR)
+    {
+      route_reply (self, peer, msg);
+      return;
+    }
+
+  if (destination == NULL)
+    {
+      if (type == G_DBUS_MESSAGE_TYPE_SIGNAL)
+        broadcast_signal (self, msg, peer->unique_name, TRUE);
+
+      return;
+    }
+
+  target = lookup_name_owner (self, destination);
+  if (target == NULL)
+    {
+      if (destination[0] == ':')
+        reply_driver_error (peer,
+                            msg,
+                            DBUS_ERROR_NAME_HAS_NO_OWNER,
+                            "The name %s is not owned",
+                            destination);
+      else
+        reply_driver_error (peer,
+                            msg,
+                            DBUS_ERROR_SERVICE_UNKNOWN,
+                            "The name %s was not provided by any .service files",
+                            destination);
+      return;
+    }
+
+  if (! policy_allows_send (self, destination, target))
+    {
+      reply_driver_error (peer,
+                          msg,
+                          DBUS_ERROR_ACCESS_DENIED,
+                          "Sending to '%s' is not allowed by the bus policy",
+                          destination);
+      return;
+    }
+
+  if (type == G_DBUS_MESSAGE_TYPE_METHOD_CALL &&
+      (g_dbus_message_get_flags (msg) &
+       G_DBUS_MESSAGE_FLAGS_NO_REPLY_EXPECTED) == 0 &&
+      ! expect_reply (self, peer, target, msg))
+    {
+      return;
+    }
+
+  forward_message (self, target, msg, peer->unique_name, TRUE);
+  eavesdrop_message (self, msg, peer->unique_name, target);
+  return;
+
+ not_registered:
+  reply_driver_error (peer,
+                      msg,
+                      DBUS_ERROR_ACCESS_DENIED,
+                      "Client tried to send a message other than Hello "
+                      "without being registered");
+  g_dbus_connection_close (peer->conn, NULL, NULL, NULL);
+}
+
+/* GDBus doesn't tell the size a message had on the wire. Its body is
+   what grows, so that is what gets checked */
+static gboolean
+message_exceeds_max_size (LiaBusBroker *self, GDBusMessage *msg)
+{
+  GVariant *body;
+
+  if (self->policy.max_message_size == 0)
+    return FALSE;
+
+  body = g_dbus_message_get_body (msg);
+
+  return body != NULL && g_variant_get_size (body) > self->policy.max_message_size;
+}
+
+static GDBusMessage *
+on_peer_message (GDBusConnection *conn,
+                 GDBusMessage    *msg,
+                 gboolean         incoming,
+                 gpointer         user_data)
+{
+  Peer *peer = user_data;
+  LiaBusBroker *self = peer->broker;
+
+  if (! incoming)
+    return msg;
+
+  /* every incoming message is handled here, and none is left for the
+     connection to dispatch */
+  g_mutex_lock (&self->lock);
+  if (! peer->closed)
+    {
+      if (message_exceeds_max_size (self, msg))
+        {
+          reply_driver_error (peer,
+                              msg,
+                              DBUS_ERROR_LIMITS_EXCEEDED,
+                              "Message exceeds the maximum size of %u bytes",
+                              self->policy.max_message_size);
+        }
+      else
+        {
+          self->routed_messages++;
+          route_message (self, peer, msg);
+        }
+    }
+  g_mutex_unlock (&self->lock);
+
+  g_object_unref (msg);
+
+  return NULL;
+}
+
+static void
+on_peer_closed (GDBusConnection *conn,
+                gboolean         remote_peer_vanished,
+                GError          *error,
+                gpointer         user_data)
+{
+  Peer *peer = user_data;
+
+  remove_peer (peer->broker, peer);
+}
+
+static void
+count_peer (LiaBusBroker *self, Peer *peer, gint delta)
+{
+  guint count;
+
+  self->num_peers += delta;
+
+  count = GPOINTER_TO_UINT (g_hash_table_lookup (self->peers_per_uid,
+                                                 GUINT_TO_POINTER (peer->uid)));
+  count += delta;
+
+  if (count == 0)
+    g_hash_table_remove (self->peers_per_uid, GUINT_TO_POINTER (peer->uid));
+  else
+    g_hash_table_insert (self->peers_per_uid,
+                         GUINT_TO_POINTER (peer->uid),
+                         GUINT_TO_POINTER (count));
+}
+
+static void
+remove_peer (LiaBusBroker *self, Peer *peer)
+{
+  g_mutex_lock (&self->lock);
+
+  if (peer->closed)
+    {
+      g_mutex_unlock (&self->lock);
+      return;
+    }
+
+  peer->closed = TRUE;
+  self->peer_list = g_list_remove (self->peer_list, peer);
+  self->eavesdrop_rules -= peer->eavesdrop_rules;
+  count_peer (self, peer, -1);
+
+  /* nobody is left to reply to, or to wait for replies from, this peer */
+  g_hash_table_remove_all (peer->expected_replies);
+  if (peer->pending_calls > 0)
+    {
+      GList *node;
+
+      for (node = self->peer_list; node != NULL; node = node->next)
+        g_hash_table_foreach_remove (((Peer *) node->data)->expected_replies,
+                                     is_reply_to,
+                                     peer);
+    }
+
+  while (peer->names != NULL)
+    release_name (self, peer->names->data, peer);
+
+  if (peer->unique_name != NULL)
+    {
+      name_owner_changed (self, peer->unique_name, peer, NULL);
+      g_hash_table_remove (self->peers, peer->unique_name);
+    }
+
+  g_mutex_unlock (&self->lock);
+
+  g_signal_handlers_disconnect_by_func (peer->conn, on_peer_closed, peer);
+  g_dbus_connection_remove_filter (peer->conn, peer->filter_id);
+
+  peer_unref (peer);
+}
+
+static gboolean
+on_new_connection (GDBusServer     *server,
+                   GDBusConnection *conn,
+                   gpointer         user_data)
+{
+  LiaBusBroker *self = user_data;
+  GCredentials *credentials;
+  guint uid = 0;
+  Peer *peer;
+
+  credentials = g_dbus_connection_get_peer_credentials (conn);
+  if (credentials != NULL)
+    uid = g_credentials_get_unix_user (credentials, NULL);
+
+  g_mutex_lock (&self->lock);
+  if ((self->policy.max_completed_connections > 0 &&
+       self->num_peers >= self->policy.max_completed_connections) ||
+      (self->policy.max_connections_per_user > 0 &&
+       GPOINTER_TO_UINT (g_hash_table_lookup (self->peers_per_uid,
+                                              GUINT_TO_POINTER (uid))) >=
+       self->policy.max_connections_per_user))
+    {
+      g_mutex_unlock (&self->lock);
+
+      g_debug ("Rejected connection, the broker has too many");
+      g_dbus_connection_close (conn, NULL, NULL, NULL);
+      return TRUE;
+    }
+  g_mutex_unlock (&self->lock);
+
+  peer = g_slice_new0 (Peer);
+  peer->broker = self;
+  peer->conn = g_object_ref (conn);
+  peer->pid = -1;
+  peer->ref_count = 1;
+  peer->expected_replies = g_hash_table_new_full (g_str_hash,
+                                                  g_str_equal,
+                                                  g_free,
+                                                  forget_expected_reply);
+
+  peer->uid = uid;
+#if GLIB_CHECK_VERSION (2, 36, 0)
+  if (credentials != NULL)
+    peer->pid = g_credentials_get_unix_pid (credentials, NULL);
+#endif
+
+  g_mutex_lock (&self->lock);
+  self->peer_list = g_list_prepend (self->peer_list, peer);
+  count_peer (self, peer, 1);
+  g_mutex_unlock (&self->lock);
+
+  g_signal_connect (conn,
+                    "closed",
+                    G_CALLBACK (on_peer_closed),
+                    peer);
+
+  /* message processing starts after this handler returns, so no message
+     can get past the filter */
+  peer->filter_id = g_dbus_connection_add_filter (conn,
+                                                  on_peer_message,
+                                                  peer_ref (peer),
+                                                  peer_unref);
+
+  return TRUE;
+}
+
+static gboolean
+on_authorize_peer (GDBusAuthObserver *observer,
+                   GIOStream         *stream,
+                   GCredentials      *credentials,
+                   gpointer           user_data)
+{
+  /* same as a session bus, only processes of our own user may connect */
+  return credentials != NULL &&
+    g_credentials_get_unix_user (credentials, NULL) == getuid ();
+}
+
+/* configuration files */
+
+/* Limits of dbus-daemon the broker doesn't implement. It behaves as if
+   they were set to the values of the configurations shipped with Lia,
+   so only a configuration setting them lower relies on them */
+static const struct
+{
+  const gchar *name;
+  guint64 value;
+} UNSUPPORTED_LIMITS[] = {
+  { "max_incoming_bytes", 1000000000 },
+  { "max_outgoing_bytes", 1000000000 },
+  { "max_incomplete_connections", 10000 },
+  { "auth_timeout", 240000 }
+};
+
+/* Limits of service activation, which the broker doesn't do */
+static const gchar * const ACTIVATION_LIMITS[] = {
+  "service_start_timeout",
+  "max_pending_service_starts",
+  NULL
+};
+
+typedef struct
+{
+  LiaBusBrokerPolicy *policy;
+  gchar *limit_name;
+  GString *limit_value;
+} LoadPolicyData;
+
+static gboolean
+set_policy_limit (LiaBusBrokerPolicy  *policy,
+                  const gchar         *name,
+                  const gchar         *str,
+                  GError             **error)
+{
+  guint64 value;
+  gchar *end;
+  guint i;
+
+  value = g_ascii_strtoull (str, &end, 10);
+  if (end == str || *end != '\0')
+    {
+      g_set_error (error,
+                   G_MARKUP_ERROR,
+                   G_MARKUP_ERROR_INVALID_CONTENT,
+                   "Invalid value '%s' for limit '%s'",
+                   str,
+                   name);
+      return FALSE;
+    }
+  value = MIN (value, G_MAXUINT);
+
+  if (strcmp (name, "max_message_size") == 0)
+    policy->max_message_size = value;
+  else if (strcmp (name, "max_completed_connections") == 0)
+    policy->max_completed_connections = value;
+  else if (strcmp (name, "max_connections_per_user") == 0)
+    policy->max_connections_per_user = value;
+  else if (strcmp (name, "max_names_per_connection") == 0)
+    policy->max_names_per_connection = value;
+  else if (strcmp (name, "max_match_rules_per_connection") == 0)
+    policy->max_match_rules_per_connection = value;
+  else if (strcmp (name, "max_replies_per_connection") == 0)
+    policy->max_replies_per_connection = value;
+  else if (name_in_list (ACTIVATION_LIMITS, name))
+    return TRUE;
+  else
+    {
+      for (i=0; i<G_N_ELEMENTS (UNSUPPORTED_LIMITS); i++)
+        if (strcmp (name, UNSUPPORTED_LIMITS[i].name) == 0)
+          break;
+
+      if (i == G_N_ELEMENTS (UNSUPPORTED_LIMITS) ||
+          value < UNSUPPORTED_LIMITS[i].value)
+        {
+          g_set_error (error,
+                       G_IO_ERROR,
+                       G_IO_ERROR_NOT_SUPPORTED,
+                       "Limit '%s' of %s is not supported by the embedded "
+                       "bus broker",
+                       name,
+                       str);
+          return FALSE;
+        }
+    }
+
+  return TRUE;
+}
+
+static void
+on_config_start_element (GMarkupParseContext  *context,
+                         const gchar          *element_name,
+                         const gchar         **attribute_names,
+                         const gchar         **attribute_values,
+                         gpointer              user_data,
+                         GError              **error)
+{
+  LoadPolicyData *data = user_data;
+  guint i;
+
+  if (strcmp (element_name, "limit") == 0)
+    {
+      g_markup_collect_attributes (element_name,
+                                   attribute_names,
+                                   attribute_values,
+                                   error,
+                                   G_MARKUP_COLLECT_STRDUP,
+                                   "name",
+                                   &data->limit_name,
+                                   G_MARKUP_COLLECT_INVALID);
+      g_string_truncate (data->limit_value, 0);
+    }
+  else if (strcmp (element_name, "deny") == 0 ||
+           strcmp (element_name, "include") == 0 ||
+           strcmp (element_name, "includedir") == 0)
+    {
+      /* the rest of the policy is compiled in */
+      g_set_error (error,
+                   G_IO_ERROR,
+                   G_IO_ERROR_NOT_SUPPORTED,
+                   "Element <%s> is not supported by the embedded bus broker",
+                   element_name);
+    }
+  else if (strcmp (element_name, "allow") == 0)
+    {
+      for (i=0; attribute_names[i] != NULL; i++)
+        if (strcmp (attribute_names[i], "eavesdrop") == 0 &&
+            strcmp (attribute_values[i], "true") == 0)
+          {
+            data->policy->allow_eavesdrop = TRUE;
+          }
+    }
+}
+
+static void
+on_config_end_element (GMarkupParseContext  *context,
+                       const gchar          *element_name,
+                       gpointer              user_data,
+                       GError              **error)
+{
+  LoadPolicyData *data = user_data;
+
+  if (strcmp (element_name, "limit") != 0 || data->limit_name == NULL)
+    return;
+
+  set_policy_limit (data->policy,
+                    data->limit_name,
+                    g_strstrip (data->limit_value->str),
+                    error);
+
+  g_free (data->limit_name);
+  data->limit_name = NULL;
+}
+
+static void
+on_config_text (GMarkupParseContext  *context,
+                const gchar          *text,
+                gsize                 text_len,
+                gpointer              user_data,
+                GError              **error)
+{
+  LoadPolicyData *data = user_data;
+
+  if (data->limit_name != NULL)
+    g_string_append_len (data->limit_value, text, text_len);
+}
+
+/* public methods */
+
+/* Loads the limits and whether eavesdropping is allowed from a
+   dbus-daemon configuration file into @policy. Fails if the file relies
+   on something the broker doesn't do, namely <deny> rules, includes, and
+   the limits in UNSUPPORTED_LIMITS set lower than there, so a bus never
+   runs with less protection than its configuration asks for */
+gboolean
+lia_bus_broker_load_policy (LiaBusBrokerPolicy  *policy,
+                            const gchar         *config_file,
+                            GError             **error)
+{
+  static const GMarkupParser parser = {
+    on_config_start_element,
+    on_config_end_element,
+    on_config_text,
+    NULL,
+    NULL
+  };
+
+  GMarkupParseContext *context;
+  LoadPolicyData data;
+  gchar *contents;
+  gsize len;
+  gboolean result;
+
+  g_return_val_if_fail (policy != NULL, FALSE);
+  g_return_val_if_fail (config_file != NULL, FALSE);
+
+  if (! g_file_get_contents (config_file, &contents, &len, error))
+    return FALSE;
+
+  data.policy = policy;
+  data.limit_name = NULL;
+  data.limit_value = g_string_new ("");
+
+  context = g_markup_parse_context_new (&parser, 0, &data, NULL);
+  result = g_markup_parse_context_parse (context, contents, len, error) &&
+    g_markup_parse_context_end_parse (context, error);
+  g_markup_parse_context_free (context);
+
+  if (! result)
+    g_prefix_error (error, "%s: ", config_file);
+
+  g_free (data.limit_name);
+  g_string_free (data.limit_value, TRUE);
+  g_free (contents);
+
+  return result;
+}
+
+LiaBusBroker *
+lia_bus_broker_new (const LiaBusBrokerPolicy  *policy,
+                    GError                   **error)
+{
+  LiaBusBroker *self;
+  GDBusAuthObserver *observer;
+
+  g_return_val_if_fail (policy != NULL, NULL);
+
+  self = g_slice_new0 (LiaBusBroker);
+  self->policy = *policy;
+  self->guid = g_dbus_generate_guid ();
+  self->next_peer_id = 1;
+
+  g_mutex_init (&self->lock);
+
+  self->peers = g_hash_table_new_full (g_str_hash,
+                                       g_str_equal,
+                                       NULL,
+                                       peer_unref);
+  self->names = g_hash_table_new_full (g_str_hash,
+                                       g_str_equal,
+                                       NULL,
+                                       free_name_entry);
+  self->peers_per_uid = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+  observer = g_dbus_auth_observer_new ();
+  g_signal_connect (observer,
+                    "authorize-authenticated-peer",
+                    G_CALLBACK (on_authorize_peer),
+                    NULL);
+
+  self->server = g_dbus_server_new_sync ("unix:tmpdir=/tmp",
+                                         G_DBUS_SERVER_FLAGS_NONE,
+                                         self->guid,
+                                         observer,
+                                         NULL,
+                                         error);
+  g_object_unref (observer);
+
+  if (self->server == NULL)
+    {
+      lia_bus_broker_free (self);
+      return NULL;
+    }
+
+  g_signal_connect (self->server,
+                    "new-connection",
+                    G_CALLBACK (on_new_connection),
+                    self);
+
+  g_dbus_server_start (self->server);
+
+  return self;
+}
+
+void
+lia_bus_broker_free (LiaBusBroker *self)
+{
+  g_return_if_fail (self != NULL);
+
+  if (self->server != NULL)
+    {
+      g_dbus_server_stop (self->server);
+      g_object_unref (self->server);
+    }
+
+  while (self->peer_list != NULL)
+    {
+      Peer *peer = self->peer_list->data;
+      GDBusConnection *conn;
+
+      conn = g_object_ref (peer->conn);
+      remove_peer (self, peer);
+      g_dbus_connection_close (conn, NULL, NULL, NULL);
+      g_object_unref (conn);
+    }
+
+  g_hash_table_unref (self->peers);
+  g_hash_table_unref (self->names);
+  g_hash_table_unref (self->peers_per_uid);
+
+  g_mutex_clear (&self->lock);
+  g_free (self->guid);
+
+  g_slice_free (LiaBusBroker, self);
+}
+
+const gchar *
+lia_bus_broker_get_address (LiaBusBroker *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+
+  return g_dbus_server_get_client_address (self->server);
+}
+
+/* Returns a snapshot of the broker's counters, named like those of
+   dbus-daemon's org.freedesktop.DBus.Debug.Stats.GetStats where there is
+   an equivalent, plus the total of messages routed (transfer floating) */
+GVariant *
+lia_bus_broker_get_stats (LiaBusBroker *self)
+{
+  GVariantBuilder builder;
+  GList *node;
+  guint connections = 0;
+  guint incomplete_connections = 0;
+  guint match_rules = 0;
+  guint max_match_rules = 0;
+  guint max_names = 0;
+  guint names;
+  guint64 routed_messages;
+
+  g_return_val_if_fail (self != NULL, NULL);
+
+  g_mutex_lock (&self->lock);
+
+  for (node = self->peer_list; node != NULL; node = node->next)
+    {
+      Peer *peer = node->data;
+      guint peer_match_rules;
+      guint peer_names;
+
+      if (peer->unique_name == NULL)
+        {
+          incomplete_connections++;
+          continue;
+        }
+
+      connections++;
+
+      peer_match_rules = g_list_length (peer->match_rules);
+      match_rules += peer_match_rules;
+      max_match_rules = MAX (max_match_rules, peer_match_rules);
+
+      /* plus the unique name */
+      peer_names = g_list_length (peer->names) + 1;
+      max_names = MAX (max_names, peer_names);
+    }
+
+  names = g_hash_table_size (self->names) + g_hash_table_size (self->peers);
+  routed_messages = self->routed_messages;
+
+  g_mutex_unlock (&self->lock);
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+
+  g_variant_builder_add (&builder, "{sv}", "ActiveConnections",
+                         g_variant_new_uint32 (connections));
+  g_variant_builder_add (&builder, "{sv}", "IncompleteConnections",
+                         g_variant_new_uint32 (incomplete_connections));
+  g_variant_builder_add (&builder, "{sv}", "MatchRules",
+                         g_variant_new_uint32 (match_rules));
+  g_variant_builder_add (&builder, "{sv}", "BusNames",
+                         g_variant_new_uint32 (names));
+  g_variant_builder_add (&builder, "{sv}", "MaxMatchRulesPerConnection",
+                         g_variant_new_uint32 (max_match_rules));
+  g_variant_builder_add (&builder, "{sv}", "MaxBusNamesPerConnection",
+                         g_variant_new_uint32 (max_names));
+  g_variant_builder_add (&builder, "{sv}", "RoutedMessages",
+                         g_variant_new_uint64 (routed_messages));
+
+  return g_variant_builder_end (&builder);
+}
+
+const LiaBusBrokerPolicy *
+lia_bus_broker_get_policy (LiaBusBroker *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+
+  return &self->policy;
+}
@@ -0,0 +1,76 @@
+/*
+ * lia-bus-broker.h
+ *
+ * This file is part of Lia <http://free-social.net/lia/>
+ *
+ * Copyright (C) 2012 Igalia S.L.
+ *
+ * Authors:
+ *   Eduardo Lima Mitev <elima@igalia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License at http://www.gnu.org/licenses/gpl-3.0.txt
+ * for more details.
+ */
+
+
+#ifndef __LIA_BUS_BROKER_H__
+#define __LIA_BUS_BROKER_H__
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/* A message bus that runs inside the process that creates it, as an
+   alternative to spawning a dbus-daemon. It listens on a unix socket,
+   speaks the D-Bus wire protocol and implements the subset of the
+   org.freedesktop.DBus interface that GDBus clients use. Used internally
+   by LiaCore. */
+
+typedef struct _LiaBusBroker LiaBusBroker;
+
+/* Bus policy, equivalent to the <policy> and <limit> elements of a
+   dbus-daemon configuration file. Name lists are compiled in, and are
+   NULL-terminated and hold exact names, prefixes ending in '*' (e.g
+   'org.example.*'), or '*' alone to match any name. The rest can be
+   loaded from a configuration file with lia_bus_broker_load_policy().
+   A limit of 0 means no limit. */
+typedef struct
+{
+  const gchar * const *allow_own;
+  const gchar * const *allow_send_destination;
+  gboolean allow_eavesdrop;
+
+  guint max_names_per_connection;
+  guint max_match_rules_per_connection;
+  guint max_replies_per_connection;
+
+  guint max_message_size;
+  guint max_completed_connections;
+  guint max_connections_per_user;
+} LiaBusBrokerPolicy;
+
+gboolean       lia_bus_broker_load_policy         (LiaBusBrokerPolicy  *policy,
+                                                   const gchar         *config_file,
+                                                   GError             **error);
+
+LiaBusBroker * lia_bus_broker_new                 (const LiaBusBrokerPolicy  *policy,
+                                                   GError                   **error);
+void           lia_bus_broker_free                (LiaBusBroker *self);
+
+const gchar *  lia_bus_broker_get_address         (LiaBusBroker *self);
+const LiaBusBrokerPolicy *
+               lia_bus_broker_get_policy          (LiaBusBroker *self);
+
+GVariant *     lia_bus_broker_get_stats           (LiaBusBroker *self);
+
+G_END_DECLS
+
+#endif /* __LIA_BUS_BROKER_H__ */
@@ -0,0 +1,348 @@
+/* Match rules of the org.freedesktop.DBus AddMatch method, shared by the
+   bus broker and the bus multiplexer, which include this file. */
+
+#define MAX_MATCH_ARGS 64
+
+typedef enum
+{
+  MATCH_ARG_EQUAL,
+  MATCH_ARG_PATH,
+  MATCH_ARG_NAMESPACE
+} MatchArgKind;
+
+typedef struct
+{
+  gint type;
+  gchar *sender;
+  gchar *interface_name;
+  gchar *member;
+  gchar *path;
+  gchar *path_namespace;
+  gchar *destination;
+  gchar *args[MAX_MATCH_ARGS];
+  MatchArgKind arg_kinds[MAX_MATCH_ARGS];
+  gint max_arg;
+  gboolean eavesdrop;
+
+  gchar *rule;
+} MatchRule;
+
+/* returns the unique name of the owner of a well-known name, or NULL */
+typedef const gchar * (* MatchRuleNameOwnerFunc) (const gchar *name,
+                                                  gpointer     user_data);
+
+static void
+free_match_rule (gpointer _data)
+{
+  MatchRule *rule = _data;
+  gint i;
+
+  g_free (rule->sender);
+  g_free (rule->interface_name);
+  g_free (rule->member);
+  g_free (rule->path);
+  g_free (rule->path_namespace);
+  g_free (rule->destination);
+
+  for (i=0; i<=rule->max_arg; i++)
+    g_free (rule->args[i]);
+
+  g_free (rule->rule);
+
+  g_slice_free (MatchRule, rule);
+}
+
+static gboolean
+set_match_rule_key (MatchRule   *rule,
+                    const gchar *key,
+                    const gchar *value)
+{
+  gchar **field = NULL;
+
+  if (strcmp (key, "type") == 0)
+    {
+      if (strcmp (value, "signal") == 0)
+        rule->type = G_DBUS_MESSAGE_TYPE_SIGNAL;
+      else if (strcmp (value, "method_call") == 0)
+        rule->type = G_DBUS_MESSAGE_TYPE_METHOD_CALL;
+      else if (strcmp (value, "method_return") == 0)
+        rule->type = G_DBUS_MESSAGE_TYPE_METHOD_RETURN;
+      else if (strcmp (value, "error") == 0)
+        rule->type = G_DBUS_MESSAGE_TYPE_ERROR;
+      else
+        return FALSE;
+
+      return TRUE;
+    }
+  else if (strcmp (key, "sender") == 0)
+    field = &rule->sender;
+  else if (strcmp (key, "interface") == 0)
+    field = &rule->interface_name;
+  else if (strcmp (key, "member") == 0)
+    field = &rule->member;
+  else if (strcmp (key, "path") == 0)
+    field = &rule->path;
+  else if (strcmp (key, "path_namespace") == 0)
+    field = &rule->path_namespace;
+  else if (strcmp (key, "destination") == 0)
+    field = &rule->destination;
+  else if (strcmp (key, "eavesdrop") == 0)
+    {
+      if (strcmp (value, "true") == 0)
+        rule->eavesdrop = TRUE;
+      else if (strcmp (value, "false") != 0)
+        return FALSE;
+
+      return TRUE;
+    }
+  else if (g_str_has_prefix (key, "arg") && g_ascii_isdigit (key[3]))
+    {
+      gchar *end;
+      guint64 index;
+      MatchArgKind kind;
+
+      index = g_ascii_strtoull (key + 3, &end, 10);
+      if (index >= MAX_MATCH_ARGS)
+        return FALSE;
+
+      if (*end == '\0')
+        kind = MATCH_ARG_EQUAL;
+      else if (strcmp (end, "path") == 0)
+        kind = MATCH_ARG_PATH;
+      else if (index == 0 && strcmp (end, "namespace") == 0)
+        kind = MATCH_ARG_NAMESPACE;
+      else
+        return FALSE;
+
+      if (rule->args[index] != NULL)
+        return FALSE;
+
+      rule->args[index] = g_strdup (value);
+      rule->arg_kinds[index] = kind;
+      rule->max_arg = MAX (rule->max_arg, (gint) index);
+
+      return TRUE;
+    }
+  else
+    return FALSE;
+
+  if (*field != NULL)
+    return FALSE;
+
+  *field = g_strdup (value);
+
+  return TRUE;
+}
+
+/* parses a match rule like "type='signal',interface='org.example.Foo'".
+   Values are quoted with apostrophes, and an apostrophe itself is
+   written as \' outside quotes */
+static MatchRule *
+parse_match_rule (const gchar *str)
+{
+  MatchRule *rule;
+  const gchar *p = str;
+
+  rule = g_slice_new0 (MatchRule);
+  rule->type = -1;
+  rule->max_arg = -1;
+  rule->rule = g_strdup (str);
+
+  while (*p != '\0')
+    {
+      const gchar *eq;
+      gchar *key;
+      GString *value;
+      gboolean ok;
+
+      while (*p == ' ' || *p == ',')
+        p++;
+      if (*p == '\0')
+        break;
+
+      eq = strchr (p, '=');
+      if (eq == NULL)
+        {
+          free_match_rule (rule);
+          return NULL;
+        }
+
+      key = g_strstrip (g_strndup (p, eq - p));
+      p = eq + 1;
+
+      value = g_string_new (NULL);
+      while (*p != '\0' && *p != ',')
+        {
+          if (*p == '\'')
+            {
+              const gchar *end;
+
+              end = strchr (p + 1, '\'');
+              if (end == NULL)
+                {
+                  g_string_free (value, TRUE);
+                  g_free (key);
+                  free_match_rule (rule);
+                  return NULL;
+                }
+
+              g_string_append_len (value, p + 1, end - p - 1);
+              p = end + 1;
+            }
+          else if (*p == '\\' && p[1] == '\'')
+            {
+              g_string_append_c (value, '\'');
+              p += 2;
+            }
+          else
+            {
+              g_string_append_c (value, *p);
+              p++;
+            }
+        }
+
+      ok = set_match_rule_key (rule, key, value->str);
+
+      g_string_free (value, TRUE);
+      g_free (key);
+
+      if (! ok)
+        {
+          free_match_rule (rule);
+          return NULL;
+        }
+    }
+
+  return rule;
+}
+
+static gboolean
+match_arg (MatchArgKind kind, const gchar *expected, const gchar *value)
+{
+  gsize len;
+
+  switch (kind)
+    {
+    case MATCH_ARG_EQUAL:
+      return strcmp (expected, value) == 0;
+
+    case MATCH_ARG_PATH:
+      if (strcmp (expected, value) == 0)
+        return TRUE;
+
+      if (g_str_has_suffix (expected, "/") && g_str_has_prefix (value, expected))
+        return TRUE;
+
+      return g_str_has_suffix (value, "/") && g_str_has_prefix (expected, value);
+
+    case MATCH_ARG_NAMESPACE:
+      len = strlen (expected);
+      return strncmp (expected, value, len) == 0 &&
+        (value[len] == '\0' || value[len] == '.');
+    }
+
+  return FALSE;
+}
+
+static gboolean
+match_rule_matches (MatchRule              *rule,
+                    GDBusMessage           *msg,
+                    const gchar            *sender,
+                    MatchRuleNameOwnerFunc  name_owner_func,
+                    gpointer                user_data)
+{
+  const gchar *path;
+
+  if (rule->type >= 0 &&
+      rule->type != (gint) g_dbus_message_get_message_type (msg))
+    {
+      return FALSE;
+    }
+
+  if (rule->sender != NULL && g_strcmp0 (rule->sender, sender) != 0)
+    {
+      /* rules can name the sender by a well-known name */
+      if (rule->sender[0] == ':' ||
+          g_strcmp0 (name_owner_func (rule->sender, user_data), sender) != 0)
+        {
+          return FALSE;
+        }
+    }
+
+  if (rule->interface_name != NULL &&
+      g_strcmp0 (rule->interface_name, g_dbus_message_get_interface (msg)) != 0)
+    {
+      return FALSE;
+    }
+
+  if (rule->member != NULL &&
+      g_strcmp0 (rule->member, g_dbus_message_get_member (msg)) != 0)
+    {
+      return FALSE;
+    }
+
+  path = g_dbus_message_get_path (msg);
+
+  if (rule->path != NULL && g_strcmp0 (rule->path, path) != 0)
+    return FALSE;
+
+  if (rule->path_namespace != NULL)
+    {
+      gsize len;
+
+      if (path == NULL)
+        return FALSE;
+
+      len = strlen (rule->path_namespace);
+      if (strcmp (rule->path_namespace, "/") != 0 &&
+          (strncmp (rule->path_namespace, path, len) != 0 ||
+           (path[len] != '\0' && path[len] != '/')))
+        {
+          return FALSE;
+        }
+    }
+
+  if (rule->destination != NULL &&
+      g_strcmp0 (rule->destination, g_dbus_message_get_destination (msg)) != 0)
+    {
+      return FALSE;
+    }
+
+  if (rule->max_arg >= 0)
+    {
+      GVariant *body;
+      gint i;
+
+      body = g_dbus_message_get_body (msg);
+      if (body == NULL ||
+          ! g_variant_is_of_type (body, G_VARIANT_TYPE_TUPLE) ||
+          (gint) g_variant_n_children (body) <= rule->max_arg)
+        {
+          return FALSE;
+        }
+
+      for (i=0; i<=rule->max_arg; i++)
+        {
+          GVariant *arg;
+          gboolean matches;
+
+          if (rule->args[i] == NULL)
+            continue;
+
+          arg = g_variant_get_child_value (body, i);
+          matches =
+            (g_variant_is_of_type (arg, G_VARIANT_TYPE_STRING) ||
+             (rule->arg_kinds[i] == MATCH_ARG_PATH &&
+              g_variant_is_of_type (arg, G_VARIANT_TYPE_OBJECT_PATH))) &&
+            match_arg (rule->arg_kinds[i],
+                       rule->args[i],
+                       g_variant_get_string (arg, NULL));
+          g_variant_unref (arg);
+
+          if (! matches)
+            return FALSE;
+        }
+    }
+
+  return TRUE;
+}
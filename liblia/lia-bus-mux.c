@@ -0,0 +1,2141 @@
+/*
+ * lia-bus-mux.c
+ *
+ * This file is part of Lia <http://free-social.net/lia/>
+ *
+ * Copyright (C) 2012 Igalia S.L.
+ *
+ * Authors:
+ *   Eduardo Lima Mitev <elima@igalia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License at http://www.gnu.org/licenses/gpl-3.0.txt
+ * for more details.
+ */
+
+
+#include <string.h>
+#include <unistd.h>
+
+#include "lia-bus-mux.h"
+
+#define DBUS_SERVICE_NAME "org.freedesktop.DBus"
+#define DBUS_OBJ_PATH     "/org/freedesktop/DBus"
+#define DBUS_IFACE_NAME   "org.freedesktop.DBus"
+
+#define DBUS_ERROR_ACCESS_DENIED    DBUS_IFACE_NAME ".Error.AccessDenied"
+#define DBUS_ERROR_INVALID_ARGS     DBUS_IFACE_NAME ".Error.InvalidArgs"
+#define DBUS_ERROR_MATCH_INVALID    DBUS_IFACE_NAME ".Error.MatchRuleInvalid"
+#define DBUS_ERROR_MATCH_NOT_FOUND  DBUS_IFACE_NAME ".Error.MatchRuleNotFound"
+#define DBUS_ERROR_NO_REPLY         DBUS_IFACE_NAME ".Error.NoReply"
+
+#define REQUEST_NAME_PRIMARY_OWNER  1
+#define REQUEST_NAME_EXISTS         3
+#define REQUEST_NAME_ALREADY_OWNER  4
+
+#define RELEASE_NAME_NOT_OWNER      3
+
+/* seconds before reconnecting a lost upstream connection, doubled after
+   every failed attempt */
+#define UPSTREAM_RETRY_DELAY_MIN    1
+#define UPSTREAM_RETRY_DELAY_MAX   60
+
+#include "lia-bus-match-rule.c"
+
+typedef struct _Upstream Upstream;
+
+typedef struct
+{
+  LiaBusMux *mux;
+  Upstream *upstream;
+  GDBusConnection *conn;
+  gchar *unique_name;
+  guint filter_id;
+
+  GList *match_rules;
+
+  /* the last signal dispatch that reached this peer, so that a signal
+     matching several of its rules is delivered once */
+  guint64 last_dispatch;
+
+  /* well-known names owned upstream on behalf of this peer */
+  GList *names;
+
+  /* serial of calls forwarded to the peer -> IncomingCall */
+  GHashTable *incoming_calls;
+
+  gboolean closed;
+
+  volatile gint ref_count;
+} MuxPeer;
+
+/* a call sent upstream, waiting for its reply */
+typedef struct
+{
+  /* NULL for the mux's own calls */
+  MuxPeer *peer;
+  guint32 peer_serial;
+
+  /* RequestName calls, to learn what the peer owns */
+  gchar *request_name;
+
+  /* the mux's GetNameOwner calls */
+  gchar *resolve_name;
+
+  /* the mux's AddMatch calls */
+  gchar *match_rule;
+} PendingCall;
+
+/* a call from upstream forwarded to a peer */
+typedef struct
+{
+  guint32 serial;
+  gchar *sender;
+} IncomingCall;
+
+/* a well-known name that peers' match rules name as sender. Signals
+   arrive with the unique name of the sender, so the mux follows the
+   owner of the name */
+typedef struct
+{
+  gchar *owner;
+  guint ref_count;
+} WatchedName;
+
+/* Subscriptions are indexed by the sender, path, interface and member
+   their rules require, any of which may be a wildcard (NULL). A signal
+   is looked up in at most 16 buckets per sender it can match as, and
+   only the rules in those buckets are evaluated */
+typedef struct
+{
+  gchar *sender;
+  gchar *path;
+  gchar *interface_name;
+  gchar *member;
+} SignalKey;
+
+typedef struct
+{
+  SignalKey key;
+
+  /* Subscription */
+  GList *subscriptions;
+} SignalBucket;
+
+typedef struct
+{
+  MuxPeer *peer;
+  MatchRule *rule;
+} Subscription;
+
+/* a rule added upstream. Peers' AddMatch calls are answered once the
+   upstream bus has accepted or rejected it */
+typedef struct
+{
+  /* number of peers' rules equal to it */
+  guint ref_count;
+
+  /* the upstream AddMatch call hasn't been answered */
+  gboolean pending;
+
+  /* RuleWaiter */
+  GList *waiters;
+} UpstreamRule;
+
+typedef struct
+{
+  MuxPeer *peer;
+  GDBusMessage *msg;
+
+  /* the peer's rule, or NULL if removed while waiting */
+  MatchRule *rule;
+} RuleWaiter;
+
+/* a message waiting for its upstream connection */
+typedef struct
+{
+  GDBusMessage *msg;
+  PendingCall *call;
+} BacklogEntry;
+
+struct _Upstream
+{
+  LiaBusMux *mux;
+  guint index;
+  GDBusConnection *conn;
+  guint filter_id;
+  gboolean failed;
+  guint retry_delay;
+
+  GList *peers;
+  guint num_peers;
+
+  volatile gint ref_count;
+
+  /* messages from peers that connected before this upstream did */
+  GQueue *backlog;
+
+  /* upstream serial -> PendingCall */
+  GHashTable *calls;
+
+  /* well-known name -> WatchedName */
+  GHashTable *watched_names;
+
+  /* well-known name -> MuxPeer owning it */
+  GHashTable *owned_names;
+
+  /* canonical rule -> UpstreamRule. Each distinct rule is added
+     upstream once */
+  GHashTable *rules;
+
+  /* SignalKey -> SignalBucket */
+  GHashTable *signal_index;
+  guint64 dispatches;
+};
+
+/* Like in LiaBusBroker, the mux's state is only touched with 'lock'
+   held. Messages are routed from the connection filters, which run in
+   GDBus' worker thread, while connections are accepted, established and
+   dropped in the thread that created the mux. */
+struct _LiaBusMux
+{
+  GDBusServer *server;
+  gchar *guid;
+  gchar *upstream_address;
+
+  GMutex lock;
+
+  Upstream **upstreams;
+  guint pool_size;
+  GCancellable *cancellable;
+
+  /* a lost upstream connection is replaced after a delay, and kept
+     until the peers it carried are gone */
+  guint *retry_src_ids;
+  GList *retired;
+
+  GList *peer_list;
+  guint next_peer_id;
+};
+
+static void     remove_peer                  (LiaBusMux *self,
+                                              MuxPeer   *peer);
+
+static void     on_upstream_closed           (GDBusConnection *conn,
+                                              gboolean         remote_peer_vanished,
+                                              GError          *error,
+                                              gpointer         user_data);
+
+static MuxPeer *
+peer_ref (MuxPeer *peer)
+{
+  g_atomic_int_inc (&peer->ref_count);
+
+  return peer;
+}
+
+static void
+free_incoming_call (gpointer _data)
+{
+  IncomingCall *call = _data;
+
+  g_free (call->sender);
+
+  g_slice_free (IncomingCall, call);
+}
+
+static void
+peer_unref (gpointer _data)
+{
+  MuxPeer *peer = _data;
+
+  if (! g_atomic_int_dec_and_test (&peer->ref_count))
+    return;
+
+  g_object_unref (peer->conn);
+  g_free (peer->unique_name);
+
+  g_list_free_full (peer->match_rules, free_match_rule);
+  g_list_free_full (peer->names, g_free);
+  g_hash_table_unref (peer->incoming_calls);
+
+  g_slice_free (MuxPeer, peer);
+}
+
+static void
+free_pending_call (gpointer _data)
+{
+  PendingCall *call = _data;
+
+  if (call->peer != NULL)
+    peer_unref (call->peer);
+
+  g_free (call->request_name);
+  g_free (call->resolve_name);
+  g_free (call->match_rule);
+
+  g_slice_free (PendingCall, call);
+}
+
+static void
+free_rule_waiter (gpointer _data)
+{
+  RuleWaiter *waiter = _data;
+
+  peer_unref (waiter->peer);
+  g_object_unref (waiter->msg);
+
+  g_slice_free (RuleWaiter, waiter);
+}
+
+static void
+free_upstream_rule (gpointer _data)
+{
+  UpstreamRule *record = _data;
+
+  g_list_free_full (record->waiters, free_rule_waiter);
+
+  g_slice_free (UpstreamRule, record);
+}
+
+static void
+free_watched_name (gpointer _data)
+{
+  WatchedName *watched = _data;
+
+  g_free (watched->owner);
+
+  g_slice_free (WatchedName, watched);
+}
+
+static void
+free_signal_bucket (gpointer _data)
+{
+  SignalBucket *bucket = _data;
+
+  g_free (bucket->key.sender);
+  g_free (bucket->key.path);
+  g_free (bucket->key.interface_name);
+  g_free (bucket->key.member);
+
+  g_list_free_full (bucket->subscriptions, (GDestroyNotify) g_free);
+
+  g_slice_free (SignalBucket, bucket);
+}
+
+static guint
+signal_key_hash (gconstpointer _key)
+{
+  const SignalKey *key = _key;
+  guint hash = 0;
+
+  if (key->sender != NULL)
+    hash = g_str_hash (key->sender);
+  if (key->path != NULL)
+    hash = hash * 31 + g_str_hash (key->path);
+  if (key->interface_name != NULL)
+    hash = hash * 31 + g_str_hash (key->interface_name);
+  if (key->member != NULL)
+    hash = hash * 31 + g_str_hash (key->member);
+
+  return hash;
+}
+
+static gboolean
+signal_key_equal (gconstpointer _a, gconstpointer _b)
+{
+  const SignalKey *a = _a;
+  const SignalKey *b = _b;
+
+  return g_strcmp0 (a->member, b->member) == 0 &&
+    g_strcmp0 (a->path, b->path) == 0 &&
+    g_strcmp0 (a->interface_name, b->interface_name) == 0 &&
+    g_strcmp0 (a->sender, b->sender) == 0;
+}
+
+static void
+free_backlog_entry (gpointer _data)
+{
+  BacklogEntry *entry = _data;
+
+  g_object_unref (entry->msg);
+  if (entry->call != NULL)
+    free_pending_call (entry->call);
+
+  g_slice_free (BacklogEntry, entry);
+}
+
+/* the connection's filter holds a reference, as it may still be running
+   after being removed */
+static Upstream *
+upstream_ref (Upstream *upstream)
+{
+  g_atomic_int_inc (&upstream->ref_count);
+
+  return upstream;
+}
+
+static void
+upstream_unref (gpointer _data)
+{
+  Upstream *upstream = _data;
+
+  if (! g_atomic_int_dec_and_test (&upstream->ref_count))
+    return;
+
+  if (upstream->conn != NULL)
+    g_object_unref (upstream->conn);
+
+  g_list_free (upstream->peers);
+
+  g_queue_free_full (upstream->backlog, free_backlog_entry);
+  g_hash_table_unref (upstream->calls);
+  g_hash_table_unref (upstream->watched_names);
+  g_hash_table_unref (upstream->owned_names);
+  g_hash_table_unref (upstream->rules);
+  g_hash_table_unref (upstream->signal_index);
+
+  g_slice_free (Upstream, upstream);
+}
+
+static void
+free_upstream (Upstream *upstream)
+{
+  if (upstream->conn != NULL)
+    {
+      g_signal_handlers_disconnect_by_func (upstream->conn,
+                                            on_upstream_closed,
+                                            upstream);
+      g_dbus_connection_remove_filter (upstream->conn, upstream->filter_id);
+      g_dbus_connection_close (upstream->conn, NULL, NULL, NULL);
+    }
+
+  upstream_unref (upstream);
+}
+
+/* sending */
+
+static void
+send_to_peer (MuxPeer *peer, GDBusMessage *msg, guint32 *out_serial)
+{
+  GError *error = NULL;
+
+  if (peer->closed)
+    return;
+
+  if (! g_dbus_connection_send_message (peer->conn,
+                                        msg,
+                                        G_DBUS_SEND_MESSAGE_FLAGS_NONE,
+                                        out_serial,
+                                        &error))
+    {
+      g_debug ("Error sending message to '%s': %s",
+               peer->unique_name,
+               error->message);
+      g_error_free (error);
+    }
+}
+
+/* sends @msg upstream, taking ownership of @call, which is looked up by
+   serial when the reply arrives */
+static void
+send_upstream (Upstream *upstream, GDBusMessage *msg, PendingCall *call)
+{
+  guint32 serial;
+  GError *error = NULL;
+
+  if (upstream->failed)
+    {
+      if (call != NULL)
+        free_pending_call (call);
+      return;
+    }
+
+  if (upstream->conn == NULL)
+    {
+      BacklogEntry *entry;
+
+      entry = g_slice_new (BacklogEntry);
+      entry->msg = g_object_ref (msg);
+      entry->call = call;
+      g_queue_push_tail (upstream->backlog, entry);
+
+      return;
+    }
+
+  if (! g_dbus_connection_send_message (upstream->conn,
+                                        msg,
+                                        G_DBUS_SEND_MESSAGE_FLAGS_NONE,
+                                        &serial,
+                                        &error))
+    {
+      g_debug ("Error sending message upstream: %s", error->message);
+      g_error_free (error);
+
+      if (call != NULL)
+        free_pending_call (call);
+      return;
+    }
+
+  /* the lock is held, so the reply can't be routed before this */
+  if (call != NULL)
+    g_hash_table_insert (upstream->calls, GUINT_TO_POINTER (serial), call);
+}
+
+/* forwards a message from @peer upstream. Replies to calls find their
+   way back to the peer by serial */
+static void
+forward_upstream (MuxPeer *peer, GDBusMessage *msg, const gchar *request_name)
+{
+  GDBusMessage *copy;
+  PendingCall *call = NULL;
+  GError *error = NULL;
+
+  /* messages get locked when sent, so a copy is needed */
+  copy = g_dbus_message_copy (msg, &error);
+  if (copy == NULL)
+    {
+      g_debug ("Error copying message: %s", error->message);
+      g_error_free (error);
+      return;
+    }
+
+  g_dbus_message_set_sender (copy, NULL);
+
+  if (g_dbus_message_get_message_type (msg) == G_DBUS_MESSAGE_TYPE_METHOD_CALL &&
+      ! (g_dbus_message_get_flags (msg) & G_DBUS_MESSAGE_FLAGS_NO_REPLY_EXPECTED))
+    {
+      call = g_slice_new0 (PendingCall);
+      call->peer = peer_ref (peer);
+      call->peer_serial = g_dbus_message_get_serial (msg);
+      call->request_name = g_strdup (request_name);
+    }
+
+  send_upstream (peer->upstream, copy, call);
+  g_object_unref (copy);
+}
+
+/* calls a method of the upstream bus on the mux's own behalf */
+static void
+call_upstream_driver (Upstream    *upstream,
+                      const gchar *method_name,
+                      GVariant    *args,
+                      PendingCall *call)
+{
+  GDBusMessage *msg;
+
+  msg = g_dbus_message_new_method_call (DBUS_SERVICE_NAME,
+                                        DBUS_OBJ_PATH,
+                                        DBUS_IFACE_NAME,
+                                        method_name);
+  g_dbus_message_set_body (msg, args);
+
+  if (call == NULL)
+    g_dbus_message_set_flags (msg, G_DBUS_MESSAGE_FLAGS_NO_REPLY_EXPECTED);
+
+  send_upstream (upstream, msg, call);
+  g_object_unref (msg);
+}
+
+static void
+reply_driver_call (MuxPeer *peer, GDBusMessage *call, GVariant *body)
+{
+  GDBusMessage *reply;
+
+  if (g_dbus_message_get_flags (call) & G_DBUS_MESSAGE_FLAGS_NO_REPLY_EXPECTED)
+    {
+      if (body != NULL)
+        g_variant_unref (g_variant_ref_sink (body));
+      return;
+    }
+
+  reply = g_dbus_message_new_method_reply (call);
+  g_dbus_message_set_sender (reply, DBUS_SERVICE_NAME);
+  g_dbus_message_set_destination (reply, peer->unique_name);
+  if (body != NULL)
+    g_dbus_message_set_body (reply, body);
+
+  send_to_peer (peer, reply, NULL);
+  g_object_unref (reply);
+}
+
+static void
+reply_driver_error (MuxPeer      *peer,
+                    GDBusMessage *call,
+                    const gchar  *error_name,
+                    const gchar  *format,
+                    ...)
+{
+  GDBusMessage *reply;
+  va_list args;
+
+  if (g_dbus_message_get_message_type (call) != G_DBUS_MESSAGE_TYPE_METHOD_CALL ||
+      (g_dbus_message_get_flags (call) & G_DBUS_MESSAGE_FLAGS_NO_REPLY_EXPECTED))
+    {
+      return;
+    }
+
+  va_start (args, format);
+  reply = g_dbus_message_new_method_error_valist (call, error_name, format, args);
+  va_end (args);
+
+  g_dbus_message_set_sender (reply, DBUS_SERVICE_NAME);
+  g_dbus_message_set_destination (reply, peer->unique_name);
+
+  send_to_peer (peer, reply, NULL);
+  g_object_unref (reply);
+}
+
+/* names */
+
+static gchar *
+name_owner_change_rule (const gchar *name)
+{
+  return g_strdup_printf ("type='signal',"
+                          "sender='" DBUS_SERVICE_NAME "',"
+                          "interface='" DBUS_IFACE_NAME "',"
+                          "member='NameOwnerChanged',"
+                          "arg0='%s'",
+                          name);
+}
+
+static void
+watch_name (Upstream *upstream, const gchar *name)
+{
+  WatchedName *watched;
+  PendingCall *call;
+  gchar *rule;
+
+  watched = g_hash_table_lookup (upstream->watched_names, name);
+  if (watched != NULL)
+    {
+      watched->ref_count++;
+      return;
+    }
+
+  watched = g_slice_new0 (WatchedName);
+  watched->ref_count = 1;
+  g_hash_table_insert (upstream->watched_names, g_strdup (name), watched);
+
+  /* follow changes of owner first, then ask for the current one */
+  rule = name_owner_change_rule (name);
+  call_upstream_driver (upstream, "AddMatch", g_variant_new ("(s)", rule), NULL);
+  g_free (rule);
+
+  call = g_slice_new0 (PendingCall);
+  call->resolve_name = g_strdup (name);
+  call_upstream_driver (upstream,
+                        "GetNameOwner",
+                        g_variant_new ("(s)", name),
+                        call);
+}
+
+static void
+unwatch_name (Upstream *upstream, const gchar *name)
+{
+  WatchedName *watched;
+  gchar *rule;
+
+  watched = g_hash_table_lookup (upstream->watched_names, name);
+  if (watched == NULL)
+    return;
+
+  watched->ref_count--;
+  if (watched->ref_count > 0)
+    return;
+
+  g_hash_table_remove (upstream->watched_names, name);
+
+  rule = name_owner_change_rule (name);
+  call_upstream_driver (upstream, "RemoveMatch", g_variant_new ("(s)", rule), NULL);
+  g_free (rule);
+}
+
+static const gchar *
+get_name_owner (const gchar *name, gpointer user_data)
+{
+  Upstream *upstream = user_data;
+  WatchedName *watched;
+
+  if (strcmp (name, DBUS_SERVICE_NAME) == 0)
+    return DBUS_SERVICE_NAME;
+
+  watched = g_hash_table_lookup (upstream->watched_names, name);
+
+  return watched != NULL ? watched->owner : NULL;
+}
+
+static gboolean
+rule_watches_sender (MatchRule *rule)
+{
+  return rule->sender != NULL &&
+    rule->sender[0] != ':' &&
+    strcmp (rule->sender, DBUS_SERVICE_NAME) != 0;
+}
+
+/* subscriptions */
+
+static void
+append_rule_key (GString *str, const gchar *key, const gchar *value)
+{
+  const gchar *p;
+
+  if (value == NULL)
+    return;
+
+  if (str->len > 0)
+    g_string_append_c (str, ',');
+
+  /* apostrophes can't be quoted, so they are closed, escaped and
+     reopened */
+  g_string_append_printf (str, "%s='", key);
+  for (p = value; *p != '\0'; p++)
+    {
+      if (*p == '\'')
+        g_string_append (str, "'\\''");
+      else
+        g_string_append_c (str, *p);
+    }
+  g_string_append_c (str, '\'');
+}
+
+/* Returns the rule with its keys in a fixed order, so that rules that
+   only differ in how they were written are added upstream once */
+static gchar *
+match_rule_to_canonical (MatchRule *rule)
+{
+  static const gchar *TYPE_NAMES[] = {
+    NULL, "method_call", "method_return", "error", "signal"
+  };
+  static const gchar *ARG_SUFFIXES[] = { "", "path", "namespace" };
+
+  GString *str;
+  gint i;
+
+  str = g_string_new (NULL);
+
+  if (rule->type > 0 && rule->type < (gint) G_N_ELEMENTS (TYPE_NAMES))
+    append_rule_key (str, "type", TYPE_NAMES[rule->type]);
+
+  append_rule_key (str, "sender", rule->sender);
+  append_rule_key (str, "interface", rule->interface_name);
+  append_rule_key (str, "member", rule->member);
+  append_rule_key (str, "path", rule->path);
+  append_rule_key (str, "path_namespace", rule->path_namespace);
+  append_rule_key (str, "destination", rule->destination);
+
+  for (i=0; i<=rule->max_arg; i++)
+    if (rule->args[i] != NULL)
+      {
+        gchar *key;
+
+        key = g_strdup_printf ("arg%d%s", i, ARG_SUFFIXES[rule->arg_kinds[i]]);
+        append_rule_key (str, key, rule->args[i]);
+        g_free (key);
+      }
+
+  return g_string_free (str, FALSE);
+}
+
+/* takes a reference on the upstream rule equal to @rule, replying to
+   the peer's AddMatch call @msg once it is in place upstream */
+static void
+ref_upstream_rule (Upstream     *upstream,
+                   MuxPeer      *peer,
+                   MatchRule    *rule,
+                   GDBusMessage *msg)
+{
+  gchar *canonical;
+  UpstreamRule *record;
+  RuleWaiter *waiter;
+  PendingCall *call;
+
+  canonical = match_rule_to_canonical (rule);
+
+  record = g_hash_table_lookup (upstream->rules, canonical);
+  if (record != NULL && ! record->pending)
+    {
+      record->ref_count++;
+      g_free (canonical);
+
+      reply_driver_call (peer, msg, NULL);
+      return;
+    }
+
+  waiter = g_slice_new (RuleWaiter);
+  waiter->peer = peer_ref (peer);
+  waiter->msg = g_object_ref (msg);
+  waiter->rule = rule;
+
+  if (record != NULL)
+    {
+      record->ref_count++;
+      record->waiters = g_list_append (record->waiters, waiter);
+      g_free (canonical);
+      return;
+    }
+
+  record = g_slice_new0 (UpstreamRule);
+  record->ref_count = 1;
+  record->pending = TRUE;
+  record->waiters = g_list_append (NULL, waiter);
+  g_hash_table_insert (upstream->rules, canonical, record);
+
+  call = g_slice_new0 (PendingCall);
+  call->match_rule = g_strdup (canonical);
+  call_upstream_driver (upstream,
+                        "AddMatch",
+                        g_variant_new ("(s)", canonical),
+                        call);
+}
+
+static void
+unref_upstream_rule (Upstream *upstream, MatchRule *rule)
+{
+  gchar *canonical;
+  UpstreamRule *record;
+  GList *node;
+
+  canonical = match_rule_to_canonical (rule);
+
+  record = g_hash_table_lookup (upstream->rules, canonical);
+  if (record == NULL)
+    {
+      g_free (canonical);
+      return;
+    }
+
+  record->ref_count--;
+
+  /* a rule waiting for upstream is kept until it is answered, so that
+     the answer finds it. It is removed then if no longer used */
+  if (record->pending)
+    {
+      for (node = record->waiters; node != NULL; node = node->next)
+        if (((RuleWaiter *) node->data)->rule == rule)
+          ((RuleWaiter *) node->data)->rule = NULL;
+    }
+  else if (record->ref_count == 0)
+    {
+      call_upstream_driver (upstream,
+                            "RemoveMatch",
+                            g_variant_new ("(s)", canonical),
+                            NULL);
+      g_hash_table_remove (upstream->rules, canonical);
+    }
+
+  g_free (canonical);
+}
+
+static void
+index_subscription (Upstream *upstream, MuxPeer *peer, MatchRule *rule)
+{
+  SignalKey key;
+  SignalBucket *bucket;
+  Subscription *subscription;
+
+  key.sender = rule->sender;
+  key.path = rule->path;
+  key.interface_name = rule->interface_name;
+  key.member = rule->member;
+
+  bucket = g_hash_table_lookup (upstream->signal_index, &key);
+  if (bucket == NULL)
+    {
+      bucket = g_slice_new0 (SignalBucket);
+      bucket->key.sender = g_strdup (rule->sender);
+      bucket->key.path = g_strdup (rule->path);
+      bucket->key.interface_name = g_strdup (rule->interface_name);
+      bucket->key.member = g_strdup (rule->member);
+
+      g_hash_table_insert (upstream->signal_index, &bucket->key, bucket);
+    }
+
+  subscription = g_new (Subscription, 1);
+  subscription->peer = peer;
+  subscription->rule = rule;
+  bucket->subscriptions = g_list_prepend (bucket->subscriptions, subscription);
+}
+
+static void
+unindex_subscription (Upstream *upstream, MatchRule *rule)
+{
+  SignalKey key;
+  SignalBucket *bucket;
+  GList *node;
+
+  key.sender = rule->sender;
+  key.path = rule->path;
+  key.interface_name = rule->interface_name;
+  key.member = rule->member;
+
+  bucket = g_hash_table_lookup (upstream->signal_index, &key);
+  if (bucket == NULL)
+    return;
+
+  for (node = bucket->subscriptions; node != NULL; node = node->next)
+    if (((Subscription *) node->data)->rule == rule)
+      break;
+
+  if (node == NULL)
+    return;
+
+  g_free (node->data);
+  bucket->subscriptions = g_list_delete_link (bucket->subscriptions, node);
+
+  if (bucket->subscriptions == NULL)
+    g_hash_table_remove (upstream->signal_index, &key);
+}
+
+/* @msg is the peer's AddMatch call, answered once the rule is in place
+   upstream */
+static void
+add_peer_rule (MuxPeer *peer, MatchRule *rule, GDBusMessage *msg)
+{
+  peer->match_rules = g_list_prepend (peer->match_rules, rule);
+
+  if (rule_watches_sender (rule))
+    watch_name (peer->upstream, rule->sender);
+
+  index_subscription (peer->upstream, peer, rule);
+  ref_upstream_rule (peer->upstream, peer, rule, msg);
+}
+
+/* drops the peer's rule and its subscription, leaving the upstream rule
+   alone */
+static void
+drop_peer_rule (MuxPeer *peer, GList *node)
+{
+  MatchRule *rule = node->data;
+
+  unindex_subscription (peer->upstream, rule);
+
+  if (rule_watches_sender (rule))
+    unwatch_name (peer->upstream, rule->sender);
+
+  free_match_rule (rule);
+  peer->match_rules = g_list_delete_link (peer->match_rules, node);
+}
+
+static void
+remove_peer_rule (MuxPeer *peer, GList *node)
+{
+  unref_upstream_rule (peer->upstream, node->data);
+  drop_peer_rule (peer, node);
+}
+
+static void
+add_owned_name (MuxPeer *peer, const gchar *name)
+{
+  if (g_hash_table_lookup (peer->upstream->owned_names, name) == peer)
+    return;
+
+  g_hash_table_insert (peer->upstream->owned_names, g_strdup (name), peer);
+  peer->names = g_list_prepend (peer->names, g_strdup (name));
+}
+
+static void
+remove_owned_name (MuxPeer *peer, const gchar *name)
+{
+  GList *node;
+
+  for (node = peer->names; node != NULL; node = node->next)
+    if (strcmp (node->data, name) == 0)
+      break;
+
+  if (node == NULL)
+    return;
+
+  if (g_hash_table_lookup (peer->upstream->owned_names, name) == peer)
+    g_hash_table_remove (peer->upstream->owned_names, name);
+
+  g_free (node->data);
+  peer->names = g_list_delete_link (peer->names, node);
+}
+
+/* routing of messages from peers */
+
+static void
+handle_driver_call (LiaBusMux *self, MuxPeer *peer, GDBusMessage *msg)
+{
+  const gchar *member;
+  GVariant *args;
+  const gchar *arg;
+  GDBusMessage *signal;
+
+  member = g_dbus_message_get_member (msg);
+  args = g_dbus_message_get_body (msg);
+
+  if (g_strcmp0 (member, "Hello") == 0)
+    {
+      if (peer->unique_name != NULL)
+        {
+          reply_driver_error (peer,
+                              msg,
+                              DBUS_IFACE_NAME ".Error.Failed",
+                              "Already handled an Hello message");
+          return;
+        }
+
+      /* the name is only meaningful between the peer and the mux, the
+         rest of the bus sees the upstream connection's */
+      peer->unique_name = g_strdup_printf (":mux.%u", self->next_peer_id++);
+
+      reply_driver_call (peer, msg, g_variant_new ("(s)", peer->unique_name));
+
+      signal = g_dbus_message_new_signal (DBUS_OBJ_PATH,
+                                          DBUS_IFACE_NAME,
+                                          "NameAcquired");
+      g_dbus_message_set_sender (signal, DBUS_SERVICE_NAME);
+      g_dbus_message_set_destination (signal, peer->unique_name);
+      g_dbus_message_set_body (signal,
+                               g_variant_new ("(s)", peer->unique_name));
+      send_to_peer (peer, signal, NULL);
+      g_object_unref (signal);
+    }
+  else if (g_strcmp0 (member, "AddMatch") == 0 ||
+           g_strcmp0 (member, "RemoveMatch") == 0)
+    {
+      MatchRule *rule;
+
+      if (args == NULL || ! g_variant_is_of_type (args, G_VARIANT_TYPE ("(s)")))
+        {
+          reply_driver_error (peer,
+                              msg,
+                              DBUS_ERROR_INVALID_ARGS,
+                              "Expected arguments of type '(s)'");
+          return;
+        }
+      g_variant_get (args, "(&s)", &arg);
+
+      if (member[0] == 'A')
+        {
+          rule = parse_match_rule (arg);
+          if (rule == NULL)
+            {
+              reply_driver_error (peer,
+                                  msg,
+                                  DBUS_ERROR_MATCH_INVALID,
+                                  "Invalid match rule '%s'",
+                                  arg);
+              return;
+            }
+
+          /* equal rules of all the peers sharing the upstream connection
+             are added upstream once, and the mux fans signals out to
+             them. The call is answered once the rule is in place */
+          add_peer_rule (peer, rule, msg);
+          return;
+        }
+      else
+        {
+          GList *node;
+
+          for (node = peer->match_rules; node != NULL; node = node->next)
+            if (strcmp (((MatchRule *) node->data)->rule, arg) == 0)
+              break;
+
+          if (node == NULL)
+            {
+              reply_driver_error (peer,
+                                  msg,
+                                  DBUS_ERROR_MATCH_NOT_FOUND,
+                                  "The given match rule wasn't found");
+              return;
+            }
+
+          remove_peer_rule (peer, node);
+        }
+
+      reply_driver_call (peer, msg, NULL);
+    }
+  else if (g_strcmp0 (member, "RequestName") == 0)
+    {
+      MuxPeer *owner;
+
+      if (args == NULL || ! g_variant_is_of_type (args, G_VARIANT_TYPE ("(su)")))
+        {
+          reply_driver_error (peer,
+                              msg,
+                              DBUS_ERROR_INVALID_ARGS,
+                              "Expected arguments of type '(su)'");
+          return;
+        }
+      g_variant_get (args, "(&su)", &arg, NULL);
+
+      /* the upstream bus would tell a peer sharing the upstream connection
+         with the owner that it owns the name already */
+      owner = g_hash_table_lookup (peer->upstream->owned_names, arg);
+      if (owner != NULL && owner != peer)
+        {
+          reply_driver_call (peer,
+                             msg,
+                             g_variant_new ("(u)", REQUEST_NAME_EXISTS));
+          return;
+        }
+
+      forward_upstream (peer, msg, arg);
+    }
+  else if (g_strcmp0 (member, "ReleaseName") == 0)
+    {
+      if (args != NULL && g_variant_is_of_type (args, G_VARIANT_TYPE ("(s)")))
+        {
+          g_variant_get (args, "(&s)", &arg);
+
+          /* the upstream connection owns the names of all its peers, so
+             only the peer that requested a name can release it */
+          if (g_hash_table_lookup (peer->upstream->owned_names, arg) != peer)
+            {
+              reply_driver_call (peer,
+                                 msg,
+                                 g_variant_new ("(u)", RELEASE_NAME_NOT_OWNER));
+              return;
+            }
+
+          remove_owned_name (peer, arg);
+        }
+
+      forward_upstream (peer, msg, NULL);
+    }
+  else
+    {
+      forward_upstream (peer, msg, NULL);
+    }
+}
+
+static void
+route_peer_message (LiaBusMux *self, MuxPeer *peer, GDBusMessage *msg)
+{
+  GDBusMessageType type;
+  IncomingCall *call;
+  GDBusMessage *reply;
+  GError *error = NULL;
+
+  type = g_dbus_message_get_message_type (msg);
+
+  if (g_strcmp0 (g_dbus_message_get_destination (msg), DBUS_SERVICE_NAME) == 0)
+    {
+      if (type != G_DBUS_MESSAGE_TYPE_METHOD_CALL)
+        return;
+
+      if (peer->unique_name == NULL &&
+          g_strcmp0 (g_dbus_message_get_member (msg), "Hello") != 0)
+        {
+          goto not_registered;
+        }
+
+      handle_driver_call (self, peer, msg);
+      return;
+    }
+
+  if (peer->unique_name == NULL)
+    goto not_registered;
+
+  if (type != G_DBUS_MESSAGE_TYPE_METHOD_RETURN &&
+      type != G_DBUS_MESSAGE_TYPE_ERROR)
+    {
+      forward_upstream (peer, msg, NULL);
+      return;
+    }
+
+  /* a reply to a call the mux forwarded to the peer */
+  call = g_hash_table_lookup (peer->incoming_calls,
+                              GUINT_TO_POINTER (g_dbus_message_get_reply_serial (msg)));
+  if (call == NULL)
+    return;
+
+  reply = g_dbus_message_copy (msg, &error);
+  if (reply == NULL)
+    {
+      g_debug ("Error copying message: %s", error->message);
+      g_error_free (error);
+    }
+  else
+    {
+      g_dbus_message_set_sender (reply, NULL);
+      g_dbus_message_set_destination (reply, call->sender);
+      g_dbus_message_set_reply_serial (reply, call->serial);
+
+      send_upstream (peer->upstream, reply, NULL);
+      g_object_unref (reply);
+    }
+
+  g_hash_table_remove (peer->incoming_calls,
+                       GUINT_TO_POINTER (g_dbus_message_get_reply_serial (msg)));
+  return;
+
+ not_registered:
+  reply_driver_error (peer,
+                      msg,
+                      DBUS_ERROR_ACCESS_DENIED,
+                      "Client tried to send a message other than Hello "
+                      "without being registered");
+  g_dbus_connection_close (peer->conn, NULL, NULL, NULL);
+}
+
+static GDBusMessage *
+on_peer_message (GDBusConnection *conn,
+                 GDBusMessage    *msg,
+                 gboolean         incoming,
+                 gpointer         user_data)
+{
+  MuxPeer *peer = user_data;
+  LiaBusMux *self = peer->mux;
+
+  if (! incoming)
+    return msg;
+
+  /* every incoming message is handled here, and none is left for the
+     connection to dispatch */
+  g_mutex_lock (&self->lock);
+  if (! peer->closed)
+    route_peer_message (self, peer, msg);
+  g_mutex_unlock (&self->lock);
+
+  g_object_unref (msg);
+
+  return NULL;
+}
+
+/* routing of messages from upstream */
+
+/* answers the AddMatch calls of the peers waiting for @match_rule. If
+   the upstream bus rejected it, the peers get its error and their rules
+   are dropped */
+static void
+route_match_rule_reply (Upstream     *upstream,
+                        const gchar  *match_rule,
+                        GDBusMessage *msg)
+{
+  UpstreamRule *record;
+  GList *waiters;
+  GList *node;
+  GVariant *body;
+  const gchar *error_name;
+  const gchar *error_msg = "";
+
+  record = g_hash_table_lookup (upstream->rules, match_rule);
+  if (record == NULL || ! record->pending)
+    return;
+
+  waiters = record->waiters;
+  record->waiters = NULL;
+  record->pending = FALSE;
+
+  if (g_dbus_message_get_message_type (msg) != G_DBUS_MESSAGE_TYPE_ERROR)
+    {
+      for (node = waiters; node != NULL; node = node->next)
+        {
+          RuleWaiter *waiter = node->data;
+
+          reply_driver_call (waiter->peer, waiter->msg, NULL);
+        }
+
+      /* all the peers removed it while waiting */
+      if (record->ref_count == 0)
+        {
+          call_upstream_driver (upstream,
+                                "RemoveMatch",
+                                g_variant_new ("(s)", match_rule),
+                                NULL);
+          g_hash_table_remove (upstream->rules, match_rule);
+        }
+
+      g_list_free_full (waiters, free_rule_waiter);
+      return;
+    }
+
+  error_name = g_dbus_message_get_error_name (msg);
+  body = g_dbus_message_get_body (msg);
+  if (body != NULL && g_variant_is_of_type (body, G_VARIANT_TYPE ("(s)")))
+    g_variant_get (body, "(&s)", &error_msg);
+
+  g_debug ("Bus mux upstream %u rejected match rule \"%s\": %s",
+           upstream->index,
+           match_rule,
+           error_name);
+
+  /* only the waiters held references on it */
+  g_hash_table_remove (upstream->rules, match_rule);
+
+  for (node = waiters; node != NULL; node = node->next)
+    {
+      RuleWaiter *waiter = node->data;
+      GList *rule_node;
+
+      reply_driver_error (waiter->peer,
+                          waiter->msg,
+                          error_name != NULL ?
+                          error_name : DBUS_IFACE_NAME ".Error.Failed",
+                          "%s",
+                          error_msg);
+
+      if (waiter->rule == NULL)
+        continue;
+
+      rule_node = g_list_find (waiter->peer->match_rules, waiter->rule);
+      if (rule_node != NULL)
+        drop_peer_rule (waiter->peer, rule_node);
+    }
+
+  g_list_free_full (waiters, free_rule_waiter);
+}
+
+static void
+route_reply (Upstream *upstream, PendingCall *call, GDBusMessage *msg)
+{
+  GVariant *body;
+  GDBusMessage *copy;
+  GError *error = NULL;
+
+  body = g_dbus_message_get_body (msg);
+
+  if (call->resolve_name != NULL)
+    {
+      WatchedName *watched;
+
+      watched = g_hash_table_lookup (upstream->watched_names, call->resolve_name);
+      if (watched != NULL &&
+          body != NULL &&
+          g_variant_is_of_type (body, G_VARIANT_TYPE ("(s)")))
+        {
+          const gchar *owner;
+
+          g_variant_get (body, "(&s)", &owner);
+
+          g_free (watched->owner);
+          watched->owner = g_strdup (owner);
+        }
+
+      return;
+    }
+
+  if (call->match_rule != NULL)
+    {
+      route_match_rule_reply (upstream, call->match_rule, msg);
+      return;
+    }
+
+  if (call->peer == NULL || call->peer->closed)
+    return;
+
+  if (call->request_name != NULL &&
+      body != NULL &&
+      g_variant_is_of_type (body, G_VARIANT_TYPE ("(u)")))
+    {
+      guint32 result;
+
+      g_variant_get (body, "(u)", &result);
+      if (result == REQUEST_NAME_PRIMARY_OWNER ||
+          result == REQUEST_NAME_ALREADY_OWNER)
+        {
+          add_owned_name (call->peer, call->request_name);
+        }
+    }
+
+  copy = g_dbus_message_copy (msg, &error);
+  if (copy == NULL)
+    {
+      g_debug ("Error copying message: %s", error->message);
+      g_error_free (error);
+      return;
+    }
+
+  g_dbus_message_set_destination (copy, call->peer->unique_name);
+  g_dbus_message_set_reply_serial (copy, call->peer_serial);
+
+  send_to_peer (call->peer, copy, NULL);
+  g_object_unref (copy);
+}
+
+static void
+forward_to_peer (MuxPeer *peer, GDBusMessage *msg)
+{
+  GDBusMessage *copy;
+  GError *error = NULL;
+
+  copy = g_dbus_message_copy (msg, &error);
+  if (copy == NULL)
+    {
+      g_debug ("Error copying message: %s", error->message);
+      g_error_free (error);
+      return;
+    }
+
+  if (g_dbus_message_get_destination (copy) != NULL)
+    g_dbus_message_set_destination (copy, peer->unique_name);
+
+  send_to_peer (peer, copy, NULL);
+  g_object_unref (copy);
+}
+
+/* Sends a broadcast signal to @peer as it came from upstream. The same
+   locked message goes to every peer, keeping the upstream serial, which
+   saves a copy of the message per peer. GDBus still serializes it anew
+   for each of them */
+static void
+send_shared_to_peer (MuxPeer *peer, GDBusMessage *msg)
+{
+  GError *error = NULL;
+
+  if (peer->closed)
+    return;
+
+  if (! g_dbus_connection_send_message (peer->conn,
+                                        msg,
+                                        G_DBUS_SEND_MESSAGE_FLAGS_PRESERVE_SERIAL,
+                                        NULL,
+                                        &error))
+    {
+      g_debug ("Error sending signal to '%s': %s",
+               peer->unique_name,
+               error->message);
+      g_error_free (error);
+    }
+}
+
+static void
+fan_out_bucket (Upstream     *upstream,
+                SignalBucket *bucket,
+                GDBusMessage *msg,
+                const gchar  *sender)
+{
+  GList *node;
+
+  for (node = bucket->subscriptions; node != NULL; node = node->next)
+    {
+      Subscription *subscription = node->data;
+      MuxPeer *peer = subscription->peer;
+
+      if (peer->last_dispatch == upstream->dispatches ||
+          peer->unique_name == NULL ||
+          peer->closed)
+        {
+          continue;
+        }
+
+      if (match_rule_matches (subscription->rule,
+                              msg,
+                              sender,
+                              get_name_owner,
+                              upstream))
+        {
+          peer->last_dispatch = upstream->dispatches;
+          send_shared_to_peer (peer, msg);
+        }
+    }
+}
+
+/* delivers a broadcast signal to the peers with a matching rule, looking
+   at the buckets it can fall in only */
+static void
+fan_out_signal (Upstream *upstream, GDBusMessage *msg, const gchar *sender)
+{
+  GPtrArray *senders;
+  const gchar *paths[2];
+  const gchar *interfaces[2];
+  const gchar *members[2];
+  GHashTableIter iter;
+  gpointer name;
+  gpointer value;
+  guint i;
+  guint j;
+  guint k;
+  guint l;
+
+  if (g_hash_table_size (upstream->signal_index) == 0)
+    return;
+
+  upstream->dispatches++;
+
+  /* sending needs either an unlocked message or the serial preserved,
+     and the message is shared among all the recipients */
+  g_dbus_message_lock (msg);
+
+  /* the sender as itself, as any of the watched names it owns, and as
+     anyone */
+  senders = g_ptr_array_new ();
+  g_ptr_array_add (senders, (gpointer) sender);
+
+  g_hash_table_iter_init (&iter, upstream->watched_names);
+  while (g_hash_table_iter_next (&iter, &name, &value))
+    if (g_strcmp0 (((WatchedName *) value)->owner, sender) == 0)
+      g_ptr_array_add (senders, name);
+
+  g_ptr_array_add (senders, NULL);
+
+  paths[0] = g_dbus_message_get_path (msg);
+  paths[1] = NULL;
+  interfaces[0] = g_dbus_message_get_interface (msg);
+  interfaces[1] = NULL;
+  members[0] = g_dbus_message_get_member (msg);
+  members[1] = NULL;
+
+  for (i=0; i<senders->len; i++)
+    for (j=0; j < (paths[0] != NULL ? 2 : 1); j++)
+      for (k=0; k < (interfaces[0] != NULL ? 2 : 1); k++)
+        for (l=0; l < (members[0] != NULL ? 2 : 1); l++)
+          {
+            SignalKey key;
+            SignalBucket *bucket;
+
+            key.sender = g_ptr_array_index (senders, i);
+            key.path = (gchar *) paths[paths[0] != NULL ? j : 1];
+            key.interface_name =
+              (gchar *) interfaces[interfaces[0] != NULL ? k : 1];
+            key.member = (gchar *) members[members[0] != NULL ? l : 1];
+
+            bucket = g_hash_table_lookup (upstream->signal_index, &key);
+            if (bucket != NULL)
+              fan_out_bucket (upstream, bucket, msg, sender);
+          }
+
+  g_ptr_array_free (senders, TRUE);
+}
+
+static void
+route_signal (Upstream *upstream, GDBusMessage *msg)
+{
+  const gchar *sender;
+  const gchar *destination;
+
+  sender = g_dbus_message_get_sender (msg);
+  destination = g_dbus_message_get_destination (msg);
+
+  if (g_strcmp0 (sender, DBUS_SERVICE_NAME) == 0 &&
+      g_strcmp0 (g_dbus_message_get_interface (msg), DBUS_IFACE_NAME) == 0)
+    {
+      const gchar *member = g_dbus_message_get_member (msg);
+      GVariant *body = g_dbus_message_get_body (msg);
+
+      if (g_strcmp0 (member, "NameOwnerChanged") == 0 &&
+          body != NULL &&
+          g_variant_is_of_type (body, G_VARIANT_TYPE ("(sss)")))
+        {
+          const gchar *name;
+          const gchar *new_owner;
+          WatchedName *watched;
+
+          g_variant_get (body, "(&s&s&s)", &name, NULL, &new_owner);
+
+          watched = g_hash_table_lookup (upstream->watched_names, name);
+          if (watched != NULL)
+            {
+              g_free (watched->owner);
+              watched->owner = new_owner[0] != '\0' ? g_strdup (new_owner) : NULL;
+            }
+        }
+      else if (destination != NULL &&
+               (g_strcmp0 (member, "NameAcquired") == 0 ||
+                g_strcmp0 (member, "NameLost") == 0) &&
+               body != NULL &&
+               g_variant_is_of_type (body, G_VARIANT_TYPE ("(s)")))
+        {
+          const gchar *name;
+          MuxPeer *peer;
+
+          /* these go to the peer the name was requested by */
+          g_variant_get (body, "(&s)", &name);
+
+          peer = g_hash_table_lookup (upstream->owned_names, name);
+          if (peer != NULL)
+            {
+              forward_to_peer (peer, msg);
+              if (member[4] == 'L')
+                remove_owned_name (peer, name);
+            }
+
+          return;
+        }
+    }
+
+  /* a unicast signal sent to a well-known name goes to the peer owning
+     it. One sent to the upstream connection's unique name can't be told
+     apart between peers, which is why core doesn't configure the mux
+     for applications relying on those */
+  if (destination != NULL)
+    {
+      MuxPeer *peer;
+
+      peer = g_hash_table_lookup (upstream->owned_names, destination);
+      if (peer != NULL)
+        forward_to_peer (peer, msg);
+      else
+        g_debug ("Dropping signal '%s' sent to bus mux upstream %u",
+                 g_dbus_message_get_member (msg),
+                 upstream->index);
+
+      return;
+    }
+
+  fan_out_signal (upstream, msg, sender);
+}
+
+static gboolean
+route_call (Upstream *upstream, GDBusMessage *msg)
+{
+  const gchar *destination;
+  MuxPeer *peer;
+  GDBusMessage *copy;
+  guint32 serial = 0;
+  GError *error = NULL;
+
+  /* only calls to names owned by a peer can be routed */
+  destination = g_dbus_message_get_destination (msg);
+  if (destination == NULL || destination[0] == ':')
+    return FALSE;
+
+  peer = g_hash_table_lookup (upstream->owned_names, destination);
+  if (peer == NULL || peer->closed)
+    return FALSE;
+
+  copy = g_dbus_message_copy (msg, &error);
+  if (copy == NULL)
+    {
+      g_debug ("Error copying message: %s", error->message);
+      g_error_free (error);
+      return TRUE;
+    }
+
+  send_to_peer (peer, copy, &serial);
+  g_object_unref (copy);
+
+  if (serial != 0 &&
+      ! (g_dbus_message_get_flags (msg) & G_DBUS_MESSAGE_FLAGS_NO_REPLY_EXPECTED))
+    {
+      IncomingCall *call;
+
+      call = g_slice_new (IncomingCall);
+      call->serial = g_dbus_message_get_serial (msg);
+      call->sender = g_strdup (g_dbus_message_get_sender (msg));
+
+      g_hash_table_insert (peer->incoming_calls, GUINT_TO_POINTER (serial), call);
+    }
+
+  return TRUE;
+}
+
+static GDBusMessage *
+on_upstream_message (GDBusConnection *conn,
+                     GDBusMessage    *msg,
+                     gboolean         incoming,
+                     gpointer         user_data)
+{
+  Upstream *upstream = user_data;
+  LiaBusMux *self = upstream->mux;
+  gboolean handled = FALSE;
+
+  if (! incoming)
+    return msg;
+
+  g_mutex_lock (&self->lock);
+
+  if (upstream->failed)
+    {
+      g_mutex_unlock (&self->lock);
+      return msg;
+    }
+
+  switch (g_dbus_message_get_message_type (msg))
+    {
+    case G_DBUS_MESSAGE_TYPE_METHOD_RETURN:
+    case G_DBUS_MESSAGE_TYPE_ERROR:
+      {
+        gpointer key;
+        PendingCall *call;
+
+        key = GUINT_TO_POINTER (g_dbus_message_get_reply_serial (msg));
+        call = g_hash_table_lookup (upstream->calls, key);
+        if (call != NULL)
+          {
+            route_reply (upstream, call, msg);
+            g_hash_table_remove (upstream->calls, key);
+            handled = TRUE;
+          }
+        break;
+      }
+
+    case G_DBUS_MESSAGE_TYPE_SIGNAL:
+      route_signal (upstream, msg);
+      handled = TRUE;
+      break;
+
+    case G_DBUS_MESSAGE_TYPE_METHOD_CALL:
+      handled = route_call (upstream, msg);
+      break;
+
+    default:
+      break;
+    }
+
+  g_mutex_unlock (&self->lock);
+
+  /* what is left, like calls to the upstream connection's unique name,
+     is answered by GDBus itself */
+  if (! handled)
+    return msg;
+
+  g_object_unref (msg);
+
+  return NULL;
+}
+
+/* upstream connections */
+
+static gboolean reconnect_upstream (gpointer user_data);
+
+static void
+drop_upstream (LiaBusMux *self, Upstream *upstream)
+{
+  GList *conns = NULL;
+  GList *node;
+
+  g_mutex_lock (&self->lock);
+
+  if (upstream->failed)
+    {
+      g_mutex_unlock (&self->lock);
+      return;
+    }
+
+  upstream->failed = TRUE;
+  g_queue_foreach (upstream->backlog, (GFunc) free_backlog_entry, NULL);
+  g_queue_clear (upstream->backlog);
+
+  for (node = upstream->peers; node != NULL; node = node->next)
+    conns = g_list_prepend (conns,
+                            g_object_ref (((MuxPeer *) node->data)->conn));
+
+  g_mutex_unlock (&self->lock);
+
+  /* the bus may be restarting, so it is given some time */
+  g_print ("Reconnecting bus mux upstream %u in %u seconds\n",
+           upstream->index,
+           upstream->retry_delay);
+  self->retry_src_ids[upstream->index] =
+    g_timeout_add_seconds (upstream->retry_delay, reconnect_upstream, upstream);
+
+  /* peers find out and reconnect, getting a working upstream */
+  for (node = conns; node != NULL; node = node->next)
+    g_dbus_connection_close (node->data, NULL, NULL, NULL);
+  g_list_free_full (conns, g_object_unref);
+}
+
+static void
+on_upstream_closed (GDBusConnection *conn,
+                    gboolean         remote_peer_vanished,
+                    GError          *error,
+                    gpointer         user_data)
+{
+  Upstream *upstream = user_data;
+
+  g_print ("Bus mux upstream connection %u closed\n", upstream->index);
+
+  drop_upstream (upstream->mux, upstream);
+}
+
+static void
+on_upstream_connection (GObject      *obj,
+                        GAsyncResult *res,
+                        gpointer      user_data)
+{
+  Upstream *upstream = user_data;
+  LiaBusMux *self;
+  GDBusConnection *conn;
+  GError *error = NULL;
+
+  conn = g_dbus_connection_new_for_address_finish (res, &error);
+  if (conn == NULL)
+    {
+      /* the mux was freed meanwhile */
+      if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        {
+          g_error_free (error);
+          return;
+        }
+
+      g_print ("Error connecting bus mux upstream %u: %s\n",
+               upstream->index,
+               error->message);
+      g_error_free (error);
+
+      drop_upstream (upstream->mux, upstream);
+      return;
+    }
+
+  self = upstream->mux;
+
+  g_dbus_connection_set_exit_on_close (conn, FALSE);
+  g_signal_connect (conn,
+                    "closed",
+                    G_CALLBACK (on_upstream_closed),
+                    upstream);
+
+  g_mutex_lock (&self->lock);
+
+  upstream->conn = conn;
+  upstream->retry_delay = UPSTREAM_RETRY_DELAY_MIN;
+  upstream->filter_id = g_dbus_connection_add_filter (conn,
+                                                      on_upstream_message,
+                                                      upstream_ref (upstream),
+                                                      upstream_unref);
+
+  /* what peers sent meanwhile, in order */
+  while (! g_queue_is_empty (upstream->backlog))
+    {
+      BacklogEntry *entry = g_queue_pop_head (upstream->backlog);
+
+      send_upstream (upstream, entry->msg, entry->call);
+      entry->call = NULL;
+      free_backlog_entry (entry);
+    }
+
+  g_mutex_unlock (&self->lock);
+}
+
+static Upstream *
+upstream_new (LiaBusMux *self, guint index)
+{
+  Upstream *upstream;
+
+  upstream = g_slice_new0 (Upstream);
+  upstream->mux = self;
+  upstream->index = index;
+  upstream->retry_delay = UPSTREAM_RETRY_DELAY_MIN;
+  upstream->ref_count = 1;
+  upstream->backlog = g_queue_new ();
+  upstream->calls = g_hash_table_new_full (g_direct_hash,
+                                           g_direct_equal,
+                                           NULL,
+                                           free_pending_call);
+  upstream->watched_names = g_hash_table_new_full (g_str_hash,
+                                                   g_str_equal,
+                                                   g_free,
+                                                   free_watched_name);
+  upstream->owned_names = g_hash_table_new_full (g_str_hash,
+                                                 g_str_equal,
+                                                 g_free,
+                                                 NULL);
+  upstream->rules = g_hash_table_new_full (g_str_hash,
+                                           g_str_equal,
+                                           g_free,
+                                           free_upstream_rule);
+  upstream->signal_index = g_hash_table_new_full (signal_key_hash,
+                                                  signal_key_equal,
+                                                  NULL,
+                                                  free_signal_bucket);
+
+  g_dbus_connection_new_for_address (self->upstream_address,
+                                     G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+                                     G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+                                     NULL,
+                                     self->cancellable,
+                                     on_upstream_connection,
+                                     upstream);
+
+  return upstream;
+}
+
+/* replaces a lost upstream connection with a new one */
+static gboolean
+reconnect_upstream (gpointer user_data)
+{
+  Upstream *old = user_data;
+  LiaBusMux *self = old->mux;
+  Upstream *upstream;
+  gboolean unused;
+
+  self->retry_src_ids[old->index] = 0;
+
+  upstream = upstream_new (self, old->index);
+  upstream->retry_delay = MIN (old->retry_delay * 2, UPSTREAM_RETRY_DELAY_MAX);
+
+  g_mutex_lock (&self->lock);
+
+  self->upstreams[old->index] = upstream;
+
+  unused = old->num_peers == 0;
+  if (! unused)
+    self->retired = g_list_prepend (self->retired, old);
+
+  g_mutex_unlock (&self->lock);
+
+  if (unused)
+    free_upstream (old);
+
+  return FALSE;
+}
+
+/* peers */
+
+static void
+on_peer_closed (GDBusConnection *conn,
+                gboolean         remote_peer_vanished,
+                GError          *error,
+                gpointer         user_data)
+{
+  MuxPeer *peer = user_data;
+
+  remove_peer (peer->mux, peer);
+}
+
+static void
+remove_peer (LiaBusMux *self, MuxPeer *peer)
+{
+  Upstream *upstream = peer->upstream;
+  GHashTableIter iter;
+  gpointer value;
+  gboolean retired_unused;
+
+  g_mutex_lock (&self->lock);
+
+  if (peer->closed)
+    {
+      g_mutex_unlock (&self->lock);
+      return;
+    }
+
+  peer->closed = TRUE;
+  self->peer_list = g_list_remove (self->peer_list, peer);
+  upstream->peers = g_list_remove (upstream->peers, peer);
+  upstream->num_peers--;
+
+  /* the upstream connection stays, so undo upstream what the peer did */
+  while (peer->match_rules != NULL)
+    remove_peer_rule (peer, peer->match_rules);
+
+  while (peer->names != NULL)
+    {
+      gchar *name = g_strdup (peer->names->data);
+
+      call_upstream_driver (upstream,
+                            "ReleaseName",
+                            g_variant_new ("(s)", name),
+                            NULL);
+      remove_owned_name (peer, name);
+      g_free (name);
+    }
+
+  /* calls the peer won't answer anymore */
+  g_hash_table_iter_init (&iter, peer->incoming_calls);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      IncomingCall *call = value;
+      GDBusMessage *msg;
+
+      msg = g_dbus_message_new ();
+      g_dbus_message_set_message_type (msg, G_DBUS_MESSAGE_TYPE_ERROR);
+      g_dbus_message_set_error_name (msg, DBUS_ERROR_NO_REPLY);
+      g_dbus_message_set_reply_serial (msg, call->serial);
+      g_dbus_message_set_destination (msg, call->sender);
+      g_dbus_message_set_body (msg,
+                               g_variant_new ("(s)",
+                                              "The remote peer disconnected"));
+
+      send_upstream (upstream, msg, NULL);
+      g_object_unref (msg);
+    }
+  g_hash_table_remove_all (peer->incoming_calls);
+
+  /* the last peer of a replaced upstream connection */
+  retired_unused = upstream->num_peers == 0 &&
+    g_list_find (self->retired, upstream) != NULL;
+  if (retired_unused)
+    self->retired = g_list_remove (self->retired, upstream);
+
+  g_mutex_unlock (&self->lock);
+
+  g_signal_handlers_disconnect_by_func (peer->conn, on_peer_closed, peer);
+  g_dbus_connection_remove_filter (peer->conn, peer->filter_id);
+
+  peer_unref (peer);
+
+  if (retired_unused)
+    free_upstream (upstream);
+}
+
+static gboolean
+on_new_connection (GDBusServer     *server,
+                   GDBusConnection *conn,
+                   gpointer         user_data)
+{
+  LiaBusMux *self = user_data;
+  Upstream *upstream = NULL;
+  MuxPeer *peer;
+  guint i;
+
+  g_mutex_lock (&self->lock);
+
+  /* the least loaded of the working upstream connections */
+  for (i=0; i<self->pool_size; i++)
+    if (! self->upstreams[i]->failed &&
+        (upstream == NULL || self->upstreams[i]->num_peers < upstream->num_peers))
+      {
+        upstream = self->upstreams[i];
+      }
+
+  if (upstream == NULL)
+    {
+      g_mutex_unlock (&self->lock);
+      return FALSE;
+    }
+
+  peer = g_slice_new0 (MuxPeer);
+  peer->mux = self;
+  peer->upstream = upstream;
+  peer->conn = g_object_ref (conn);
+  peer->incoming_calls = g_hash_table_new_full (g_direct_hash,
+                                                g_direct_equal,
+                                                NULL,
+                                                free_incoming_call);
+  peer->ref_count = 1;
+
+  self->peer_list = g_list_prepend (self->peer_list, peer);
+  upstream->peers = g_list_prepend (upstream->peers, peer);
+  upstream->num_peers++;
+
+  g_mutex_unlock (&self->lock);
+
+  g_signal_connect (conn,
+                    "closed",
+                    G_CALLBACK (on_peer_closed),
+                    peer);
+
+  /* message processing starts after this handler returns, so no message
+     can get past the filter */
+  peer->filter_id = g_dbus_connection_add_filter (conn,
+                                                  on_peer_message,
+                                                  peer_ref (peer),
+                                                  peer_unref);
+
+  return TRUE;
+}
+
+static gboolean
+on_authorize_peer (GDBusAuthObserver *observer,
+                   GIOStream         *stream,
+                   GCredentials      *credentials,
+                   gpointer           user_data)
+{
+  /* only processes of our own user may connect */
+  return credentials != NULL &&
+    g_credentials_get_unix_user (credentials, NULL) == getuid ();
+}
+
+/* public methods */
+
+LiaBusMux *
+lia_bus_mux_new (const gchar  *upstream_address,
+                 guint         pool_size,
+                 GError      **error)
+{
+  LiaBusMux *self;
+  GDBusAuthObserver *observer;
+  guint i;
+
+  g_return_val_if_fail (upstream_address != NULL, NULL);
+  g_return_val_if_fail (pool_size > 0, NULL);
+
+  self = g_slice_new0 (LiaBusMux);
+  self->guid = g_dbus_generate_guid ();
+  self->upstream_address = g_strdup (upstream_address);
+  self->next_peer_id = 1;
+  self->cancellable = g_cancellable_new ();
+
+  g_mutex_init (&self->lock);
+
+  /* peers are queued on an upstream connection until it is ready */
+  self->pool_size = pool_size;
+  self->upstreams = g_new0 (Upstream *, pool_size);
+  self->retry_src_ids = g_new0 (guint, pool_size);
+  for (i=0; i<pool_size; i++)
+    self->upstreams[i] = upstream_new (self, i);
+
+  observer = g_dbus_auth_observer_new ();
+  g_signal_connect (observer,
+                    "authorize-authenticated-peer",
+                    G_CALLBACK (on_authorize_peer),
+                    NULL);
+
+  self->server = g_dbus_server_new_sync ("unix:tmpdir=/tmp",
+                                         G_DBUS_SERVER_FLAGS_NONE,
+                                         self->guid,
+                                         observer,
+                                         NULL,
+                                         error);
+  g_object_unref (observer);
+
+  if (self->server == NULL)
+    {
+      lia_bus_mux_free (self);
+      return NULL;
+    }
+
+  g_signal_connect (self->server,
+                    "new-connection",
+                    G_CALLBACK (on_new_connection),
+                    self);
+
+  g_dbus_server_start (self->server);
+
+  return self;
+}
+
+void
+lia_bus_mux_free (LiaBusMux *self)
+{
+  guint i;
+
+  g_return_if_fail (self != NULL);
+
+  if (self->server != NULL)
+    {
+      g_dbus_server_stop (self->server);
+      g_object_unref (self->server);
+    }
+
+  while (self->peer_list != NULL)
+    {
+      MuxPeer *peer = self->peer_list->data;
+      GDBusConnection *conn;
+
+      conn = g_object_ref (peer->conn);
+      remove_peer (self, peer);
+      g_dbus_connection_close (conn, NULL, NULL, NULL);
+      g_object_unref (conn);
+    }
+
+  g_cancellable_cancel (self->cancellable);
+  g_object_unref (self->cancellable);
+
+  for (i=0; i<self->pool_size; i++)
+    {
+      if (self->retry_src_ids[i] != 0)
+        g_source_remove (self->retry_src_ids[i]);
+
+      free_upstream (self->upstreams[i]);
+    }
+  g_free (self->upstreams);
+  g_free (self->retry_src_ids);
+
+  g_mutex_clear (&self->lock);
+  g_free (self->upstream_address);
+  g_free (self->guid);
+
+  g_slice_free (LiaBusMux, self);
+}
+
+const gchar *
+lia_bus_mux_get_address (LiaBusMux *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+
+  return g_dbus_server_get_client_address (self->server);
+}
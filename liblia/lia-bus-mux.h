@@ -0,0 +1,58 @@
+/*
+ * lia-bus-mux.h
+ *
+ * This file is part of Lia <http://free-social.net/lia/>
+ *
+ * Copyright (C) 2012 Igalia S.L.
+ *
+ * Authors:
+ *   Eduardo Lima Mitev <elima@igalia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License at http://www.gnu.org/licenses/gpl-3.0.txt
+ * for more details.
+ */
+
+
+#ifndef __LIA_BUS_MUX_H__
+#define __LIA_BUS_MUX_H__
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/* A bus multiplexer. It looks like a message bus to the connections it
+   accepts on its own unix socket, but carries their traffic over a small
+   pool of connections to an upstream message bus. Calls are forwarded
+   with serials of the upstream connection and their replies are routed
+   back by serial, while signals are fanned out locally according to each
+   connection's match rules. Used internally by LiaWebview, so that web
+   peers don't need a bus connection each.
+
+   Applications see all the connections sharing an upstream connection
+   as a single caller: per-caller call limits and cancellation of a
+   departed caller's calls cannot tell them apart, and signals sent to
+   that caller's unique name reach none of them. Core doesn't configure
+   the mux while an installed application declares it relies on those
+   (see lia-core-apps.c). An upstream connection that is lost is
+   reconnected with a growing delay. */
+
+typedef struct _LiaBusMux LiaBusMux;
+
+LiaBusMux *    lia_bus_mux_new                 (const gchar  *upstream_address,
+                                                guint         pool_size,
+                                                GError      **error);
+void           lia_bus_mux_free                (LiaBusMux *self);
+
+const gchar *  lia_bus_mux_get_address         (LiaBusMux *self);
+
+G_END_DECLS
+
+#endif /* __LIA_BUS_MUX_H__ */
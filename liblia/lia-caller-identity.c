@@ -0,0 +1,76 @@
+/*
+ * lia-caller-identity.c
+ *
+ * This file is part of Lia <http://free-social.net/lia/>
+ *
+ * Copyright (C) 2012 Igalia S.L.
+ *
+ * Authors:
+ *   Eduardo Lima Mitev <elima@igalia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License at http://www.gnu.org/licenses/gpl-3.0.txt
+ * for more details.
+ */
+
+#include "lia-caller-identity.h"
+
+G_DEFINE_BOXED_TYPE (LiaCallerIdentity,
+                     lia_caller_identity,
+                     lia_caller_identity_ref,
+                     lia_caller_identity_unref);
+
+/* public methods */
+
+LiaCallerIdentity *
+lia_caller_identity_new (const gchar *unique_name, LiaBusType bus_type)
+{
+  LiaCallerIdentity *self;
+
+  g_return_val_if_fail (unique_name != NULL, NULL);
+
+  self = g_slice_new0 (LiaCallerIdentity);
+  self->ref_count = 1;
+
+  self->unique_name = g_strdup (unique_name);
+  self->bus_type = bus_type;
+  self->uid = (guint32) -1;
+  self->pid = 0;
+
+  return self;
+}
+
+/**
+ * lia_caller_identity_ref:
+ *
+ * Returns: (transfer full):
+ **/
+LiaCallerIdentity *
+lia_caller_identity_ref (LiaCallerIdentity *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+
+  g_atomic_int_inc (&self->ref_count);
+
+  return self;
+}
+
+void
+lia_caller_identity_unref (LiaCallerIdentity *self)
+{
+  g_return_if_fail (self != NULL);
+
+  if (g_atomic_int_dec_and_test (&self->ref_count))
+    {
+      g_free (self->unique_name);
+
+      g_slice_free (LiaCallerIdentity, self);
+    }
+}
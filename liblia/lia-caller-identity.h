@@ -0,0 +1,68 @@
+/*
+ * lia-caller-identity.h
+ *
+ * This file is part of Lia <http://free-social.net/lia/>
+ *
+ * Copyright (C) 2012 Igalia S.L.
+ *
+ * Authors:
+ *   Eduardo Lima Mitev <elima@igalia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License at http://www.gnu.org/licenses/gpl-3.0.txt
+ * for more details.
+ */
+
+#ifndef __LIA_CALLER_IDENTITY_H__
+#define __LIA_CALLER_IDENTITY_H__
+
+#include <glib-object.h>
+
+#include <lia-defines.h>
+
+G_BEGIN_DECLS
+
+typedef struct _LiaCallerIdentity LiaCallerIdentity;
+
+/**
+ * LiaCallerIdentity:
+ * @unique_name: The unique bus name of the caller
+ * @bus_type: The bus the caller is connected to
+ * @uid: The unix user id of the caller's process, or -1 if unknown
+ * @pid: The process id of the caller, or 0 if unknown
+ *
+ * Stable identity of a caller of a registered object, resolved once per
+ * unique bus name and cached by #LiaApplication.
+ **/
+struct _LiaCallerIdentity
+{
+  /*< private >*/
+  volatile gint ref_count;
+
+  /*< public >*/
+  gchar *unique_name;
+  LiaBusType bus_type;
+  guint32 uid;
+  guint32 pid;
+};
+
+#define LIA_TYPE_CALLER_IDENTITY (lia_caller_identity_get_type ())
+
+GType               lia_caller_identity_get_type       (void) G_GNUC_CONST;
+
+LiaCallerIdentity * lia_caller_identity_new            (const gchar *unique_name,
+                                                        LiaBusType   bus_type);
+
+LiaCallerIdentity * lia_caller_identity_ref            (LiaCallerIdentity *self);
+void                lia_caller_identity_unref          (LiaCallerIdentity *self);
+
+G_END_DECLS
+
+#endif /* __LIA_CALLER_IDENTITY_H__ */
@@ -0,0 +1,249 @@
+/* Registry of installed applications. Installed applications are not
+   launched at startup, but on demand when the Webview gets a request for
+   one of their web dirs (see ActivateApp). Each one is described by a
+   file in SYS_CONF_DIR/apps, e.g:
+
+     [Application]
+     ServiceName=org.example.Notes
+     HtmlRoot=/usr/share/notes/html
+     Exec=python3 /usr/share/notes/notes.py
+
+   An application that tells web peers apart, through per-caller call
+   limits, signals sent to a single peer, or cancellation of the calls
+   of peers that go away, adds 'PeerIdentity=true'. The Webview's bus
+   mux makes peers sharing an upstream connection look like one, so it
+   is not used while such an application is installed.
+
+   The service names of installed applications are published through
+   discovery, so the Webview knows which paths it can activate. Idle ones
+   may be stopped again under memory pressure (see lia-core-eviction.c). */
+
+#define APPS_DIR          SYS_CONF_DIR "/apps"
+#define APPS_FILE_SUFFIX  ".app"
+#define APPS_GROUP        "Application"
+
+typedef struct
+{
+  gchar *service_name;
+  gchar *html_root;
+  gchar *command_line;
+  gboolean peer_identity;
+  guint child_id;
+  gint64 last_activity;
+} InstalledApp;
+
+static void
+free_installed_app (gpointer _data)
+{
+  InstalledApp *app = _data;
+
+  g_free (app->service_name);
+  g_free (app->html_root);
+  g_free (app->command_line);
+
+  g_slice_free (InstalledApp, app);
+}
+
+static void
+publish_installed_apps (LiaCore *self)
+{
+  GPtrArray *names;
+  GHashTableIter iter;
+  gpointer key;
+
+  names = g_ptr_array_new ();
+
+  g_hash_table_iter_init (&iter, self->priv->apps);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    g_ptr_array_add (names, key);
+
+  config_set (self,
+              LIA_CONFIG_KEY_ACTIVATABLE_APPS,
+              g_variant_new_strv ((const gchar * const *) names->pdata,
+                                  names->len));
+
+  g_ptr_array_free (names, TRUE);
+}
+
+/* the Webview only multiplexes web peers onto shared bus connections if
+   no installed application needs to tell them apart. Until this is
+   published, web peers get a bus connection each */
+static void
+publish_webview_bus_mux (LiaCore *self)
+{
+  GHashTableIter iter;
+  gpointer value;
+  guint32 pool_size;
+
+  pool_size = self->priv->webview_bus_mux;
+
+  g_hash_table_iter_init (&iter, self->priv->apps);
+  while (pool_size > 0 && g_hash_table_iter_next (&iter, NULL, &value))
+    if (((InstalledApp *) value)->peer_identity)
+      {
+        g_print ("Not multiplexing web peers' bus connections, '%s' needs to tell them apart\n",
+                 ((InstalledApp *) value)->service_name);
+        pool_size = 0;
+      }
+
+  config_set (self,
+              LIA_CONFIG_KEY_WEBVIEW_BUS_MUX,
+              g_variant_new_uint32 (pool_size));
+}
+
+static void
+install_app (LiaCore     *self,
+             const gchar *service_name,
+             const gchar *html_root,
+             const gchar *command_line,
+             gboolean     peer_identity)
+{
+  InstalledApp *app;
+
+  app = g_slice_new0 (InstalledApp);
+  app->service_name = g_strdup (service_name);
+  app->html_root = g_strdup (html_root);
+  app->command_line = g_strdup (command_line);
+  app->peer_identity = peer_identity;
+
+  g_hash_table_replace (self->priv->apps, app->service_name, app);
+}
+
+static gboolean
+load_app_file (LiaCore *self, const gchar *filename, GError **error)
+{
+  GKeyFile *key_file;
+  gchar *service_name = NULL;
+  gchar *html_root = NULL;
+  gchar *command_line = NULL;
+  gboolean result = FALSE;
+
+  key_file = g_key_file_new ();
+
+  if (g_key_file_load_from_file (key_file, filename, G_KEY_FILE_NONE, error) &&
+      (service_name = g_key_file_get_string (key_file,
+                                             APPS_GROUP,
+                                             "ServiceName",
+                                             error)) != NULL &&
+      (command_line = g_key_file_get_string (key_file,
+                                             APPS_GROUP,
+                                             "Exec",
+                                             error)) != NULL)
+    {
+      /* optional */
+      html_root = g_key_file_get_string (key_file,
+                                         APPS_GROUP,
+                                         "HtmlRoot",
+                                         NULL);
+
+      install_app (self,
+                   service_name,
+                   html_root,
+                   command_line,
+                   g_key_file_get_boolean (key_file,
+                                           APPS_GROUP,
+                                           "PeerIdentity",
+                                           NULL));
+      result = TRUE;
+    }
+
+  g_free (service_name);
+  g_free (html_root);
+  g_free (command_line);
+  g_key_file_free (key_file);
+
+  return result;
+}
+
+static void
+load_installed_apps (LiaCore *self)
+{
+  GDir *dir;
+  const gchar *name;
+
+  dir = g_dir_open (APPS_DIR, 0, NULL);
+  if (dir != NULL)
+    {
+      while ((name = g_dir_read_name (dir)) != NULL)
+        {
+          gchar *filename;
+          GError *error = NULL;
+
+          if (! g_str_has_suffix (name, APPS_FILE_SUFFIX))
+            continue;
+
+          filename = g_build_filename (APPS_DIR, name, NULL);
+          if (! load_app_file (self, filename, &error))
+            {
+              g_print ("Ignoring application file %s: %s\n",
+                       filename,
+                       error->message);
+              g_error_free (error);
+            }
+          g_free (filename);
+        }
+
+      g_dir_close (dir);
+    }
+
+  g_print ("%u installed applications\n", g_hash_table_size (self->priv->apps));
+
+  publish_installed_apps (self);
+  publish_webview_bus_mux (self);
+}
+
+/* Launches an installed application unless it is already running or about
+   to. It is up to the application to register its web dir once ready */
+static gboolean
+activate_app (LiaCore *self, const gchar *service_name, GError **error)
+{
+  InstalledApp *app;
+  ChildProcess *child;
+  gchar *env[2] = { NULL, NULL };
+  gboolean result;
+
+  app = g_hash_table_lookup (self->priv->apps, service_name);
+  if (app == NULL)
+    {
+      g_set_error (error,
+                   G_IO_ERROR,
+                   G_IO_ERROR_NOT_FOUND,
+                   "No installed application with service name '%s'",
+                   service_name);
+      return FALSE;
+    }
+
+  child = g_hash_table_lookup (self->priv->children,
+                               GUINT_TO_POINTER (app->child_id));
+  if (child != NULL)
+    {
+      /* running, or about to be restarted already */
+      if (child->state != CHILD_STATE_STOPPED)
+        return TRUE;
+
+      g_print ("Activating '%s'\n", service_name);
+
+      app->last_activity = g_get_monotonic_time ();
+      restart_child (child);
+      return TRUE;
+    }
+
+  g_print ("Activating '%s'\n", service_name);
+
+  app->last_activity = g_get_monotonic_time ();
+
+  if (app->html_root != NULL)
+    env[0] = g_strdup_printf ("%s=%s",
+                              LIA_ENV_KEY_WEBVIEW_HTML_ROOT,
+                              app->html_root);
+
+  result = lia_core_launch_full (self,
+                                 app->command_line,
+                                 env,
+                                 LIA_RESTART_ON_FAILURE,
+                                 &app->child_id,
+                                 error);
+  g_free (env[0]);
+
+  return result;
+}
@@ -0,0 +1,794 @@
+/* Bus monitor. Core periodically samples the load of each Lia bus, to
+   tell whether a slow web is caused by a saturated bus. Bus daemons are
+   queried through org.freedesktop.DBus.Debug.Stats, which dbus-daemon
+   only provides when built with --enable-stats, and the embedded broker
+   is asked directly.
+
+   Every sample holds connection, name and match rule counts, the
+   messages queued in the daemon, and the message rate where it is known
+   (the embedded broker only, dbus-daemon doesn't count the messages it
+   routes). Per connection counts of a dbus-daemon come from its aggregate
+   peaks, and queues from a bounded sample of connections that rotates
+   from one round to the next, so that monitoring doesn't add a call per
+   connection to a bus that may already be saturated. The sample grows
+   while a limit is near. A warning is printed when a count gets close to the matching
+   <limit> of the bus' configuration file, and the last samples of each
+   bus are kept and exported on the private bus through the Supervisor
+   (see GetBusStats and GetBusStatsHistory). */
+
+#define BUS_MONITOR_INTERVAL     10  /* seconds */
+#define BUS_MONITOR_HISTORY_SIZE 60  /* samples */
+#define BUS_MONITOR_WARN_RATIO   0.8
+
+/* connections of a bus daemon asked for their stats on each round */
+#define BUS_MONITOR_CONN_SAMPLE           64
+#define BUS_MONITOR_CONN_SAMPLE_NEAR_LIMIT 1024
+
+#define BUS_DRIVER_SERVICE_NAME  "org.freedesktop.DBus"
+#define BUS_DRIVER_OBJ_PATH      "/org/freedesktop/DBus"
+#define BUS_DRIVER_IFACE_NAME    "org.freedesktop.DBus"
+#define BUS_DRIVER_STATS_IFACE   "org.freedesktop.DBus.Debug.Stats"
+
+typedef enum
+{
+  BUS_LIMIT_CONNECTIONS,
+  BUS_LIMIT_MATCH_RULES,
+  BUS_LIMIT_NAMES,
+  BUS_LIMIT_INCOMING_BYTES,
+  BUS_LIMIT_OUTGOING_BYTES,
+
+  BUS_LIMIT_LAST
+} BusLimit;
+
+/* names of the <limit> elements in dbus-daemon configuration files. All
+   but the connections one are per connection */
+static const gchar *BUS_LIMIT_NAMES[BUS_LIMIT_LAST] = {
+  "max_completed_connections",
+  "max_match_rules_per_connection",
+  "max_names_per_connection",
+  "max_incoming_bytes",
+  "max_outgoing_bytes"
+};
+
+static const gchar *BUS_NAMES[3] = {"private", "protected", "public"};
+
+typedef struct
+{
+  gint64 time;
+  gint64 monotonic_time;
+
+  guint32 connections;
+  guint32 incomplete_connections;
+  guint32 match_rules;
+  guint32 bus_names;
+
+  /* highest among connections */
+  guint32 max_match_rules;
+  guint32 max_bus_names;
+  guint64 max_incoming_bytes;
+  guint64 max_outgoing_bytes;
+
+  /* waiting in the daemon, sampled connections */
+  guint32 sampled_connections;
+  guint64 queued_messages;
+  guint64 queued_bytes;
+
+  gboolean has_routed_messages;
+  guint64 routed_messages;
+  gdouble message_rate;
+
+  guint warnings;
+} BusSample;
+
+typedef struct _BusMonitor
+{
+  LiaBusType bus_type;
+
+  guint64 limits[BUS_LIMIT_LAST];
+  gboolean limits_loaded;
+
+  GQueue *history;
+  guint conn_sample_offset;
+
+  gboolean busy;
+  gboolean stats_unavailable;
+} BusMonitor;
+
+typedef struct
+{
+  LiaCore *self;
+  BusMonitor *monitor;
+  GDBusConnection *conn;
+  BusSample *sample;
+  guint ops;
+} BusStatsRound;
+
+static BusMonitor *
+bus_monitor_new (LiaBusType bus_type)
+{
+  BusMonitor *monitor;
+
+  monitor = g_slice_new0 (BusMonitor);
+  monitor->bus_type = bus_type;
+  monitor->history = g_queue_new ();
+
+  return monitor;
+}
+
+static void
+free_bus_sample (gpointer data)
+{
+  g_slice_free (BusSample, data);
+}
+
+static void
+free_bus_monitor (BusMonitor *monitor)
+{
+  g_queue_free_full (monitor->history, free_bus_sample);
+
+  g_slice_free (BusMonitor, monitor);
+}
+
+/* limits from configuration files */
+
+typedef struct
+{
+  BusMonitor *monitor;
+  gint current_limit;
+} BusConfParseData;
+
+static void
+on_bus_conf_start_element (GMarkupParseContext  *context,
+                           const gchar          *element_name,
+                           const gchar         **attribute_names,
+                           const gchar         **attribute_values,
+                           gpointer              user_data,
+                           GError              **error)
+{
+  BusConfParseData *data = user_data;
+  gint i;
+  gint j;
+
+  data->current_limit = -1;
+
+  if (g_strcmp0 (element_name, "limit") != 0)
+    return;
+
+  for (i=0; attribute_names[i] != NULL; i++)
+    {
+      if (g_strcmp0 (attribute_names[i], "name") != 0)
+        continue;
+
+      for (j=0; j<BUS_LIMIT_LAST; j++)
+        if (g_strcmp0 (attribute_values[i], BUS_LIMIT_NAMES[j]) == 0)
+          data->current_limit = j;
+    }
+}
+
+static void
+on_bus_conf_end_element (GMarkupParseContext  *context,
+                         const gchar          *element_name,
+                         gpointer              user_data,
+                         GError              **error)
+{
+  BusConfParseData *data = user_data;
+
+  data->current_limit = -1;
+}
+
+static void
+on_bus_conf_text (GMarkupParseContext  *context,
+                  const gchar          *text,
+                  gsize                 text_len,
+                  gpointer              user_data,
+                  GError              **error)
+{
+  BusConfParseData *data = user_data;
+  gchar *value;
+
+  if (data->current_limit < 0)
+    return;
+
+  value = g_strndup (text, text_len);
+  data->monitor->limits[data->current_limit] =
+    g_ascii_strtoull (g_strstrip (value), NULL, 10);
+  g_free (value);
+}
+
+static void
+load_bus_limits_from_file (BusMonitor *monitor, const gchar *filename)
+{
+  static const GMarkupParser parser = {
+    on_bus_conf_start_element,
+    on_bus_conf_end_element,
+    on_bus_conf_text,
+    NULL,
+    NULL
+  };
+
+  GMarkupParseContext *context;
+  BusConfParseData data;
+  gchar *content;
+  gsize size;
+  GError *error = NULL;
+
+  if (! g_file_get_contents (filename, &content, &size, &error))
+    {
+      g_debug ("Error reading bus limits: %s", error->message);
+      g_error_free (error);
+      return;
+    }
+
+  data.monitor = monitor;
+  data.current_limit = -1;
+
+  context = g_markup_parse_context_new (&parser, 0, &data, NULL);
+  if (! g_markup_parse_context_parse (context, content, size, &error) ||
+      ! g_markup_parse_context_end_parse (context, &error))
+    {
+      g_debug ("Error parsing bus limits from %s: %s",
+               filename,
+               error->message);
+      g_error_free (error);
+    }
+
+  g_markup_parse_context_free (context);
+  g_free (content);
+}
+
+/* limits are loaded lazily, since the embedded broker or daemon of a bus
+   only exists once its address is resolved */
+static void
+load_bus_limits (LiaCore *self, BusMonitor *monitor)
+{
+  LiaBusBroker *broker;
+
+  if (monitor->limits_loaded)
+    return;
+
+  monitor->limits_loaded = TRUE;
+
+  broker = self->priv->bus_brokers[monitor->bus_type];
+  if (broker != NULL)
+    {
+      const LiaBusBrokerPolicy *policy;
+
+      policy = lia_bus_broker_get_policy (broker);
+      monitor->limits[BUS_LIMIT_MATCH_RULES] =
+        policy->max_match_rules_per_connection;
+      monitor->limits[BUS_LIMIT_NAMES] = policy->max_names_per_connection;
+    }
+  else if (BUS_CONFIG_FILES[monitor->bus_type] != NULL)
+    {
+      load_bus_limits_from_file (monitor, BUS_CONFIG_FILES[monitor->bus_type]);
+    }
+}
+
+/* samples */
+
+static guint64
+get_sample_value (BusSample *sample, BusLimit limit)
+{
+  switch (limit)
+    {
+    case BUS_LIMIT_CONNECTIONS:
+      return sample->connections + sample->incomplete_connections;
+    case BUS_LIMIT_MATCH_RULES:
+      return sample->max_match_rules;
+    case BUS_LIMIT_NAMES:
+      return sample->max_bus_names;
+    case BUS_LIMIT_INCOMING_BYTES:
+      return sample->max_incoming_bytes;
+    case BUS_LIMIT_OUTGOING_BYTES:
+      return sample->max_outgoing_bytes;
+    default:
+      return 0;
+    }
+}
+
+static void
+check_bus_limits (BusMonitor *monitor, BusSample *sample, BusSample *last)
+{
+  gint i;
+
+  for (i=0; i<BUS_LIMIT_LAST; i++)
+    {
+      guint64 value;
+      guint64 limit = monitor->limits[i];
+
+      if (limit == 0)
+        continue;
+
+      value = get_sample_value (sample, i);
+      if (value < limit * BUS_MONITOR_WARN_RATIO)
+        continue;
+
+      sample->warnings |= 1 << i;
+
+      /* only warn when crossing the threshold, not on every sample */
+      if (last == NULL || (last->warnings & (1 << i)) == 0)
+        g_print ("Warning: %s bus is approaching its %s limit (%" G_GUINT64_FORMAT " of %" G_GUINT64_FORMAT ")\n",
+                 BUS_NAMES[monitor->bus_type],
+                 BUS_LIMIT_NAMES[i],
+                 value,
+                 limit);
+    }
+}
+
+static void
+add_bus_sample (LiaCore *self, BusMonitor *monitor, BusSample *sample)
+{
+  BusSample *last;
+
+  last = g_queue_peek_tail (monitor->history);
+
+  sample->message_rate = -1.0;
+  if (sample->has_routed_messages &&
+      last != NULL &&
+      last->has_routed_messages &&
+      sample->routed_messages >= last->routed_messages &&
+      sample->monotonic_time > last->monotonic_time)
+    {
+      sample->message_rate =
+        (sample->routed_messages - last->routed_messages) /
+        ((gdouble) (sample->monotonic_time - last->monotonic_time) /
+         G_USEC_PER_SEC);
+    }
+
+  check_bus_limits (monitor, sample, last);
+
+  g_queue_push_tail (monitor->history, sample);
+  if (g_queue_get_length (monitor->history) > BUS_MONITOR_HISTORY_SIZE)
+    free_bus_sample (g_queue_pop_head (monitor->history));
+}
+
+static BusSample *
+bus_sample_new (void)
+{
+  BusSample *sample;
+
+  sample = g_slice_new0 (BusSample);
+  sample->time = g_get_real_time ();
+  sample->monotonic_time = g_get_monotonic_time ();
+
+  return sample;
+}
+
+static guint64
+lookup_stat (GVariant *stats, const gchar *key)
+{
+  GVariant *value;
+  guint64 result = 0;
+
+  value = g_variant_lookup_value (stats, key, NULL);
+  if (value == NULL)
+    return 0;
+
+  if (g_variant_is_of_type (value, G_VARIANT_TYPE_UINT32))
+    result = g_variant_get_uint32 (value);
+  else if (g_variant_is_of_type (value, G_VARIANT_TYPE_UINT64))
+    result = g_variant_get_uint64 (value);
+
+  g_variant_unref (value);
+
+  return result;
+}
+
+/* embedded broker */
+
+static void
+sample_bus_broker (LiaCore *self, BusMonitor *monitor, LiaBusBroker *broker)
+{
+  BusSample *sample;
+  GVariant *stats;
+
+  stats = g_variant_ref_sink (lia_bus_broker_get_stats (broker));
+
+  sample = bus_sample_new ();
+  sample->connections = lookup_stat (stats, "ActiveConnections");
+  sample->incomplete_connections = lookup_stat (stats, "IncompleteConnections");
+  sample->match_rules = lookup_stat (stats, "MatchRules");
+  sample->bus_names = lookup_stat (stats, "BusNames");
+  sample->max_match_rules = lookup_stat (stats, "MaxMatchRulesPerConnection");
+  sample->max_bus_names = lookup_stat (stats, "MaxBusNamesPerConnection");
+  sample->has_routed_messages = TRUE;
+  sample->routed_messages = lookup_stat (stats, "RoutedMessages");
+
+  g_variant_unref (stats);
+
+  add_bus_sample (self, monitor, sample);
+}
+
+/* bus daemons */
+
+static void
+bus_stats_round_op_done (BusStatsRound *round)
+{
+  round->ops--;
+  if (round->ops > 0)
+    return;
+
+  if (round->sample != NULL)
+    {
+      add_bus_sample (round->self, round->monitor, round->sample);
+      round->sample = NULL;
+    }
+
+  round->monitor->busy = FALSE;
+
+  g_object_unref (round->conn);
+  g_object_unref (round->self);
+  g_slice_free (BusStatsRound, round);
+}
+
+static void
+on_bus_connection_stats (GObject      *obj,
+                         GAsyncResult *res,
+                         gpointer      user_data)
+{
+  BusStatsRound *round = user_data;
+  GVariant *ret;
+  GError *error = NULL;
+
+  /* connections may go away in the meantime, so errors are expected */
+  ret = g_dbus_connection_call_finish (G_DBUS_CONNECTION (obj), res, &error);
+  if (ret == NULL)
+    {
+      g_error_free (error);
+    }
+  else if (round->sample != NULL)
+    {
+      BusSample *sample = round->sample;
+      GVariant *stats;
+      guint64 incoming_bytes;
+      guint64 outgoing_bytes;
+
+      stats = g_variant_get_child_value (ret, 0);
+
+      incoming_bytes = lookup_stat (stats, "IncomingBytes");
+      outgoing_bytes = lookup_stat (stats, "OutgoingBytes");
+
+      sample->queued_messages += lookup_stat (stats, "IncomingMessages") +
+        lookup_stat (stats, "OutgoingMessages");
+      sample->queued_bytes += incoming_bytes + outgoing_bytes;
+
+      sample->max_incoming_bytes = MAX (sample->max_incoming_bytes,
+                                        incoming_bytes);
+      sample->max_outgoing_bytes = MAX (sample->max_outgoing_bytes,
+                                        outgoing_bytes);
+      sample->max_match_rules = MAX (sample->max_match_rules,
+                                     lookup_stat (stats, "MatchRules"));
+      sample->max_bus_names = MAX (sample->max_bus_names,
+                                   lookup_stat (stats, "BusNames"));
+
+      g_variant_unref (stats);
+      g_variant_unref (ret);
+    }
+
+  bus_stats_round_op_done (round);
+}
+
+static void
+on_bus_names_listed (GObject      *obj,
+                     GAsyncResult *res,
+                     gpointer      user_data)
+{
+  BusStatsRound *round = user_data;
+  GVariant *ret;
+  GError *error = NULL;
+
+  ret = g_dbus_connection_call_finish (G_DBUS_CONNECTION (obj), res, &error);
+  if (ret == NULL)
+    {
+      g_debug ("Error listing names of the %s bus: %s",
+               BUS_NAMES[round->monitor->bus_type],
+               error->message);
+      g_error_free (error);
+    }
+  else
+    {
+      BusMonitor *monitor = round->monitor;
+      BusSample *last;
+      GVariantIter *iter;
+      const gchar *name;
+      GPtrArray *unique_names;
+      guint sample_size;
+      guint i;
+
+      unique_names = g_ptr_array_new ();
+
+      g_variant_get (ret, "(as)", &iter);
+      while (g_variant_iter_next (iter, "&s", &name))
+        if (name[0] == ':')
+          g_ptr_array_add (unique_names, (gpointer) name);
+
+      last = g_queue_peek_tail (monitor->history);
+      sample_size = last != NULL && last->warnings != 0 ?
+        BUS_MONITOR_CONN_SAMPLE_NEAR_LIMIT : BUS_MONITOR_CONN_SAMPLE;
+      sample_size = MIN (sample_size, unique_names->len);
+
+      /* start where the previous round left off, so that every connection
+         gets its turn */
+      if (unique_names->len > 0)
+        monitor->conn_sample_offset %= unique_names->len;
+
+      for (i=0; i<sample_size; i++)
+        {
+          name = g_ptr_array_index (unique_names,
+                                    (monitor->conn_sample_offset + i) %
+                                    unique_names->len);
+
+          round->ops++;
+          g_dbus_connection_call (round->conn,
+                                  BUS_DRIVER_SERVICE_NAME,
+                                  BUS_DRIVER_OBJ_PATH,
+                                  BUS_DRIVER_STATS_IFACE,
+                                  "GetConnectionStats",
+                                  g_variant_new ("(s)", name),
+                                  G_VARIANT_TYPE ("(a{sv})"),
+                                  G_DBUS_CALL_FLAGS_NONE,
+                                  -1,
+                                  NULL,
+                                  on_bus_connection_stats,
+                                  round);
+        }
+
+      monitor->conn_sample_offset += sample_size;
+      if (round->sample != NULL)
+        round->sample->sampled_connections = sample_size;
+
+      g_ptr_array_unref (unique_names);
+      g_variant_iter_free (iter);
+      g_variant_unref (ret);
+    }
+
+  bus_stats_round_op_done (round);
+}
+
+static void
+on_bus_stats (GObject      *obj,
+              GAsyncResult *res,
+              gpointer      user_data)
+{
+  BusStatsRound *round = user_data;
+  BusMonitor *monitor = round->monitor;
+  GVariant *ret;
+  GError *error = NULL;
+
+  ret = g_dbus_connection_call_finish (G_DBUS_CONNECTION (obj), res, &error);
+  if (ret == NULL)
+    {
+      if (g_error_matches (error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD) ||
+          g_error_matches (error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_INTERFACE) ||
+          g_error_matches (error, G_DBUS_ERROR, G_DBUS_ERROR_ACCESS_DENIED))
+        {
+          g_print ("Statistics of the %s bus not available (%s), it won't be monitored\n",
+                   BUS_NAMES[monitor->bus_type],
+                   error->message);
+          monitor->stats_unavailable = TRUE;
+        }
+      else
+        {
+          g_debug ("Error getting statistics of the %s bus: %s",
+                   BUS_NAMES[monitor->bus_type],
+                   error->message);
+        }
+      g_error_free (error);
+    }
+  else
+    {
+      BusSample *sample;
+      GVariant *stats;
+
+      stats = g_variant_get_child_value (ret, 0);
+
+      sample = bus_sample_new ();
+      sample->connections = lookup_stat (stats, "ActiveConnections");
+      sample->incomplete_connections = lookup_stat (stats, "IncompleteConnections");
+      sample->match_rules = lookup_stat (stats, "MatchRules");
+      sample->bus_names = lookup_stat (stats, "BusNames");
+
+      /* high-water marks since the daemon started */
+      sample->max_match_rules = lookup_stat (stats, "PeakMatchRulesPerConnection");
+      sample->max_bus_names = lookup_stat (stats, "PeakBusNamesPerConnection");
+      round->sample = sample;
+
+      g_variant_unref (stats);
+      g_variant_unref (ret);
+
+      /* queues only come from each connection, a sample of them is
+         asked */
+      round->ops++;
+      g_dbus_connection_call (round->conn,
+                              BUS_DRIVER_SERVICE_NAME,
+                              BUS_DRIVER_OBJ_PATH,
+                              BUS_DRIVER_IFACE_NAME,
+                              "ListNames",
+                              NULL,
+                              G_VARIANT_TYPE ("(as)"),
+                              G_DBUS_CALL_FLAGS_NONE,
+                              -1,
+                              NULL,
+                              on_bus_names_listed,
+                              round);
+    }
+
+  bus_stats_round_op_done (round);
+}
+
+static void
+sample_bus_daemon (LiaCore *self, BusMonitor *monitor, GDBusConnection *conn)
+{
+  BusStatsRound *round;
+
+  round = g_slice_new0 (BusStatsRound);
+  round->self = g_object_ref (self);
+  round->monitor = monitor;
+  round->conn = g_object_ref (conn);
+  round->ops = 1;
+
+  monitor->busy = TRUE;
+
+  g_dbus_connection_call (conn,
+                          BUS_DRIVER_SERVICE_NAME,
+                          BUS_DRIVER_OBJ_PATH,
+                          BUS_DRIVER_STATS_IFACE,
+                          "GetStats",
+                          NULL,
+                          G_VARIANT_TYPE ("(a{sv})"),
+                          G_DBUS_CALL_FLAGS_NONE,
+                          -1,
+                          NULL,
+                          on_bus_stats,
+                          round);
+}
+
+static gboolean
+sample_buses (gpointer user_data)
+{
+  LiaCore *self = LIA_CORE (user_data);
+  gint i;
+
+  for (i=0; i<3; i++)
+    {
+      BusMonitor *monitor = self->priv->bus_monitors[i];
+      GDBusConnection *conn;
+
+      if (monitor->busy || monitor->stats_unavailable)
+        continue;
+
+      load_bus_limits (self, monitor);
+
+      if (self->priv->bus_brokers[i] != NULL)
+        {
+          sample_bus_broker (self, monitor, self->priv->bus_brokers[i]);
+          continue;
+        }
+
+      /* core may not be connected to this bus yet */
+      conn = lia_application_get_bus (LIA_APPLICATION (self), i);
+      if (conn != NULL)
+        sample_bus_daemon (self, monitor, conn);
+    }
+
+  return TRUE;
+}
+
+static void
+start_bus_monitor (LiaCore *self)
+{
+  self->priv->bus_monitor_src_id =
+    g_timeout_add_seconds (BUS_MONITOR_INTERVAL, sample_buses, self);
+}
+
+/* info exported through the Supervisor */
+
+static GVariant *
+build_bus_sample_info (BusSample *sample)
+{
+  GVariantBuilder builder;
+  GVariantBuilder warnings;
+  gint i;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+
+  g_variant_builder_add (&builder, "{sv}", "time",
+                         g_variant_new_int64 (sample->time));
+  g_variant_builder_add (&builder, "{sv}", "connections",
+                         g_variant_new_uint32 (sample->connections));
+  g_variant_builder_add (&builder, "{sv}", "incomplete-connections",
+                         g_variant_new_uint32 (sample->incomplete_connections));
+  g_variant_builder_add (&builder, "{sv}", "match-rules",
+                         g_variant_new_uint32 (sample->match_rules));
+  g_variant_builder_add (&builder, "{sv}", "bus-names",
+                         g_variant_new_uint32 (sample->bus_names));
+  g_variant_builder_add (&builder, "{sv}", "max-match-rules-per-connection",
+                         g_variant_new_uint32 (sample->max_match_rules));
+  g_variant_builder_add (&builder, "{sv}", "max-bus-names-per-connection",
+                         g_variant_new_uint32 (sample->max_bus_names));
+  g_variant_builder_add (&builder, "{sv}", "sampled-connections",
+                         g_variant_new_uint32 (sample->sampled_connections));
+  g_variant_builder_add (&builder, "{sv}", "queued-messages",
+                         g_variant_new_uint64 (sample->queued_messages));
+  g_variant_builder_add (&builder, "{sv}", "queued-bytes",
+                         g_variant_new_uint64 (sample->queued_bytes));
+
+  if (sample->message_rate >= 0)
+    g_variant_builder_add (&builder, "{sv}", "message-rate",
+                           g_variant_new_double (sample->message_rate));
+
+  g_variant_builder_init (&warnings, G_VARIANT_TYPE_STRING_ARRAY);
+  for (i=0; i<BUS_LIMIT_LAST; i++)
+    if (sample->warnings & (1 << i))
+      g_variant_builder_add (&warnings, "s", BUS_LIMIT_NAMES[i]);
+  g_variant_builder_add (&builder, "{sv}", "warnings",
+                         g_variant_builder_end (&warnings));
+
+  return g_variant_builder_end (&builder);
+}
+
+/* latest sample and limits of each bus, keyed by bus name */
+static GVariant *
+get_bus_stats_info (LiaCore *self)
+{
+  GVariantBuilder builder;
+  gint i;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sa{sv}}"));
+
+  for (i=0; i<3; i++)
+    {
+      BusMonitor *monitor = self->priv->bus_monitors[i];
+      BusSample *sample;
+      GVariantBuilder info;
+      GVariantBuilder limits;
+      gint j;
+
+      g_variant_builder_init (&info, G_VARIANT_TYPE ("a{sv}"));
+
+      g_variant_builder_add (&info, "{sv}", "source",
+                             g_variant_new_string (self->priv->bus_brokers[i] != NULL ?
+                                                   "broker" : "dbus-daemon"));
+      g_variant_builder_add (&info, "{sv}", "available",
+                             g_variant_new_boolean (! monitor->stats_unavailable));
+
+      g_variant_builder_init (&limits, G_VARIANT_TYPE ("a{st}"));
+      for (j=0; j<BUS_LIMIT_LAST; j++)
+        if (monitor->limits[j] > 0)
+          g_variant_builder_add (&limits, "{st}",
+                                 BUS_LIMIT_NAMES[j],
+                                 monitor->limits[j]);
+      g_variant_builder_add (&info, "{sv}", "limits",
+                             g_variant_builder_end (&limits));
+
+      sample = g_queue_peek_tail (monitor->history);
+      if (sample != NULL)
+        g_variant_builder_add (&info, "{sv}", "last-sample",
+                               build_bus_sample_info (sample));
+
+      g_variant_builder_add (&builder, "{s@a{sv}}",
+                             BUS_NAMES[i],
+                             g_variant_builder_end (&info));
+    }
+
+  return g_variant_builder_end (&builder);
+}
+
+/* every sample kept for a bus, oldest first */
+static GVariant *
+get_bus_stats_history (LiaCore *self, LiaBusType bus_type)
+{
+  GVariantBuilder builder;
+  GList *node;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("aa{sv}"));
+
+  for (node = self->priv->bus_monitors[bus_type]->history->head;
+       node != NULL;
+       node = node->next)
+    {
+      g_variant_builder_add_value (&builder, build_bus_sample_info (node->data));
+    }
+
+  return g_variant_builder_end (&builder);
+}
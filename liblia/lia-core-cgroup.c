@@ -0,0 +1,502 @@
+/* Per-child cgroups. When core runs in a cgroup v2 subtree delegated to
+   its user (e.g a systemd unit with Delegate=yes), every child gets a leaf
+   cgroup of its own there, so that its CPU and memory can be limited and
+   accounted for separately from the rest. Otherwise children just share
+   core's cgroup.
+
+   Processes can only live in leaves once controllers are enabled for a
+   subtree, so core moves itself to a leaf too:
+
+     <delegated subtree>/
+       lia-core/      core itself
+       child-1/       first child launched
+       ... */
+
+#define CGROUP_MOUNT_POINT "/sys/fs/cgroup"
+#define CGROUP_CORE_LEAF   "lia-core"
+#define CGROUP_CHILD_PREFIX "child-"
+
+#define CGROUP_CPU_WEIGHT_DEFAULT 100
+
+static gboolean
+cgroup_write (const gchar  *dir,
+              const gchar  *file,
+              const gchar  *value,
+              GError      **error)
+{
+  gchar *path;
+  gint fd;
+  gboolean result = TRUE;
+
+  /* cgroup files must be written in place, with a single write */
+  path = g_build_filename (dir, file, NULL);
+
+  fd = open (path, O_WRONLY | O_CLOEXEC);
+  if (fd < 0 || write (fd, value, strlen (value)) < 0)
+    {
+      g_set_error (error,
+                   G_IO_ERROR,
+                   g_io_error_from_errno (errno),
+                   "Failed to write '%s' to %s: %s",
+                   value,
+                   path,
+                   g_strerror (errno));
+      result = FALSE;
+    }
+
+  if (fd >= 0)
+    close (fd);
+  g_free (path);
+
+  return result;
+}
+
+static gchar *
+cgroup_read (const gchar *dir, const gchar *file)
+{
+  gchar *path;
+  gchar *content = NULL;
+
+  path = g_build_filename (dir, file, NULL);
+  g_file_get_contents (path, &content, NULL, NULL);
+  g_free (path);
+
+  return content;
+}
+
+/* Returns the path of the cgroup core runs in, from /proc/self/cgroup */
+static gchar *
+get_own_cgroup (void)
+{
+  gchar *content = NULL;
+  gchar **lines;
+  gchar *path = NULL;
+  gint i;
+
+  if (! g_file_get_contents ("/proc/self/cgroup", &content, NULL, NULL))
+    return NULL;
+
+  /* the unified hierarchy is the '0::' entry */
+  lines = g_strsplit (content, "\n", -1);
+  for (i=0; lines[i] != NULL; i++)
+    if (g_str_has_prefix (lines[i], "0::"))
+      {
+        path = g_build_filename (CGROUP_MOUNT_POINT, lines[i] + 3, NULL);
+        break;
+      }
+
+  g_strfreev (lines);
+  g_free (content);
+
+  return path;
+}
+
+/* removes leaves left by a previous run. Those with processes still
+   in them can't be removed, and are reused */
+static void
+remove_stale_child_cgroups (const gchar *base)
+{
+  GDir *dir;
+  const gchar *name;
+
+  dir = g_dir_open (base, 0, NULL);
+  if (dir == NULL)
+    return;
+
+  while ((name = g_dir_read_name (dir)) != NULL)
+    if (g_str_has_prefix (name, CGROUP_CHILD_PREFIX))
+      {
+        gchar *path;
+
+        path = g_build_filename (base, name, NULL);
+        rmdir (path);
+        g_free (path);
+      }
+
+  g_dir_close (dir);
+}
+
+static void
+setup_cgroups (LiaCore *self)
+{
+  static const gchar *CONTROLLERS[] = { "+cpu", "+memory", "+io", NULL };
+
+  gchar *base;
+  gchar *path;
+  gboolean delegated;
+  gint i;
+  GError *error = NULL;
+
+  base = get_own_cgroup ();
+  if (base == NULL)
+    {
+      g_print ("No cgroup v2 hierarchy, children will share core's cgroup\n");
+      return;
+    }
+
+  path = g_build_filename (base, "cgroup.subtree_control", NULL);
+  delegated = access (path, W_OK) == 0;
+  g_free (path);
+
+  if (! delegated)
+    {
+      g_print ("Cgroup %s is not delegated to core, children will share it\n",
+               base);
+      g_free (base);
+      return;
+    }
+
+  /* move core out of the way */
+  path = g_build_filename (base, CGROUP_CORE_LEAF, NULL);
+  if ((g_mkdir (path, 0755) != 0 && errno != EEXIST) ||
+      ! cgroup_write (path, "cgroup.procs", "0", &error))
+    {
+      if (error == NULL)
+        g_set_error (&error,
+                     G_IO_ERROR,
+                     g_io_error_from_errno (errno),
+                     "Failed to create %s: %s",
+                     path,
+                     g_strerror (errno));
+
+      g_print ("Failed to set up cgroups, children will share core's cgroup: %s\n",
+               error->message);
+      g_error_free (error);
+      g_free (path);
+      g_free (base);
+      return;
+    }
+  g_free (path);
+
+  remove_stale_child_cgroups (base);
+
+  /* controllers are enabled one by one, since some might not be available
+     to us. Accounting works without them, only the limits depend on them */
+  for (i=0; CONTROLLERS[i] != NULL; i++)
+    if (! cgroup_write (base, "cgroup.subtree_control", CONTROLLERS[i], &error))
+      {
+        g_print ("Controller '%s' not available: %s\n",
+                 CONTROLLERS[i] + 1,
+                 error->message);
+        g_clear_error (&error);
+      }
+
+  g_print ("Children cgroups under %s\n", base);
+
+  self->priv->cgroup_base = base;
+}
+
+/* like cgroup_write(), but succeeds if the file doesn't exist because
+   its controller is not enabled */
+static gboolean
+cgroup_write_limit (const gchar  *dir,
+                    const gchar  *file,
+                    gchar        *value,
+                    GError      **error)
+{
+  GError *_error = NULL;
+
+  if (! cgroup_write (dir, file, value, &_error) &&
+      ! g_error_matches (_error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+    {
+      g_propagate_error (error, _error);
+      g_free (value);
+      return FALSE;
+    }
+
+  g_clear_error (&_error);
+  g_free (value);
+
+  return TRUE;
+}
+
+static gboolean
+cgroup_apply_limits (ChildProcess *child, GError **error)
+{
+  return
+    cgroup_write_limit (child->cgroup,
+                        "cpu.weight",
+                        g_strdup_printf ("%u",
+                                         child->cpu_weight > 0 ?
+                                         child->cpu_weight :
+                                         CGROUP_CPU_WEIGHT_DEFAULT),
+                        error) &&
+    cgroup_write_limit (child->cgroup,
+                        "memory.high",
+                        child->memory_high > 0 ?
+                        g_strdup_printf ("%" G_GUINT64_FORMAT, child->memory_high) :
+                        g_strdup ("max"),
+                        error) &&
+    cgroup_write_limit (child->cgroup,
+                        "memory.max",
+                        child->memory_max > 0 ?
+                        g_strdup_printf ("%" G_GUINT64_FORMAT, child->memory_max) :
+                        g_strdup ("max"),
+                        error);
+}
+
+/* Creates the child's leaf cgroup if it doesn't have one yet. Returns
+   FALSE if the child can't have a cgroup of its own */
+static gboolean
+cgroup_create_child (ChildProcess *child)
+{
+  gchar *name;
+  gchar *path;
+  GError *error = NULL;
+
+  if (child->cgroup != NULL)
+    return TRUE;
+
+  if (child->self->priv->cgroup_base == NULL)
+    return FALSE;
+
+  name = g_strdup_printf (CGROUP_CHILD_PREFIX "%u", child->id);
+  path = g_build_filename (child->self->priv->cgroup_base, name, NULL);
+  g_free (name);
+
+  if (g_mkdir (path, 0755) != 0 && errno != EEXIST)
+    {
+      g_print ("Failed to create cgroup %s: %s\n", path, g_strerror (errno));
+      g_free (path);
+      return FALSE;
+    }
+
+  child->cgroup = path;
+
+  /* not fatal, the child is still accounted for */
+  if (! cgroup_apply_limits (child, &error))
+    {
+      g_print ("Failed to set resource limits of child %u: %s\n",
+               child->id,
+               error->message);
+      g_error_free (error);
+    }
+
+  return TRUE;
+}
+
+/* Creates the child's leaf cgroup if needed, and opens its 'cgroup.procs'
+   file for the child to move itself in before exec. Returns -1 if the
+   child can't have a cgroup of its own. */
+static gint
+cgroup_prepare_child (ChildProcess *child)
+{
+  gchar *path;
+  gint fd;
+
+  if (! cgroup_create_child (child))
+    return -1;
+
+  path = g_build_filename (child->cgroup, "cgroup.procs", NULL);
+  fd = open (path, O_WRONLY | O_CLOEXEC);
+  g_free (path);
+
+  return fd;
+}
+
+/* runs in the child, between fork and exec. Writing '0' moves the
+   writing process itself */
+static void
+cgroup_child_setup (gpointer user_data)
+{
+  gint fd = GPOINTER_TO_INT (user_data);
+
+  if (fd >= 0 && write (fd, "0", 1) < 0)
+    {
+      /* stays in core's cgroup */
+    }
+}
+
+/* moves a child that was not spawned by us, like those forked by a
+   zygote, to its cgroup */
+static void
+cgroup_attach_child (ChildProcess *child)
+{
+  gchar *pid;
+  GError *error = NULL;
+
+  if (child->cgroup == NULL || child->pid <= 0)
+    return;
+
+  pid = g_strdup_printf ("%d", child->pid);
+  if (! cgroup_write (child->cgroup, "cgroup.procs", pid, &error))
+    {
+      g_print ("Failed to move child %u to its cgroup: %s\n",
+               child->id,
+               error->message);
+      g_error_free (error);
+    }
+  g_free (pid);
+}
+
+static void
+cgroup_remove_child (ChildProcess *child)
+{
+  if (child->cgroup == NULL)
+    return;
+
+  /* fails if processes are still running in it, which will be removed
+     on the next start of core */
+  rmdir (child->cgroup);
+
+  g_free (child->cgroup);
+  child->cgroup = NULL;
+}
+
+static guint64
+cgroup_read_uint64 (const gchar *dir, const gchar *file, const gchar *key)
+{
+  gchar *content;
+  gchar *p = NULL;
+  guint64 value = 0;
+
+  content = cgroup_read (dir, file);
+  if (content == NULL)
+    return 0;
+
+  if (key == NULL)
+    {
+      p = content;
+    }
+  else
+    {
+      gsize key_len = strlen (key);
+
+      for (p = content; p != NULL; p = strchr (p, '\n'))
+        {
+          if (*p == '\n')
+            p++;
+
+          if (strncmp (p, key, key_len) == 0 && p[key_len] == ' ')
+            {
+              p += key_len + 1;
+              break;
+            }
+        }
+    }
+
+  if (p != NULL)
+    value = g_ascii_strtoull (p, NULL, 10);
+
+  g_free (content);
+
+  return value;
+}
+
+/* Reads the 10 seconds averages of a pressure stall information file, as
+   the percentage of time some or all tasks were stalled */
+static gboolean
+cgroup_read_pressure (const gchar *dir,
+                      const gchar *file,
+                      gdouble     *some,
+                      gdouble     *full)
+{
+  gchar *content;
+  gchar *p;
+
+  content = cgroup_read (dir, file);
+  if (content == NULL)
+    return FALSE;
+
+  *some = 0;
+  *full = 0;
+
+  p = strstr (content, "some avg10=");
+  if (p != NULL)
+    *some = g_ascii_strtod (p + strlen ("some avg10="), NULL);
+
+  p = strstr (content, "full avg10=");
+  if (p != NULL)
+    *full = g_ascii_strtod (p + strlen ("full avg10="), NULL);
+
+  g_free (content);
+
+  return TRUE;
+}
+
+static void
+cgroup_add_child_info (ChildProcess *child, GVariantBuilder *info)
+{
+  static const gchar *RESOURCES[] = { "cpu", "memory", "io", NULL };
+
+  gint i;
+
+  if (child->cgroup == NULL)
+    return;
+
+  g_variant_builder_add (info, "{sv}", "cgroup",
+                         g_variant_new_string (child->cgroup));
+  g_variant_builder_add (info, "{sv}", "cpu-weight",
+                         g_variant_new_uint32 (child->cpu_weight > 0 ?
+                                               child->cpu_weight :
+                                               CGROUP_CPU_WEIGHT_DEFAULT));
+  g_variant_builder_add (info, "{sv}", "memory-high-bytes",
+                         g_variant_new_uint64 (child->memory_high));
+  g_variant_builder_add (info, "{sv}", "memory-max-bytes",
+                         g_variant_new_uint64 (child->memory_max));
+
+  /* the whole cgroup, including processes the child spawned */
+  g_variant_builder_add (info, "{sv}", "cgroup-cpu-usage-us",
+                         g_variant_new_uint64 (cgroup_read_uint64 (child->cgroup,
+                                                                   "cpu.stat",
+                                                                   "usage_usec")));
+  g_variant_builder_add (info, "{sv}", "cgroup-memory-bytes",
+                         g_variant_new_uint64 (cgroup_read_uint64 (child->cgroup,
+                                                                   "memory.current",
+                                                                   NULL)));
+
+  for (i=0; RESOURCES[i] != NULL; i++)
+    {
+      gchar *file;
+      gdouble some;
+      gdouble full;
+
+      file = g_strdup_printf ("%s.pressure", RESOURCES[i]);
+      if (cgroup_read_pressure (child->cgroup, file, &some, &full))
+        {
+          gchar *key;
+
+          key = g_strdup_printf ("%s-pressure-some", RESOURCES[i]);
+          g_variant_builder_add (info, "{sv}", key, g_variant_new_double (some));
+          g_free (key);
+
+          key = g_strdup_printf ("%s-pressure-full", RESOURCES[i]);
+          g_variant_builder_add (info, "{sv}", key, g_variant_new_double (full));
+          g_free (key);
+        }
+      g_free (file);
+    }
+}
+
+static gboolean
+set_child_limits (ChildProcess  *child,
+                  guint          cpu_weight,
+                  guint64        memory_high,
+                  guint64        memory_max,
+                  GError       **error)
+{
+  if (cpu_weight > 10000)
+    {
+      g_set_error (error,
+                   G_IO_ERROR,
+                   G_IO_ERROR_INVALID_ARGUMENT,
+                   "CPU weight must be between 1 and 10000");
+      return FALSE;
+    }
+
+  child->cpu_weight = cpu_weight;
+  child->memory_high = memory_high;
+  child->memory_max = memory_max;
+
+  if (child->cgroup == NULL)
+    {
+      g_set_error (error,
+                   G_IO_ERROR,
+                   G_IO_ERROR_NOT_SUPPORTED,
+                   "Child %u doesn't have a cgroup of its own",
+                   child->id);
+      return FALSE;
+    }
+
+  return cgroup_apply_limits (child, error);
+}
@@ -0,0 +1,146 @@
+/* Service discovery. Core serves the configuration applications need to
+   join the system (service names and bus addresses) on its peer-to-peer
+   endpoint, which listens on an abstract unix socket named after the base
+   service name. A client gets a versioned snapshot with a single call,
+   and is notified of every change afterwards. */
+
+static const gchar discovery_introspection_xml[] =
+  "<node>"
+  "  <interface name='" LIA_DISCOVERY_IFACE_NAME "'>"
+  "    <method name='GetConfig'>"
+  "      <arg type='u' name='version' direction='out'/>"
+  "      <arg type='a{sv}' name='config' direction='out'/>"
+  "    </method>"
+  "    <signal name='Changed'>"
+  "      <arg type='u' name='version'/>"
+  "      <arg type='a{sv}' name='config'/>"
+  "    </signal>"
+  "  </interface>"
+  "</node>";
+
+static GVariant *
+build_config (LiaCore *self)
+{
+  GVariantBuilder builder;
+  GHashTableIter iter;
+  gpointer key;
+  gpointer value;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+
+  g_hash_table_iter_init (&iter, self->priv->config);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    g_variant_builder_add (&builder, "{sv}", key, value);
+
+  return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
+
+/* sets a configuration entry and publishes the new snapshot to core
+   itself, to the embedded Webview if any, and to every application
+   connected to the discovery endpoint */
+static void
+config_set (LiaCore *self, const gchar *key, GVariant *value)
+{
+  GVariant *config;
+  GList *node;
+
+  g_hash_table_insert (self->priv->config,
+                       g_strdup (key),
+                       g_variant_ref_sink (value));
+  self->priv->config_version++;
+
+  config = build_config (self);
+
+  lia_application_set_config (LIA_APPLICATION (self),
+                              self->priv->config_version,
+                              config);
+
+  if (self->priv->webview != NULL)
+    lia_application_set_config (LIA_APPLICATION (self->priv->webview),
+                                self->priv->config_version,
+                                config);
+
+  for (node = self->priv->peer_conns; node != NULL; node = node->next)
+    {
+      GError *error = NULL;
+
+      if (! g_dbus_connection_emit_signal (node->data,
+                                           NULL,
+                                           LIA_DISCOVERY_OBJ_PATH,
+                                           LIA_DISCOVERY_IFACE_NAME,
+                                           "Changed",
+                                           g_variant_new ("(u@a{sv})",
+                                                          self->priv->config_version,
+                                                          config),
+                                           &error))
+        {
+          g_debug ("Error notifying configuration change: %s", error->message);
+          g_error_free (error);
+        }
+    }
+
+  g_variant_unref (config);
+}
+
+static void
+on_discovery_method_call (GDBusConnection       *connection,
+                          const gchar           *sender,
+                          const gchar           *object_path,
+                          const gchar           *interface_name,
+                          const gchar           *method_name,
+                          GVariant              *parameters,
+                          GDBusMethodInvocation *invocation,
+                          gpointer               user_data)
+{
+  LiaCore *self = LIA_CORE (user_data);
+
+  if (g_strcmp0 (method_name, "GetConfig") == 0)
+    {
+      GVariant *config;
+
+      config = build_config (self);
+      g_dbus_method_invocation_return_value (invocation,
+                                             g_variant_new ("(u@a{sv})",
+                                                            self->priv->config_version,
+                                                            config));
+      g_variant_unref (config);
+    }
+  else
+    {
+      g_dbus_method_invocation_return_error (invocation,
+                                             G_DBUS_ERROR,
+                                             G_DBUS_ERROR_UNKNOWN_METHOD,
+                                             "Unknown method '%s'",
+                                             method_name);
+    }
+}
+
+/* the object lives as long as the peer connection, so its registration
+   id is not kept */
+static void
+register_discovery_object (LiaCore *self, GDBusConnection *conn)
+{
+  static GDBusNodeInfo *introspection_data = NULL;
+  static const GDBusInterfaceVTable vtable = {
+    on_discovery_method_call,
+    NULL,
+    NULL
+  };
+  GError *error = NULL;
+
+  if (introspection_data == NULL)
+    introspection_data =
+      g_dbus_node_info_new_for_xml (discovery_introspection_xml, NULL);
+
+  if (g_dbus_connection_register_object (conn,
+                                         LIA_DISCOVERY_OBJ_PATH,
+                                         introspection_data->interfaces[0],
+                                         &vtable,
+                                         self,
+                                         NULL,
+                                         &error) == 0)
+    {
+      g_print ("Error registering discovery object: %s\n", error->message);
+      g_error_free (error);
+    }
+}
@@ -0,0 +1,415 @@
+/* Idle application eviction. Installed applications are launched on
+   demand (see lia-core-apps.c), so they can also be stopped when memory
+   gets scarce and launched again transparently on their next web
+   request. Core watches the memory pressure (PSI) of its cgroup subtree,
+   or of the whole system when it has none, and when it stays above a
+   threshold, stops the least recently used application among those idle
+   for long enough, one at a time.
+
+   An application's last activity is the most recent of the last request
+   for its web dirs, as seen by the Webview, and the last method call it
+   dispatched, which includes the calls of web peers coming through the
+   Webview's D-Bus bridge. Both are only queried when pressure is high.
+
+   Applications get a Drain call before being stopped, to save their
+   state. */
+
+#define EVICTION_CHECK_INTERVAL 5    /* seconds */
+#define EVICTION_SETTLE_TIME    15   /* seconds */
+#define EVICTION_DRAIN_TIMEOUT  5000 /* milliseconds */
+
+typedef struct
+{
+  LiaCore *self;
+  gchar *service_name;
+  guint child_id;
+} EvictionCallData;
+
+static EvictionCallData *
+eviction_call_data_new (LiaCore *self, InstalledApp *app)
+{
+  EvictionCallData *data;
+
+  data = g_slice_new0 (EvictionCallData);
+  data->self = g_object_ref (self);
+  data->service_name = g_strdup (app->service_name);
+  data->child_id = app->child_id;
+
+  return data;
+}
+
+static void
+free_eviction_call_data (EvictionCallData *data)
+{
+  g_object_unref (data->self);
+  g_free (data->service_name);
+
+  g_slice_free (EvictionCallData, data);
+}
+
+static gboolean
+read_memory_pressure (LiaCore *self, gdouble *some)
+{
+  gdouble full;
+
+  if (self->priv->cgroup_base != NULL &&
+      cgroup_read_pressure (self->priv->cgroup_base,
+                            "memory.pressure",
+                            some,
+                            &full))
+    {
+      return TRUE;
+    }
+
+  return cgroup_read_pressure ("/proc/pressure", "memory", some, &full);
+}
+
+/* returns the child running an installed application, if it is up */
+static ChildProcess *
+get_app_child (LiaCore *self, InstalledApp *app)
+{
+  ChildProcess *child;
+
+  child = g_hash_table_lookup (self->priv->children,
+                               GUINT_TO_POINTER (app->child_id));
+  if (child == NULL || child->state != CHILD_STATE_READY || child->pid <= 0)
+    return NULL;
+
+  return child;
+}
+
+static void
+update_app_activity (LiaCore *self, const gchar *service_name, guint64 idle_ms)
+{
+  InstalledApp *app;
+  gint64 last_activity;
+
+  app = g_hash_table_lookup (self->priv->apps, service_name);
+  if (app == NULL)
+    return;
+
+  last_activity = g_get_monotonic_time () - (gint64) idle_ms * 1000;
+  app->last_activity = MAX (app->last_activity, last_activity);
+}
+
+static guint64
+get_child_memory (ChildProcess *child)
+{
+  if (child->cgroup != NULL)
+    return cgroup_read_uint64 (child->cgroup, "memory.current", NULL);
+  else
+    return get_process_pss (child->pid);
+}
+
+static void
+on_app_drained (GObject      *obj,
+                GAsyncResult *res,
+                gpointer      user_data)
+{
+  EvictionCallData *data = user_data;
+  LiaCore *self = data->self;
+  ChildProcess *child;
+  GVariant *ret;
+  GError *error = NULL;
+
+  /* stopped anyway, draining is a courtesy */
+  ret = g_dbus_connection_call_finish (G_DBUS_CONNECTION (obj), res, &error);
+  if (ret == NULL)
+    {
+      g_debug ("Error draining '%s': %s", data->service_name, error->message);
+      g_error_free (error);
+    }
+  else
+    {
+      g_variant_unref (ret);
+    }
+
+  child = g_hash_table_lookup (self->priv->children,
+                               GUINT_TO_POINTER (data->child_id));
+  if (child != NULL && child->pid > 0)
+    {
+      guint64 memory;
+
+      memory = get_child_memory (child);
+
+      self->priv->evictions++;
+      self->priv->evicted_memory += memory;
+
+      g_print ("Evicted '%s', reclaiming %" G_GUINT64_FORMAT " KiB\n",
+               data->service_name,
+               memory / 1024);
+
+      child->stop_requested = TRUE;
+      kill (child->pid, SIGTERM);
+    }
+
+  free_eviction_call_data (data);
+}
+
+static void
+evict_app (LiaCore *self, InstalledApp *app)
+{
+  GDBusConnection *conn;
+
+  g_print ("Memory pressure is high, evicting '%s' (idle for %" G_GINT64_FORMAT " s)\n",
+           app->service_name,
+           (g_get_monotonic_time () - app->last_activity) / G_USEC_PER_SEC);
+
+  self->priv->last_eviction_time = g_get_monotonic_time ();
+
+  conn = lia_application_get_bus (LIA_APPLICATION (self), LIA_BUS_PRIVATE);
+  g_dbus_connection_call (conn,
+                          app->service_name,
+                          LIA_APPLICATION_OBJ_PATH,
+                          LIA_APPLICATION_IFACE_NAME,
+                          "Drain",
+                          NULL,
+                          NULL,
+                          G_DBUS_CALL_FLAGS_NONE,
+                          EVICTION_DRAIN_TIMEOUT,
+                          NULL,
+                          on_app_drained,
+                          eviction_call_data_new (self, app));
+}
+
+static void
+evict_least_recently_used_app (LiaCore *self)
+{
+  GHashTableIter iter;
+  gpointer value;
+  InstalledApp *victim = NULL;
+  gint64 idle_since;
+
+  idle_since = g_get_monotonic_time () -
+    (gint64) self->priv->eviction_idle_time * G_USEC_PER_SEC;
+
+  g_hash_table_iter_init (&iter, self->priv->apps);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      InstalledApp *app = value;
+
+      if (get_app_child (self, app) == NULL || app->last_activity > idle_since)
+        continue;
+
+      if (victim == NULL || app->last_activity < victim->last_activity)
+        victim = app;
+    }
+
+  if (victim != NULL)
+    evict_app (self, victim);
+  else
+    g_debug ("Memory pressure is high, but no application is idle");
+}
+
+static void
+eviction_round_op_done (LiaCore *self)
+{
+  self->priv->eviction_ops--;
+  if (self->priv->eviction_ops > 0)
+    return;
+
+  evict_least_recently_used_app (self);
+
+  g_object_unref (self);
+}
+
+static void
+on_web_dir_activity (GObject      *obj,
+                     GAsyncResult *res,
+                     gpointer      user_data)
+{
+  LiaCore *self = LIA_CORE (user_data);
+  GVariant *ret;
+  GError *error = NULL;
+
+  ret = g_dbus_connection_call_finish (G_DBUS_CONNECTION (obj), res, &error);
+  if (ret == NULL)
+    {
+      g_debug ("Error getting web dir activity: %s", error->message);
+      g_error_free (error);
+    }
+  else
+    {
+      GVariantIter *iter;
+      const gchar *path;
+      guint64 idle_ms;
+
+      g_variant_get (ret, "(a{st})", &iter);
+      while (g_variant_iter_next (iter, "{&st}", &path, &idle_ms))
+        update_app_activity (self, path, idle_ms);
+
+      g_variant_iter_free (iter);
+      g_variant_unref (ret);
+    }
+
+  eviction_round_op_done (self);
+}
+
+static void
+on_app_call_stats (GObject      *obj,
+                   GAsyncResult *res,
+                   gpointer      user_data)
+{
+  EvictionCallData *data = user_data;
+  GVariant *ret;
+  GError *error = NULL;
+
+  ret = g_dbus_connection_call_finish (G_DBUS_CONNECTION (obj), res, &error);
+  if (ret == NULL)
+    {
+      g_debug ("Error getting call stats of '%s': %s",
+               data->service_name,
+               error->message);
+      g_error_free (error);
+    }
+  else
+    {
+      GVariant *stats;
+      guint64 idle_ms;
+
+      stats = g_variant_get_child_value (ret, 0);
+      if (g_variant_lookup (stats, "idle-time-ms", "t", &idle_ms))
+        update_app_activity (data->self, data->service_name, idle_ms);
+
+      g_variant_unref (stats);
+      g_variant_unref (ret);
+    }
+
+  eviction_round_op_done (data->self);
+  free_eviction_call_data (data);
+}
+
+/* gathers the last activity of every running installed application,
+   and then evicts the least recently used one if idle */
+static void
+start_eviction_round (LiaCore *self)
+{
+  GDBusConnection *conn;
+  const gchar *webview_service_name;
+  GHashTableIter iter;
+  gpointer value;
+
+  conn = lia_application_get_bus (LIA_APPLICATION (self), LIA_BUS_PRIVATE);
+  if (conn == NULL)
+    return;
+
+  g_object_ref (self);
+  self->priv->eviction_ops = 1;
+
+  webview_service_name =
+    lia_application_get_config_string (LIA_APPLICATION (self),
+                                       LIA_CONFIG_KEY_WEBVIEW_SERVICE_NAME);
+  if (webview_service_name != NULL)
+    {
+      self->priv->eviction_ops++;
+      g_dbus_connection_call (conn,
+                              webview_service_name,
+                              LIA_WEBVIEW_OBJ_PATH,
+                              LIA_WEBVIEW_IFACE_NAME,
+                              "GetWebDirActivity",
+                              NULL,
+                              G_VARIANT_TYPE ("(a{st})"),
+                              G_DBUS_CALL_FLAGS_NONE,
+                              -1,
+                              NULL,
+                              on_web_dir_activity,
+                              self);
+    }
+
+  g_hash_table_iter_init (&iter, self->priv->apps);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      InstalledApp *app = value;
+
+      if (get_app_child (self, app) == NULL)
+        continue;
+
+      self->priv->eviction_ops++;
+      g_dbus_connection_call (conn,
+                              app->service_name,
+                              LIA_STATS_OBJ_PATH,
+                              LIA_STATS_IFACE_NAME,
+                              "GetCallStats",
+                              NULL,
+                              G_VARIANT_TYPE ("(a{sv})"),
+                              G_DBUS_CALL_FLAGS_NONE,
+                              -1,
+                              NULL,
+                              on_app_call_stats,
+                              eviction_call_data_new (self, app));
+    }
+
+  eviction_round_op_done (self);
+}
+
+static gboolean
+check_memory_pressure (gpointer user_data)
+{
+  LiaCore *self = LIA_CORE (user_data);
+  gdouble pressure;
+
+  /* pressure is a 10 seconds average, so it takes a while to reflect
+     the previous eviction */
+  if (self->priv->eviction_ops > 0 ||
+      g_get_monotonic_time () - self->priv->last_eviction_time <
+      EVICTION_SETTLE_TIME * G_USEC_PER_SEC)
+    {
+      return TRUE;
+    }
+
+  if (! read_memory_pressure (self, &pressure) ||
+      pressure < self->priv->eviction_pressure)
+    {
+      return TRUE;
+    }
+
+  start_eviction_round (self);
+
+  return TRUE;
+}
+
+static void
+start_eviction_monitor (LiaCore *self)
+{
+  gdouble pressure;
+
+  if (self->priv->eviction_pressure <= 0 ||
+      g_hash_table_size (self->priv->apps) == 0)
+    {
+      return;
+    }
+
+  if (! read_memory_pressure (self, &pressure))
+    {
+      g_print ("Memory pressure information not available, idle applications won't be evicted\n");
+      return;
+    }
+
+  self->priv->eviction_src_id = g_timeout_add_seconds (EVICTION_CHECK_INTERVAL,
+                                                       check_memory_pressure,
+                                                       self);
+}
+
+static GVariant *
+get_eviction_info (LiaCore *self)
+{
+  GVariantBuilder builder;
+  gdouble pressure;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+
+  g_variant_builder_add (&builder, "{sv}", "evictions",
+                         g_variant_new_uint32 (self->priv->evictions));
+  g_variant_builder_add (&builder, "{sv}", "memory-reclaimed-bytes",
+                         g_variant_new_uint64 (self->priv->evicted_memory));
+  g_variant_builder_add (&builder, "{sv}", "memory-pressure-threshold",
+                         g_variant_new_double (self->priv->eviction_pressure));
+  g_variant_builder_add (&builder, "{sv}", "idle-time-s",
+                         g_variant_new_uint32 (self->priv->eviction_idle_time));
+
+  if (read_memory_pressure (self, &pressure))
+    g_variant_builder_add (&builder, "{sv}", "memory-pressure",
+                           g_variant_new_double (pressure));
+
+  return g_variant_builder_end (&builder);
+}
@@ -0,0 +1,341 @@
+/* Startup steps. Each step starts as soon as all the steps it depends on
+   are done, so independent steps run concurrently and a cold boot takes
+   as long as the longest chain of dependencies rather than the sum of
+   all steps.
+
+   Steps without a start function are driven by the regular initialization
+   of the application (bus setup and connection), and are only marked done
+   from there. */
+typedef enum
+{
+  STARTUP_STEP_BUS_ADDRESSES,
+  STARTUP_STEP_PRIVATE_BUS,
+  STARTUP_STEP_ZYGOTES,
+  STARTUP_STEP_INSTALLED_APPS,
+  STARTUP_STEP_AUTH_SERVICE,
+  STARTUP_STEP_WEBVIEW,
+  STARTUP_STEP_BUS_MONITOR,
+
+  STARTUP_STEP_LAST
+} StartupStep;
+
+#define STEP(step) (1 << (step))
+
+/* steps that must be done before core's initialization completes. The
+   rest only count for the time-to-ready */
+#define STARTUP_INIT_STEPS (STEP (STARTUP_STEP_AUTH_SERVICE))
+
+#define STARTUP_ALL_STEPS  (STEP (STARTUP_STEP_LAST) - 1)
+
+typedef void (* StartupStepFunc) (LiaCore *self);
+
+static void start_zygotes_step       (LiaCore *self);
+static void load_installed_apps_step (LiaCore *self);
+static void create_auth_service_step (LiaCore *self);
+static void launch_webview_step      (LiaCore *self);
+static void start_bus_monitor_step   (LiaCore *self);
+
+static const struct
+{
+  const gchar *name;
+  guint deps;
+  StartupStepFunc start;
+} STARTUP_STEPS[STARTUP_STEP_LAST] = {
+  { "bus-addresses", 0, NULL },
+  { "private-bus",   0, NULL },
+
+  { "start-zygotes",
+    0,
+    start_zygotes_step },
+
+  { "load-installed-apps",
+    0,
+    load_installed_apps_step },
+
+  { "create-auth-service",
+    STEP (STARTUP_STEP_PRIVATE_BUS),
+    create_auth_service_step },
+
+  /* finishes when the Webview reports it is ready, or once initialized
+     if it runs in core's process */
+  { "launch-webview",
+    STEP (STARTUP_STEP_BUS_ADDRESSES),
+    launch_webview_step },
+
+  { "start-bus-monitor",
+    STEP (STARTUP_STEP_BUS_ADDRESSES),
+    start_bus_monitor_step }
+};
+
+static void startup_advance (LiaCore *self);
+
+static void
+startup_complete_init (LiaCore *self, GError *error)
+{
+  GSimpleAsyncResult *res = self->priv->init_result;
+
+  self->priv->init_result = NULL;
+
+  if (error != NULL)
+    {
+      abort_init_async (self, res, error);
+      return;
+    }
+
+  self->priv->initialized = TRUE;
+
+  g_simple_async_result_complete_in_idle (res);
+  g_object_unref (res);
+  g_object_unref (self);
+}
+
+static void
+startup_step_done (LiaCore *self, StartupStep step)
+{
+  if (self->priv->startup_done & STEP (step))
+    return;
+
+  self->priv->startup_done |= STEP (step);
+  lia_application_trace_end (LIA_APPLICATION (self),
+                             self->priv->startup_spans[step]);
+
+  startup_advance (self);
+}
+
+static void
+startup_step_failed (LiaCore *self, StartupStep step, GError *error)
+{
+  lia_application_trace_end (LIA_APPLICATION (self),
+                             self->priv->startup_spans[step]);
+
+  g_print ("Startup step '%s' failed: %s\n",
+           STARTUP_STEPS[step].name,
+           error->message);
+
+  if (self->priv->init_result != NULL)
+    {
+      startup_complete_init (self, error);
+    }
+  else if (! self->priv->initialized && self->priv->startup_error == NULL)
+    {
+      /* reported once core's initialization gets to wait for steps */
+      self->priv->startup_error = error;
+    }
+  else
+    {
+      g_error_free (error);
+    }
+}
+
+static void
+startup_advance (LiaCore *self)
+{
+  gint i;
+
+  /* start every step whose dependencies are satisfied */
+  for (i=0; i<STARTUP_STEP_LAST; i++)
+    {
+      if (STARTUP_STEPS[i].start == NULL ||
+          (self->priv->startup_started & STEP (i)) ||
+          (self->priv->startup_done & STARTUP_STEPS[i].deps) != STARTUP_STEPS[i].deps)
+        {
+          continue;
+        }
+
+      self->priv->startup_started |= STEP (i);
+      self->priv->startup_spans[i] =
+        lia_application_trace_begin (LIA_APPLICATION (self),
+                                     STARTUP_STEPS[i].name);
+
+      STARTUP_STEPS[i].start (self);
+    }
+
+  if (self->priv->init_result != NULL &&
+      (self->priv->startup_done & STARTUP_INIT_STEPS) == STARTUP_INIT_STEPS)
+    {
+      startup_complete_init (self, NULL);
+    }
+
+  if (self->priv->initialized &&
+      self->priv->time_to_ready < 0 &&
+      self->priv->startup_done == STARTUP_ALL_STEPS)
+    {
+      self->priv->time_to_ready =
+        g_get_monotonic_time () - self->priv->startup_time;
+
+      g_print ("System ready in %" G_GINT64_FORMAT " ms\n",
+               self->priv->time_to_ready / 1000);
+    }
+}
+
+static void
+startup_begin (LiaCore *self, gint io_priority, GCancellable *cancellable)
+{
+  self->priv->startup_time = g_get_monotonic_time ();
+  self->priv->startup_spans = g_new0 (guint, STARTUP_STEP_LAST);
+  self->priv->startup_io_priority = io_priority;
+  if (cancellable != NULL)
+    self->priv->startup_cancellable = g_object_ref (cancellable);
+
+  startup_advance (self);
+}
+
+/* called from the supervisor when a child reports it is ready */
+static void
+startup_child_ready (LiaCore *self, guint child_id)
+{
+  if (child_id != 0 && child_id == self->priv->webview_child_id)
+    startup_step_done (self, STARTUP_STEP_WEBVIEW);
+}
+
+static void
+start_zygotes_step (LiaCore *self)
+{
+  start_zygotes (self);
+
+  startup_step_done (self, STARTUP_STEP_ZYGOTES);
+}
+
+static void
+load_installed_apps_step (LiaCore *self)
+{
+  load_installed_apps (self);
+  start_eviction_monitor (self);
+
+  startup_step_done (self, STARTUP_STEP_INSTALLED_APPS);
+}
+
+static void
+start_bus_monitor_step (LiaCore *self)
+{
+  start_bus_monitor (self);
+
+  startup_step_done (self, STARTUP_STEP_BUS_MONITOR);
+}
+
+static void
+on_auth_service_created (GObject      *obj,
+                         GAsyncResult *res,
+                         gpointer      user_data)
+{
+  LiaCore *self = LIA_CORE (user_data);
+  GError *error = NULL;
+
+  self->priv->auth_service =
+    LIA_AUTH_SERVICE (g_async_initable_new_finish (G_ASYNC_INITABLE (obj),
+                                                   res,
+                                                   &error));
+  if (self->priv->auth_service == NULL)
+    {
+      startup_step_failed (self, STARTUP_STEP_AUTH_SERVICE, error);
+    }
+  else
+    {
+      GList *node;
+
+      /* also serve core objects to peers that are already connected
+         directly */
+      for (node = self->priv->peer_conns; node != NULL; node = node->next)
+        export_core_objects_on_connection (self, node->data);
+
+      if (self->priv->webview != NULL)
+        lia_webview_set_auth_service (self->priv->webview,
+                                      self->priv->auth_service);
+
+      startup_step_done (self, STARTUP_STEP_AUTH_SERVICE);
+    }
+
+  g_object_unref (self);
+}
+
+static void
+create_auth_service_step (LiaCore *self)
+{
+  GDBusConnection *priv_bus_conn;
+
+  priv_bus_conn = lia_application_get_bus (LIA_APPLICATION (self),
+                                           LIA_BUS_PRIVATE);
+
+  g_object_ref (self);
+  g_async_initable_new_async (LIA_TYPE_AUTH_SERVICE,
+                              self->priv->startup_io_priority,
+                              self->priv->startup_cancellable,
+                              on_auth_service_created,
+                              self,
+                              "dbus-connection", priv_bus_conn,
+                              NULL);
+}
+
+static void
+on_embedded_webview_initialized (GObject      *obj,
+                                 GAsyncResult *res,
+                                 gpointer      user_data)
+{
+  LiaCore *self = LIA_CORE (user_data);
+  GError *error = NULL;
+
+  if (! g_async_initable_init_finish (G_ASYNC_INITABLE (obj), res, &error))
+    startup_step_failed (self, STARTUP_STEP_WEBVIEW, error);
+  else
+    startup_step_done (self, STARTUP_STEP_WEBVIEW);
+
+  g_object_unref (self);
+}
+
+/* Runs the Webview as an object of core's own process. It gets core's
+   configuration handed in instead of connecting to discovery, and calls
+   the auth service directly once it is created. Everything else,
+   including the API offered to applications, goes through the buses as
+   usual */
+static void
+launch_embedded_webview (LiaCore *self)
+{
+  GVariant *config;
+
+  self->priv->webview =
+    g_object_new (LIA_TYPE_WEBVIEW,
+                  "base-service-name",
+                  lia_application_get_base_service_name (LIA_APPLICATION (self)),
+                  NULL);
+
+  config = build_config (self);
+  lia_application_set_config (LIA_APPLICATION (self->priv->webview),
+                              self->priv->config_version,
+                              config);
+  g_variant_unref (config);
+
+  if (self->priv->auth_service != NULL)
+    lia_webview_set_auth_service (self->priv->webview,
+                                  self->priv->auth_service);
+
+  g_object_ref (self);
+  g_async_initable_init_async (G_ASYNC_INITABLE (self->priv->webview),
+                               self->priv->startup_io_priority,
+                               self->priv->startup_cancellable,
+                               on_embedded_webview_initialized,
+                               self);
+}
+
+static void
+launch_webview_step (LiaCore *self)
+{
+  GError *error = NULL;
+
+  if (self->priv->embedded_webview)
+    {
+      launch_embedded_webview (self);
+      return;
+    }
+
+  /* the Webview only needs the buses to be up. Core objects it talks to
+     are looked up lazily, so it doesn't wait for the rest of core */
+  if (! lia_core_launch_full (self,
+                              SYS_PROG_DIR "/lia-webview",
+                              NULL,
+                              LIA_RESTART_ON_FAILURE,
+                              &self->priv->webview_child_id,
+                              &error))
+    {
+      startup_step_failed (self, STARTUP_STEP_WEBVIEW, error);
+    }
+}
@@ -0,0 +1,781 @@
+#define RESTART_BACKOFF_MIN    100   /* milliseconds */
+#define RESTART_BACKOFF_MAX    30000 /* milliseconds */
+#define RESTART_STABLE_UPTIME  10    /* seconds */
+
+static const gchar supervisor_introspection_xml[] =
+  "<interface name='" LIA_SUPERVISOR_IFACE_NAME "'>"
+  "  <method name='GetChildren'>"
+  "    <arg type='a(ua{sv})' name='children' direction='out'/>"
+  "  </method>"
+  "  <method name='NotifyReady'>"
+  "    <arg type='u' name='child_id' direction='in'/>"
+  "  </method>"
+  "  <method name='Restart'>"
+  "    <arg type='u' name='child_id' direction='in'/>"
+  "  </method>"
+  "  <method name='ActivateApp'>"
+  "    <arg type='s' name='service_name' direction='in'/>"
+  "  </method>"
+  "  <method name='SetLimits'>"
+  "    <arg type='u' name='child_id' direction='in'/>"
+  "    <arg type='u' name='cpu_weight' direction='in'/>"
+  "    <arg type='t' name='memory_high' direction='in'/>"
+  "    <arg type='t' name='memory_max' direction='in'/>"
+  "  </method>"
+  "  <method name='GetEvictions'>"
+  "    <arg type='a{sv}' name='evictions' direction='out'/>"
+  "  </method>"
+  "  <method name='GetBusStats'>"
+  "    <arg type='a{sa{sv}}' name='buses' direction='out'/>"
+  "  </method>"
+  "  <method name='GetBusStatsHistory'>"
+  "    <arg type='n' name='bus_type' direction='in'/>"
+  "    <arg type='aa{sv}' name='samples' direction='out'/>"
+  "  </method>"
+  "  <method name='GetStartup'>"
+  "    <arg type='x' name='time_to_ready' direction='out'/>"
+  "    <arg type='a(sxx)' name='trace' direction='out'/>"
+  "  </method>"
+  "  <signal name='ChildStateChanged'>"
+  "    <arg type='u' name='child_id'/>"
+  "    <arg type='s' name='state'/>"
+  "  </signal>"
+  "</interface>";
+
+typedef enum
+{
+  CHILD_STATE_STARTING,
+  CHILD_STATE_READY,
+  CHILD_STATE_BACKOFF,
+  CHILD_STATE_STOPPED
+} ChildState;
+
+static const gchar *CHILD_STATE_NAMES[] = {
+  "starting",
+  "ready",
+  "backoff",
+  "stopped"
+};
+
+typedef struct _Zygote Zygote;
+
+/* ChildProcess */
+typedef struct
+{
+  LiaCore *self;
+  guint id;
+  gchar *command_line;
+  gchar **env;
+  LiaRestartPolicy restart_policy;
+
+  GPid pid;
+  guint child_watch_id;
+  ChildState state;
+  gint64 start_time;
+  gint64 ready_time;
+  GPid ready_pid;
+
+  guint restarts;
+  guint backoff;
+  guint restart_src_id;
+  gboolean restart_requested;
+  gboolean stop_requested;
+
+  gboolean use_zygote;
+  Zygote *zygote;
+  guint zygote_request_id;
+
+  gchar *cgroup;
+  guint cpu_weight;
+  guint64 memory_high;
+  guint64 memory_max;
+} ChildProcess;
+
+typedef struct
+{
+  LiaCore *self;
+  GDBusMethodInvocation *invocation;
+  guint32 child_id;
+} NotifyReadyData;
+
+static gboolean spawn_child         (ChildProcess *child, GError **error);
+
+static gboolean zygote_launch_child (ChildProcess  *child,
+                                     gchar        **argv,
+                                     gchar        **launch_env);
+static void     zygote_forget_child (ChildProcess *child);
+
+static gboolean cgroup_create_child   (ChildProcess *child);
+static gint     cgroup_prepare_child  (ChildProcess *child);
+static void     cgroup_child_setup    (gpointer user_data);
+static void     cgroup_attach_child   (ChildProcess *child);
+static void     cgroup_remove_child   (ChildProcess *child);
+static void     cgroup_add_child_info (ChildProcess    *child,
+                                       GVariantBuilder *info);
+static gboolean set_child_limits      (ChildProcess  *child,
+                                       guint          cpu_weight,
+                                       guint64        memory_high,
+                                       guint64        memory_max,
+                                       GError       **error);
+
+static void     startup_child_ready (LiaCore *self, guint child_id);
+
+static gboolean activate_app        (LiaCore      *self,
+                                     const gchar  *service_name,
+                                     GError      **error);
+static GVariant *get_eviction_info  (LiaCore *self);
+
+static GVariant *get_bus_stats_info    (LiaCore *self);
+static GVariant *get_bus_stats_history (LiaCore *self, LiaBusType bus_type);
+
+static void
+free_child_process (gpointer _data)
+{
+  ChildProcess *child = _data;
+
+  if (child->child_watch_id > 0)
+    g_source_remove (child->child_watch_id);
+
+  if (child->restart_src_id > 0)
+    g_source_remove (child->restart_src_id);
+
+  if (child->zygote != NULL)
+    zygote_forget_child (child);
+
+  if (child->pid > 0)
+    {
+      /* supervised children don't outlive the supervisor */
+      kill (child->pid, SIGTERM);
+      g_spawn_close_pid (child->pid);
+    }
+
+  cgroup_remove_child (child);
+
+  g_free (child->command_line);
+  g_strfreev (child->env);
+
+  g_slice_free (ChildProcess, child);
+}
+
+static void
+set_child_state (ChildProcess *child, ChildState state)
+{
+  if (child->state == state)
+    return;
+
+  child->state = state;
+
+  g_print ("Child %u ('%s') is %s\n",
+           child->id,
+           child->command_line,
+           CHILD_STATE_NAMES[state]);
+
+  lia_application_emit_signal (LIA_APPLICATION (child->self),
+                               LIA_BUS_PRIVATE,
+                               NULL,
+                               LIA_SUPERVISOR_OBJ_PATH,
+                               LIA_SUPERVISOR_IFACE_NAME,
+                               "ChildStateChanged",
+                               g_variant_new ("(us)",
+                                              child->id,
+                                              CHILD_STATE_NAMES[state]),
+                               NULL);
+}
+
+static gboolean
+restart_child (gpointer user_data)
+{
+  ChildProcess *child = user_data;
+  GError *error = NULL;
+
+  child->restart_src_id = 0;
+  child->restarts++;
+
+  if (! spawn_child (child, &error))
+    {
+      g_print ("Failed to restart '%s': %s\n",
+               child->command_line,
+               error->message);
+      g_error_free (error);
+
+      /* try again later */
+      child->backoff = CLAMP (child->backoff * 2,
+                              RESTART_BACKOFF_MIN,
+                              RESTART_BACKOFF_MAX);
+      set_child_state (child, CHILD_STATE_BACKOFF);
+      child->restart_src_id = g_timeout_add (child->backoff,
+                                             restart_child,
+                                             child);
+    }
+
+  return FALSE;
+}
+
+static void
+mark_child_ready (ChildProcess *child)
+{
+  if (child->state != CHILD_STATE_STARTING)
+    return;
+
+  child->ready_time = g_get_monotonic_time ();
+  set_child_state (child, CHILD_STATE_READY);
+
+  startup_child_ready (child->self, child->id);
+}
+
+static void
+handle_child_exit (ChildProcess *child, gint status)
+{
+  gboolean failed;
+  gint64 uptime;
+
+  child->pid = 0;
+
+  if (child->restart_requested)
+    {
+      child->restart_requested = FALSE;
+      restart_child (child);
+      return;
+    }
+
+  /* evicted, launched again on demand */
+  if (child->stop_requested)
+    {
+      child->stop_requested = FALSE;
+      set_child_state (child, CHILD_STATE_STOPPED);
+      return;
+    }
+
+  failed = ! WIFEXITED (status) || WEXITSTATUS (status) != 0;
+
+  if (WIFSIGNALED (status))
+    g_print ("Child %u ('%s') killed by signal %d\n",
+             child->id, child->command_line, WTERMSIG (status));
+  else
+    g_print ("Child %u ('%s') exited with status %d\n",
+             child->id, child->command_line, WEXITSTATUS (status));
+
+  if (child->restart_policy == LIA_RESTART_NEVER ||
+      (child->restart_policy == LIA_RESTART_ON_FAILURE && ! failed))
+    {
+      set_child_state (child, CHILD_STATE_STOPPED);
+      return;
+    }
+
+  /* back off exponentially while the child keeps crashing early, and
+     start over once it had been running for a while */
+  uptime = g_get_monotonic_time () - child->start_time;
+  if (child->backoff == 0 || uptime > RESTART_STABLE_UPTIME * G_USEC_PER_SEC)
+    child->backoff = RESTART_BACKOFF_MIN;
+  else
+    child->backoff = MIN (child->backoff * 2, RESTART_BACKOFF_MAX);
+
+  set_child_state (child, CHILD_STATE_BACKOFF);
+  child->restart_src_id = g_timeout_add (child->backoff,
+                                         restart_child,
+                                         child);
+}
+
+static void
+on_child_exited (GPid     pid,
+                 gint     status,
+                 gpointer user_data)
+{
+  ChildProcess *child = user_data;
+
+  child->child_watch_id = 0;
+  g_spawn_close_pid (pid);
+
+  handle_child_exit (child, status);
+}
+
+static gboolean
+spawn_child (ChildProcess *child, GError **error)
+{
+  gint argc;
+  gchar **argv;
+  gchar **launch_env;
+  gchar *child_id_env[2];
+  gint cgroup_fd;
+  gboolean result;
+
+  if (! g_shell_parse_argv (child->command_line, &argc, &argv, error))
+    return FALSE;
+
+  /* lets the child report readiness back to us */
+  child_id_env[0] = g_strdup_printf ("%s=%u", LIA_ENV_KEY_CHILD_ID, child->id);
+  child_id_env[1] = NULL;
+
+  launch_env = build_launch_env (child->self, child->env, child_id_env);
+  g_free (child_id_env[0]);
+
+  child->start_time = g_get_monotonic_time ();
+  child->ready_time = 0;
+  child->ready_pid = 0;
+
+  /* fork from a pre-initialized runtime if there is one for this child */
+  if (child->use_zygote && zygote_launch_child (child, argv, launch_env))
+    {
+      g_strfreev (argv);
+      g_strfreev (launch_env);
+
+      set_child_state (child, CHILD_STATE_STARTING);
+
+      return TRUE;
+    }
+
+  /* the child moves itself to its cgroup before exec, so everything it
+     does is accounted there */
+  cgroup_fd = cgroup_prepare_child (child);
+
+  result = g_spawn_async (NULL,
+                          argv,
+                          launch_env,
+                          G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD,
+                          cgroup_fd >= 0 ? cgroup_child_setup : NULL,
+                          GINT_TO_POINTER (cgroup_fd),
+                          &child->pid,
+                          error);
+
+  if (cgroup_fd >= 0)
+    close (cgroup_fd);
+
+  g_strfreev (argv);
+  g_strfreev (launch_env);
+
+  if (! result)
+    return FALSE;
+
+  g_print ("Launched: '%s' with PID: %d\n", child->command_line, child->pid);
+
+  child->child_watch_id = g_child_watch_add (child->pid,
+                                             on_child_exited,
+                                             child);
+
+  set_child_state (child, CHILD_STATE_STARTING);
+
+  return TRUE;
+}
+
+static gboolean
+launch_child (LiaCore           *self,
+              const gchar       *command_line,
+              gchar            **env,
+              LiaRestartPolicy   restart_policy,
+              gboolean           use_zygote,
+              guint             *child_id,
+              GError           **error)
+{
+  ChildProcess *child;
+
+  child = g_slice_new0 (ChildProcess);
+  child->self = self;
+  child->id = self->priv->next_child_id;
+  child->command_line = g_strdup (command_line);
+  child->env = g_strdupv (env);
+  child->restart_policy = restart_policy;
+  child->state = CHILD_STATE_STOPPED;
+  child->use_zygote = use_zygote;
+  child->cpu_weight = self->priv->child_cpu_weight;
+  child->memory_high = self->priv->child_memory_high;
+  child->memory_max = self->priv->child_memory_max;
+
+  if (! spawn_child (child, error))
+    {
+      g_print ("Failed to launch '%s': %s\n", command_line, (*error)->message);
+      free_child_process (child);
+      return FALSE;
+    }
+
+  self->priv->next_child_id++;
+  g_hash_table_insert (self->priv->children,
+                       GUINT_TO_POINTER (child->id),
+                       child);
+
+  if (child_id != NULL)
+    *child_id = child->id;
+
+  return TRUE;
+}
+
+/* Reads CPU time (milliseconds) and resident set size (bytes) of a
+   process from procfs. Returns FALSE if not available. */
+static gboolean
+get_process_usage (GPid pid, guint64 *cpu_time, guint64 *rss)
+{
+  gchar *filename;
+  gchar *content = NULL;
+  gchar *p;
+  guint64 utime, stime;
+  guint64 pages;
+
+  filename = g_strdup_printf ("/proc/%d/stat", pid);
+  g_file_get_contents (filename, &content, NULL, NULL);
+  g_free (filename);
+  if (content == NULL)
+    return FALSE;
+
+  /* skip pid and command, which may contain spaces */
+  p = strrchr (content, ')');
+  if (p == NULL ||
+      sscanf (p + 2,
+              "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %"
+              G_GUINT64_FORMAT " %" G_GUINT64_FORMAT,
+              &utime, &stime) != 2)
+    {
+      g_free (content);
+      return FALSE;
+    }
+  g_free (content);
+
+  *cpu_time = (utime + stime) * 1000 / sysconf (_SC_CLK_TCK);
+
+  filename = g_strdup_printf ("/proc/%d/statm", pid);
+  g_file_get_contents (filename, &content, NULL, NULL);
+  g_free (filename);
+  if (content == NULL)
+    return FALSE;
+
+  if (sscanf (content, "%*u %" G_GUINT64_FORMAT, &pages) != 1)
+    pages = 0;
+  g_free (content);
+
+  *rss = pages * sysconf (_SC_PAGESIZE);
+
+  return TRUE;
+}
+
+/* Reads the proportional set size (bytes) of a process, which accounts
+   for pages shared with other processes, e.g with a zygote. Returns 0 if
+   not available. */
+static guint64
+get_process_pss (GPid pid)
+{
+  gchar *filename;
+  gchar *content = NULL;
+  gchar *p;
+  guint64 pss = 0;
+
+  filename = g_strdup_printf ("/proc/%d/smaps_rollup", pid);
+  g_file_get_contents (filename, &content, NULL, NULL);
+  g_free (filename);
+  if (content == NULL)
+    return 0;
+
+  p = strstr (content, "\nPss:");
+  if (p != NULL)
+    pss = g_ascii_strtoull (p + strlen ("\nPss:"), NULL, 10) * 1024;
+
+  g_free (content);
+
+  return pss;
+}
+
+static GVariant *
+get_children_info (LiaCore *self)
+{
+  GVariantBuilder builder;
+  GHashTableIter iter;
+  gpointer value;
+  gint64 now;
+
+  now = g_get_monotonic_time ();
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(ua{sv})"));
+
+  g_hash_table_iter_init (&iter, self->priv->children);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      ChildProcess *child = value;
+      GVariantBuilder info;
+      guint64 cpu_time;
+      guint64 rss;
+
+      g_variant_builder_init (&info, G_VARIANT_TYPE ("a{sv}"));
+
+      g_variant_builder_add (&info, "{sv}", "command-line",
+                             g_variant_new_string (child->command_line));
+      g_variant_builder_add (&info, "{sv}", "state",
+                             g_variant_new_string (CHILD_STATE_NAMES[child->state]));
+      g_variant_builder_add (&info, "{sv}", "pid",
+                             g_variant_new_int32 (child->pid));
+      g_variant_builder_add (&info, "{sv}", "restarts",
+                             g_variant_new_uint32 (child->restarts));
+
+      if (child->pid > 0)
+        {
+          g_variant_builder_add (&info, "{sv}", "uptime-ms",
+                                 g_variant_new_uint64 ((now - child->start_time) / 1000));
+
+          if (child->ready_time > 0)
+            g_variant_builder_add (&info, "{sv}", "time-to-ready-ms",
+                                   g_variant_new_uint64 ((child->ready_time -
+                                                          child->start_time) / 1000));
+
+          if (get_process_usage (child->pid, &cpu_time, &rss))
+            {
+              g_variant_builder_add (&info, "{sv}", "cpu-time-ms",
+                                     g_variant_new_uint64 (cpu_time));
+              g_variant_builder_add (&info, "{sv}", "rss-bytes",
+                                     g_variant_new_uint64 (rss));
+              g_variant_builder_add (&info, "{sv}", "pss-bytes",
+                                     g_variant_new_uint64 (get_process_pss (child->pid)));
+            }
+
+          g_variant_builder_add (&info, "{sv}", "zygote",
+                                 g_variant_new_boolean (child->zygote != NULL));
+        }
+
+      cgroup_add_child_info (child, &info);
+
+      g_variant_builder_add (&builder, "(ua{sv})", child->id, &info);
+    }
+
+  return g_variant_builder_end (&builder);
+}
+
+static void
+on_notify_ready_identity (GObject      *obj,
+                          GAsyncResult *res,
+                          gpointer      user_data)
+{
+  NotifyReadyData *data = user_data;
+  LiaCallerIdentity *identity;
+  ChildProcess *child;
+  GPid pid = 0;
+
+  identity = lia_application_resolve_caller_identity_finish (LIA_APPLICATION (obj),
+                                                             res,
+                                                             NULL);
+  if (identity != NULL)
+    {
+      pid = identity->pid;
+      lia_caller_identity_unref (identity);
+    }
+
+  /* the child may be gone while its identity was resolved */
+  child = g_hash_table_lookup (data->self->priv->children,
+                               GUINT_TO_POINTER (data->child_id));
+  if (child == NULL)
+    {
+      g_dbus_method_invocation_return_error (data->invocation,
+                                             G_IO_ERROR,
+                                             G_IO_ERROR_NOT_FOUND,
+                                             "No child with id %u",
+                                             data->child_id);
+    }
+  else if (pid <= 0 || (child->pid > 0 && pid != child->pid))
+    {
+      g_dbus_method_invocation_return_error (data->invocation,
+                                             G_IO_ERROR,
+                                             G_IO_ERROR_PERMISSION_DENIED,
+                                             "Caller is not child %u",
+                                             data->child_id);
+    }
+  else
+    {
+      /* a child forked by a zygote may be ready before the zygote tells
+         us its pid, it is checked then */
+      if (child->pid > 0)
+        mark_child_ready (child);
+      else if (child->state == CHILD_STATE_STARTING)
+        child->ready_pid = pid;
+
+      g_dbus_method_invocation_return_value (data->invocation, NULL);
+    }
+
+  g_object_unref (data->invocation);
+  g_object_unref (data->self);
+  g_slice_free (NotifyReadyData, data);
+}
+
+static void
+on_supervisor_method_call (LiaApplication        *app,
+                           LiaBusType             bus_type,
+                           const gchar           *caller_id,
+                           const gchar           *object_path,
+                           const gchar           *interface_name,
+                           const gchar           *method_name,
+                           GVariant              *arguments,
+                           GDBusMethodInvocation *invocation,
+                           gpointer               user_data)
+{
+  LiaCore *self = LIA_CORE (app);
+  ChildProcess *child = NULL;
+  guint32 child_id;
+
+  /* GetChildren */
+  if (g_strcmp0 (method_name, "GetChildren") == 0)
+    {
+      GVariant *children;
+
+      children = get_children_info (self);
+      g_dbus_method_invocation_return_value (invocation,
+                                             g_variant_new_tuple (&children, 1));
+      return;
+    }
+  /* GetStartup */
+  else if (g_strcmp0 (method_name, "GetStartup") == 0)
+    {
+      GVariant *trace;
+
+      trace = lia_application_get_startup_trace (app);
+      g_dbus_method_invocation_return_value (invocation,
+                                             g_variant_new ("(x@a(sxx))",
+                                                            self->priv->time_to_ready,
+                                                            trace));
+      g_variant_unref (trace);
+      return;
+    }
+  /* GetEvictions */
+  else if (g_strcmp0 (method_name, "GetEvictions") == 0)
+    {
+      GVariant *info;
+
+      info = get_eviction_info (self);
+      g_dbus_method_invocation_return_value (invocation,
+                                             g_variant_new_tuple (&info, 1));
+      return;
+    }
+  /* GetBusStats */
+  else if (g_strcmp0 (method_name, "GetBusStats") == 0)
+    {
+      GVariant *info;
+
+      info = get_bus_stats_info (self);
+      g_dbus_method_invocation_return_value (invocation,
+                                             g_variant_new_tuple (&info, 1));
+      return;
+    }
+  /* GetBusStatsHistory */
+  else if (g_strcmp0 (method_name, "GetBusStatsHistory") == 0)
+    {
+      gint16 bus_type;
+      GVariant *samples;
+
+      g_variant_get (arguments, "(n)", &bus_type);
+      if (bus_type < LIA_BUS_PRIVATE || bus_type > LIA_BUS_PUBLIC)
+        {
+          g_dbus_method_invocation_return_error (invocation,
+                                                 G_IO_ERROR,
+                                                 G_IO_ERROR_INVALID_ARGUMENT,
+                                                 "Invalid bus type %d",
+                                                 bus_type);
+          return;
+        }
+
+      samples = get_bus_stats_history (self, bus_type);
+      g_dbus_method_invocation_return_value (invocation,
+                                             g_variant_new_tuple (&samples, 1));
+      return;
+    }
+  /* ActivateApp */
+  else if (g_strcmp0 (method_name, "ActivateApp") == 0)
+    {
+      const gchar *service_name;
+      GError *error = NULL;
+
+      g_variant_get (arguments, "(&s)", &service_name);
+
+      if (! activate_app (self, service_name, &error))
+        g_dbus_method_invocation_take_error (invocation, error);
+      else
+        g_dbus_method_invocation_return_value (invocation, NULL);
+      return;
+    }
+
+  g_variant_get_child (arguments, 0, "u", &child_id);
+  child = g_hash_table_lookup (self->priv->children,
+                               GUINT_TO_POINTER (child_id));
+  if (child == NULL)
+    {
+      g_dbus_method_invocation_return_error (invocation,
+                                             G_IO_ERROR,
+                                             G_IO_ERROR_NOT_FOUND,
+                                             "No child with id %u",
+                                             child_id);
+      return;
+    }
+
+  /* NotifyReady */
+  if (g_strcmp0 (method_name, "NotifyReady") == 0)
+    {
+      NotifyReadyData *data;
+
+      /* only the child itself can tell it is ready, which takes the
+         caller's pid */
+      data = g_slice_new (NotifyReadyData);
+      data->self = g_object_ref (self);
+      data->invocation = g_object_ref (invocation);
+      data->child_id = child_id;
+
+      lia_application_resolve_caller_identity (app,
+                                               bus_type,
+                                               caller_id,
+                                               NULL,
+                                               on_notify_ready_identity,
+                                               data);
+      return;
+    }
+  /* Restart */
+  else if (g_strcmp0 (method_name, "Restart") == 0)
+    {
+      if (child->pid > 0)
+        {
+          /* restarted by the child watch, right away */
+          child->restart_requested = TRUE;
+          kill (child->pid, SIGTERM);
+        }
+      else if (child->restart_src_id > 0)
+        {
+          g_source_remove (child->restart_src_id);
+          restart_child (child);
+        }
+      else
+        {
+          restart_child (child);
+        }
+    }
+  /* SetLimits */
+  else if (g_strcmp0 (method_name, "SetLimits") == 0)
+    {
+      guint32 cpu_weight;
+      guint64 memory_high;
+      guint64 memory_max;
+      GError *error = NULL;
+
+      g_variant_get (arguments,
+                     "(uutt)",
+                     NULL,
+                     &cpu_weight,
+                     &memory_high,
+                     &memory_max);
+
+      if (! set_child_limits (child, cpu_weight, memory_high, memory_max, &error))
+        {
+          g_dbus_method_invocation_take_error (invocation, error);
+          return;
+        }
+    }
+
+  g_dbus_method_invocation_return_value (invocation, NULL);
+}
+
+static void
+register_supervisor_object (LiaCore *self)
+{
+  GError *error = NULL;
+
+  if (lia_application_register_object (LIA_APPLICATION (self),
+                                       LIA_BUS_PRIVATE,
+                                       LIA_SUPERVISOR_OBJ_PATH,
+                                       supervisor_introspection_xml,
+                                       on_supervisor_method_call,
+                                       NULL,
+                                       NULL,
+                                       &error) == 0)
+    {
+      g_print ("Error registering supervisor object: %s\n", error->message);
+      g_error_free (error);
+    }
+}
@@ -0,0 +1,481 @@
+#define ZYGOTE_PYTHON_SCRIPT PKGDATADIR "/zygote/lia-zygote-python.py"
+
+/* Zygote */
+struct _Zygote
+{
+  LiaCore *self;
+  gchar *runtime;
+  gchar *address;
+  guint child_id;
+
+  GSocketService *service;
+  GSocketConnection *conn;
+  GDataInputStream *input;
+  GCancellable *cancellable;
+
+  GHashTable *requests;
+  GHashTable *children;
+  guint next_request_id;
+};
+
+static void read_zygote_message (Zygote *zygote);
+
+static void
+zygote_close_connection (Zygote *zygote)
+{
+  if (zygote->conn == NULL)
+    return;
+
+  g_cancellable_cancel (zygote->cancellable);
+  g_object_unref (zygote->cancellable);
+  zygote->cancellable = NULL;
+
+  g_io_stream_close (G_IO_STREAM (zygote->conn), NULL, NULL);
+  g_object_unref (zygote->conn);
+  zygote->conn = NULL;
+
+  g_object_unref (zygote->input);
+  zygote->input = NULL;
+}
+
+static void
+free_zygote (gpointer _data)
+{
+  Zygote *zygote = _data;
+
+  zygote_close_connection (zygote);
+
+  g_socket_service_stop (zygote->service);
+  g_object_unref (zygote->service);
+
+  g_hash_table_unref (zygote->requests);
+  g_hash_table_unref (zygote->children);
+
+  g_free (zygote->runtime);
+  g_free (zygote->address);
+
+  g_slice_free (Zygote, zygote);
+}
+
+static void
+zygote_forget_child (ChildProcess *child)
+{
+  Zygote *zygote = child->zygote;
+
+  if (child->pid > 0)
+    g_hash_table_remove (zygote->children, GINT_TO_POINTER (child->pid));
+  else
+    g_hash_table_remove (zygote->requests,
+                         GUINT_TO_POINTER (child->zygote_request_id));
+
+  child->zygote = NULL;
+}
+
+/* The zygote went away. Its children are re-parented to us, since we are
+   a child subreaper, so they are watched directly from now on. Launches
+   it didn't get to do are done by fork/exec instead. */
+static void
+zygote_lost (Zygote *zygote)
+{
+  GHashTableIter iter;
+  gpointer value;
+  GList *pending;
+  GList *node;
+
+  zygote_close_connection (zygote);
+
+  g_hash_table_iter_init (&iter, zygote->children);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      ChildProcess *child = value;
+
+      child->zygote = NULL;
+      child->child_watch_id = g_child_watch_add (child->pid,
+                                                 on_child_exited,
+                                                 child);
+    }
+  g_hash_table_remove_all (zygote->children);
+
+  pending = g_hash_table_get_values (zygote->requests);
+  g_hash_table_remove_all (zygote->requests);
+  for (node = pending; node != NULL; node = node->next)
+    {
+      ChildProcess *child = node->data;
+      GError *error = NULL;
+
+      child->zygote = NULL;
+      if (! spawn_child (child, &error))
+        {
+          g_print ("Failed to launch '%s': %s\n",
+                   child->command_line,
+                   error->message);
+          g_error_free (error);
+
+          handle_child_exit (child, 1 << 8);
+        }
+    }
+  g_list_free (pending);
+}
+
+static void
+handle_zygote_message (Zygote *zygote, const gchar *msg)
+{
+  JsonParser *parser;
+  JsonObject *obj;
+  ChildProcess *child;
+  GError *error = NULL;
+
+  parser = json_parser_new ();
+  if (! json_parser_load_from_data (parser, msg, -1, &error) ||
+      ! JSON_NODE_HOLDS_OBJECT (json_parser_get_root (parser)))
+    {
+      g_debug ("Invalid message from zygote: %s",
+               error != NULL ? error->message : msg);
+      g_clear_error (&error);
+      g_object_unref (parser);
+      return;
+    }
+
+  obj = json_node_get_object (json_parser_get_root (parser));
+
+  /* a launch request has been served */
+  if (json_object_has_member (obj, "id"))
+    {
+      guint id;
+
+      id = json_object_get_int_member (obj, "id");
+      child = g_hash_table_lookup (zygote->requests, GUINT_TO_POINTER (id));
+      if (child != NULL)
+        {
+          g_hash_table_steal (zygote->requests, GUINT_TO_POINTER (id));
+
+          child->pid = json_object_get_int_member (obj, "pid");
+          g_hash_table_insert (zygote->children,
+                               GINT_TO_POINTER (child->pid),
+                               child);
+
+          g_print ("Launched: '%s' with PID: %d (forked from %s zygote)\n",
+                   child->command_line,
+                   child->pid,
+                   zygote->runtime);
+
+          /* forked children start in the zygote's cgroup. They are moved
+             as soon as we know them, and are still running the zygote's
+             pre-loaded code by then */
+          if (cgroup_create_child (child))
+            cgroup_attach_child (child);
+
+          if (child->ready_pid == child->pid)
+            mark_child_ready (child);
+          child->ready_pid = 0;
+        }
+    }
+  /* a child forked by the zygote exited */
+  else if (json_object_has_member (obj, "exited"))
+    {
+      GPid pid;
+
+      pid = json_object_get_int_member (obj, "exited");
+      child = g_hash_table_lookup (zygote->children, GINT_TO_POINTER (pid));
+      if (child != NULL)
+        {
+          g_hash_table_steal (zygote->children, GINT_TO_POINTER (pid));
+          child->zygote = NULL;
+
+          handle_child_exit (child,
+                             json_object_get_int_member (obj, "status"));
+        }
+    }
+
+  g_object_unref (parser);
+}
+
+static void
+on_zygote_message_read (GObject      *obj,
+                        GAsyncResult *res,
+                        gpointer      user_data)
+{
+  Zygote *zygote = user_data;
+  gchar *line;
+  GError *error = NULL;
+
+  line = g_data_input_stream_read_line_finish (G_DATA_INPUT_STREAM (obj),
+                                               res,
+                                               NULL,
+                                               &error);
+  if (line == NULL)
+    {
+      if (error != NULL)
+        {
+          /* connection was closed on purpose */
+          if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            {
+              g_error_free (error);
+              return;
+            }
+
+          g_debug ("Error reading from %s zygote: %s",
+                   zygote->runtime,
+                   error->message);
+          g_error_free (error);
+        }
+
+      zygote_lost (zygote);
+      return;
+    }
+
+  handle_zygote_message (zygote, line);
+  g_free (line);
+
+  read_zygote_message (zygote);
+}
+
+static void
+read_zygote_message (Zygote *zygote)
+{
+  g_data_input_stream_read_line_async (zygote->input,
+                                       G_PRIORITY_DEFAULT,
+                                       zygote->cancellable,
+                                       on_zygote_message_read,
+                                       zygote);
+}
+
+static gboolean
+on_zygote_incoming (GSocketService    *service,
+                    GSocketConnection *conn,
+                    GObject           *source_object,
+                    gpointer           user_data)
+{
+  Zygote *zygote = user_data;
+  ChildProcess *child;
+  GCredentials *credentials;
+  gboolean is_zygote = FALSE;
+
+  /* the socket is abstract and any process of ours (including the apps
+     we launch) can connect to it, so only the zygote process we spawned
+     is accepted */
+  child = g_hash_table_lookup (zygote->self->priv->children,
+                               GUINT_TO_POINTER (zygote->child_id));
+  credentials = g_socket_get_credentials (g_socket_connection_get_socket (conn),
+                                          NULL);
+  if (credentials != NULL && child != NULL && child->pid > 0)
+    {
+      is_zygote =
+        g_credentials_get_unix_user (credentials, NULL) == getuid () &&
+        g_credentials_get_unix_pid (credentials, NULL) == child->pid;
+    }
+
+  if (credentials != NULL)
+    g_object_unref (credentials);
+
+  if (! is_zygote)
+    {
+      g_debug ("Rejected connection to %s zygote socket", zygote->runtime);
+      g_io_stream_close (G_IO_STREAM (conn), NULL, NULL);
+      return TRUE;
+    }
+
+  /* a restarted zygote replaces the previous one */
+  if (zygote->conn != NULL)
+    zygote_lost (zygote);
+
+  zygote->conn = g_object_ref (conn);
+  zygote->cancellable = g_cancellable_new ();
+  zygote->input =
+    g_data_input_stream_new (g_io_stream_get_input_stream (G_IO_STREAM (conn)));
+
+  g_print ("%s zygote connected\n", zygote->runtime);
+
+  read_zygote_message (zygote);
+
+  return TRUE;
+}
+
+static const gchar *
+get_child_runtime (gchar **argv)
+{
+  gchar *program;
+  const gchar *runtime = NULL;
+
+  if (argv[0] == NULL || argv[1] == NULL || argv[1][0] == '-')
+    return NULL;
+
+  program = g_path_get_basename (argv[0]);
+
+  if (g_strcmp0 (program, "python") == 0 ||
+      g_strcmp0 (program, "python3") == 0)
+    {
+      runtime = "python";
+    }
+
+  g_free (program);
+
+  return runtime;
+}
+
+static gboolean
+zygote_launch_child (ChildProcess  *child,
+                     gchar        **argv,
+                     gchar        **launch_env)
+{
+  const gchar *runtime;
+  Zygote *zygote;
+  JsonBuilder *builder;
+  JsonGenerator *generator;
+  JsonNode *root;
+  gchar *msg;
+  GOutputStream *output;
+  gboolean result;
+  GError *error = NULL;
+  gint i;
+
+  runtime = get_child_runtime (argv);
+  if (runtime == NULL)
+    return FALSE;
+
+  zygote = g_hash_table_lookup (child->self->priv->zygotes, runtime);
+  if (zygote == NULL || zygote->conn == NULL)
+    return FALSE;
+
+  builder = json_builder_new ();
+  json_builder_begin_object (builder);
+
+  json_builder_set_member_name (builder, "id");
+  json_builder_add_int_value (builder, zygote->next_request_id);
+
+  json_builder_set_member_name (builder, "argv");
+  json_builder_begin_array (builder);
+  for (i=0; argv[i] != NULL; i++)
+    json_builder_add_string_value (builder, argv[i]);
+  json_builder_end_array (builder);
+
+  json_builder_set_member_name (builder, "env");
+  json_builder_begin_array (builder);
+  for (i=0; launch_env[i] != NULL; i++)
+    json_builder_add_string_value (builder, launch_env[i]);
+  json_builder_end_array (builder);
+
+  json_builder_end_object (builder);
+
+  root = json_builder_get_root (builder);
+  generator = json_generator_new ();
+  json_generator_set_root (generator, root);
+  msg = json_generator_to_data (generator, NULL);
+  json_node_free (root);
+  g_object_unref (generator);
+  g_object_unref (builder);
+
+  /* messages are small and the peer is local, a blocking write is fine */
+  output = g_io_stream_get_output_stream (G_IO_STREAM (zygote->conn));
+  result = g_output_stream_write_all (output, msg, strlen (msg), NULL, NULL, &error) &&
+    g_output_stream_write_all (output, "\n", 1, NULL, NULL, &error);
+  g_free (msg);
+
+  if (! result)
+    {
+      g_debug ("Error writing to %s zygote: %s", runtime, error->message);
+      g_error_free (error);
+
+      zygote_lost (zygote);
+      return FALSE;
+    }
+
+  child->zygote = zygote;
+  child->zygote_request_id = zygote->next_request_id;
+  g_hash_table_insert (zygote->requests,
+                       GUINT_TO_POINTER (child->zygote_request_id),
+                       child);
+
+  zygote->next_request_id++;
+
+  return TRUE;
+}
+
+static void
+start_zygote (LiaCore     *self,
+              const gchar *runtime,
+              const gchar *command_line)
+{
+  Zygote *zygote;
+  GSocketAddress *address;
+  gchar *env[2];
+  GError *error = NULL;
+
+  zygote = g_slice_new0 (Zygote);
+  zygote->self = self;
+  zygote->runtime = g_strdup (runtime);
+  zygote->address =
+    g_strdup_printf ("lia-zygote-%s-%s-%d",
+                     lia_application_get_base_service_name (LIA_APPLICATION (self)),
+                     runtime,
+                     getpid ());
+  zygote->requests = g_hash_table_new (g_direct_hash, g_direct_equal);
+  zygote->children = g_hash_table_new (g_direct_hash, g_direct_equal);
+  zygote->next_request_id = 1;
+
+  zygote->service = g_socket_service_new ();
+  address = g_unix_socket_address_new_with_type (zygote->address,
+                                                 -1,
+                                                 G_UNIX_SOCKET_ADDRESS_ABSTRACT);
+  if (! g_socket_listener_add_address (G_SOCKET_LISTENER (zygote->service),
+                                       address,
+                                       G_SOCKET_TYPE_STREAM,
+                                       G_SOCKET_PROTOCOL_DEFAULT,
+                                       NULL,
+                                       NULL,
+                                       &error))
+    {
+      g_print ("Failed to start %s zygote: %s\n", runtime, error->message);
+      g_error_free (error);
+      g_object_unref (address);
+      free_zygote (zygote);
+      return;
+    }
+  g_object_unref (address);
+
+  g_signal_connect (zygote->service,
+                    "incoming",
+                    G_CALLBACK (on_zygote_incoming),
+                    zygote);
+  g_socket_service_start (zygote->service);
+
+  g_hash_table_insert (self->priv->zygotes, zygote->runtime, zygote);
+
+  env[0] = g_strdup_printf ("%s=%s", LIA_ENV_KEY_ZYGOTE_ADDR, zygote->address);
+  env[1] = NULL;
+
+  if (! launch_child (self,
+                      command_line,
+                      env,
+                      LIA_RESTART_ON_FAILURE,
+                      FALSE,
+                      &zygote->child_id,
+                      &error))
+    {
+      g_error_free (error);
+    }
+
+  g_free (env[0]);
+}
+
+static void
+start_zygotes (LiaCore *self)
+{
+  gchar *python;
+
+#ifdef PR_SET_CHILD_SUBREAPER
+  /* adopt children forked by a zygote if the zygote dies */
+  prctl (PR_SET_CHILD_SUBREAPER, 1);
+#endif
+
+  python = g_find_program_in_path ("python3");
+  if (python != NULL && g_file_test (ZYGOTE_PYTHON_SCRIPT, G_FILE_TEST_EXISTS))
+    {
+      gchar *command_line;
+
+      command_line = g_strdup_printf ("%s %s", python, ZYGOTE_PYTHON_SCRIPT);
+      start_zygote (self, "python", command_line);
+      g_free (command_line);
+    }
+  g_free (python);
+}
@@ -21,11 +21,24 @@
  */
 
 #include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include <glib/gstdio.h>
+#include <gio/gunixsocketaddress.h>
+#include <json-glib/json-glib.h>
 #include <evd.h>
 
 #include "lia-core.h"
+#include "lia-application-private.h"
 
 #include "lia-auth-service.h"
+#include "lia-bus-broker.h"
+#include "lia-webview.h"
 
 #define LIA_CORE_GET_PRIVATE(obj) (G_TYPE_INSTANCE_GET_PRIVATE ((obj),  \
                                    LIA_TYPE_CORE, \
@@ -40,8 +53,116 @@ struct _LiaCorePrivate
   EvdDBusDaemon *prot_bus_daemon;
   EvdDBusDaemon *pub_bus_daemon;
 
-  gchar **launch_env;
-  guint launch_env_count;
+  gboolean embedded_broker;
+  LiaBusBroker *bus_brokers[3];
+
+  guint public_bus_shards;
+  guint webview_bus_mux;
+  gchar **shard_addresses;
+  GPtrArray *shard_daemons;
+  GPtrArray *shard_brokers;
+
+  struct _BusMonitor *bus_monitors[3];
+  guint bus_monitor_src_id;
+
+  GDBusServer *peer_server;
+  GList *peer_conns;
+
+  GHashTable *config;
+  guint config_version;
+
+  gchar *service_name;
+
+  GHashTable *children;
+  guint next_child_id;
+
+  GHashTable *zygotes;
+
+  GHashTable *apps;
+  gdouble eviction_pressure;
+  guint eviction_idle_time;
+  guint eviction_src_id;
+  guint eviction_ops;
+  gint64 last_eviction_time;
+  guint evictions;
+  guint64 evicted_memory;
+
+  gchar *cgroup_base;
+  guint child_cpu_weight;
+  guint64 child_memory_high;
+  guint64 child_memory_max;
+
+  gint64 startup_time;
+  gint startup_io_priority;
+  GCancellable *startup_cancellable;
+  guint startup_started;
+  guint startup_done;
+  guint *startup_spans;
+  GError *startup_error;
+  GSimpleAsyncResult *init_result;
+  gboolean initialized;
+  gint64 time_to_ready;
+  guint webview_child_id;
+
+  gboolean embedded_webview;
+  LiaWebview *webview;
+};
+
+typedef struct
+{
+  LiaCore *self;
+  gint io_priority;
+  GCancellable *cancellable;
+  GAsyncReadyCallback callback;
+  gpointer user_data;
+  guint ops;
+  GError *error;
+} LoadEnvData;
+
+typedef struct
+{
+  LoadEnvData *data;
+  LiaBusType bus_type;
+  guint shard;
+  const gchar *config_file;
+  gchar *address;
+  EvdDBusDaemon *daemon;
+  LiaBusBroker *broker;
+  guint span_id;
+} BusSetupData;
+
+/* properties */
+enum
+{
+  PROP_0,
+  PROP_EMBEDDED_BROKER,
+  PROP_CHILD_CPU_WEIGHT,
+  PROP_CHILD_MEMORY_HIGH,
+  PROP_CHILD_MEMORY_MAX,
+  PROP_EVICTION_MEMORY_PRESSURE,
+  PROP_EVICTION_IDLE_TIME,
+  PROP_EMBEDDED_WEBVIEW,
+  PROP_PUBLIC_BUS_SHARDS,
+  PROP_WEBVIEW_BUS_MUX
+};
+
+/* Policies of the embedded broker. The names allowed are compiled in
+   from what the dbus-daemon-prot.conf and dbus-daemon-pub.conf
+   configurations allow, the limits and eavesdropping are loaded from
+   them when the bus is set up. The private bus is the session bus, so it
+   has none */
+static const gchar * const ANY_NAME[] = { "*", NULL };
+
+static const LiaBusBrokerPolicy BUS_BROKER_POLICIES[3] = {
+  { NULL, NULL, FALSE, 0, 0, 0, 0, 0, 0 },
+  { ANY_NAME, ANY_NAME, FALSE, 50000, 50000, 50000, 0, 0, 0 },
+  { ANY_NAME, ANY_NAME, FALSE, 50000, 50000, 50000, 0, 0, 0 }
+};
+
+static const gchar *BUS_CONFIG_FILES[3] = {
+  NULL,
+  SYS_CONF_DIR "/dbus-daemon-prot.conf",
+  SYS_CONF_DIR "/dbus-daemon-pub.conf"
 };
 
 static void     lia_core_class_init                (LiaCoreClass *class);
@@ -50,15 +171,48 @@ static void     lia_core_init                      (LiaCore *self);
 static void     finalize                           (GObject *obj);
 static void     dispose                            (GObject *obj);
 
+static void     set_property                       (GObject      *obj,
+                                                    guint         prop_id,
+                                                    const GValue *value,
+                                                    GParamSpec   *pspec);
+static void     get_property                       (GObject    *obj,
+                                                    guint       prop_id,
+                                                    GValue     *value,
+                                                    GParamSpec *pspec);
+
 static void     init_async                         (LiaApplication *lia_app,
                                                     GAsyncResult   *result,
                                                     gint            io_priority,
                                                     GCancellable   *cancellable);
 
-static gboolean load_env                           (LiaApplication  *self,
+static void     load_env_async                     (LiaApplication      *self,
+                                                    gint                 io_priority,
+                                                    GCancellable        *cancellable,
+                                                    GAsyncReadyCallback  callback,
+                                                    gpointer             user_data);
+static gboolean load_env_finish                    (LiaApplication  *self,
+                                                    GAsyncResult    *result,
                                                     gchar          **service_name,
                                                     GError         **error);
 
+static void     free_child_process                 (gpointer _data);
+static void     free_zygote                        (gpointer _data);
+static void     free_installed_app                 (gpointer _data);
+
+static struct _BusMonitor *
+                bus_monitor_new                    (LiaBusType bus_type);
+static void     free_bus_monitor                   (struct _BusMonitor *monitor);
+
+static void     register_objects                   (LiaApplication *app,
+                                                    LiaBusType      bus_type);
+
+static gchar ** build_launch_env                   (LiaCore  *self,
+                                                    gchar   **env,
+                                                    gchar   **extra_env);
+
+static void     export_core_objects_on_connection  (LiaCore         *self,
+                                                    GDBusConnection *conn);
+
 G_DEFINE_TYPE (LiaCore, lia_core, LIA_TYPE_APPLICATION);
 
 static void
@@ -70,10 +224,110 @@ lia_core_class_init (LiaCoreClass *class)
   obj_class = G_OBJECT_CLASS (class);
   obj_class->dispose = dispose;
   obj_class->finalize = finalize;
+  obj_class->get_property = get_property;
+  obj_class->set_property = set_property;
 
   lia_app_class = LIA_APPLICATION_CLASS (class);
   lia_app_class->init_async_finished = init_async;
-  lia_app_class->load_env = load_env;
+  lia_app_class->load_env_async = load_env_async;
+  lia_app_class->load_env_finish = load_env_finish;
+  lia_app_class->register_objects = register_objects;
+
+  /* properties */
+  g_object_class_install_property (obj_class,
+                                   PROP_EMBEDDED_BROKER,
+                                   g_param_spec_boolean ("embedded-broker",
+                                                         "Embedded broker",
+                                                         "Whether to route the protected and public buses in-process instead of spawning dbus-daemon instances",
+                                                         FALSE,
+                                                         G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY |
+                                                         G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (obj_class,
+                                   PROP_CHILD_CPU_WEIGHT,
+                                   g_param_spec_uint ("child-cpu-weight",
+                                                      "Child CPU weight",
+                                                      "The cgroup CPU weight (1-10000) of children launched from now on, or 0 for the default",
+                                                      0,
+                                                      10000,
+                                                      0,
+                                                      G_PARAM_READWRITE |
+                                                      G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (obj_class,
+                                   PROP_CHILD_MEMORY_HIGH,
+                                   g_param_spec_uint64 ("child-memory-high",
+                                                        "Child memory high",
+                                                        "The memory usage in bytes above which children launched from now on are throttled, or 0 for no limit",
+                                                        0,
+                                                        G_MAXUINT64,
+                                                        0,
+                                                        G_PARAM_READWRITE |
+                                                        G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (obj_class,
+                                   PROP_CHILD_MEMORY_MAX,
+                                   g_param_spec_uint64 ("child-memory-max",
+                                                        "Child memory max",
+                                                        "The memory usage in bytes above which children launched from now on are OOM-killed, or 0 for no limit",
+                                                        0,
+                                                        G_MAXUINT64,
+                                                        0,
+                                                        G_PARAM_READWRITE |
+                                                        G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (obj_class,
+                                   PROP_EVICTION_MEMORY_PRESSURE,
+                                   g_param_spec_double ("eviction-memory-pressure",
+                                                        "Eviction memory pressure",
+                                                        "The memory pressure (percentage of time stalled) above which idle installed applications are stopped, or 0 to never stop them",
+                                                        0.0,
+                                                        100.0,
+                                                        20.0,
+                                                        G_PARAM_READWRITE | G_PARAM_CONSTRUCT |
+                                                        G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (obj_class,
+                                   PROP_EVICTION_IDLE_TIME,
+                                   g_param_spec_uint ("eviction-idle-time",
+                                                      "Eviction idle time",
+                                                      "The time in seconds an installed application must have been idle to be stopped under memory pressure",
+                                                      0,
+                                                      G_MAXUINT,
+                                                      600,
+                                                      G_PARAM_READWRITE | G_PARAM_CONSTRUCT |
+                                                      G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (obj_class,
+                                   PROP_EMBEDDED_WEBVIEW,
+                                   g_param_spec_boolean ("embedded-webview",
+                                                         "Embedded webview",
+                                                         "Whether to run the Webview inside core's process instead of launching lia-webview",
+                                                         FALSE,
+                                                         G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY |
+                                                         G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (obj_class,
+                                   PROP_PUBLIC_BUS_SHARDS,
+                                   g_param_spec_uint ("public-bus-shards",
+                                                      "Public bus shards",
+                                                      "Number of bus daemons the public bus is split into, among which the Webview spreads web peers",
+                                                      1,
+                                                      64,
+                                                      1,
+                                                      G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY |
+                                                      G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (obj_class,
+                                   PROP_WEBVIEW_BUS_MUX,
+                                   g_param_spec_uint ("webview-bus-mux",
+                                                      "Webview bus mux",
+                                                      "Number of upstream bus connections the Webview multiplexes web peers onto, per bus, or 0 for a bus connection per web peer. Not used while an installed application declares PeerIdentity",
+                                                      0,
+                                                      64,
+                                                      0,
+                                                      G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY |
+                                                      G_PARAM_STATIC_STRINGS));
 
   g_type_class_add_private (obj_class, sizeof (LiaCorePrivate));
 }
@@ -92,21 +346,140 @@ lia_core_init (LiaCore *self)
   priv->prot_bus_daemon = NULL;
   priv->pub_bus_daemon = NULL;
 
-  priv->launch_env = g_new0 (char *, 16);
-  priv->launch_env_count = 0;
+  priv->embedded_broker = FALSE;
+  priv->bus_brokers[LIA_BUS_PRIVATE] = NULL;
+  priv->bus_brokers[LIA_BUS_PROTECTED] = NULL;
+  priv->bus_brokers[LIA_BUS_PUBLIC] = NULL;
+
+  priv->public_bus_shards = 1;
+  priv->webview_bus_mux = 0;
+  priv->shard_addresses = NULL;
+  priv->shard_daemons = g_ptr_array_new_with_free_func (g_object_unref);
+  priv->shard_brokers =
+    g_ptr_array_new_with_free_func ((GDestroyNotify) lia_bus_broker_free);
+
+  priv->bus_monitors[LIA_BUS_PRIVATE] = bus_monitor_new (LIA_BUS_PRIVATE);
+  priv->bus_monitors[LIA_BUS_PROTECTED] = bus_monitor_new (LIA_BUS_PROTECTED);
+  priv->bus_monitors[LIA_BUS_PUBLIC] = bus_monitor_new (LIA_BUS_PUBLIC);
+  priv->bus_monitor_src_id = 0;
+
+  priv->peer_server = NULL;
+  priv->peer_conns = NULL;
+
+  priv->config = g_hash_table_new_full (g_str_hash,
+                                        g_str_equal,
+                                        g_free,
+                                        (GDestroyNotify) g_variant_unref);
+  priv->config_version = 0;
+
+  priv->service_name = NULL;
+
+  priv->children = g_hash_table_new_full (g_direct_hash,
+                                          g_direct_equal,
+                                          NULL,
+                                          free_child_process);
+  priv->next_child_id = 1;
+
+  priv->zygotes = g_hash_table_new_full (g_str_hash,
+                                         g_str_equal,
+                                         NULL,
+                                         free_zygote);
+
+  priv->apps = g_hash_table_new_full (g_str_hash,
+                                      g_str_equal,
+                                      NULL,
+                                      free_installed_app);
+  priv->eviction_pressure = 0;
+  priv->eviction_idle_time = 0;
+  priv->eviction_src_id = 0;
+  priv->eviction_ops = 0;
+  priv->last_eviction_time = 0;
+  priv->evictions = 0;
+  priv->evicted_memory = 0;
+
+  priv->cgroup_base = NULL;
+  priv->child_cpu_weight = 0;
+  priv->child_memory_high = 0;
+  priv->child_memory_max = 0;
+
+  priv->startup_cancellable = NULL;
+  priv->startup_started = 0;
+  priv->startup_done = 0;
+  priv->startup_spans = NULL;
+  priv->startup_error = NULL;
+  priv->init_result = NULL;
+  priv->initialized = FALSE;
+  priv->time_to_ready = -1;
+  priv->webview_child_id = 0;
+
+  priv->embedded_webview = FALSE;
+  priv->webview = NULL;
 }
 
+static void     on_peer_connection_closed          (GDBusConnection *connection,
+                                                    gboolean         remote_peer_vanished,
+                                                    GError          *error,
+                                                    gpointer         user_data);
+
 static void
 dispose (GObject *obj)
 {
   LiaCore *self = LIA_CORE (obj);
 
+  if (self->priv->peer_server != NULL)
+    {
+      g_dbus_server_stop (self->priv->peer_server);
+      g_object_unref (self->priv->peer_server);
+      self->priv->peer_server = NULL;
+    }
+
+  while (self->priv->peer_conns != NULL)
+    {
+      GDBusConnection *conn = self->priv->peer_conns->data;
+
+      g_signal_handlers_disconnect_by_func (conn,
+                                            on_peer_connection_closed,
+                                            self);
+      g_object_unref (conn);
+      self->priv->peer_conns = g_list_delete_link (self->priv->peer_conns,
+                                                   self->priv->peer_conns);
+    }
+
+  if (self->priv->webview != NULL)
+    {
+      g_object_unref (self->priv->webview);
+      self->priv->webview = NULL;
+    }
+
   if (self->priv->auth_service != NULL)
     {
       g_object_unref (self->priv->auth_service);
       self->priv->auth_service = NULL;
     }
 
+  if (self->priv->startup_cancellable != NULL)
+    {
+      g_cancellable_cancel (self->priv->startup_cancellable);
+      g_object_unref (self->priv->startup_cancellable);
+      self->priv->startup_cancellable = NULL;
+    }
+
+  if (self->priv->eviction_src_id > 0)
+    {
+      g_source_remove (self->priv->eviction_src_id);
+      self->priv->eviction_src_id = 0;
+    }
+
+  if (self->priv->bus_monitor_src_id > 0)
+    {
+      g_source_remove (self->priv->bus_monitor_src_id);
+      self->priv->bus_monitor_src_id = 0;
+    }
+
+  /* children go first, they may still be tracked by a zygote */
+  g_hash_table_remove_all (self->priv->children);
+  g_hash_table_remove_all (self->priv->zygotes);
+
   G_OBJECT_CLASS (lia_core_parent_class)->dispose (obj);
 }
 
@@ -114,6 +487,7 @@ static void
 finalize (GObject *obj)
 {
   LiaCore *self = LIA_CORE (obj);
+  gint i;
 
   if (self->priv->priv_bus_daemon != NULL)
     g_object_unref (self->priv->priv_bus_daemon);
@@ -124,11 +498,142 @@ finalize (GObject *obj)
   if (self->priv->pub_bus_daemon != NULL)
     g_object_unref (self->priv->pub_bus_daemon);
 
-  g_strfreev (self->priv->launch_env);
+  for (i=0; i<3; i++)
+    {
+      if (self->priv->bus_brokers[i] != NULL)
+        lia_bus_broker_free (self->priv->bus_brokers[i]);
+
+      free_bus_monitor (self->priv->bus_monitors[i]);
+    }
+
+  g_ptr_array_unref (self->priv->shard_daemons);
+  g_ptr_array_unref (self->priv->shard_brokers);
+  g_strfreev (self->priv->shard_addresses);
+
+  g_hash_table_unref (self->priv->config);
+  g_free (self->priv->service_name);
+
+  g_hash_table_unref (self->priv->children);
+  g_hash_table_unref (self->priv->zygotes);
+  g_hash_table_unref (self->priv->apps);
+
+  g_free (self->priv->cgroup_base);
+
+  g_free (self->priv->startup_spans);
+  if (self->priv->startup_error != NULL)
+    g_error_free (self->priv->startup_error);
 
   G_OBJECT_CLASS (lia_core_parent_class)->finalize (obj);
 }
 
+static void
+set_property (GObject      *obj,
+              guint         prop_id,
+              const GValue *value,
+              GParamSpec   *pspec)
+{
+  LiaCore *self;
+
+  self = LIA_CORE (obj);
+
+  switch (prop_id)
+    {
+    case PROP_EMBEDDED_BROKER:
+      self->priv->embedded_broker = g_value_get_boolean (value);
+      break;
+
+    case PROP_CHILD_CPU_WEIGHT:
+      self->priv->child_cpu_weight = g_value_get_uint (value);
+      break;
+
+    case PROP_CHILD_MEMORY_HIGH:
+      self->priv->child_memory_high = g_value_get_uint64 (value);
+      break;
+
+    case PROP_CHILD_MEMORY_MAX:
+      self->priv->child_memory_max = g_value_get_uint64 (value);
+      break;
+
+    case PROP_EVICTION_MEMORY_PRESSURE:
+      self->priv->eviction_pressure = g_value_get_double (value);
+      break;
+
+    case PROP_EVICTION_IDLE_TIME:
+      self->priv->eviction_idle_time = g_value_get_uint (value);
+      break;
+
+    case PROP_EMBEDDED_WEBVIEW:
+      self->priv->embedded_webview = g_value_get_boolean (value);
+      break;
+
+    case PROP_PUBLIC_BUS_SHARDS:
+      self->priv->public_bus_shards = g_value_get_uint (value);
+      break;
+
+    case PROP_WEBVIEW_BUS_MUX:
+      self->priv->webview_bus_mux = g_value_get_uint (value);
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
+      break;
+    }
+}
+
+static void
+get_property (GObject    *obj,
+              guint       prop_id,
+              GValue     *value,
+              GParamSpec *pspec)
+{
+  LiaCore *self;
+
+  self = LIA_CORE (obj);
+
+  switch (prop_id)
+    {
+    case PROP_EMBEDDED_BROKER:
+      g_value_set_boolean (value, self->priv->embedded_broker);
+      break;
+
+    case PROP_CHILD_CPU_WEIGHT:
+      g_value_set_uint (value, self->priv->child_cpu_weight);
+      break;
+
+    case PROP_CHILD_MEMORY_HIGH:
+      g_value_set_uint64 (value, self->priv->child_memory_high);
+      break;
+
+    case PROP_CHILD_MEMORY_MAX:
+      g_value_set_uint64 (value, self->priv->child_memory_max);
+      break;
+
+    case PROP_EVICTION_MEMORY_PRESSURE:
+      g_value_set_double (value, self->priv->eviction_pressure);
+      break;
+
+    case PROP_EVICTION_IDLE_TIME:
+      g_value_set_uint (value, self->priv->eviction_idle_time);
+      break;
+
+    case PROP_EMBEDDED_WEBVIEW:
+      g_value_set_boolean (value, self->priv->embedded_webview);
+      break;
+
+    case PROP_PUBLIC_BUS_SHARDS:
+      g_value_set_uint (value, self->priv->public_bus_shards);
+      break;
+
+    case PROP_WEBVIEW_BUS_MUX:
+      g_value_set_uint (value, self->priv->webview_bus_mux);
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
+      break;
+    }
+}
+
 static void
 abort_init_async (LiaCore            *self,
                   GSimpleAsyncResult *res,
@@ -143,208 +648,500 @@ abort_init_async (LiaCore            *self,
   g_object_unref (self);
 }
 
+/* Children only get the base service name in their environment. The rest
+   of the configuration is obtained from core's discovery endpoint, which
+   is found through it */
 static gchar **
-build_launch_env (LiaCore *self, gchar **env)
+build_launch_env (LiaCore *self, gchar **env, gchar **extra_env)
 {
-  gchar **launch_env = NULL;
-  gint i, c;
-  guint launch_env_len = 0;
+  GPtrArray *launch_env;
+  gint i;
 
-  launch_env_len = self->priv->launch_env_count;
+  launch_env = g_ptr_array_new ();
 
-  if (env != NULL)
-    launch_env_len += g_strv_length (env);
+  for (i=0; env != NULL && env[i] != NULL; i++)
+    g_ptr_array_add (launch_env, g_strdup (env[i]));
 
-  launch_env = g_new0 (gchar *, launch_env_len + 1);
+  for (i=0; extra_env != NULL && extra_env[i] != NULL; i++)
+    g_ptr_array_add (launch_env, g_strdup (extra_env[i]));
 
-  c = 0;
+  g_ptr_array_add (launch_env,
+                   g_strdup_printf ("%s=%s",
+                                    LIA_ENV_KEY_BASE_SERVICE_NAME,
+                                    lia_application_get_base_service_name (LIA_APPLICATION (self))));
+  g_ptr_array_add (launch_env, NULL);
 
-  if (env != NULL)
-    {
-      i = 0;
-      while (env[i] != NULL)
-        {
-          launch_env[c] = g_strdup (env[i]);
-          c++;
-          i++;
-        }
-    }
+  return (gchar **) g_ptr_array_free (launch_env, FALSE);
+}
+
+#include "lia-core-discovery.c"
+#include "lia-core-supervisor.c"
+#include "lia-core-zygote.c"
+#include "lia-core-cgroup.c"
+#include "lia-core-apps.c"
+#include "lia-core-eviction.c"
+#include "lia-core-bus-monitor.c"
+#include "lia-core-startup.c"
+
+static void
+export_core_objects_on_connection (LiaCore *self, GDBusConnection *conn)
+{
+  GError *error = NULL;
+
+  if (self->priv->auth_service == NULL)
+    return;
 
-  i = 0;
-  while (self->priv->launch_env[i] != NULL)
+  if (! lia_auth_service_export_on_connection (self->priv->auth_service,
+                                               conn,
+                                               &error))
     {
-      launch_env[c] = g_strdup (self->priv->launch_env[i]);
-      c++;
-      i++;
+      g_print ("Error exporting auth service on peer connection: %s\n",
+               error->message);
+      g_error_free (error);
     }
-
-  return launch_env;
 }
 
 static void
-launch_env_add_entry (LiaCore *self, const gchar *key, const gchar *value)
+on_peer_connection_closed (GDBusConnection *connection,
+                           gboolean         remote_peer_vanished,
+                           GError          *error,
+                           gpointer         user_data)
 {
-  self->priv->launch_env[self->priv->launch_env_count] =
-    g_strdup_printf ("%s=%s", key, value);
+  LiaCore *self = LIA_CORE (user_data);
 
-  self->priv->launch_env_count++;
+  g_signal_handlers_disconnect_by_func (connection,
+                                        on_peer_connection_closed,
+                                        self);
+
+  self->priv->peer_conns = g_list_remove (self->priv->peer_conns, connection);
+  g_object_unref (connection);
 }
 
 static gboolean
-write_env_file (LiaCore *self, GError **error)
+on_new_peer_connection (GDBusServer     *server,
+                        GDBusConnection *connection,
+                        gpointer         user_data)
 {
-  gchar **env;
-  gchar *content;
-  gboolean result = TRUE;
-  gchar *filename;
+  LiaCore *self = LIA_CORE (user_data);
+
+  g_object_ref (connection);
+  self->priv->peer_conns = g_list_prepend (self->priv->peer_conns, connection);
 
-  env = build_launch_env (self, NULL);
+  g_signal_connect (connection,
+                    "closed",
+                    G_CALLBACK (on_peer_connection_closed),
+                    self);
 
-  content = g_strjoinv ("\n", env);
+  /* discovery is served right away, other core objects once they exist */
+  register_discovery_object (self, connection);
+  export_core_objects_on_connection (self, connection);
 
-  filename =
-    g_strdup_printf ("/tmp/%s.env",
+  return TRUE;
+}
+
+static gboolean
+on_authorize_peer (GDBusAuthObserver *observer,
+                   GIOStream         *stream,
+                   GCredentials      *credentials,
+                   gpointer           user_data)
+{
+  /* only processes of the same user that runs core are allowed to
+     connect directly */
+  return credentials != NULL &&
+    g_credentials_get_unix_user (credentials, NULL) == getuid ();
+}
+
+static gboolean
+start_peer_server (LiaCore *self, GError **error)
+{
+  GDBusAuthObserver *observer;
+  gchar *guid;
+  gchar *address;
+
+  observer = g_dbus_auth_observer_new ();
+  g_signal_connect (observer,
+                    "authorize-authenticated-peer",
+                    G_CALLBACK (on_authorize_peer),
+                    self);
+
+  guid = g_dbus_generate_guid ();
+
+  /* the address only depends on the base service name, so applications
+     can find core without being told where it is */
+  address =
+    g_strdup_printf (LIA_DISCOVERY_ADDRESS_FORMAT,
                      lia_application_get_base_service_name (LIA_APPLICATION (self)));
 
-  if (! g_file_set_contents (filename,
-                             content,
-                             -1,
-                             error))
+  self->priv->peer_server = g_dbus_server_new_sync (address,
+                                                    G_DBUS_SERVER_FLAGS_NONE,
+                                                    guid,
+                                                    observer,
+                                                    NULL,
+                                                    error);
+  g_free (guid);
+  g_object_unref (observer);
+
+  if (self->priv->peer_server == NULL)
     {
-      result = FALSE;
+      g_free (address);
+      return FALSE;
     }
 
-  g_free (filename);
-  g_free (content);
-  g_strfreev (env);
+  g_signal_connect (self->priv->peer_server,
+                    "new-connection",
+                    G_CALLBACK (on_new_peer_connection),
+                    self);
+
+  g_dbus_server_start (self->priv->peer_server);
 
-  return result;
+  g_print ("Core discovery address: %s\n", address);
+  g_free (address);
+
+  return TRUE;
 }
 
 static void
-on_auth_service_created (GObject      *obj,
-                         GAsyncResult *res,
-                         gpointer      user_data)
+free_load_env_data (LoadEnvData *data)
 {
-  GSimpleAsyncResult *result = G_SIMPLE_ASYNC_RESULT (user_data);
-  LiaCore *self;
+  g_object_unref (data->self);
+
+  if (data->cancellable != NULL)
+    g_object_unref (data->cancellable);
+
+  if (data->error != NULL)
+    g_error_free (data->error);
+
+
+  g_slice_free (LoadEnvData, data);
+}
+
+static void
+finish_load_env (LoadEnvData *data)
+{
+  GSimpleAsyncResult *res;
+
+  /* core's configuration is already applied as it was set, see
+     config_set() */
+  res = g_simple_async_result_new (G_OBJECT (data->self),
+                                   data->callback,
+                                   data->user_data,
+                                   load_env_async);
+
+  if (data->error != NULL)
+    {
+      g_simple_async_result_take_error (res, data->error);
+      data->error = NULL;
+    }
+
+  g_simple_async_result_complete_in_idle (res);
+  g_object_unref (res);
+
+  free_load_env_data (data);
+}
+
+static void
+setup_bus_thread (GSimpleAsyncResult *res,
+                  GObject            *obj,
+                  GCancellable       *cancellable)
+{
+  BusSetupData *bus_data;
   GError *error = NULL;
 
-  self = LIA_CORE (g_async_result_get_source_object (G_ASYNC_RESULT (result)));
+  bus_data = g_simple_async_result_get_op_res_gpointer (res);
 
-  self->priv->auth_service =
-    LIA_AUTH_SERVICE (g_async_initable_new_finish (G_ASYNC_INITABLE (obj),
-                                                   res,
-                                                   &error));
-  if (self->priv->auth_service == NULL)
+  if (bus_data->config_file == NULL)
     {
-      abort_init_async (self, result, error);
+      /* @TODO: by now lets just use user's session bus */
+      bus_data->address =
+        g_dbus_address_get_for_bus_sync (G_BUS_TYPE_SESSION,
+                                         cancellable,
+                                         &error);
     }
   else
     {
-      /* launch webview service */
-      if (! lia_core_launch (self,
-                             SYS_PROG_DIR "/lia-webview",
-                             NULL,
-                             &error))
-        {
-          abort_init_async (self, result, error);
-        }
+      bus_data->daemon = evd_dbus_daemon_new (bus_data->config_file, &error);
+      if (bus_data->daemon != NULL)
+        g_object_get (bus_data->daemon,
+                      "address", &bus_data->address,
+                      NULL);
+    }
+
+  if (error != NULL)
+    g_simple_async_result_take_error (res, error);
+}
+
+static void
+on_bus_setup (GObject      *obj,
+              GAsyncResult *res,
+              gpointer      user_data)
+{
+  BusSetupData *bus_data = user_data;
+  LoadEnvData *data = bus_data->data;
+  LiaCore *self = data->self;
+  GError *error = NULL;
+
+  static const gchar *CONFIG_KEYS[3] = {
+    LIA_CONFIG_KEY_PRIVATE_BUS_ADDR,
+    LIA_CONFIG_KEY_PROTECTED_BUS_ADDR,
+    LIA_CONFIG_KEY_PUBLIC_BUS_ADDR
+  };
+  static const gchar *BUS_LABELS[3] = {"Private", "Protected", "Public"};
+
+  lia_application_trace_end (LIA_APPLICATION (self), bus_data->span_id);
+
+  if (g_simple_async_result_propagate_error (G_SIMPLE_ASYNC_RESULT (res),
+                                             &error))
+    {
+      if (data->error == NULL)
+        data->error = error;
       else
+        g_error_free (error);
+    }
+  else if (bus_data->shard > 0)
+    {
+      if (bus_data->daemon != NULL)
+        g_ptr_array_add (self->priv->shard_daemons, bus_data->daemon);
+      if (bus_data->broker != NULL)
+        g_ptr_array_add (self->priv->shard_brokers, bus_data->broker);
+
+      g_print ("Public bus shard %u address: %s\n",
+               bus_data->shard,
+               bus_data->address);
+
+      self->priv->shard_addresses[bus_data->shard] = bus_data->address;
+      bus_data->address = NULL;
+    }
+  else
+    {
+      if (bus_data->bus_type == LIA_BUS_PROTECTED)
+        self->priv->prot_bus_daemon = bus_data->daemon;
+      else if (bus_data->bus_type == LIA_BUS_PUBLIC)
+        self->priv->pub_bus_daemon = bus_data->daemon;
+
+      self->priv->bus_brokers[bus_data->bus_type] = bus_data->broker;
+
+      g_print ("%s bus address: %s\n",
+               BUS_LABELS[bus_data->bus_type],
+               bus_data->address);
+
+      if (bus_data->bus_type == LIA_BUS_PUBLIC &&
+          self->priv->shard_addresses != NULL)
         {
-          g_simple_async_result_complete (result);
-          g_object_unref (result);
-          g_object_unref (self);
+          self->priv->shard_addresses[0] = g_strdup (bus_data->address);
         }
+
+      /* publishing the address also starts connecting core to this bus,
+         without waiting for the others */
+      config_set (self,
+                  CONFIG_KEYS[bus_data->bus_type],
+                  g_variant_new_string (bus_data->address));
     }
 
-  g_object_unref (self);
+  g_free (bus_data->address);
+  g_slice_free (BusSetupData, bus_data);
+
+  data->ops--;
+  if (data->ops > 0)
+    return;
+
+  /* the shards are published all at once, so that the Webview never
+     spreads peers over a partial ring */
+  if (data->error == NULL && self->priv->shard_addresses != NULL)
+    config_set (self,
+                LIA_CONFIG_KEY_PUBLIC_BUS_SHARDS,
+                g_variant_new_strv ((const gchar * const *) self->priv->shard_addresses,
+                                    -1));
+
+  /* core steps that need the bus addresses, like launching the Webview,
+     start right away */
+  if (data->error == NULL)
+    startup_step_done (self, STARTUP_STEP_BUS_ADDRESSES);
+
+  finish_load_env (data);
 }
 
-static gboolean
-load_env (LiaApplication *app, gchar **service_name, GError **error)
+static void
+setup_bus (LoadEnvData *data,
+           LiaBusType   bus_type,
+           guint        shard,
+           const gchar *config_file)
+{
+  static const gchar *SPAN_NAMES[3] = {
+    "resolve-private-bus",
+    "start-protected-bus-daemon",
+    "start-public-bus-daemon"
+  };
+
+  BusSetupData *bus_data;
+  GSimpleAsyncResult *res;
+
+  bus_data = g_slice_new0 (BusSetupData);
+  bus_data->data = data;
+  bus_data->bus_type = bus_type;
+  bus_data->shard = shard;
+  bus_data->config_file = config_file;
+  bus_data->span_id = lia_application_trace_begin (LIA_APPLICATION (data->self),
+                                                   shard > 0 ?
+                                                   "start-public-bus-shard" :
+                                                   SPAN_NAMES[bus_type]);
+
+  res = g_simple_async_result_new (G_OBJECT (data->self),
+                                   on_bus_setup,
+                                   bus_data,
+                                   setup_bus);
+  g_simple_async_result_set_op_res_gpointer (res, bus_data, NULL);
+
+  data->ops++;
+
+  if (config_file != NULL && data->self->priv->embedded_broker)
+    {
+      LiaBusBrokerPolicy policy;
+      GError *error = NULL;
+
+      /* the embedded broker is listening as soon as it is created, there
+         is no process to wait for. A configuration it can't honour fails
+         the setup */
+      policy = BUS_BROKER_POLICIES[bus_type];
+      if (lia_bus_broker_load_policy (&policy, config_file, &error))
+        bus_data->broker = lia_bus_broker_new (&policy, &error);
+
+      if (bus_data->broker == NULL)
+        g_simple_async_result_take_error (res, error);
+      else
+        bus_data->address =
+          g_strdup (lia_bus_broker_get_address (bus_data->broker));
+
+      g_simple_async_result_complete_in_idle (res);
+    }
+  else
+    {
+      g_simple_async_result_run_in_thread (res,
+                                           setup_bus_thread,
+                                           data->io_priority,
+                                           data->cancellable);
+    }
+  g_object_unref (res);
+}
+
+static void
+load_env_async (LiaApplication      *app,
+                gint                 io_priority,
+                GCancellable        *cancellable,
+                GAsyncReadyCallback  callback,
+                gpointer             user_data)
 {
   LiaCore *self = LIA_CORE (app);
   const gchar *base_service_name;
   gchar *webview_service_name;
-  gchar *priv_bus_addr;
-  gchar *prot_bus_addr;
-  gchar *pub_bus_addr;
+  LoadEnvData *data;
+  GError *error = NULL;
+  guint span_id;
+  guint i;
 
   base_service_name = lia_application_get_base_service_name (app);
-  launch_env_add_entry (self, LIA_ENV_KEY_BASE_SERVICE_NAME, base_service_name);
-
-  if (*service_name != NULL)
-    g_free (*service_name);
-
-  *service_name = g_strdup_printf ("%s.%s",
-                                   base_service_name,
-                                   LIA_CORE_SERVICE_NAME_SUFFIX);
-  g_setenv (LIA_ENV_KEY_CORE_SERVICE_NAME, *service_name, TRUE);
-  launch_env_add_entry (self, LIA_ENV_KEY_CORE_SERVICE_NAME, *service_name);
+  config_set (self,
+              LIA_CONFIG_KEY_BASE_SERVICE_NAME,
+              g_variant_new_string (base_service_name));
+
+  g_free (self->priv->service_name);
+  self->priv->service_name = g_strdup_printf ("%s.%s",
+                                              base_service_name,
+                                              LIA_CORE_SERVICE_NAME_SUFFIX);
+  config_set (self,
+              LIA_CONFIG_KEY_CORE_SERVICE_NAME,
+              g_variant_new_string (self->priv->service_name));
 
   webview_service_name = g_strdup_printf ("%s.%s",
                                           base_service_name,
                                           LIA_WEBVIEW_SERVICE_NAME_SUFFIX);
-  g_setenv (LIA_ENV_KEY_WEBVIEW_SERVICE_NAME, webview_service_name, TRUE);
-  launch_env_add_entry (self,
-                        LIA_ENV_KEY_WEBVIEW_SERVICE_NAME,
-                        webview_service_name);
+  config_set (self,
+              LIA_CONFIG_KEY_WEBVIEW_SERVICE_NAME,
+              g_variant_new_string (webview_service_name));
   g_free (webview_service_name);
 
-  /* private bus */
-  /* @TODO: by now lets just use user's session bus */
-  priv_bus_addr =
-    g_dbus_address_get_for_bus_sync (G_BUS_TYPE_SESSION,
-                                     NULL,
-                                     error);
-  if (priv_bus_addr == NULL)
-    return FALSE;
-
-  g_setenv (LIA_ENV_KEY_PRIVATE_BUS_ADDR, priv_bus_addr, TRUE);
-  launch_env_add_entry (self, LIA_ENV_KEY_PRIVATE_BUS_ADDR, priv_bus_addr);
-
-  g_print ("Private bus address: %s\n", priv_bus_addr);
-  g_free (priv_bus_addr);
-
-  /* protected bus */
-  self->priv->prot_bus_daemon =
-    evd_dbus_daemon_new (SYS_CONF_DIR "/dbus-daemon-prot.conf", error);
-  if (self->priv->prot_bus_daemon == NULL)
-    return FALSE;
-  else
-    g_object_get (self->priv->prot_bus_daemon,
-                  "address", &prot_bus_addr,
-                  NULL);
+  /* children get a cgroup of their own from the very first one */
+  span_id = lia_application_trace_begin (app, "setup-cgroups");
+  setup_cgroups (self);
+  lia_application_trace_end (app, span_id);
 
-  g_setenv (LIA_ENV_KEY_PROTECTED_BUS_ADDR, prot_bus_addr, TRUE);
-  launch_env_add_entry (self, LIA_ENV_KEY_PROTECTED_BUS_ADDR, prot_bus_addr);
+  /* start the steps that don't depend on the buses */
+  startup_begin (self, io_priority, cancellable);
 
-  g_print ("Protected bus address: %s\n", prot_bus_addr);
-  g_free (prot_bus_addr);
+  /* discovery endpoint, also used for direct calls to core-only
+     interfaces */
+  span_id = lia_application_trace_begin (app, "start-peer-server");
+  if (! start_peer_server (self, &error))
+    {
+      g_simple_async_report_take_gerror_in_idle (G_OBJECT (self),
+                                                 callback,
+                                                 user_data,
+                                                 error);
+      return;
+    }
+  lia_application_trace_end (app, span_id);
+
+  data = g_slice_new0 (LoadEnvData);
+  data->self = self;
+  g_object_ref (self);
+  data->io_priority = io_priority;
+  if (cancellable != NULL)
+    data->cancellable = g_object_ref (cancellable);
+  data->callback = callback;
+  data->user_data = user_data;
+
+  /* the public bus shard addresses are collected as they come */
+  g_strfreev (self->priv->shard_addresses);
+  self->priv->shard_addresses = NULL;
+  if (self->priv->public_bus_shards > 1)
+    self->priv->shard_addresses =
+      g_new0 (gchar *, self->priv->public_bus_shards + 1);
+
+  /* the three buses are independent from each other, so resolve the
+     private bus address and start the protected and public bus daemons
+     in parallel */
+  setup_bus (data, LIA_BUS_PRIVATE, 0, BUS_CONFIG_FILES[LIA_BUS_PRIVATE]);
+  setup_bus (data, LIA_BUS_PROTECTED, 0, BUS_CONFIG_FILES[LIA_BUS_PROTECTED]);
+  setup_bus (data, LIA_BUS_PUBLIC, 0, BUS_CONFIG_FILES[LIA_BUS_PUBLIC]);
+
+  /* the rest of the public bus shards, with the same configuration and
+     in the same mode as the public bus */
+  for (i=1; i<self->priv->public_bus_shards; i++)
+    setup_bus (data, LIA_BUS_PUBLIC, i, BUS_CONFIG_FILES[LIA_BUS_PUBLIC]);
+}
 
-  /* public bus */
-  self->priv->pub_bus_daemon =
-    evd_dbus_daemon_new (SYS_CONF_DIR "/dbus-daemon-pub.conf", error);
-  if (self->priv->pub_bus_daemon == NULL)
-    return FALSE;
-  else
-    g_object_get (self->priv->pub_bus_daemon,
-                  "address", &pub_bus_addr,
-                  NULL);
+static gboolean
+load_env_finish (LiaApplication  *app,
+                 GAsyncResult    *result,
+                 gchar          **service_name,
+                 GError         **error)
+{
+  LiaCore *self = LIA_CORE (app);
+
+  if (! LIA_APPLICATION_CLASS (lia_core_parent_class)->load_env_finish (app,
+                                                                         result,
+                                                                         service_name,
+                                                                         error))
+    {
+      return FALSE;
+    }
 
-  g_setenv (LIA_ENV_KEY_PUBLIC_BUS_ADDR, pub_bus_addr, TRUE);
-  launch_env_add_entry (self, LIA_ENV_KEY_PUBLIC_BUS_ADDR, pub_bus_addr);
+  g_free (*service_name);
+  *service_name = g_strdup (self->priv->service_name);
 
-  g_print ("Public bus address: %s\n", pub_bus_addr);
-  g_free (pub_bus_addr);
+  return TRUE;
+}
+
+static void
+register_objects (LiaApplication *app, LiaBusType bus_type)
+{
+  if (bus_type == LIA_BUS_PRIVATE)
+    register_supervisor_object (LIA_CORE (app));
 
-  if (! write_env_file (self, error))
-    return FALSE;
+  LIA_APPLICATION_CLASS (lia_core_parent_class)->register_objects (app,
+                                                                   bus_type);
 
-  return LIA_APPLICATION_CLASS (lia_core_parent_class)->load_env (app,
-                                                                  service_name,
-                                                                  error);
+  if (bus_type == LIA_BUS_PRIVATE)
+    startup_step_done (LIA_CORE (app), STARTUP_STEP_PRIVATE_BUS);
 }
 
 static void
@@ -353,61 +1150,177 @@ init_async (LiaApplication *lia_app,
             gint            io_priority,
             GCancellable   *cancellable)
 {
-  GDBusConnection *priv_bus_conn;
-
-  priv_bus_conn = lia_application_get_bus (lia_app, LIA_BUS_PRIVATE);
-
-  /* create auth service object */
-  g_object_ref (lia_app);
-  g_async_initable_new_async (LIA_TYPE_AUTH_SERVICE,
-                              G_PRIORITY_DEFAULT,
-                              NULL,
-                              on_auth_service_created,
-                              result,
-                              "dbus-connection", priv_bus_conn,
-                              NULL);
+  LiaCore *self = LIA_CORE (lia_app);
+
+  g_object_ref (self);
+
+  if (self->priv->startup_error != NULL)
+    {
+      GError *error = self->priv->startup_error;
+
+      self->priv->startup_error = NULL;
+      abort_init_async (self, G_SIMPLE_ASYNC_RESULT (result), error);
+      return;
+    }
+
+  /* buses are connected, now wait for the startup steps that core can't
+     work without. They were started as soon as their dependencies were
+     met, so most likely they are done already */
+  self->priv->init_result = G_SIMPLE_ASYNC_RESULT (result);
+  startup_advance (self);
 }
 
 /* public methods */
 
+/**
+ * lia_core_launch:
+ *
+ * Launches @command_line as a supervised child with the
+ * %LIA_RESTART_ON_FAILURE policy. See lia_core_launch_full().
+ **/
 gboolean
 lia_core_launch (LiaCore      *self,
                  const gchar  *command_line,
                  gchar       **env,
                  GError      **error)
 {
-  gboolean result = TRUE;
-  gint argc;
-  gchar **argv;
-  GPid pid;
-  gchar **launch_env = NULL;
+  return lia_core_launch_full (self,
+                               command_line,
+                               env,
+                               LIA_RESTART_ON_FAILURE,
+                               NULL,
+                               error);
+}
 
+/**
+ * lia_core_launch_full:
+ * @env: (allow-none): Environment entries to add to the child's
+ * @restart_policy: When to restart the child after it exits
+ * @child_id: (out) (allow-none): Return location for the child's id
+ *
+ * Launches @command_line with Lia's launch environment, and supervises
+ * the resulting process. The child is restarted according to
+ * @restart_policy, with an exponential backoff that starts at 100ms
+ * while it keeps exiting shortly after being launched. Its state, CPU
+ * time and memory usage are available on the private bus through the
+ * supervisor object.
+ *
+ * Python applications (e.g 'python3 /path/to/app.py') are forked from a
+ * pre-initialized zygote process when one is running, which saves the
+ * interpreter start-up and the loading of Lia's typelibs.
+ *
+ * Returns: %TRUE if the child was launched, %FALSE otherwise.
+ **/
+gboolean
+lia_core_launch_full (LiaCore           *self,
+                      const gchar       *command_line,
+                      gchar            **env,
+                      LiaRestartPolicy   restart_policy,
+                      guint             *child_id,
+                      GError           **error)
+{
   g_return_val_if_fail (LIA_IS_CORE (self), FALSE);
+  g_return_val_if_fail (command_line != NULL, FALSE);
+
+  return launch_child (self,
+                       command_line,
+                       env,
+                       restart_policy,
+                       TRUE,
+                       child_id,
+                       error);
+}
 
-  if (! g_shell_parse_argv (command_line, &argc, &argv, error))
-    return FALSE;
+/**
+ * lia_core_install_app:
+ * @service_name: The service name the application owns on the buses
+ * @html_root: (allow-none): The application's HTML root, passed to it as
+ * its default #LiaApplication:webview-html-root
+ * @command_line: The command line that launches the application
+ *
+ * Adds an application to the registry of installed applications, in
+ * addition to those described in the 'apps' directory of Lia's
+ * configuration. Installed applications are not launched right away, but
+ * as soon as the Webview gets a request for one of their web dirs. The
+ * request is held until the application registers its web dir, and
+ * served then.
+ **/
+void
+lia_core_install_app (LiaCore     *self,
+                      const gchar *service_name,
+                      const gchar *html_root,
+                      const gchar *command_line)
+{
+  g_return_if_fail (LIA_IS_CORE (self));
+  g_return_if_fail (service_name != NULL);
+  g_return_if_fail (command_line != NULL);
 
-  launch_env = build_launch_env (self, env);
+  install_app (self, service_name, html_root, command_line);
+  publish_installed_apps (self);
+}
 
-  if (! g_spawn_async (NULL,
-                       argv,
-                       launch_env,
-                       G_SPAWN_SEARCH_PATH,
-                       NULL,
-                       NULL,
-                       &pid,
-                       error))
-    {
-      g_print ("Failed to launch '%s': %s\n", command_line, (*error)->message);
-      result = FALSE;
-    }
-  else
+/**
+ * lia_core_set_child_limits:
+ * @child_id: The id of a child launched by lia_core_launch_full()
+ * @cpu_weight: The child's share of CPU time (1-10000), or 0 for the
+ * default (100)
+ * @memory_high: Memory usage in bytes above which the child is throttled
+ * and its memory reclaimed aggressively, or 0 for no limit
+ * @memory_max: Memory usage in bytes that the child can't exceed, or 0
+ * for no limit
+ *
+ * Sets the resource limits of a child's cgroup. Each child gets a cgroup
+ * of its own when core runs in a cgroup v2 subtree delegated to it, and
+ * the limits set here survive restarts of the child. Limits for children
+ * launched afterwards are taken from the #LiaCore:child-cpu-weight,
+ * #LiaCore:child-memory-high and #LiaCore:child-memory-max properties.
+ *
+ * The resulting usage and pressure stall information of each child are
+ * published on the private bus through the supervisor object.
+ *
+ * Returns: %TRUE if the limits were applied, %FALSE otherwise.
+ **/
+gboolean
+lia_core_set_child_limits (LiaCore  *self,
+                           guint     child_id,
+                           guint     cpu_weight,
+                           guint64   memory_high,
+                           guint64   memory_max,
+                           GError  **error)
+{
+  ChildProcess *child;
+
+  g_return_val_if_fail (LIA_IS_CORE (self), FALSE);
+
+  child = g_hash_table_lookup (self->priv->children,
+                               GUINT_TO_POINTER (child_id));
+  if (child == NULL)
     {
-      g_print ("Launched: '%s' with PID: %d\n", command_line, pid);
+      g_set_error (error,
+                   G_IO_ERROR,
+                   G_IO_ERROR_NOT_FOUND,
+                   "No child with id %u",
+                   child_id);
+      return FALSE;
     }
 
-  g_strfreev (argv);
-  g_strfreev (launch_env);
+  return set_child_limits (child, cpu_weight, memory_high, memory_max, error);
+}
+
+/**
+ * lia_core_get_time_to_ready:
+ *
+ * Gets the time it took from the start of core's initialization until
+ * all the startup steps were done, including the Webview reporting it is
+ * ready. Independent steps run concurrently, so this measures the
+ * critical path of the startup.
+ *
+ * Returns: The time in microseconds, or -1 if the system is not ready yet.
+ **/
+gint64
+lia_core_get_time_to_ready (LiaCore *self)
+{
+  g_return_val_if_fail (LIA_IS_CORE (self), -1);
 
-  return result;
+  return self->priv->time_to_ready;
 }
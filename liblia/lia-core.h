@@ -31,6 +31,13 @@
 
 G_BEGIN_DECLS
 
+typedef enum
+{
+  LIA_RESTART_NEVER,
+  LIA_RESTART_ON_FAILURE,
+  LIA_RESTART_ALWAYS
+} LiaRestartPolicy;
+
 typedef struct _LiaCore LiaCore;
 typedef struct _LiaCoreClass LiaCoreClass;
 typedef struct _LiaCorePrivate LiaCorePrivate;
@@ -69,6 +76,26 @@ gboolean          lia_core_launch              (LiaCore      *self,
                                                 const gchar  *command_line,
                                                 gchar       **env,
                                                 GError      **error);
+gboolean          lia_core_launch_full         (LiaCore           *self,
+                                                const gchar       *command_line,
+                                                gchar            **env,
+                                                LiaRestartPolicy   restart_policy,
+                                                guint             *child_id,
+                                                GError           **error);
+
+void              lia_core_install_app         (LiaCore     *self,
+                                                const gchar *service_name,
+                                                const gchar *html_root,
+                                                const gchar *command_line);
+
+gboolean          lia_core_set_child_limits    (LiaCore  *self,
+                                                guint     child_id,
+                                                guint     cpu_weight,
+                                                guint64   memory_high,
+                                                guint64   memory_max,
+                                                GError  **error);
+
+gint64            lia_core_get_time_to_ready   (LiaCore *self);
 
 G_END_DECLS
 
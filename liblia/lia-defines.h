@@ -30,14 +30,32 @@ typedef enum
   LIA_BUS_PUBLIC    = 2
 } LiaBusType;
 
+#define LIA_ENV_KEY_BASE_SERVICE_NAME    "LIA_BASE_SERVICE_NAME"
+#define LIA_ENV_KEY_CHILD_ID             "LIA_CHILD_ID"
+#define LIA_ENV_KEY_ZYGOTE_ADDR          "LIA_ZYGOTE_ADDRESS"
+#define LIA_ENV_KEY_WEBVIEW_HTML_ROOT    "LIA_WEBVIEW_HTML_ROOT"
+
+/* fallback for applications not started by core, used if its discovery
+   endpoint can't be reached */
 #define LIA_ENV_KEY_PRIVATE_BUS_ADDR     "LIA_PRIVATE_BUS_ADDRESS"
 #define LIA_ENV_KEY_PROTECTED_BUS_ADDR   "LIA_PROTECTED_BUS_ADDRESS"
 #define LIA_ENV_KEY_PUBLIC_BUS_ADDR      "LIA_PUBLIC_BUS_ADDRESS"
-
-#define LIA_ENV_KEY_BASE_SERVICE_NAME    "LIA_BASE_SERVICE_NAME"
 #define LIA_ENV_KEY_CORE_SERVICE_NAME    "LIA_CORE_SERVICE_NAME"
 #define LIA_ENV_KEY_WEBVIEW_SERVICE_NAME "LIA_WEBVIEW_SERVICE_NAME"
 
+/* core's discovery endpoint, formatted with the base service name */
+#define LIA_DISCOVERY_ADDRESS_FORMAT     "unix:abstract=lia-discovery-%s"
+
+#define LIA_CONFIG_KEY_BASE_SERVICE_NAME    "base-service-name"
+#define LIA_CONFIG_KEY_CORE_SERVICE_NAME    "core-service-name"
+#define LIA_CONFIG_KEY_WEBVIEW_SERVICE_NAME "webview-service-name"
+#define LIA_CONFIG_KEY_PRIVATE_BUS_ADDR     "private-bus-address"
+#define LIA_CONFIG_KEY_PROTECTED_BUS_ADDR   "protected-bus-address"
+#define LIA_CONFIG_KEY_PUBLIC_BUS_ADDR      "public-bus-address"
+#define LIA_CONFIG_KEY_ACTIVATABLE_APPS     "activatable-apps"
+#define LIA_CONFIG_KEY_PUBLIC_BUS_SHARDS    "public-bus-shards"
+#define LIA_CONFIG_KEY_WEBVIEW_BUS_MUX      "webview-bus-mux-pool-size"
+
 #define LIA_CORE_SERVICE_NAME_SUFFIX    "Lia.Core"
 #define LIA_WEBVIEW_SERVICE_NAME_SUFFIX "Lia.Webview"
 
@@ -47,7 +65,21 @@ typedef enum
 #define LIA_AUTH_SERVICE_OBJ_PATH   LIA_BASE_OBJ_PATH "/Core/AuthService"
 #define LIA_AUTH_SERVICE_IFACE_NAME LIA_BASE_IFACE_NAME ".Core.AuthService"
 
+#define LIA_SUPERVISOR_OBJ_PATH   LIA_BASE_OBJ_PATH "/Core/Supervisor"
+#define LIA_SUPERVISOR_IFACE_NAME LIA_BASE_IFACE_NAME ".Core.Supervisor"
+
+#define LIA_DISCOVERY_OBJ_PATH   LIA_BASE_OBJ_PATH "/Core/Discovery"
+#define LIA_DISCOVERY_IFACE_NAME LIA_BASE_IFACE_NAME ".Core.Discovery"
+
 #define LIA_WEBVIEW_OBJ_PATH   LIA_BASE_OBJ_PATH "/Webview"
 #define LIA_WEBVIEW_IFACE_NAME LIA_BASE_IFACE_NAME ".Webview"
 
+#define LIA_APPLICATION_OBJ_PATH   LIA_BASE_OBJ_PATH "/Application"
+#define LIA_APPLICATION_IFACE_NAME LIA_BASE_IFACE_NAME ".Application"
+
+#define LIA_STATS_OBJ_PATH   LIA_BASE_OBJ_PATH "/Stats"
+#define LIA_STATS_IFACE_NAME LIA_BASE_IFACE_NAME ".Stats"
+
+#define LIA_DBUS_ERROR_LIMITS_EXCEEDED LIA_BASE_IFACE_NAME ".Error.LimitsExceeded"
+
 #endif /* __LIA_DEFINES_H__ */
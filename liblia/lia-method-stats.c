@@ -0,0 +1,432 @@
+/*
+ * lia-method-stats.c
+ *
+ * This file is part of Lia <http://free-social.net/lia/>
+ *
+ * Copyright (C) 2012 Igalia S.L.
+ *
+ * Authors:
+ *   Eduardo Lima Mitev <elima@igalia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License at http://www.gnu.org/licenses/gpl-3.0.txt
+ * for more details.
+ */
+
+
+#include <string.h>
+
+#include "lia-method-stats.h"
+
+/* Latencies are recorded in microseconds into log-linear buckets: values
+   below SUB_BUCKETS get a bucket each, and every power of two above that
+   is split into SUB_BUCKETS linear sub-buckets, giving a relative error
+   below 1/SUB_BUCKETS for any recorded value. */
+#define SUB_BUCKET_BITS 3
+#define SUB_BUCKETS     (1 << SUB_BUCKET_BITS)
+#define MAX_EXPONENT    40
+#define NUM_BUCKETS     ((MAX_EXPONENT - SUB_BUCKET_BITS + 1) * SUB_BUCKETS)
+
+/* Method names come from remote callers, so past this many entries calls
+   are recorded together under OTHER_METHODS_NAME */
+#define MAX_METHOD_ENTRIES 512
+#define OTHER_METHODS_NAME "*"
+
+/* calls not replied in this time are forgotten, well above D-Bus' default
+   call timeout of 25 seconds */
+#define PENDING_CALL_EXPIRE 120 /* seconds */
+
+typedef struct _MethodEntry MethodEntry;
+
+struct _MethodEntry
+{
+  MethodEntry *next;
+
+  gchar *interface_name;
+  gchar *method_name;
+
+  volatile gint calls;
+  volatile gint errors;
+  volatile gint buckets[NUM_BUCKETS];
+};
+
+typedef struct
+{
+  MethodEntry *entry;
+  gint64 start;
+} PendingCall;
+
+typedef struct
+{
+  LiaMethodStats *stats;
+  GHashTable *pending;
+  gint64 last_expire;
+} ConnData;
+
+/* Filters of all connections run in GDBus' worker thread, so 'lookup' and
+   the 'pending' table of each connection are only ever touched from that
+   thread. Readers in other threads only walk the 'entries' list, which
+   is append-only, and read counters atomically. No locks are taken. */
+struct _LiaMethodStats
+{
+  MethodEntry * volatile entries;
+  GHashTable *lookup;
+
+  volatile gint ref_count;
+};
+
+static void
+free_method_entry (MethodEntry *entry)
+{
+  g_free (entry->interface_name);
+  g_free (entry->method_name);
+
+  g_slice_free (MethodEntry, entry);
+}
+
+static void
+free_pending_call (gpointer _data)
+{
+  g_slice_free (PendingCall, _data);
+}
+
+static void
+free_conn_data (gpointer _data)
+{
+  ConnData *data = _data;
+
+  g_hash_table_unref (data->pending);
+  lia_method_stats_unref (data->stats);
+
+  g_slice_free (ConnData, data);
+}
+
+static guint
+get_bucket_index (guint64 value)
+{
+  guint exponent;
+
+  if (value < SUB_BUCKETS)
+    return value;
+
+  if (value >> MAX_EXPONENT != 0)
+    value = (G_GUINT64_CONSTANT (1) << MAX_EXPONENT) - 1;
+
+  exponent = SUB_BUCKET_BITS;
+  while (value >> (exponent + 1) != 0)
+    exponent++;
+
+  return (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKETS +
+    ((value >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1));
+}
+
+static guint64
+get_bucket_value (guint index)
+{
+  guint exponent;
+
+  if (index < SUB_BUCKETS)
+    return index;
+
+  exponent = index / SUB_BUCKETS - 1 + SUB_BUCKET_BITS;
+
+  return (guint64) (SUB_BUCKETS + index % SUB_BUCKETS) <<
+    (exponent - SUB_BUCKET_BITS);
+}
+
+static MethodEntry *
+lookup_method_entry (LiaMethodStats *self,
+                     const gchar    *interface_name,
+                     const gchar    *method_name)
+{
+  MethodEntry *entry;
+  gchar *key;
+
+  key = g_strdup_printf ("%s.%s", interface_name, method_name);
+
+  entry = g_hash_table_lookup (self->lookup, key);
+  if (entry == NULL && g_hash_table_size (self->lookup) >= MAX_METHOD_ENTRIES)
+    {
+      g_free (key);
+
+      interface_name = "";
+      method_name = OTHER_METHODS_NAME;
+      key = g_strdup_printf (".%s", method_name);
+
+      entry = g_hash_table_lookup (self->lookup, key);
+    }
+
+  if (entry == NULL)
+    {
+      entry = g_slice_new0 (MethodEntry);
+      entry->interface_name = g_strdup (interface_name);
+      entry->method_name = g_strdup (method_name);
+
+      /* publish the fully initialized entry to readers */
+      do
+        {
+          entry->next = g_atomic_pointer_get (&self->entries);
+        }
+      while (! g_atomic_pointer_compare_and_exchange (&self->entries,
+                                                      entry->next,
+                                                      entry));
+
+      g_hash_table_insert (self->lookup, key, entry);
+    }
+  else
+    {
+      g_free (key);
+    }
+
+  return entry;
+}
+
+static gboolean
+pending_call_expired (gpointer key, gpointer value, gpointer user_data)
+{
+  PendingCall *call = value;
+  gint64 *deadline = user_data;
+
+  return call->start < *deadline;
+}
+
+/* drops the calls that never got a reply, e.g because their caller went
+   away, at most once every PENDING_CALL_EXPIRE seconds */
+static void
+expire_pending_calls (ConnData *data, gint64 now)
+{
+  gint64 deadline;
+
+  if (now - data->last_expire < PENDING_CALL_EXPIRE * G_USEC_PER_SEC)
+    return;
+
+  data->last_expire = now;
+  deadline = now - PENDING_CALL_EXPIRE * G_USEC_PER_SEC;
+
+  g_hash_table_foreach_remove (data->pending, pending_call_expired, &deadline);
+}
+
+static GDBusMessage *
+connection_filter (GDBusConnection *conn,
+                   GDBusMessage    *msg,
+                   gboolean         incoming,
+                   gpointer         user_data)
+{
+  ConnData *data = user_data;
+  GDBusMessageType msg_type;
+  gchar *key;
+
+  msg_type = g_dbus_message_get_message_type (msg);
+
+  if (incoming && msg_type == G_DBUS_MESSAGE_TYPE_METHOD_CALL)
+    {
+      MethodEntry *entry;
+      const gchar *interface_name;
+
+      interface_name = g_dbus_message_get_interface (msg);
+      entry = lookup_method_entry (data->stats,
+                                   interface_name != NULL ? interface_name : "",
+                                   g_dbus_message_get_member (msg));
+
+      g_atomic_int_inc (&entry->calls);
+
+      if ((g_dbus_message_get_flags (msg) &
+           G_DBUS_MESSAGE_FLAGS_NO_REPLY_EXPECTED) == 0)
+        {
+          PendingCall *call;
+          const gchar *sender;
+
+          sender = g_dbus_message_get_sender (msg);
+          key = g_strdup_printf ("%s|%u",
+                                 sender != NULL ? sender : "",
+                                 g_dbus_message_get_serial (msg));
+
+          call = g_slice_new (PendingCall);
+          call->entry = entry;
+          call->start = g_get_monotonic_time ();
+
+          g_hash_table_insert (data->pending, key, call);
+
+          expire_pending_calls (data, call->start);
+        }
+    }
+  else if (! incoming &&
+           (msg_type == G_DBUS_MESSAGE_TYPE_METHOD_RETURN ||
+            msg_type == G_DBUS_MESSAGE_TYPE_ERROR))
+    {
+      PendingCall *call;
+      const gchar *destination;
+
+      destination = g_dbus_message_get_destination (msg);
+      key = g_strdup_printf ("%s|%u",
+                             destination != NULL ? destination : "",
+                             g_dbus_message_get_reply_serial (msg));
+
+      call = g_hash_table_lookup (data->pending, key);
+      if (call != NULL)
+        {
+          gint64 latency;
+
+          latency = g_get_monotonic_time () - call->start;
+          g_atomic_int_inc (&call->entry->buckets[get_bucket_index (MAX (latency, 0))]);
+
+          if (msg_type == G_DBUS_MESSAGE_TYPE_ERROR)
+            g_atomic_int_inc (&call->entry->errors);
+
+          g_hash_table_remove (data->pending, key);
+        }
+
+      g_free (key);
+    }
+
+  return msg;
+}
+
+/* public methods */
+
+LiaMethodStats *
+lia_method_stats_new (void)
+{
+  LiaMethodStats *self;
+
+  self = g_slice_new0 (LiaMethodStats);
+
+  self->entries = NULL;
+  self->lookup = g_hash_table_new_full (g_str_hash,
+                                        g_str_equal,
+                                        g_free,
+                                        NULL);
+  self->ref_count = 1;
+
+  return self;
+}
+
+LiaMethodStats *
+lia_method_stats_ref (LiaMethodStats *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+
+  g_atomic_int_inc (&self->ref_count);
+
+  return self;
+}
+
+void
+lia_method_stats_unref (LiaMethodStats *self)
+{
+  MethodEntry *entry;
+
+  g_return_if_fail (self != NULL);
+
+  if (! g_atomic_int_dec_and_test (&self->ref_count))
+    return;
+
+  g_hash_table_unref (self->lookup);
+
+  entry = self->entries;
+  while (entry != NULL)
+    {
+      MethodEntry *next;
+
+      next = entry->next;
+      free_method_entry (entry);
+      entry = next;
+    }
+
+  g_slice_free (LiaMethodStats, self);
+}
+
+guint
+lia_method_stats_watch_connection (LiaMethodStats  *self,
+                                   GDBusConnection *conn)
+{
+  ConnData *data;
+
+  g_return_val_if_fail (self != NULL, 0);
+  g_return_val_if_fail (G_IS_DBUS_CONNECTION (conn), 0);
+
+  data = g_slice_new (ConnData);
+  data->stats = lia_method_stats_ref (self);
+  data->pending = g_hash_table_new_full (g_str_hash,
+                                         g_str_equal,
+                                         g_free,
+                                         free_pending_call);
+  data->last_expire = g_get_monotonic_time ();
+
+  /* GDBus frees the connection data once the filter is removed and
+     guaranteed not to be running anymore */
+  return g_dbus_connection_add_filter (conn,
+                                       connection_filter,
+                                       data,
+                                       free_conn_data);
+}
+
+void
+lia_method_stats_unwatch_connection (LiaMethodStats  *self,
+                                     GDBusConnection *conn,
+                                     guint            watch_id)
+{
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (G_IS_DBUS_CONNECTION (conn));
+
+  g_dbus_connection_remove_filter (conn, watch_id);
+}
+
+/**
+ * lia_method_stats_get_snapshot:
+ *
+ * Returns: (transfer floating): A #GVariant of type 'a(ssuua(tu))' with
+ *   the interface name, method name, number of calls, number of errors
+ *   and the non-empty latency buckets of every method called so far.
+ *   Each bucket is given as its lower bound in microseconds and the
+ *   number of calls that fell in it.
+ **/
+GVariant *
+lia_method_stats_get_snapshot (LiaMethodStats *self)
+{
+  GVariantBuilder builder;
+  MethodEntry *entry;
+
+  g_return_val_if_fail (self != NULL, NULL);
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(ssuua(tu))"));
+
+  entry = g_atomic_pointer_get (&self->entries);
+  while (entry != NULL)
+    {
+      GVariantBuilder buckets;
+      gint i;
+
+      g_variant_builder_init (&buckets, G_VARIANT_TYPE ("a(tu)"));
+      for (i=0; i<NUM_BUCKETS; i++)
+        {
+          gint count;
+
+          count = g_atomic_int_get (&entry->buckets[i]);
+          if (count > 0)
+            g_variant_builder_add (&buckets,
+                                   "(tu)",
+                                   get_bucket_value (i),
+                                   (guint32) count);
+        }
+
+      g_variant_builder_add (&builder,
+                             "(ssuua(tu))",
+                             entry->interface_name,
+                             entry->method_name,
+                             (guint32) g_atomic_int_get (&entry->calls),
+                             (guint32) g_atomic_int_get (&entry->errors),
+                             &buckets);
+
+      entry = entry->next;
+    }
+
+  return g_variant_builder_end (&builder);
+}
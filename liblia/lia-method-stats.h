@@ -0,0 +1,52 @@
+/*
+ * lia-method-stats.h
+ *
+ * This file is part of Lia <http://free-social.net/lia/>
+ *
+ * Copyright (C) 2012 Igalia S.L.
+ *
+ * Authors:
+ *   Eduardo Lima Mitev <elima@igalia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License at http://www.gnu.org/licenses/gpl-3.0.txt
+ * for more details.
+ */
+
+
+#ifndef __LIA_METHOD_STATS_H__
+#define __LIA_METHOD_STATS_H__
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/* Per-method call counters and latency histograms, recorded from a
+   D-Bus connection filter. A filter may still run after its connection
+   is unwatched, so each watched connection holds a reference on the
+   stats. Used internally by LiaApplication. */
+
+typedef struct _LiaMethodStats LiaMethodStats;
+
+LiaMethodStats * lia_method_stats_new                (void);
+LiaMethodStats * lia_method_stats_ref                (LiaMethodStats *self);
+void             lia_method_stats_unref              (LiaMethodStats *self);
+
+guint            lia_method_stats_watch_connection   (LiaMethodStats  *self,
+                                                      GDBusConnection *conn);
+void             lia_method_stats_unwatch_connection (LiaMethodStats  *self,
+                                                      GDBusConnection *conn,
+                                                      guint            watch_id);
+
+GVariant *       lia_method_stats_get_snapshot       (LiaMethodStats *self);
+
+G_END_DECLS
+
+#endif /* __LIA_METHOD_STATS_H__ */
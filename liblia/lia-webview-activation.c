@@ -0,0 +1,277 @@
+/* On-demand activation of installed applications. A request for the web
+   dir of an application that core can activate (see the
+   'activatable-apps' configuration entry) is held while core launches
+   the application, and served as soon as the application registers its
+   web dir. All requests arriving meanwhile are queued behind the first
+   one, so an application is activated only once. */
+
+#define ACTIVATION_TIMEOUT 30 /* seconds */
+
+/* how long web clients are told to wait before retrying a request whose
+   application couldn't be activated */
+#define ACTIVATION_RETRY_AFTER "10" /* seconds */
+
+/* PendingActivation */
+typedef struct
+{
+  LiaWebview *self;
+  gchar *service_name;
+  GQueue held_requests;
+  guint timeout_src_id;
+} PendingActivation;
+
+typedef struct
+{
+  EvdHttpConnection *conn;
+  EvdHttpRequest *request;
+} HeldRequest;
+
+/* the pending activation can be gone (e.g timed out) by the time
+   ActivateApp returns, so the call carries its own copy of the name */
+typedef struct
+{
+  LiaWebview *self;
+  gchar *service_name;
+} ActivateCallData;
+
+static void
+free_held_request (gpointer _data)
+{
+  HeldRequest *data = _data;
+
+  g_object_unref (data->conn);
+  g_object_unref (data->request);
+
+  g_slice_free (HeldRequest, data);
+}
+
+static void
+free_pending_activation (gpointer _data)
+{
+  PendingActivation *data = _data;
+  HeldRequest *held;
+
+  if (data->timeout_src_id > 0)
+    g_source_remove (data->timeout_src_id);
+
+  while ((held = g_queue_pop_head (&data->held_requests)) != NULL)
+    free_held_request (held);
+
+  g_free (data->service_name);
+
+  g_slice_free (PendingActivation, data);
+}
+
+/* Returns the service name of the installed application a path belongs
+   to, or NULL if it is not one core can activate */
+static gchar *
+lookup_activatable_app (LiaWebview *self, const gchar *path)
+{
+  GVariant *config;
+  const gchar **apps;
+  const gchar *name;
+  const gchar *name_end;
+  gchar *result = NULL;
+  gint i;
+
+  config = lia_application_get_config (LIA_APPLICATION (self));
+  if (config == NULL ||
+      ! g_str_has_prefix (path, self->priv->base_path) ||
+      ! g_variant_lookup (config, LIA_CONFIG_KEY_ACTIVATABLE_APPS, "^a&s", &apps))
+    {
+      return NULL;
+    }
+
+  name = path + strlen (self->priv->base_path);
+  name_end = strchr (name, '/');
+  if (name_end == NULL)
+    name_end = name + strlen (name);
+
+  for (i=0; apps[i] != NULL; i++)
+    if (strlen (apps[i]) == (gsize) (name_end - name) &&
+        strncmp (apps[i], name, name_end - name) == 0)
+      {
+        result = g_strdup (apps[i]);
+        break;
+      }
+
+  g_free (apps);
+
+  return result;
+}
+
+static void
+fail_activation (LiaWebview  *self,
+                 const gchar *service_name,
+                 guint        status_code)
+{
+  PendingActivation *data;
+  HeldRequest *held;
+  SoupMessageHeaders *headers;
+  const gchar *content;
+
+  data = g_hash_table_lookup (self->priv->activations, service_name);
+  if (data == NULL)
+    return;
+
+  content = soup_status_get_phrase (status_code);
+
+  headers = soup_message_headers_new (SOUP_MESSAGE_HEADERS_RESPONSE);
+  soup_message_headers_set_content_type (headers, "text/plain", NULL);
+
+  /* the application may still come up, or be activated next time */
+  if (status_code == SOUP_STATUS_SERVICE_UNAVAILABLE)
+    soup_message_headers_replace (headers,
+                                  "Retry-After",
+                                  ACTIVATION_RETRY_AFTER);
+
+  while ((held = g_queue_pop_head (&data->held_requests)) != NULL)
+    {
+      evd_web_service_respond (self->priv->web_service,
+                               held->conn,
+                               status_code,
+                               headers,
+                               content,
+                               strlen (content),
+                               NULL);
+      free_held_request (held);
+    }
+
+  soup_message_headers_free (headers);
+
+  g_hash_table_remove (self->priv->activations, service_name);
+}
+
+static gboolean
+activation_timeout (gpointer user_data)
+{
+  PendingActivation *data = user_data;
+
+  g_print ("Timeout activating '%s'\n", data->service_name);
+
+  data->timeout_src_id = 0;
+  fail_activation (data->self,
+                   data->service_name,
+                   SOUP_STATUS_SERVICE_UNAVAILABLE);
+
+  return FALSE;
+}
+
+static void
+on_app_activated (GObject      *obj,
+                  GAsyncResult *res,
+                  gpointer      user_data)
+{
+  ActivateCallData *data = user_data;
+  GVariant *ret;
+  GError *error = NULL;
+
+  ret = g_dbus_connection_call_finish (G_DBUS_CONNECTION (obj), res, &error);
+  if (ret == NULL)
+    {
+      g_print ("Error activating '%s': %s\n",
+               data->service_name,
+               error->message);
+
+      fail_activation (data->self,
+                       data->service_name,
+                       g_error_matches (error,
+                                        G_IO_ERROR,
+                                        G_IO_ERROR_NOT_FOUND) ?
+                       SOUP_STATUS_NOT_FOUND :
+                       SOUP_STATUS_SERVICE_UNAVAILABLE);
+
+      g_error_free (error);
+    }
+  else
+    {
+      /* nothing else to do until the application registers its web dir */
+      g_variant_unref (ret);
+    }
+
+  g_object_unref (data->self);
+  g_free (data->service_name);
+  g_slice_free (ActivateCallData, data);
+}
+
+static void
+hold_request_for_activation (LiaWebview        *self,
+                             const gchar       *service_name,
+                             EvdHttpConnection *conn,
+                             EvdHttpRequest    *request)
+{
+  PendingActivation *data;
+  HeldRequest *held;
+  ActivateCallData *call_data;
+
+  held = g_slice_new0 (HeldRequest);
+  held->conn = g_object_ref (conn);
+  held->request = g_object_ref (request);
+
+  data = g_hash_table_lookup (self->priv->activations, service_name);
+  if (data != NULL)
+    {
+      g_queue_push_tail (&data->held_requests, held);
+      return;
+    }
+
+  data = g_slice_new0 (PendingActivation);
+  data->self = self;
+  data->service_name = g_strdup (service_name);
+  g_queue_init (&data->held_requests);
+  g_queue_push_tail (&data->held_requests, held);
+
+  g_hash_table_insert (self->priv->activations, data->service_name, data);
+
+  data->timeout_src_id = g_timeout_add_seconds (ACTIVATION_TIMEOUT,
+                                                activation_timeout,
+                                                data);
+
+  call_data = g_slice_new0 (ActivateCallData);
+  call_data->self = g_object_ref (self);
+  call_data->service_name = g_strdup (service_name);
+
+  g_dbus_connection_call (lia_application_get_bus (LIA_APPLICATION (self),
+                                                   LIA_BUS_PRIVATE),
+                          lia_application_get_core_service_name (LIA_APPLICATION (self)),
+                          LIA_SUPERVISOR_OBJ_PATH,
+                          LIA_SUPERVISOR_IFACE_NAME,
+                          "ActivateApp",
+                          g_variant_new ("(s)", service_name),
+                          NULL,
+                          G_DBUS_CALL_FLAGS_NONE,
+                          -1,
+                          NULL,
+                          on_app_activated,
+                          call_data);
+}
+
+/* serves the requests held while the application owning 'path' was
+   being activated */
+static void
+replay_activation (LiaWebview *self, const gchar *path)
+{
+  PendingActivation *data;
+  HeldRequest *held;
+
+  data = g_hash_table_lookup (self->priv->activations, path);
+  if (data == NULL)
+    return;
+
+  g_hash_table_steal (self->priv->activations, path);
+
+  g_print ("'%s' activated, serving %u held requests\n",
+           data->service_name,
+           g_queue_get_length (&data->held_requests));
+
+  while ((held = g_queue_pop_head (&data->held_requests)) != NULL)
+    {
+      web_service_on_request (EVD_WEB_SERVICE (self->priv->web_service),
+                              held->conn,
+                              held->request,
+                              self);
+      free_held_request (held);
+    }
+
+  free_pending_activation (data);
+}
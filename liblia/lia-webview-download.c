@@ -0,0 +1,286 @@
+#define DOWNLOAD_EXPIRE_TIMEOUT 300 /* seconds */
+
+/* DownloadData */
+typedef struct
+{
+  LiaWebview *self;
+  gchar *id;
+  gint fd;
+  gchar *content_type;
+  gchar *file_name;
+  LiaBusType bus_type;
+  guint expire_src_id;
+} DownloadData;
+
+typedef struct
+{
+  EvdHttpConnection *conn;
+  GInputStream *input;
+} DownloadStreamData;
+
+static void
+free_download_data (gpointer _data)
+{
+  DownloadData *data = _data;
+
+  if (data->expire_src_id > 0)
+    g_source_remove (data->expire_src_id);
+
+  if (data->fd >= 0)
+    close (data->fd);
+
+  g_free (data->id);
+  g_free (data->content_type);
+  g_free (data->file_name);
+
+  g_slice_free (DownloadData, data);
+}
+
+static gboolean
+download_expired (gpointer user_data)
+{
+  DownloadData *data = user_data;
+
+  data->expire_src_id = 0;
+  g_hash_table_remove (data->self->priv->downloads, data->id);
+
+  return FALSE;
+}
+
+static gchar *
+offer_download (LiaWebview   *self,
+                gint          fd,
+                const gchar  *content_type,
+                const gchar  *file_name,
+                LiaBusType    bus_type,
+                GError      **error)
+{
+  DownloadData *data;
+  struct stat st;
+
+  if (fstat (fd, &st) != 0)
+    {
+      g_set_error (error,
+                   G_IO_ERROR,
+                   g_io_error_from_errno (errno),
+                   "Failed to stat download file descriptor: %s",
+                   g_strerror (errno));
+      close (fd);
+      return NULL;
+    }
+
+  data = g_slice_new0 (DownloadData);
+  data->self = self;
+  data->id = evd_uuid_new ();
+  data->fd = fd;
+  data->content_type = g_strdup (content_type);
+  data->file_name = g_strdup (file_name);
+  data->bus_type = bus_type;
+
+  data->expire_src_id = g_timeout_add_seconds (DOWNLOAD_EXPIRE_TIMEOUT,
+                                               download_expired,
+                                               data);
+
+  g_hash_table_insert (self->priv->downloads, data->id, data);
+
+  return g_strdup_printf ("%s%s", self->priv->download_path, data->id);
+}
+
+static void
+handle_offer_download_call (LiaWebview            *self,
+                            GVariant              *arguments,
+                            GDBusMethodInvocation *invocation)
+{
+  GDBusMessage *msg;
+  GUnixFDList *fd_list;
+  gint32 fd_index;
+  const gchar *content_type;
+  const gchar *file_name;
+  gint16 bus_type;
+  gint fd;
+  gchar *url_path;
+  GError *error = NULL;
+
+  g_variant_get (arguments,
+                 "(h&s&sn)",
+                 &fd_index,
+                 &content_type,
+                 &file_name,
+                 &bus_type);
+
+  msg = g_dbus_method_invocation_get_message (invocation);
+  fd_list = g_dbus_message_get_unix_fd_list (msg);
+  if (fd_list == NULL)
+    {
+      g_dbus_method_invocation_return_error (invocation,
+                                             G_IO_ERROR,
+                                             G_IO_ERROR_INVALID_ARGUMENT,
+                                             "No file descriptor was passed");
+      return;
+    }
+
+  fd = g_unix_fd_list_get (fd_list, fd_index, &error);
+  if (fd < 0)
+    {
+      g_dbus_method_invocation_take_error (invocation, error);
+      return;
+    }
+
+  url_path = offer_download (self,
+                             fd,
+                             content_type,
+                             file_name,
+                             (LiaBusType) bus_type,
+                             &error);
+  if (url_path == NULL)
+    {
+      g_dbus_method_invocation_take_error (invocation, error);
+    }
+  else
+    {
+      g_dbus_method_invocation_return_value (invocation,
+                                             g_variant_new ("(s)", url_path));
+      g_free (url_path);
+    }
+}
+
+static void
+on_download_streamed (GObject      *obj,
+                      GAsyncResult *res,
+                      gpointer      user_data)
+{
+  DownloadStreamData *data = user_data;
+  GError *error = NULL;
+
+  if (g_output_stream_splice_finish (G_OUTPUT_STREAM (obj), res, &error) < 0)
+    {
+      g_debug ("Error streaming download: %s", error->message);
+      g_error_free (error);
+    }
+
+  g_io_stream_close (G_IO_STREAM (data->conn), NULL, NULL);
+
+  g_object_unref (data->input);
+  g_object_unref (data->conn);
+  g_slice_free (DownloadStreamData, data);
+}
+
+static void
+handle_download_request (LiaWebview        *self,
+                         EvdHttpConnection *conn,
+                         EvdHttpRequest    *request,
+                         LiaBusType         bus_type,
+                         const gchar       *id)
+{
+  DownloadData *download;
+  SoupMessageHeaders *headers;
+  DownloadStreamData *data;
+  GOutputStream *output;
+  gchar *fd_path;
+  gint fd;
+  struct stat st;
+  GError *error = NULL;
+
+  download = g_hash_table_lookup (self->priv->downloads, id);
+  if (download == NULL || bus_type > download->bus_type)
+    {
+      evd_web_service_respond (self->priv->web_service,
+                               conn,
+                               download == NULL ?
+                                 SOUP_STATUS_NOT_FOUND : SOUP_STATUS_FORBIDDEN,
+                               NULL,
+                               NULL,
+                               0,
+                               NULL);
+      return;
+    }
+
+  /* downloads are one-shot, take ownership of the file descriptor */
+  g_hash_table_steal (self->priv->downloads, id);
+  if (download->expire_src_id > 0)
+    {
+      g_source_remove (download->expire_src_id);
+      download->expire_src_id = 0;
+    }
+
+  /* the open file description is shared with the application (and with
+     any other offer of the same file descriptor), so read the file through
+     a description of our own instead of moving its offset. The size is
+     taken now, since a tmp-file can't be sealed and may have changed since
+     it was offered */
+  fd_path = g_strdup_printf ("/proc/self/fd/%d", download->fd);
+  fd = open (fd_path, O_RDONLY | O_CLOEXEC);
+  g_free (fd_path);
+  if (fd < 0 || fstat (fd, &st) != 0)
+    {
+      g_debug ("Error reopening download file descriptor: %s",
+               g_strerror (errno));
+
+      if (fd >= 0)
+        close (fd);
+      free_download_data (download);
+
+      evd_web_service_respond (self->priv->web_service,
+                               conn,
+                               SOUP_STATUS_INTERNAL_SERVER_ERROR,
+                               NULL,
+                               NULL,
+                               0,
+                               NULL);
+      return;
+    }
+
+  headers = soup_message_headers_new (SOUP_MESSAGE_HEADERS_RESPONSE);
+  soup_message_headers_set_content_length (headers, st.st_size);
+  soup_message_headers_set_content_type (headers,
+                                         download->content_type[0] != '\0' ?
+                                         download->content_type :
+                                         "application/octet-stream",
+                                         NULL);
+  if (download->file_name[0] != '\0')
+    {
+      GHashTable *params;
+
+      params = g_hash_table_new (g_str_hash, g_str_equal);
+      g_hash_table_insert (params, "filename", download->file_name);
+      soup_message_headers_set_content_disposition (headers,
+                                                    "attachment",
+                                                    params);
+      g_hash_table_unref (params);
+    }
+
+  if (! evd_http_connection_write_response_headers (conn,
+                                                    SOUP_HTTP_1_1,
+                                                    SOUP_STATUS_OK,
+                                                    NULL,
+                                                    headers,
+                                                    &error))
+    {
+      g_debug ("Error writing download headers: %s", error->message);
+      g_error_free (error);
+
+      soup_message_headers_free (headers);
+      close (fd);
+      free_download_data (download);
+      return;
+    }
+  soup_message_headers_free (headers);
+
+  /* stream the file descriptor straight to the connection, reading it
+     in chunks so memory use doesn't depend on the download size */
+  data = g_slice_new (DownloadStreamData);
+  data->conn = conn;
+  g_object_ref (conn);
+  data->input = g_unix_input_stream_new (fd, TRUE);
+
+  free_download_data (download);
+
+  output = g_io_stream_get_output_stream (G_IO_STREAM (conn));
+  g_output_stream_splice_async (output,
+                                data->input,
+                                G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE,
+                                G_PRIORITY_DEFAULT,
+                                NULL,
+                                on_download_streamed,
+                                data);
+}
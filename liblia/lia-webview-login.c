@@ -1,8 +1,13 @@
+#define LOGIN_DEADLINE 30000 /* milliseconds */
+
 typedef struct
 {
   LiaWebview *self;
   EvdHttpConnection *conn;
   EvdHttpRequest *request;
+  GCancellable *cancellable;
+  gulong conn_closed_handler_id;
+  gint64 deadline;
 } LoginData;
 
 static void
@@ -10,6 +15,9 @@ free_login_data (gpointer _data)
 {
   LoginData *data = _data;
 
+  g_signal_handler_disconnect (data->conn, data->conn_closed_handler_id);
+  g_object_unref (data->cancellable);
+
   g_object_unref (data->self);
   g_object_unref (data->conn);
   g_object_unref (data->request);
@@ -63,47 +71,31 @@ free_auth_session_data (gpointer _data)
 }
 
 static void
-on_auth_response (GObject      *obj,
-                  GAsyncResult *res,
-                  gpointer      user_data)
+complete_login (LoginData  *data,
+                gchar      *user_id,
+                gchar      *auth_token,
+                LiaBusType  bus_type,
+                GError     *error)
 {
-  LoginData *data = user_data;
-  GError *error = NULL;
-  GVariant *result;
-
-  gchar *user_id;
-  gint16 _bus_type;
-  LiaBusType bus_type;
-  gchar *auth_token;
   const gchar *session_id;
-
   SoupMessageHeaders *headers;
   gchar *cookie;
 
-  result = g_dbus_connection_call_finish (G_DBUS_CONNECTION (obj),
-                                          res,
-                                          &error);
-  if (! result)
+  if (error != NULL)
     {
       /* @TODO: Authentication failed */
       g_debug ("Error, authentication failed: %s", error->message);
-      respond_login_failed (data, error);
+
+      /* nobody is waiting for a response if the web client went away */
+      if (! g_cancellable_is_cancelled (data->cancellable))
+        respond_login_failed (data, error);
 
       g_error_free (error);
 
       goto out;
     }
 
-  g_variant_get (result,
-                 "(ssn)",
-                 &user_id,
-                 &auth_token,
-                 &_bus_type);
-
-  g_variant_unref (result);
-
   /* save session! */
-  bus_type = (LiaBusType) _bus_type;
   session_id = new_auth_session_data (data->self, user_id, bus_type, auth_token);
 
   headers = soup_message_headers_new (SOUP_MESSAGE_HEADERS_RESPONSE);
@@ -130,13 +122,66 @@ on_auth_response (GObject      *obj,
   free_login_data (data);
 }
 
+static void
+on_auth_response (GObject      *obj,
+                  GAsyncResult *res,
+                  gpointer      user_data)
+{
+  LoginData *data = user_data;
+  GError *error = NULL;
+  GVariant *result;
+
+  gchar *user_id = NULL;
+  gchar *auth_token = NULL;
+  gint16 _bus_type = LIA_BUS_PRIVATE;
+
+  result = g_dbus_connection_call_finish (G_DBUS_CONNECTION (obj),
+                                          res,
+                                          &error);
+  if (result != NULL)
+    {
+      g_variant_get (result,
+                     "(ssn)",
+                     &user_id,
+                     &auth_token,
+                     &_bus_type);
+
+      g_variant_unref (result);
+    }
+
+  complete_login (data, user_id, auth_token, (LiaBusType) _bus_type, error);
+}
+
+/* used instead of on_auth_response when the auth service lives in this
+   same process (core's embedded mode) */
+static void
+on_direct_auth_response (GObject      *obj,
+                         GAsyncResult *res,
+                         gpointer      user_data)
+{
+  LoginData *data = user_data;
+  GError *error = NULL;
+
+  gchar *user_id = NULL;
+  gchar *auth_token = NULL;
+  LiaBusType bus_type = LIA_BUS_PRIVATE;
+
+  lia_auth_service_authenticate_finish (LIA_AUTH_SERVICE (obj),
+                                        res,
+                                        &user_id,
+                                        &auth_token,
+                                        &bus_type,
+                                        &error);
+
+  complete_login (data, user_id, auth_token, bus_type, error);
+}
+
 static void
 on_login_conn_closed (EvdConnection *conn, gpointer user_data)
 {
-  GCancellable *cancellable = G_CANCELLABLE (user_data);
+  LoginData *data = user_data;
 
-  g_cancellable_cancel (cancellable);
-  g_object_unref (cancellable);
+  g_cancellable_cancel (data->cancellable);
 }
 
 static void
@@ -152,7 +197,7 @@ on_login_content_read (GObject      *obj,
   gssize size;
   GError *error = NULL;
   GHashTable *params;
-  GCancellable *cancellable;
+  gint64 timeout;
   SoupURI *uri;
   GDBusConnection *bus_conn;
   const gchar *core_service_name;
@@ -173,6 +218,25 @@ on_login_content_read (GObject      *obj,
       /* @TODO: Failed reading login data */
       g_debug ("Error reading login daa: %s", error->message);
       g_error_free (error);
+      free_login_data (data);
+      return;
+    }
+
+  /* the Authenticate call gets whatever is left of the request's
+     deadline, rather than a fixed timeout of its own */
+  timeout = (data->deadline - g_get_monotonic_time ()) / 1000;
+  if (timeout <= 0)
+    {
+      g_free (content);
+
+      evd_web_service_respond (self->priv->web_service,
+                               conn,
+                               SOUP_STATUS_GATEWAY_TIMEOUT,
+                               NULL,
+                               NULL,
+                               0,
+                               NULL);
+      free_login_data (data);
       return;
     }
 
@@ -184,34 +248,39 @@ on_login_content_read (GObject      *obj,
   user = (const gchar *) g_hash_table_lookup (params, "user");
   passw = (const gchar *) g_hash_table_lookup (params, "passw");
 
-  cancellable = g_cancellable_new ();
-  g_signal_connect (conn,
-                    "close",
-                    G_CALLBACK (on_login_conn_closed),
-                    cancellable);
-
   uri = evd_http_request_get_uri (data->request);
   domain = g_strdup_printf ("%s:%d", uri->host, uri->port);
 
-  bus_conn = lia_application_get_bus (LIA_APPLICATION (self), LIA_BUS_PRIVATE);
-  core_service_name =
-    lia_application_get_core_service_name (LIA_APPLICATION (self));
-
-  g_dbus_connection_call (bus_conn,
-                          core_service_name,
-                          LIA_AUTH_SERVICE_OBJ_PATH,
-                          LIA_AUTH_SERVICE_IFACE_NAME,
-                          "Authenticate",
-                          g_variant_new ("(sss)",
-                                         user,
-                                         passw,
-                                         domain),
-                          NULL,
-                          G_DBUS_CALL_FLAGS_NONE,
-                          30000,
-                          cancellable,
-                          on_auth_response,
-                          data);
+  if (self->priv->auth_service != NULL)
+    {
+      lia_auth_service_authenticate (self->priv->auth_service,
+                                     user,
+                                     passw,
+                                     domain,
+                                     data->cancellable,
+                                     on_direct_auth_response,
+                                     data);
+    }
+  else
+    {
+      bus_conn = get_core_connection (self, &core_service_name);
+
+      g_dbus_connection_call (bus_conn,
+                              core_service_name,
+                              LIA_AUTH_SERVICE_OBJ_PATH,
+                              LIA_AUTH_SERVICE_IFACE_NAME,
+                              "Authenticate",
+                              g_variant_new ("(sss)",
+                                             user,
+                                             passw,
+                                             domain),
+                              NULL,
+                              G_DBUS_CALL_FLAGS_NONE,
+                              (gint) timeout,
+                              data->cancellable,
+                              on_auth_response,
+                              data);
+    }
 
   g_free (domain);
   g_hash_table_unref (params);
@@ -240,8 +309,18 @@ handle_signin_request (LiaWebview        *self,
   data->request = request;
   g_object_ref (request);
 
+  data->deadline = g_get_monotonic_time () + LOGIN_DEADLINE * 1000;
+
+  /* abandon the login if the web client goes away */
+  data->cancellable = g_cancellable_new ();
+  data->conn_closed_handler_id =
+    g_signal_connect (conn,
+                      "close",
+                      G_CALLBACK (on_login_conn_closed),
+                      data);
+
   evd_http_connection_read_all_content (conn,
-                                        NULL,
+                                        data->cancellable,
                                         on_login_content_read,
                                         data);
 }
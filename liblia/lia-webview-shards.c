@@ -0,0 +1,172 @@
+/* Spreading of web peers among the public bus shards. When core runs the
+   public bus as several bus daemons (see the 'public-bus-shards'
+   configuration entry), each web peer is connected to one of them, chosen
+   by consistent hashing of its session id. Every shard owns a number of
+   points on a hash ring, and a peer goes to the shard owning the first
+   point after its own hash, so adding or removing a shard only moves the
+   peers that hash next to that shard's points. */
+
+#define SHARD_RING_POINTS 64 /* per shard */
+
+/* RingPoint */
+typedef struct
+{
+  guint32 hash;
+  guint shard;
+} RingPoint;
+
+static guint32
+shard_ring_hash (const gchar *key)
+{
+  guint32 hash = 2166136261U;
+  const guchar *p;
+
+  /* FNV-1a */
+  for (p = (const guchar *) key; *p != '\0'; p++)
+    {
+      hash ^= *p;
+      hash *= 16777619U;
+    }
+
+  /* FNV-1a alone leaves short, similar keys close to each other on the
+     ring, so mix the bits a bit more */
+  hash ^= hash >> 16;
+  hash *= 0x85ebca6bU;
+  hash ^= hash >> 13;
+  hash *= 0xc2b2ae35U;
+  hash ^= hash >> 16;
+
+  return hash;
+}
+
+static gint
+ring_point_compare (gconstpointer a, gconstpointer b)
+{
+  const RingPoint *point_a = a;
+  const RingPoint *point_b = b;
+
+  if (point_a->hash < point_b->hash)
+    return -1;
+  else if (point_a->hash > point_b->hash)
+    return 1;
+  else
+    return (gint) point_a->shard - (gint) point_b->shard;
+}
+
+static void
+free_shard_ring (LiaWebview *self)
+{
+  if (self->priv->shard_ring != NULL)
+    {
+      g_array_unref (self->priv->shard_ring);
+      self->priv->shard_ring = NULL;
+    }
+
+  g_strfreev (self->priv->shard_addrs);
+  self->priv->shard_addrs = NULL;
+
+  if (self->priv->shard_config != NULL)
+    {
+      g_variant_unref (self->priv->shard_config);
+      self->priv->shard_config = NULL;
+    }
+}
+
+/* The ring points depend on the shard indexes only, so a shard that is
+   restarted at a different address keeps its peers */
+static void
+build_shard_ring (LiaWebview *self, gchar **addrs)
+{
+  guint len;
+  guint i;
+  guint j;
+
+  self->priv->shard_addrs = addrs;
+
+  len = g_strv_length (addrs);
+  if (len < 2)
+    return;
+
+  self->priv->shard_ring = g_array_sized_new (FALSE,
+                                              FALSE,
+                                              sizeof (RingPoint),
+                                              len * SHARD_RING_POINTS);
+
+  for (i=0; i<len; i++)
+    for (j=0; j<SHARD_RING_POINTS; j++)
+      {
+        RingPoint point;
+        gchar *key;
+
+        key = g_strdup_printf ("shard-%u-%u", i, j);
+        point.hash = shard_ring_hash (key);
+        point.shard = i;
+        g_free (key);
+
+        g_array_append_val (self->priv->shard_ring, point);
+      }
+
+  g_array_sort (self->priv->shard_ring, ring_point_compare);
+}
+
+/* Returns the address of the public bus shard that the peer identified
+   by @key connects to, or NULL if the public bus is not sharded */
+static const gchar *
+lookup_public_bus_shard (LiaWebview *self, const gchar *key)
+{
+  GVariant *config;
+  RingPoint *points;
+  guint32 hash;
+  guint low;
+  guint high;
+
+  /* the configuration is replaced as a whole on every change, so the
+     ring is rebuilt only when the snapshot differs */
+  config = lia_application_get_config (LIA_APPLICATION (self));
+  if (config != self->priv->shard_config)
+    {
+      gchar **addrs = NULL;
+
+      free_shard_ring (self);
+
+      if (config != NULL)
+        {
+          self->priv->shard_config = g_variant_ref (config);
+
+          if (! g_variant_lookup (config,
+                                  LIA_CONFIG_KEY_PUBLIC_BUS_SHARDS,
+                                  "^as",
+                                  &addrs))
+            {
+              addrs = NULL;
+            }
+        }
+
+      if (addrs != NULL)
+        build_shard_ring (self, addrs);
+    }
+
+  if (self->priv->shard_ring == NULL)
+    return NULL;
+
+  hash = shard_ring_hash (key);
+  points = (RingPoint *) self->priv->shard_ring->data;
+
+  /* first point at or after the hash, wrapping around the ring */
+  low = 0;
+  high = self->priv->shard_ring->len;
+  while (low < high)
+    {
+      guint mid = low + (high - low) / 2;
+
+      if (points[mid].hash < hash)
+        low = mid + 1;
+      else
+        high = mid;
+    }
+
+  if (low == self->priv->shard_ring->len)
+    low = 0;
+
+  return self->priv->shard_addrs[points[low].shard];
+}
@@ -0,0 +1,365 @@
+#define UPLOAD_BLOCK_SIZE 0xFFFF
+
+#define UPLOAD_PATH_PREFIX "upload/"
+
+/* UploadData */
+typedef struct
+{
+  LiaWebview *self;
+  EvdHttpConnection *conn;
+  EvdHttpRequest *request;
+  gchar *owner_id;
+  guint32 id;
+  gboolean accepted;
+  GOutputStream *pipe_output;
+  gchar *buffer;
+  gssize size;
+  gsize written;
+  gboolean more;
+  goffset received;
+  goffset expected;
+} UploadData;
+
+static void read_upload_chunk (UploadData *data);
+
+static void
+free_upload_data (UploadData *data)
+{
+  g_object_unref (data->self);
+  g_object_unref (data->conn);
+  g_object_unref (data->request);
+  g_free (data->owner_id);
+
+  /* closing the pipe signals end-of-stream to the application */
+  if (data->pipe_output != NULL)
+    {
+      g_output_stream_close (data->pipe_output, NULL, NULL);
+      g_object_unref (data->pipe_output);
+    }
+
+  g_free (data->buffer);
+
+  g_slice_free (UploadData, data);
+}
+
+static void
+on_upload_ended (GObject      *obj,
+                 GAsyncResult *res,
+                 gpointer      user_data)
+{
+  UploadData *data = user_data;
+  GVariant *ret;
+  GError *error = NULL;
+
+  ret = g_dbus_connection_call_finish (G_DBUS_CONNECTION (obj), res, &error);
+  if (ret == NULL)
+    {
+      g_debug ("Error ending upload: %s", error->message);
+      g_error_free (error);
+    }
+  else
+    {
+      g_variant_unref (ret);
+    }
+
+  free_upload_data (data);
+}
+
+/* tells the application whether it got all the content, before the pipe
+   is closed, so that it can tell a truncated upload from a complete one
+   when it reaches the end of the pipe */
+static void
+end_upload_in_app (UploadData *data, gboolean complete)
+{
+  if (! data->accepted)
+    {
+      free_upload_data (data);
+      return;
+    }
+
+  g_dbus_connection_call (lia_application_get_bus (LIA_APPLICATION (data->self),
+                                                   LIA_BUS_PRIVATE),
+                          data->owner_id,
+                          LIA_APPLICATION_OBJ_PATH,
+                          LIA_APPLICATION_IFACE_NAME,
+                          "EndUpload",
+                          g_variant_new ("(ub)", data->id, complete),
+                          NULL,
+                          G_DBUS_CALL_FLAGS_NONE,
+                          -1,
+                          NULL,
+                          on_upload_ended,
+                          data);
+}
+
+static void
+finish_upload (UploadData *data, guint status_code, GError *error)
+{
+  SoupMessageHeaders *headers;
+
+  /* a rejected upload leaves unread content on the connection, so it
+     cannot be reused */
+  headers = soup_message_headers_new (SOUP_MESSAGE_HEADERS_RESPONSE);
+  if (status_code != SOUP_STATUS_OK)
+    soup_message_headers_replace (headers, "Connection", "close");
+
+  evd_web_service_respond (data->self->priv->web_service,
+                           data->conn,
+                           status_code,
+                           headers,
+                           error != NULL ? error->message : NULL,
+                           error != NULL ? strlen (error->message) : 0,
+                           NULL);
+
+  soup_message_headers_free (headers);
+
+  end_upload_in_app (data, status_code == SOUP_STATUS_OK);
+}
+
+/* called once the request body has been read to its end */
+static void
+end_upload (UploadData *data)
+{
+  GError *error;
+
+  /* the body ends early when the web client goes away before sending all
+     of it, be it before the announced length or before the last chunk */
+  if ((data->expected < 0 || data->received == data->expected) &&
+      evd_connection_is_connected (EVD_CONNECTION (data->conn)))
+    {
+      finish_upload (data, SOUP_STATUS_OK, NULL);
+      return;
+    }
+
+  error = g_error_new (G_IO_ERROR,
+                       G_IO_ERROR_PARTIAL_INPUT,
+                       "Upload content ended after %" G_GINT64_FORMAT " bytes",
+                       (gint64) data->received);
+  g_debug ("%s", error->message);
+
+  finish_upload (data, SOUP_STATUS_BAD_REQUEST, error);
+  g_error_free (error);
+}
+
+static void
+on_upload_chunk_written (GObject      *obj,
+                         GAsyncResult *res,
+                         gpointer      user_data)
+{
+  UploadData *data = user_data;
+  gssize size;
+  GError *error = NULL;
+
+  size = g_output_stream_write_finish (G_OUTPUT_STREAM (obj), res, &error);
+  if (size < 0)
+    {
+      /* application closed its end of the pipe, which means it
+         rejected the upload */
+      g_debug ("Upload aborted by application: %s", error->message);
+      finish_upload (data, SOUP_STATUS_FORBIDDEN, error);
+      g_error_free (error);
+      return;
+    }
+
+  data->written += size;
+  if ((gssize) data->written < data->size)
+    {
+      g_output_stream_write_async (data->pipe_output,
+                                   data->buffer + data->written,
+                                   data->size - data->written,
+                                   G_PRIORITY_DEFAULT,
+                                   NULL,
+                                   on_upload_chunk_written,
+                                   data);
+    }
+  else if (data->more)
+    {
+      read_upload_chunk (data);
+    }
+  else
+    {
+      end_upload (data);
+    }
+}
+
+static void
+on_upload_chunk_read (GObject      *obj,
+                      GAsyncResult *res,
+                      gpointer      user_data)
+{
+  UploadData *data = user_data;
+  GError *error = NULL;
+
+  data->size = evd_http_connection_read_content_finish (EVD_HTTP_CONNECTION (obj),
+                                                        res,
+                                                        &data->more,
+                                                        &error);
+  if (data->size < 0)
+    {
+      /* web client went away, the application sees a failed stream */
+      g_debug ("Error reading upload content: %s", error->message);
+      g_error_free (error);
+
+      end_upload_in_app (data, FALSE);
+    }
+  else if (data->size == 0)
+    {
+      if (data->more)
+        read_upload_chunk (data);
+      else
+        end_upload (data);
+    }
+  else
+    {
+      /* only one block is in flight at a time, so memory use doesn't
+         depend on the size of the upload */
+      data->received += data->size;
+      data->written = 0;
+      g_output_stream_write_async (data->pipe_output,
+                                   data->buffer,
+                                   data->size,
+                                   G_PRIORITY_DEFAULT,
+                                   NULL,
+                                   on_upload_chunk_written,
+                                   data);
+    }
+}
+
+static void
+read_upload_chunk (UploadData *data)
+{
+  evd_http_connection_read_content (data->conn,
+                                    data->buffer,
+                                    UPLOAD_BLOCK_SIZE,
+                                    NULL,
+                                    on_upload_chunk_read,
+                                    data);
+}
+
+static void
+on_upload_handled (GObject      *obj,
+                   GAsyncResult *res,
+                   gpointer      user_data)
+{
+  UploadData *data = user_data;
+  GVariant *ret;
+  gboolean accepted = FALSE;
+  GError *error = NULL;
+
+  ret = g_dbus_connection_call_with_unix_fd_list_finish (G_DBUS_CONNECTION (obj),
+                                                         NULL,
+                                                         res,
+                                                         &error);
+  if (ret == NULL)
+    {
+      g_debug ("Error handing upload to application: %s", error->message);
+      finish_upload (data, SOUP_STATUS_INTERNAL_SERVER_ERROR, error);
+      g_error_free (error);
+      return;
+    }
+
+  g_variant_get (ret, "(b)", &accepted);
+  g_variant_unref (ret);
+
+  if (! accepted)
+    {
+      finish_upload (data, SOUP_STATUS_FORBIDDEN, NULL);
+    }
+  else
+    {
+      data->accepted = TRUE;
+      data->buffer = g_new (gchar, UPLOAD_BLOCK_SIZE);
+      read_upload_chunk (data);
+    }
+}
+
+static void
+handle_upload_request (LiaWebview        *self,
+                       EvdHttpConnection *conn,
+                       EvdHttpRequest    *request,
+                       AppWebDir         *app_web_dir,
+                       LiaBusType         bus_type,
+                       const gchar       *upload_path)
+{
+  UploadData *data;
+  gint fds[2];
+  GUnixFDList *fd_list;
+  gint fd_index;
+  SoupMessageHeaders *headers;
+  const gchar *content_type;
+  GError *error = NULL;
+
+  if (app_web_dir->owner_id == NULL)
+    {
+      evd_web_service_respond (self->priv->web_service,
+                               conn,
+                               SOUP_STATUS_NOT_FOUND,
+                               NULL,
+                               NULL,
+                               0,
+                               NULL);
+      return;
+    }
+
+  /* the request body is streamed into a pipe, whose read end is handed
+     to the application owning the web dir */
+  if (! g_unix_open_pipe (fds, FD_CLOEXEC, &error))
+    {
+      evd_web_service_respond (self->priv->web_service,
+                               conn,
+                               SOUP_STATUS_INTERNAL_SERVER_ERROR,
+                               NULL,
+                               error->message,
+                               strlen (error->message),
+                               NULL);
+      g_error_free (error);
+      return;
+    }
+
+  fd_list = g_unix_fd_list_new ();
+  fd_index = g_unix_fd_list_append (fd_list, fds[0], NULL);
+  close (fds[0]);
+
+  data = g_slice_new0 (UploadData);
+  data->self = self;
+  g_object_ref (self);
+  data->conn = conn;
+  g_object_ref (conn);
+  data->request = request;
+  g_object_ref (request);
+  data->owner_id = g_strdup (app_web_dir->owner_id);
+  data->id = self->priv->next_upload_id++;
+  data->pipe_output = g_unix_output_stream_new (fds[1], TRUE);
+
+  headers = evd_http_message_get_headers (EVD_HTTP_MESSAGE (request));
+  content_type = soup_message_headers_get_content_type (headers, NULL);
+
+  if (soup_message_headers_get_encoding (headers) == SOUP_ENCODING_CONTENT_LENGTH)
+    data->expected = soup_message_headers_get_content_length (headers);
+  else
+    data->expected = -1;
+
+  g_dbus_connection_call_with_unix_fd_list (
+                    lia_application_get_bus (LIA_APPLICATION (self),
+                                             LIA_BUS_PRIVATE),
+                    app_web_dir->owner_id,
+                    LIA_APPLICATION_OBJ_PATH,
+                    LIA_APPLICATION_IFACE_NAME,
+                    "HandleUpload",
+                    g_variant_new ("(hssxnu)",
+                                   fd_index,
+                                   upload_path,
+                                   content_type != NULL ? content_type : "",
+                                   (gint64) data->expected,
+                                   bus_type,
+                                   data->id),
+                    G_VARIANT_TYPE ("(b)"),
+                    G_DBUS_CALL_FLAGS_NONE,
+                    -1,
+                    fd_list,
+                    NULL,
+                    on_upload_handled,
+                    data);
+
+  g_object_unref (fd_list);
+}
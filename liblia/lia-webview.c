@@ -21,10 +21,21 @@
  */
 
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 #include <evd.h>
 #include <libsoup/soup.h>
+#include <gio/gunixfdlist.h>
+#include <gio/gunixinputstream.h>
+#include <gio/gunixoutputstream.h>
+#include <glib-unix.h>
 
 #include "lia-webview.h"
+#include "lia-application-private.h"
+#include "lia-auth-service.h"
+#include "lia-bus-mux.h"
 
 #include "lia-defines.h"
 
@@ -41,6 +52,7 @@ G_DEFINE_TYPE (LiaWebview, lia_webview, LIA_TYPE_APPLICATION);
 #define REST_ACTION_SIGNIN  "signin"
 #define REST_ACTION_SIGNOUT "signout"
 #define REST_ACTION_CONFIG  "webview-config"
+#define REST_ACTION_DOWNLOAD "download/"
 
 #define SESSION_ID_COOKIE_NAME_SUFFIX LIA_WEBVIEW_SERVICE_NAME_SUFFIX ".SID"
 
@@ -54,6 +66,20 @@ static const gchar introspection_xml[] =
   "      <arg type='s' name='path' direction='in'/>"
   "      <arg type='s' name='dir' direction='in'/>"
   "    </method>"
+  "    <method name='OfferDownload'>"
+  "      <arg type='h' name='fd' direction='in'/>"
+  "      <arg type='s' name='content_type' direction='in'/>"
+  "      <arg type='s' name='file_name' direction='in'/>"
+  "      <arg type='n' name='bus_type' direction='in'/>"
+  "      <arg type='s' name='url_path' direction='out'/>"
+  "    </method>"
+  "    <method name='GetWebDirActivity'>"
+  "      <arg type='a{st}' name='idle_times' direction='out'/>"
+  "    </method>"
+  "    <method name='GetBusMuxAddress'>"
+  "      <arg type='s' name='bus_address' direction='in'/>"
+  "      <arg type='s' name='mux_address' direction='out'/>"
+  "    </method>"
   "  </interface>";
 
 /* private data */
@@ -79,10 +105,27 @@ struct _LiaWebviewPrivate
   gchar *own_path_regexp;
   gchar *signin_path;
   gchar *signout_path;
+  gchar *download_path;
 
   guint obj_reg_id;
 
   GList *app_web_dirs;
+
+  guint listen_span;
+
+  GHashTable *downloads;
+
+  GHashTable *activations;
+
+  LiaAuthService *auth_service;
+
+  GArray *shard_ring;
+  gchar **shard_addrs;
+  GVariant *shard_config;
+
+  GHashTable *bus_muxes;
+
+  guint32 next_upload_id;
 };
 
 /* AuthData */
@@ -100,9 +143,15 @@ typedef struct
 typedef struct
 {
   gchar *path;
+  gchar *app_path;
   EvdWebDir *web_dir;
   LiaBusType bus_type;
   gchar *owner_id;
+  gint64 last_hit;
+
+  /* the entry for the application's path itself, after the ones for
+     each bus' dir */
+  gboolean is_root;
 } AppWebDir;
 
 typedef struct
@@ -148,7 +197,8 @@ static void     init_async                                (LiaApplication *self,
                                                            gint            io_priority,
                                                            GCancellable   *cancellable);
 
-static gboolean load_env                                  (LiaApplication  *self,
+static gboolean load_env_finish                           (LiaApplication  *self,
+                                                           GAsyncResult    *result,
                                                            gchar          **service_name,
                                                            GError         **error);
 
@@ -165,8 +215,25 @@ static void     web_service_on_request                    (EvdWebService     *we
                                                            gpointer           user_data);
 
 static void     free_auth_session_data                    (gpointer _data);
+static void     free_download_data                        (gpointer _data);
+
+static void     handle_offer_download_call                (LiaWebview            *self,
+                                                           GVariant              *arguments,
+                                                           GDBusMethodInvocation *invocation);
 static void     free_app_web_dir                          (gpointer _data);
 
+static void     free_pending_activation                   (gpointer _data);
+static void     replay_activation                         (LiaWebview  *self,
+                                                           const gchar *path);
+
+static void     free_shard_ring                           (LiaWebview *self);
+static const gchar *
+                lookup_public_bus_shard                   (LiaWebview  *self,
+                                                           const gchar *key);
+static const gchar *
+                get_bus_mux_address                       (LiaWebview  *self,
+                                                           const gchar *bus_addr);
+
 static void
 lia_webview_class_init (LiaWebviewClass *class)
 {
@@ -182,7 +249,7 @@ lia_webview_class_init (LiaWebviewClass *class)
   lia_app_class = LIA_APPLICATION_CLASS (class);
   lia_app_class->init_async_finished = init_async;
   lia_app_class->register_objects = register_objects;
-  lia_app_class->load_env = load_env;
+  lia_app_class->load_env_finish = load_env_finish;
 
   /* signals */
   /*
@@ -228,6 +295,8 @@ lia_webview_init (LiaWebview *self)
                                        priv->base_path);
   priv->signout_path = g_strdup_printf ("%s" REST_ACTION_SIGNOUT,
                                         priv->base_path);
+  priv->download_path = g_strdup_printf ("%s" REST_ACTION_DOWNLOAD,
+                                         priv->base_path);
 
   priv->transport_base_path = g_strdup_printf ("%s" TRANSPORT_BASE_PATH_SUFFIX,
                                                priv->base_path);
@@ -293,6 +362,34 @@ lia_webview_init (LiaWebview *self)
   priv->obj_reg_id = 0;
 
   priv->app_web_dirs = NULL;
+
+  priv->listen_span = 0;
+
+  /* downloads offered by applications */
+  priv->downloads = g_hash_table_new_full (g_str_hash,
+                                           g_str_equal,
+                                           NULL,
+                                           free_download_data);
+
+  /* requests held while an installed application is activated */
+  priv->activations = g_hash_table_new_full (g_str_hash,
+                                             g_str_equal,
+                                             NULL,
+                                             free_pending_activation);
+
+  priv->auth_service = NULL;
+
+  priv->shard_ring = NULL;
+  priv->shard_addrs = NULL;
+  priv->shard_config = NULL;
+
+  /* bus multiplexers, by upstream bus address */
+  priv->bus_muxes = g_hash_table_new_full (g_str_hash,
+                                           g_str_equal,
+                                           g_free,
+                                           (GDestroyNotify) lia_bus_mux_free);
+
+  priv->next_upload_id = 1;
 }
 
 static void
@@ -311,6 +408,26 @@ dispose (GObject *obj)
       self->priv->web_service = NULL;
     }
 
+  if (self->priv->downloads != NULL)
+    {
+      g_hash_table_unref (self->priv->downloads);
+      self->priv->downloads = NULL;
+    }
+
+  if (self->priv->activations != NULL)
+    {
+      g_hash_table_unref (self->priv->activations);
+      self->priv->activations = NULL;
+    }
+
+  if (self->priv->auth_service != NULL)
+    {
+      g_object_unref (self->priv->auth_service);
+      self->priv->auth_service = NULL;
+    }
+
+  g_hash_table_remove_all (self->priv->bus_muxes);
+
   /* D-Bus bridge */
   if (self->priv->dbus_bridge != NULL)
     {
@@ -353,12 +470,16 @@ finalize (GObject *obj)
   g_free (self->priv->own_path_regexp);
   g_free (self->priv->signin_path);
   g_free (self->priv->signout_path);
+  g_free (self->priv->download_path);
 
   g_free (self->priv->base_path);
   g_free (self->priv->bus_addr_alias);
   g_free (self->priv->transport_base_path);
   g_free (self->priv->jquery_path);
 
+  free_shard_ring (self);
+  g_hash_table_unref (self->priv->bus_muxes);
+
   G_OBJECT_CLASS (lia_webview_parent_class)->finalize (obj);
 }
 
@@ -411,6 +532,7 @@ free_app_web_dir (gpointer _data)
 
   g_object_unref (data->web_dir);
   g_free (data->path);
+  g_free (data->app_path);
   g_free (data->owner_id);
 
   g_slice_free (AppWebDir, data);
@@ -450,8 +572,11 @@ register_web_dir (LiaWebview   *self,
 
       app_web_dir = g_slice_new0 (AppWebDir);
       app_web_dir->path = g_strdup (url_path);
+      app_web_dir->app_path = g_strdup (path);
+      app_web_dir->last_hit = g_get_monotonic_time ();
       app_web_dir->web_dir = web_dir;
       app_web_dir->bus_type = i;
+      app_web_dir->is_root = i == 3;
       app_web_dir->owner_id = g_strdup (owner_id);
 
       self->priv->app_web_dirs = g_list_append (self->priv->app_web_dirs,
@@ -524,6 +649,51 @@ bus_name_vanished (GDBusConnection *connection,
   g_bus_unwatch_name (data->watcher_id);
 }
 
+/* Returns the time (milliseconds) since the last request for each
+   registered web dir, as an a{st} keyed by the path it was registered
+   with. Core uses it to tell which applications are idle */
+static GVariant *
+get_web_dir_idle_times (LiaWebview *self)
+{
+  GHashTable *last_hits;
+  GVariantBuilder builder;
+  GHashTableIter iter;
+  gpointer key;
+  gpointer value;
+  GList *node;
+  gint64 now;
+
+  /* an application registers several web dirs, one per bus type */
+  last_hits = g_hash_table_new (g_str_hash, g_str_equal);
+  for (node = self->priv->app_web_dirs; node != NULL; node = node->next)
+    {
+      AppWebDir *app_web_dir = node->data;
+      AppWebDir *latest;
+
+      latest = g_hash_table_lookup (last_hits, app_web_dir->app_path);
+      if (latest == NULL || app_web_dir->last_hit > latest->last_hit)
+        g_hash_table_insert (last_hits, app_web_dir->app_path, app_web_dir);
+    }
+
+  now = g_get_monotonic_time ();
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{st}"));
+
+  g_hash_table_iter_init (&iter, last_hits);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      AppWebDir *app_web_dir = value;
+
+      g_variant_builder_add (&builder,
+                             "{st}",
+                             key,
+                             (guint64) (now - app_web_dir->last_hit) / 1000);
+    }
+
+  g_hash_table_unref (last_hits);
+
+  return g_variant_builder_end (&builder);
+}
+
 static void
 on_bus_method_called (LiaApplication        *app,
                       LiaBusType             bus_type,
@@ -572,11 +742,44 @@ on_bus_method_called (LiaApplication        *app,
                                             bus_name_vanished,
                                             data,
                                             free_name_watch_data);
+
+          /* serve requests held while the application was activated */
+          replay_activation (self, path);
         }
 
       g_free (dir);
       g_free (path);
     }
+  /* OfferDownload */
+  else if (g_strcmp0 (method_name, "OfferDownload") == 0)
+    {
+      handle_offer_download_call (self, arguments, invocation);
+    }
+  /* GetWebDirActivity */
+  else if (g_strcmp0 (method_name, "GetWebDirActivity") == 0)
+    {
+      GVariant *idle_times;
+
+      idle_times = get_web_dir_idle_times (self);
+      g_dbus_method_invocation_return_value (invocation,
+                                             g_variant_new_tuple (&idle_times, 1));
+    }
+  /* GetBusMuxAddress */
+  else if (g_strcmp0 (method_name, "GetBusMuxAddress") == 0)
+    {
+      const gchar *bus_addr;
+      const gchar *mux_addr;
+
+      /* the mux web peers of @bus_addr are bridged to, created if there
+         is none yet. Empty if peers get a bus connection each */
+      g_variant_get (arguments, "(&s)", &bus_addr);
+
+      mux_addr = get_bus_mux_address (self, bus_addr);
+      g_dbus_method_invocation_return_value (invocation,
+                                             g_variant_new ("(s)",
+                                                            mux_addr != NULL ?
+                                                            mux_addr : ""));
+    }
 }
 
 static void
@@ -630,13 +833,51 @@ get_auth_data_from_request (LiaWebview *self, EvdHttpRequest *request)
   return auth_data;
 }
 
+/* Returns the address of the multiplexer carrying web peers' traffic to
+   the bus at @bus_addr, or NULL if peers get a bus connection each */
+static const gchar *
+get_bus_mux_address (LiaWebview *self, const gchar *bus_addr)
+{
+  GVariant *config;
+  guint32 pool_size = 0;
+  LiaBusMux *mux;
+
+  config = lia_application_get_config (LIA_APPLICATION (self));
+  if (config == NULL ||
+      ! g_variant_lookup (config, LIA_CONFIG_KEY_WEBVIEW_BUS_MUX, "u", &pool_size) ||
+      pool_size == 0)
+    {
+      return NULL;
+    }
+
+  mux = g_hash_table_lookup (self->priv->bus_muxes, bus_addr);
+  if (mux == NULL)
+    {
+      GError *error = NULL;
+
+      mux = lia_bus_mux_new (bus_addr, pool_size, &error);
+      if (mux == NULL)
+        {
+          g_print ("Error creating bus mux for '%s': %s\n",
+                   bus_addr,
+                   error->message);
+          g_error_free (error);
+          return NULL;
+        }
+
+      g_hash_table_insert (self->priv->bus_muxes, g_strdup (bus_addr), mux);
+    }
+
+  return lia_bus_mux_get_address (mux);
+}
+
 static guint
 transport_on_validate_peer (EvdTransport *transport,
                             EvdPeer      *peer,
                             gpointer      user_data)
 {
   LiaWebview *self = LIA_WEBVIEW (user_data);
-  const gchar *bus_addr;
+  const gchar *bus_addr = NULL;
   EvdHttpConnection *conn;
   EvdHttpRequest *request;
   LiaBusType bus_type = LIA_BUS_PUBLIC;
@@ -659,7 +900,27 @@ transport_on_validate_peer (EvdTransport *transport,
       /* @TODO: use AUTH_TOKEN cookie to verify credentials and re-auth */
     }
 
-  bus_addr = lia_application_get_bus_address (LIA_APPLICATION (self), bus_type);
+  /* peers of the same session always land on the same public bus shard,
+     so they can see each other's unique names */
+  if (bus_type == LIA_BUS_PUBLIC)
+    bus_addr = lookup_public_bus_shard (self,
+                                        auth_data != NULL ?
+                                        auth_data->session_id :
+                                        evd_peer_get_id (peer));
+
+  if (bus_addr == NULL)
+    bus_addr = lia_application_get_bus_address (LIA_APPLICATION (self),
+                                                bus_type);
+
+  /* the bridge connects to the mux instead, if there is one */
+  if (bus_addr != NULL)
+    {
+      const gchar *mux_addr;
+
+      mux_addr = get_bus_mux_address (self, bus_addr);
+      if (mux_addr != NULL)
+        bus_addr = mux_addr;
+    }
 
   evd_dbus_agent_create_address_alias (G_OBJECT (peer),
                                        bus_addr,
@@ -674,8 +935,13 @@ web_service_on_listen (GObject      *obj,
                        gpointer      user_data)
 {
   GSimpleAsyncResult *result = G_SIMPLE_ASYNC_RESULT (user_data);
+  LiaWebview *self;
   GError *error = NULL;
 
+  self = LIA_WEBVIEW (g_async_result_get_source_object (G_ASYNC_RESULT (result)));
+  lia_application_trace_end (LIA_APPLICATION (self), self->priv->listen_span);
+  g_object_unref (self);
+
   if (! evd_service_listen_finish (EVD_SERVICE (obj), res, &error))
     {
       g_simple_async_result_set_from_error (result, error);
@@ -723,14 +989,18 @@ on_tls_credentials_ready (GObject      *obj,
 }
 
 static gboolean
-load_env (LiaApplication *app, gchar **service_name, GError **error)
+load_env_finish (LiaApplication  *app,
+                 GAsyncResult    *result,
+                 gchar          **service_name,
+                 GError         **error)
 {
   const gchar *base_service_name;
   const gchar *webview_service_name;
 
-  if (! LIA_APPLICATION_CLASS (lia_webview_parent_class)->load_env (app,
-                                                                   service_name,
-                                                                   error))
+  if (! LIA_APPLICATION_CLASS (lia_webview_parent_class)->load_env_finish (app,
+                                                                          result,
+                                                                          service_name,
+                                                                          error))
     {
       return FALSE;
     }
@@ -738,7 +1008,9 @@ load_env (LiaApplication *app, gchar **service_name, GError **error)
   if (*service_name != NULL)
     g_free (*service_name);
 
-  webview_service_name = g_getenv (LIA_ENV_KEY_WEBVIEW_SERVICE_NAME);
+  webview_service_name =
+    lia_application_get_config_string (app,
+                                       LIA_CONFIG_KEY_WEBVIEW_SERVICE_NAME);
   if (webview_service_name == NULL)
     {
       base_service_name = lia_application_get_base_service_name (app);
@@ -755,6 +1027,27 @@ load_env (LiaApplication *app, gchar **service_name, GError **error)
   return TRUE;
 }
 
+/* Returns the connection and bus name to use for calling core-only
+   interfaces like AuthService. The direct peer-to-peer link to core's
+   discovery endpoint is preferred since it skips the bus daemon, falling
+   back to the private bus. */
+static GDBusConnection *
+get_core_connection (LiaWebview *self, const gchar **bus_name)
+{
+  GDBusConnection *core_peer_conn;
+
+  core_peer_conn =
+    lia_application_get_discovery_connection (LIA_APPLICATION (self));
+  if (core_peer_conn != NULL && ! g_dbus_connection_is_closed (core_peer_conn))
+    {
+      *bus_name = NULL;
+      return core_peer_conn;
+    }
+
+  *bus_name = lia_application_get_core_service_name (LIA_APPLICATION (self));
+  return lia_application_get_bus (LIA_APPLICATION (self), LIA_BUS_PRIVATE);
+}
+
 static void
 setup_jquery_web_dir (LiaWebview *self)
 {
@@ -795,6 +1088,9 @@ init_async (LiaApplication *lia_app,
                      lia_application_get_base_service_name (lia_app),
                      SESSION_ID_COOKIE_NAME_SUFFIX);
 
+  self->priv->listen_span = lia_application_trace_begin (lia_app,
+                                                         "web-service-listen");
+
   creds = evd_service_get_tls_credentials (EVD_SERVICE (self->priv->web_service));
   evd_tls_credentials_add_certificate_from_file (creds,
                                                  "/home/elima/projects/lia/ssl-cert-snakeoil.pem",
@@ -819,6 +1115,10 @@ init_async (LiaApplication *lia_app,
 }
 
 #include "lia-webview-login.c"
+#include "lia-webview-download.c"
+#include "lia-webview-upload.c"
+#include "lia-webview-activation.c"
+#include "lia-webview-shards.c"
 
 static AppWebDir *
 lookup_app_web_dir (LiaWebview *self, const gchar *path)
@@ -888,6 +1188,7 @@ web_service_on_request (EvdWebService     *web_service,
   AuthData *auth_data;
   LiaBusType bus_type = LIA_BUS_PUBLIC;
   AppWebDir *app_web_dir;
+  gchar *service_name;
 
   /* resolve auth data for this user-agent */
   auth_data = get_auth_data_from_request (self, request);
@@ -938,12 +1239,41 @@ web_service_on_request (EvdWebService     *web_service,
       handle_signout_request (self, conn, request, auth_data);
       return;
     }
+  /* download offered by an application? */
+  else if (g_str_has_prefix (uri->path, self->priv->download_path))
+    {
+      handle_download_request (self,
+                               conn,
+                               request,
+                               bus_type,
+                               uri->path + strlen (self->priv->download_path));
+      return;
+    }
 
   /* all other requests */
   app_web_dir = lookup_app_web_dir (self, uri->path);
   if (app_web_dir != NULL)
     {
-      if (bus_type <= app_web_dir->bus_type)
+      const gchar *app_path;
+
+      app_web_dir->last_hit = g_get_monotonic_time ();
+
+      app_path = uri->path + strlen (app_web_dir->path);
+
+      /* upload to the application owning the web dir? */
+      if (app_web_dir->is_root &&
+          g_str_has_prefix (app_path, UPLOAD_PATH_PREFIX) &&
+          (g_strcmp0 (evd_http_request_get_method (request), "POST") == 0 ||
+           g_strcmp0 (evd_http_request_get_method (request), "PUT") == 0))
+        {
+          handle_upload_request (self,
+                                 conn,
+                                 request,
+                                 app_web_dir,
+                                 bus_type,
+                                 app_path + strlen (UPLOAD_PATH_PREFIX));
+        }
+      else if (bus_type <= app_web_dir->bus_type)
         {
           evd_web_service_add_connection_with_request (
                                          EVD_WEB_SERVICE (app_web_dir->web_dir),
@@ -963,6 +1293,12 @@ web_service_on_request (EvdWebService     *web_service,
                                    NULL);
         }
     }
+  /* installed application that is not running? */
+  else if ((service_name = lookup_activatable_app (self, uri->path)) != NULL)
+    {
+      hold_request_for_activation (self, service_name, conn, request);
+      g_free (service_name);
+    }
   else
     {
       evd_web_service_add_connection_with_request (
@@ -972,3 +1308,29 @@ web_service_on_request (EvdWebService     *web_service,
                               EVD_SERVICE (web_service));
     }
 }
+
+/* public methods */
+
+/**
+ * lia_webview_set_auth_service:
+ * @auth_service: (allow-none):
+ *
+ * Makes the webview authenticate users by calling @auth_service directly,
+ * instead of calling core's AuthService over the bus. Only meaningful
+ * when the webview runs inside core's process.
+ **/
+void
+lia_webview_set_auth_service (LiaWebview     *self,
+                              LiaAuthService *auth_service)
+{
+  g_return_if_fail (LIA_IS_WEBVIEW (self));
+  g_return_if_fail (auth_service == NULL || LIA_IS_AUTH_SERVICE (auth_service));
+
+  if (auth_service != NULL)
+    g_object_ref (auth_service);
+
+  if (self->priv->auth_service != NULL)
+    g_object_unref (self->priv->auth_service);
+
+  self->priv->auth_service = auth_service;
+}
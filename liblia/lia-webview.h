@@ -28,6 +28,7 @@
 
 #include <lia-defines.h>
 #include <lia-application.h>
+#include <lia-auth-service.h>
 
 G_BEGIN_DECLS
 
@@ -58,6 +59,9 @@ struct _LiaWebviewClass
 
 GType             lia_webview_get_type            (void) G_GNUC_CONST;
 
+void              lia_webview_set_auth_service    (LiaWebview     *self,
+                                                   LiaAuthService *auth_service);
+
 G_END_DECLS
 
 #endif /* __LIA_WEBVIEW_H__ */
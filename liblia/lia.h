@@ -23,9 +23,11 @@
 #ifndef __FSN_H__
 #define __FSN_H__
 
+#include <lia-caller-identity.h>
 #include <lia-application.h>
 #include <lia-rdf-store.h>
 #include <lia-core.h>
 #include <lia-webview.h>
+#include <lia-app-host.h>
 
 #endif /* __FSN_H__ */